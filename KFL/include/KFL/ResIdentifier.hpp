@@ -35,6 +35,7 @@
 
 #include <KFL/PreDeclare.hpp>
 #include <KFL/CXX17/string_view.hpp>
+#include <KFL/CustomizedStreamBuf.hpp>
 #include <istream>
 #include <vector>
 #include <string>
@@ -46,14 +47,26 @@ namespace KlayGE
 	public:
 		ResIdentifier(std::string_view name, uint64_t timestamp,
 				std::shared_ptr<std::istream> const & is)
-			: res_name_(name), timestamp_(timestamp), istream_(is)
+			: res_name_(name), timestamp_(timestamp), istream_(is),
+				view_data_(nullptr), view_size_(0)
 		{
 		}
 		ResIdentifier(std::string_view name, uint64_t timestamp,
 				std::shared_ptr<std::istream> const & is, std::shared_ptr<std::streambuf> const & streambuf)
-			: res_name_(name), timestamp_(timestamp), istream_(is), streambuf_(streambuf)
+			: res_name_(name), timestamp_(timestamp), istream_(is), streambuf_(streambuf),
+				view_data_(nullptr), view_size_(0)
 		{
 		}
+		// A resource backed by contiguous memory, such as a mapped file. holder owns the memory and is kept alive.
+		ResIdentifier(std::string_view name, uint64_t timestamp,
+				std::shared_ptr<void const> const & holder, void const * data, uint64_t size)
+			: res_name_(name), timestamp_(timestamp), holder_(holder),
+				view_data_(data), view_size_(size)
+		{
+			uint8_t const * begin = static_cast<uint8_t const *>(data);
+			streambuf_ = std::make_shared<MemStreamBuf>(begin, begin + size);
+			istream_ = std::make_shared<std::istream>(streambuf_.get());
+		}
 
 		void ResName(std::string_view name)
 		{
@@ -113,11 +126,25 @@ namespace KlayGE
 			return *istream_;
 		}
 
+		// The whole resource as one block of memory, or nullptr if it's only readable as a stream.
+		//  Loaders can read from it directly instead of copying through read().
+		void const * MemoryView() const
+		{
+			return view_data_;
+		}
+		uint64_t MemoryViewSize() const
+		{
+			return view_size_;
+		}
+
 	private:
 		std::string res_name_;
 		uint64_t timestamp_;
+		std::shared_ptr<void const> holder_;
 		std::shared_ptr<std::istream> istream_;
 		std::shared_ptr<std::streambuf> streambuf_;
+		void const * view_data_;
+		uint64_t view_size_;
 	};
 }
 
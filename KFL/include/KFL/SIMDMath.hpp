@@ -34,6 +34,7 @@
 #pragma once
 
 #include <KFL/PreDeclare.hpp>
+#include <KFL/Math.hpp>
 
 #if defined(KLAYGE_SSE_SUPPORT) && !defined(KLAYGE_COMPILER_CLANGC2)
 	#define SIMD_MATH_SSE
@@ -51,11 +52,11 @@ namespace KlayGE
 	{
 		// General Vector
 		///////////////////////////////////////////////////////////////////////////////
-		SIMDVectorF4 Add(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
-		SIMDVectorF4 Substract(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
-		SIMDVectorF4 Multiply(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
-		SIMDVectorF4 Divide(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
-		SIMDVectorF4 Negative(SIMDVectorF4 const & rhs);
+		inline SIMDVectorF4 Add(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
+		inline SIMDVectorF4 Substract(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
+		inline SIMDVectorF4 Multiply(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
+		inline SIMDVectorF4 Divide(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs);
+		inline SIMDVectorF4 Negative(SIMDVectorF4 const & rhs);
 
 		SIMDVectorF4 BaryCentric(SIMDVectorF4 const & v1, SIMDVectorF4 const & v2, SIMDVectorF4 const & v3,
 			float f, float g);
@@ -85,12 +86,12 @@ namespace KlayGE
 		void StoreVector2(float2& fs, SIMDVectorF4 const & v);
 		void StoreVector3(float3& fs, SIMDVectorF4 const & v);
 		void StoreVector4(float4& fs, SIMDVectorF4 const & v);
-		SIMDVectorF4 SetVector(float x, float y, float z, float w);
-		SIMDVectorF4 SetVector(float v);
-		float GetX(SIMDVectorF4 const & rhs);
-		float GetY(SIMDVectorF4 const & rhs);
-		float GetZ(SIMDVectorF4 const & rhs);
-		float GetW(SIMDVectorF4 const & rhs);
+		inline SIMDVectorF4 SetVector(float x, float y, float z, float w);
+		inline SIMDVectorF4 SetVector(float v);
+		inline float GetX(SIMDVectorF4 const & rhs);
+		inline float GetY(SIMDVectorF4 const & rhs);
+		inline float GetZ(SIMDVectorF4 const & rhs);
+		inline float GetW(SIMDVectorF4 const & rhs);
 		float GetByIndex(SIMDVectorF4 const & rhs, size_t index);
 		SIMDVectorF4 SetX(SIMDVectorF4 const & rhs, float v);
 		SIMDVectorF4 SetY(SIMDVectorF4 const & rhs, float v);
@@ -251,6 +252,14 @@ namespace KlayGE
 		// From Game Programming Gems 5, Section 2.6.
 		void ObliqueClipping(SIMDMatrixF4& proj, SIMDVectorF4 const & clip_plane);
 
+		// Bound
+		///////////////////////////////////////////////////////////////////////////////
+		// Tests num boxes, given as one array per min/max coordinate, against a frustum, 4 (8 with AVX) boxes at a time.
+		//  results[i] is what MathLib::intersect_aabb_frustum gives for box i.
+		void IntersectAABBsFrustum(float const * min_x, float const * min_y, float const * min_z,
+			float const * max_x, float const * max_y, float const * max_z, uint32_t num,
+			Frustum const & frustum, BoundOverlap* results);
+
 
 		// Color
 		///////////////////////////////////////////////////////////////////////////////
@@ -262,4 +271,148 @@ namespace KlayGE
 #include <KFL/SIMDVector.hpp>
 #include <KFL/SIMDMatrix.hpp>
 
+namespace KlayGE
+{
+	namespace SIMDMathLib
+	{
+		// The per-component basics are inline, so loops over SIMDVectorF4 don't pay a call for each of them
+		inline SIMDVectorF4 Add(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+		{
+			SIMDVectorF4 ret;
+#if defined(SIMD_MATH_SSE)
+			ret.Vec() = _mm_add_ps(lhs.Vec(), rhs.Vec());
+#else
+			for (int i = 0; i < 4; ++ i)
+			{
+				ret.Vec()[i] = lhs.Vec()[i] + rhs.Vec()[i];
+			}
+#endif
+			return ret;
+		}
+
+		inline SIMDVectorF4 Substract(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+		{
+			SIMDVectorF4 ret;
+#if defined(SIMD_MATH_SSE)
+			ret.Vec() = _mm_sub_ps(lhs.Vec(), rhs.Vec());
+#else
+			for (int i = 0; i < 4; ++ i)
+			{
+				ret.Vec()[i] = lhs.Vec()[i] - rhs.Vec()[i];
+			}
+#endif
+			return ret;
+		}
+
+		inline SIMDVectorF4 Multiply(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+		{
+			SIMDVectorF4 ret;
+#if defined(SIMD_MATH_SSE)
+			ret.Vec() = _mm_mul_ps(lhs.Vec(), rhs.Vec());
+#else
+			for (int i = 0; i < 4; ++ i)
+			{
+				ret.Vec()[i] = lhs.Vec()[i] * rhs.Vec()[i];
+			}
+#endif
+			return ret;
+		}
+
+		inline SIMDVectorF4 Divide(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+		{
+			SIMDVectorF4 ret;
+#if defined(SIMD_MATH_SSE)
+			ret.Vec() = _mm_div_ps(lhs.Vec(), rhs.Vec());
+#else
+			for (int i = 0; i < 4; ++ i)
+			{
+				ret.Vec()[i] = lhs.Vec()[i] / rhs.Vec()[i];
+			}
+#endif
+			return ret;
+		}
+
+		inline SIMDVectorF4 Negative(SIMDVectorF4 const & rhs)
+		{
+			SIMDVectorF4 ret;
+#if defined(SIMD_MATH_SSE)
+			ret.Vec() = _mm_sub_ps(_mm_setzero_ps(), rhs.Vec());
+#else
+			for (int i = 0; i < 4; ++ i)
+			{
+				ret.Vec()[i] = -rhs.Vec()[i];
+			}
+#endif
+			return ret;
+		}
+
+		inline SIMDVectorF4 SetVector(float x, float y, float z, float w)
+		{
+			SIMDVectorF4 ret;
+#if defined(SIMD_MATH_SSE)
+			ret.Vec() = _mm_set_ps(w, z, y, x);
+#else
+			ret.Vec()[0] = x;
+			ret.Vec()[1] = y;
+			ret.Vec()[2] = z;
+			ret.Vec()[3] = w;
+#endif
+			return ret;
+		}
+
+		inline SIMDVectorF4 SetVector(float v)
+		{
+			SIMDVectorF4 ret;
+#if defined(SIMD_MATH_SSE)
+			ret.Vec() = _mm_set_ps1(v);
+#else
+			ret.Vec()[0] = v;
+			ret.Vec()[1] = v;
+			ret.Vec()[2] = v;
+			ret.Vec()[3] = v;
+#endif
+			return ret;
+		}
+
+		inline float GetX(SIMDVectorF4 const & rhs)
+		{
+#if defined(SIMD_MATH_SSE)
+			return _mm_cvtss_f32(rhs.Vec());
+#else
+			return GetByIndex(rhs, 0);
+#endif
+		}
+
+		inline float GetY(SIMDVectorF4 const & rhs)
+		{
+#if defined(SIMD_MATH_SSE)
+			__m128 tmp = _mm_shuffle_ps(rhs.Vec(), rhs.Vec(), _MM_SHUFFLE(1, 1, 1, 1));
+			return _mm_cvtss_f32(tmp);
+#else
+			return GetByIndex(rhs, 1);
+#endif
+		}
+
+		inline float GetZ(SIMDVectorF4 const & rhs)
+		{
+#if defined(SIMD_MATH_SSE)
+			__m128 tmp = _mm_shuffle_ps(rhs.Vec(), rhs.Vec(), _MM_SHUFFLE(2, 2, 2, 2));
+			return _mm_cvtss_f32(tmp);
+#else
+			return GetByIndex(rhs, 2);
+#endif
+		}
+
+		inline float GetW(SIMDVectorF4 const & rhs)
+		{
+#if defined(SIMD_MATH_SSE)
+			__m128 tmp = _mm_shuffle_ps(rhs.Vec(), rhs.Vec(), _MM_SHUFFLE(3, 3, 3, 3));
+			return _mm_cvtss_f32(tmp);
+#else
+			return GetByIndex(rhs, 3);
+#endif
+		}
+	}
+}
+
 #endif		// _KFL_SIMDMATH_HPP
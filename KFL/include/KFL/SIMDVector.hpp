@@ -56,7 +56,10 @@ namespace KlayGE
 		SIMDVectorF4()
 		{
 		}
-		SIMDVectorF4(SIMDVectorF4 const & rhs);
+		SIMDVectorF4(SIMDVectorF4 const & rhs)
+			: vec_(rhs.vec_)
+		{
+		}
 
 		static size_t size()
 		{
@@ -83,7 +86,14 @@ namespace KlayGE
 		SIMDVectorF4 const & operator/=(SIMDVectorF4 const & rhs);
 		SIMDVectorF4 const & operator/=(float rhs);
 
-		SIMDVectorF4& operator=(SIMDVectorF4 const & rhs);
+		SIMDVectorF4& operator=(SIMDVectorF4 const & rhs)
+		{
+			if (this != &rhs)
+			{
+				vec_ = rhs.vec_;
+			}
+			return *this;
+		}
 
 		SIMDVectorF4 const operator+() const;
 		SIMDVectorF4 const operator-() const;
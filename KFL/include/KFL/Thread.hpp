@@ -34,6 +34,8 @@
 #pragma once
 
 #include <boost/assert.hpp>
+#include <algorithm>
+#include <atomic>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
@@ -612,6 +614,60 @@ namespace KlayGE
 	private:
 		std::shared_ptr<thread_pool_common_data_t> data_;
 	};
+
+	// Calls func(i) for every i in [0, num), on the calling thread and up to max_threads - 1 threads from the pool.
+	//  Threads take the next index when they are done with one, so uneven items still balance. 0 max_threads means
+	//  one thread per hardware thread. If func throws, no more indices are handed out, and the first exception is
+	//  rethrown once every thread is done.
+	template <typename Func>
+	void parallel_for(thread_pool& tp, uint32_t num, uint32_t max_threads, Func const & func)
+	{
+		std::atomic<uint32_t> next(0);
+		std::mutex error_mutex;
+		std::exception_ptr error;
+		auto worker = [&func, &next, &error_mutex, &error, num]
+		{
+			try
+			{
+				for (uint32_t i = next ++; i < num; i = next ++)
+				{
+					func(i);
+				}
+			}
+			catch (...)
+			{
+				next = num;
+
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!error)
+				{
+					error = std::current_exception();
+				}
+			}
+		};
+
+		if (0 == max_threads)
+		{
+			max_threads = std::max(std::thread::hardware_concurrency(), 1U);
+		}
+		uint32_t const num_threads = std::min(num, max_threads);
+		std::vector<joiner<void>> joiners;
+		joiners.reserve(num_threads);
+		for (uint32_t i = 1; i < num_threads; ++ i)
+		{
+			joiners.push_back(tp(worker));
+		}
+		worker();
+		for (auto& j : joiners)
+		{
+			j();
+		}
+
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
 }
 
 #endif		// _KFL_THREAD_HPP
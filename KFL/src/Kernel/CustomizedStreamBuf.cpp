@@ -54,7 +54,7 @@ namespace KlayGE
 
 		char_type const * c = current_;
 		++ current_;
-		return *c;
+		return traits_type::to_int_type(*c);
 	}
 
 	MemStreamBuf::int_type MemStreamBuf::underflow()
@@ -64,7 +64,7 @@ namespace KlayGE
 			return traits_type::eof();
 		}
 
-		return *current_;
+		return traits_type::to_int_type(*current_);
 	}
 
 	std::streamsize MemStreamBuf::xsgetn(char_type* s, std::streamsize count)
@@ -86,7 +86,7 @@ namespace KlayGE
 		}
 
 		-- current_;
-		return *current_;
+		return traits_type::to_int_type(*current_);
 	}
 	
 	std::streamsize MemStreamBuf::showmanyc()
@@ -55,11 +55,21 @@ namespace KlayGE
 
 	XMLNodePtr XMLDocument::Parse(ResIdentifierPtr const & source)
 	{
-		source->seekg(0, std::ios_base::end);
-		int len = static_cast<int>(source->tellg());
-		source->seekg(0, std::ios_base::beg);
-		xml_src_.resize(len + 1, 0);
-		source->read(&xml_src_[0], len);
+		// rapidxml parses in place and needs a terminating 0, so even a mapped source has to be copied once
+		char const * view = static_cast<char const *>(source->MemoryView());
+		if (view != nullptr)
+		{
+			xml_src_.assign(view, view + source->MemoryViewSize());
+			xml_src_.push_back(0);
+		}
+		else
+		{
+			source->seekg(0, std::ios_base::end);
+			int len = static_cast<int>(source->tellg());
+			source->seekg(0, std::ios_base::beg);
+			xml_src_.resize(len + 1, 0);
+			source->read(&xml_src_[0], len);
+		}
 
 		static_cast<rapidxml::xml_document<>*>(doc_.get())->parse<0>(&xml_src_[0]);
 		root_ = MakeSharedPtr<XMLNode>(static_cast<rapidxml::xml_document<>*>(doc_.get())->first_node());
@@ -31,86 +31,139 @@
 #include <KFL/KFL.hpp>
 #include <KFL/SIMDMath.hpp>
 
+#include <KFL/Frustum.hpp>
+
 #ifdef SIMD_MATH_SSE
 	#include <emmintrin.h>
+	#ifdef KLAYGE_AVX_SUPPORT
+		#include <immintrin.h>
+	#endif
 #endif
 
-namespace KlayGE
+namespace
 {
-	namespace SIMDMathLib
+	using namespace KlayGE;
+
+	// Per plane, the box corner farthest along its normal (v0) and the nearest one (v1), as coordinate arrays
+	struct FrustumCorners
 	{
-		// General Vector
-		///////////////////////////////////////////////////////////////////////////////
-		SIMDVectorF4 Add(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+		float const * v0[6][3];
+		float const * v1[6][3];
+	};
+
+#ifdef SIMD_MATH_SSE
+	// Overlaps of width boxes, from the lanes where the far or the near corner is outside of a plane
+	void StoreOverlaps(BoundOverlap* results, uint32_t width, int outside, int intersect)
+	{
+		for (uint32_t j = 0; j < width; ++ j)
 		{
-			SIMDVectorF4 ret;
-#if defined(SIMD_MATH_SSE)
-			ret.Vec() = _mm_add_ps(lhs.Vec(), rhs.Vec());
-#else
-			for (int i = 0; i < 4; ++ i)
+			if (outside & (1 << j))
 			{
-				ret.Vec()[i] = lhs.Vec()[i] + rhs.Vec()[i];
+				results[j] = BO_No;
+			}
+			else
+			{
+				results[j] = (intersect & (1 << j)) ? BO_Partial : BO_Yes;
 			}
-#endif
-			return ret;
 		}
+	}
+
+	int NegativeMask(SIMDVectorF4 const & v)
+	{
+		return (SIMDMathLib::GetX(v) < 0 ? 1 : 0) | (SIMDMathLib::GetY(v) < 0 ? 2 : 0)
+			| (SIMDMathLib::GetZ(v) < 0 ? 4 : 0) | (SIMDMathLib::GetW(v) < 0 ? 8 : 0);
+	}
+
+	SIMDVectorF4 DotCorners(SIMDVectorF4 const (&plane)[4], float const * const (&v)[3], uint32_t i)
+	{
+		using namespace SIMDMathLib;
+
+		// Same order of operations as MathLib::dot_coord
+		return Add(Add(Add(Multiply(plane[0], SetVector(v[0][i], v[0][i + 1], v[0][i + 2], v[0][i + 3])),
+			Multiply(plane[1], SetVector(v[1][i], v[1][i + 1], v[1][i + 2], v[1][i + 3]))),
+			Multiply(plane[2], SetVector(v[2][i], v[2][i + 1], v[2][i + 2], v[2][i + 3]))), plane[3]);
+	}
 
-		SIMDVectorF4 Substract(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+	// Tests boxes [begin, num) 4 at a time, returns where the remaining boxes start
+	uint32_t IntersectAABBsFrustumF4(FrustumCorners const & corners, uint32_t begin, uint32_t num,
+		Frustum const & frustum, BoundOverlap* results)
+	{
+		SIMDVectorF4 planes[6][4];
+		for (int p = 0; p < 6; ++ p)
 		{
-			SIMDVectorF4 ret;
-#if defined(SIMD_MATH_SSE)
-			ret.Vec() = _mm_sub_ps(lhs.Vec(), rhs.Vec());
-#else
-			for (int i = 0; i < 4; ++ i)
+			Plane const & plane = frustum.FrustumPlane(p);
+			for (int j = 0; j < 4; ++ j)
 			{
-				ret.Vec()[i] = lhs.Vec()[i] - rhs.Vec()[i];
+				planes[p][j] = SIMDMathLib::SetVector(plane[j]);
 			}
-#endif
-			return ret;
 		}
 
-		SIMDVectorF4 Multiply(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+		uint32_t i = begin;
+		for (; i + 4 <= num; i += 4)
 		{
-			SIMDVectorF4 ret;
-#if defined(SIMD_MATH_SSE)
-			ret.Vec() = _mm_mul_ps(lhs.Vec(), rhs.Vec());
-#else
-			for (int i = 0; i < 4; ++ i)
+			int outside = 0;
+			int intersect = 0;
+			for (int p = 0; (p < 6) && (outside != 0xF); ++ p)
 			{
-				ret.Vec()[i] = lhs.Vec()[i] * rhs.Vec()[i];
+				outside |= NegativeMask(DotCorners(planes[p], corners.v0[p], i));
+				intersect |= NegativeMask(DotCorners(planes[p], corners.v1[p], i));
 			}
-#endif
-			return ret;
+
+			StoreOverlaps(&results[i], 4, outside, intersect);
 		}
 
-		SIMDVectorF4 Divide(SIMDVectorF4 const & lhs, SIMDVectorF4 const & rhs)
+		return i;
+	}
+
+#ifdef KLAYGE_AVX_SUPPORT
+	// SIMDVectorF4 is 4 wide, 8 boxes at a time go to AVX directly
+	__m256 DotCorners(__m256 const (&plane)[4], float const * const (&v)[3], uint32_t i)
+	{
+		return _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane[0], _mm256_loadu_ps(v[0] + i)),
+			_mm256_mul_ps(plane[1], _mm256_loadu_ps(v[1] + i))), _mm256_mul_ps(plane[2], _mm256_loadu_ps(v[2] + i))),
+			plane[3]);
+	}
+
+	uint32_t IntersectAABBsFrustumF8(FrustumCorners const & corners, uint32_t begin, uint32_t num,
+		Frustum const & frustum, BoundOverlap* results)
+	{
+		__m256 planes[6][4];
+		for (int p = 0; p < 6; ++ p)
 		{
-			SIMDVectorF4 ret;
-#if defined(SIMD_MATH_SSE)
-			ret.Vec() = _mm_div_ps(lhs.Vec(), rhs.Vec());
-#else
-			for (int i = 0; i < 4; ++ i)
+			Plane const & plane = frustum.FrustumPlane(p);
+			for (int j = 0; j < 4; ++ j)
 			{
-				ret.Vec()[i] = lhs.Vec()[i] / rhs.Vec()[i];
+				planes[p][j] = _mm256_set1_ps(plane[j]);
 			}
-#endif
-			return ret;
 		}
+		__m256 const zero = _mm256_setzero_ps();
 
-		SIMDVectorF4 Negative(SIMDVectorF4 const & rhs)
+		uint32_t i = begin;
+		for (; i + 8 <= num; i += 8)
 		{
-			SIMDVectorF4 ret;
-#if defined(SIMD_MATH_SSE)
-			ret.Vec() = _mm_sub_ps(_mm_setzero_ps(), rhs.Vec());
-#else
-			for (int i = 0; i < 4; ++ i)
+			int outside = 0;
+			int intersect = 0;
+			for (int p = 0; (p < 6) && (outside != 0xFF); ++ p)
 			{
-				ret.Vec()[i] = -rhs.Vec()[i];
+				outside |= _mm256_movemask_ps(_mm256_cmp_ps(DotCorners(planes[p], corners.v0[p], i), zero, _CMP_LT_OQ));
+				intersect |= _mm256_movemask_ps(_mm256_cmp_ps(DotCorners(planes[p], corners.v1[p], i), zero, _CMP_LT_OQ));
 			}
-#endif
-			return ret;
+
+			StoreOverlaps(&results[i], 8, outside, intersect);
 		}
 
+		return i;
+	}
+#endif
+#endif
+}
+
+namespace KlayGE
+{
+	namespace SIMDMathLib
+	{
+		// General Vector
+		///////////////////////////////////////////////////////////////////////////////
 		SIMDVectorF4 BaryCentric(SIMDVectorF4 const & v1, SIMDVectorF4 const & v2, SIMDVectorF4 const & v3,
 			float f, float g)
 		{
@@ -351,73 +404,6 @@ namespace KlayGE
 #endif
 		}
 
-		SIMDVectorF4 SetVector(float x, float y, float z, float w)
-		{
-			SIMDVectorF4 ret;
-#if defined(SIMD_MATH_SSE)
-			ret.Vec() = _mm_set_ps(w, z, y, x);
-#else
-			ret.Vec()[0] = x;
-			ret.Vec()[1] = y;
-			ret.Vec()[2] = z;
-			ret.Vec()[3] = w;
-#endif
-			return ret;
-		}
-
-		SIMDVectorF4 SetVector(float v)
-		{
-			SIMDVectorF4 ret;
-#if defined(SIMD_MATH_SSE)
-			ret.Vec() = _mm_set_ps1(v);
-#else
-			ret.Vec()[0] = v;
-			ret.Vec()[1] = v;
-			ret.Vec()[2] = v;
-			ret.Vec()[3] = v;
-#endif
-			return ret;
-		}
-
-		float GetX(SIMDVectorF4 const & rhs)
-		{
-#if defined(SIMD_MATH_SSE)
-			return _mm_cvtss_f32(rhs.Vec());
-#else
-			return GetByIndex(rhs, 0);
-#endif
-		}
-
-		float GetY(SIMDVectorF4 const & rhs)
-		{
-#if defined(SIMD_MATH_SSE)
-			__m128 tmp = _mm_shuffle_ps(rhs.Vec(), rhs.Vec(), _MM_SHUFFLE(1, 1, 1, 1));
-			return _mm_cvtss_f32(tmp);
-#else
-			return GetByIndex(rhs, 1);
-#endif
-		}
-
-		float GetZ(SIMDVectorF4 const & rhs)
-		{
-#if defined(SIMD_MATH_SSE)
-			__m128 tmp = _mm_shuffle_ps(rhs.Vec(), rhs.Vec(), _MM_SHUFFLE(2, 2, 2, 2));
-			return _mm_cvtss_f32(tmp);
-#else
-			return GetByIndex(rhs, 2);
-#endif
-		}
-
-		float GetW(SIMDVectorF4 const & rhs)
-		{
-#if defined(SIMD_MATH_SSE)
-			__m128 tmp = _mm_shuffle_ps(rhs.Vec(), rhs.Vec(), _MM_SHUFFLE(3, 3, 3, 3));
-			return _mm_cvtss_f32(tmp);
-#else
-			return GetByIndex(rhs, 3);
-#endif
-		}
-
 		float GetByIndex(SIMDVectorF4 const & rhs, size_t index)
 		{
 #if defined(SIMD_MATH_SSE)
@@ -2155,6 +2141,56 @@ namespace KlayGE
 			proj.Col(2, clip_plane * SetVector(c));
 		}
 
+		// Bound
+		///////////////////////////////////////////////////////////////////////////////
+		void IntersectAABBsFrustum(float const * min_x, float const * min_y, float const * min_z,
+			float const * max_x, float const * max_y, float const * max_z, uint32_t num,
+			Frustum const & frustum, BoundOverlap* results)
+		{
+			// The corners only depend on the signs of the plane normal, so they are picked once for all boxes
+			FrustumCorners corners;
+			for (int p = 0; p < 6; ++ p)
+			{
+				Plane const & plane = frustum.FrustumPlane(p);
+				corners.v0[p][0] = (plane.a() < 0) ? min_x : max_x;
+				corners.v0[p][1] = (plane.b() < 0) ? min_y : max_y;
+				corners.v0[p][2] = (plane.c() < 0) ? min_z : max_z;
+				corners.v1[p][0] = (plane.a() < 0) ? max_x : min_x;
+				corners.v1[p][1] = (plane.b() < 0) ? max_y : min_y;
+				corners.v1[p][2] = (plane.c() < 0) ? max_z : min_z;
+			}
+
+			uint32_t i = 0;
+#ifdef SIMD_MATH_SSE
+#ifdef KLAYGE_AVX_SUPPORT
+			i = IntersectAABBsFrustumF8(corners, i, num, frustum, results);
+#endif
+			i = IntersectAABBsFrustumF4(corners, i, num, frustum, results);
+#endif
+
+			for (; i < num; ++ i)
+			{
+				BoundOverlap bo = BO_Yes;
+				for (int p = 0; p < 6; ++ p)
+				{
+					Plane const & plane = frustum.FrustumPlane(p);
+					if (plane.a() * corners.v0[p][0][i] + plane.b() * corners.v0[p][1][i] + plane.c() * corners.v0[p][2][i]
+						+ plane.d() < 0)
+					{
+						bo = BO_No;
+						break;
+					}
+					if (plane.a() * corners.v1[p][0][i] + plane.b() * corners.v1[p][1][i] + plane.c() * corners.v1[p][2][i]
+						+ plane.d() < 0)
+					{
+						bo = BO_Partial;
+					}
+				}
+
+				results[i] = bo;
+			}
+		}
+
 		// Color
 		///////////////////////////////////////////////////////////////////////////////
 		SIMDVectorF4 NegativeColor(SIMDVectorF4 const & rhs)
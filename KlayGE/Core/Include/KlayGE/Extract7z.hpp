@@ -34,12 +34,99 @@
 #pragma once
 
 #include <KlayGE/PreDeclare.hpp>
+#include <KlayGE/Package.hpp>
 #include <KFL/CXX17/string_view.hpp>
 
+#include <condition_variable>
+#include <list>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct IInArchive;
 
 namespace KlayGE
 {
+	// An opened 7z package. The archive header is parsed once, and the directory stays resident.
+	// Solid blocks are decoded as a whole and kept in an LRU cache, so that opening many files
+	// from the same block doesn't decompress it again and again.
+	class KLAYGE_CORE_API SevenZipPackage : public Package
+	{
+	public:
+		SevenZipPackage(ResIdentifierPtr const & archive_is, std::string_view password);
+		~SevenZipPackage() override;
+
+		uint64_t Timestamp() const override;
+
+		uint32_t Find(std::string_view extract_file_path) override;
+		ResIdentifierPtr Extract(std::string_view extract_file_path, std::string_view res_name) override;
+		void Extract(std::string_view extract_file_path, std::shared_ptr<std::ostream> const & os);
+
+		std::vector<std::string> const & FilePaths() const override
+		{
+			return file_paths_;
+		}
+
+		void CacheBudget(uint64_t budget) override;
+		uint64_t CacheBudget() const
+		{
+			return cache_budget_;
+		}
+		uint64_t CacheSize() const
+		{
+			return cache_size_;
+		}
+		uint32_t NumBlockDecodes() const
+		{
+			return num_block_decodes_;
+		}
+
+	private:
+		struct ItemInfo
+		{
+			uint32_t block;
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		struct SolidBlock
+		{
+			uint32_t block;
+			std::vector<uint8_t> data;
+		};
+		typedef std::shared_ptr<SolidBlock> SolidBlockPtr;
+
+		std::shared_ptr<SolidBlock const> DecodeBlock(uint32_t block);
+		void EvictBlocks();
+
+	private:
+		ResIdentifierPtr archive_is_;
+		std::string password_;
+		std::shared_ptr<IInArchive> archive_;
+
+		std::unordered_map<std::string, uint32_t> directory_;
+		std::unordered_map<uint32_t, ItemInfo> items_;
+		std::vector<std::vector<uint32_t>> block_items_;
+		std::vector<uint64_t> block_sizes_;
+		std::vector<std::string> file_paths_;
+
+		// Serializes the extractions, the archive reads one stream
+		std::mutex archive_mutex_;
+
+		std::mutex mutex_;
+		std::list<SolidBlockPtr> cached_blocks_;
+		std::unordered_map<uint32_t, std::list<SolidBlockPtr>::iterator> cached_block_index_;
+		std::unordered_set<uint32_t> decoding_blocks_;
+		std::condition_variable decoded_cond_;
+		uint64_t cache_budget_;
+		uint64_t cache_size_;
+		uint32_t num_block_decodes_;
+	};
+
+	// One-off lookups that open the archive and scan it up to the item. Use SevenZipPackage, or ResLoader's
+	//  package cache, to read many files from the same archive.
 	KLAYGE_CORE_API uint32_t Find7z(ResIdentifierPtr const & archive_is,
 		std::string_view password,
 		std::string_view extract_file_path);
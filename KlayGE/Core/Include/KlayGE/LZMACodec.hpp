@@ -48,11 +48,29 @@ namespace KlayGE
 		void Encode(std::vector<uint8_t>& output, ResIdentifierPtr const & res, uint64_t len);
 		void Encode(std::vector<uint8_t>& output, void const * input, uint64_t len);
 
+		// Compresses the input as independent chunks of chunk_size bytes, which Decode can decode in parallel.
+		//  Decode tells chunked and single stream data apart by itself.
+		uint64_t EncodeChunked(std::ostream& os, void const * input, uint64_t len, uint32_t chunk_size = 1UL << 20);
+		void EncodeChunked(std::vector<uint8_t>& output, void const * input, uint64_t len, uint32_t chunk_size = 1UL << 20);
+
 		uint64_t Decode(std::ostream& os, ResIdentifierPtr const & res, uint64_t len, uint64_t original_len);
 		uint64_t Decode(std::ostream& os, void const * input, uint64_t len, uint64_t original_len);
 		void Decode(std::vector<uint8_t>& output, ResIdentifierPtr const & res, uint64_t len, uint64_t original_len);
 		void Decode(std::vector<uint8_t>& output, void const * input, uint64_t len, uint64_t original_len);
 		void Decode(void* output, void const * input, uint64_t len, uint64_t original_len);
+
+		// Upper bound of the threads decoding the chunks of one input, the calling thread included
+		void MaxDecodeThreads(uint32_t num);
+		uint32_t MaxDecodeThreads() const
+		{
+			return max_decode_threads_;
+		}
+
+	private:
+		void DecodeChunked(void* output, void const * input, uint64_t len, uint64_t original_len);
+
+	private:
+		uint32_t max_decode_threads_;
 	};
 }
 
@@ -0,0 +1,123 @@
+/**
+ * @file MappedPackage.hpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+#ifndef _KLAYGE_MAPPEDPACKAGE_HPP
+#define _KLAYGE_MAPPEDPACKAGE_HPP
+
+#pragma once
+
+#include <KlayGE/PreDeclare.hpp>
+#include <KlayGE/Package.hpp>
+#include <KFL/CXX17/string_view.hpp>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace KlayGE
+{
+	class MappedFile;
+
+	// KlayGE's own package format, .kpk. Files are either split into independently LZMA compressed chunks,
+	//  or stored uncompressed at an aligned offset. The directory is sorted by a hash of the file path.
+	//
+	// Layout: KpkHeader, KpkEntry[num_entries], KpkChunk[num_chunks], file names, data.
+	class KLAYGE_CORE_API MappedPackage : public Package
+	{
+	public:
+		MappedPackage(std::string const & pkt_name, uint64_t timestamp);
+		~MappedPackage() override;
+
+		uint64_t Timestamp() const override;
+
+		uint32_t Find(std::string_view extract_file_path) override;
+		// Uncompressed files are views of the mapping. Compressed files are decoded chunk by chunk in parallel.
+		ResIdentifierPtr Extract(std::string_view extract_file_path, std::string_view res_name) override;
+
+		std::vector<std::string> const & FilePaths() const override
+		{
+			return file_paths_;
+		}
+
+	private:
+		struct Entry
+		{
+			uint64_t name_hash;
+			uint64_t offset;
+			uint64_t size;
+			uint32_t first_chunk;
+			uint32_t num_chunks;
+			uint32_t path_index;
+		};
+
+		struct Chunk
+		{
+			uint64_t offset;
+			uint32_t compressed_size;
+			uint32_t original_size;
+		};
+
+		void DecodeChunks(Entry const & entry, uint8_t* output) const;
+
+	private:
+		std::shared_ptr<MappedFile> file_;
+		uint64_t timestamp_;
+
+		std::vector<Entry> entries_;
+		std::vector<Chunk> chunks_;
+		std::vector<std::string> file_paths_;
+	};
+
+	class KLAYGE_CORE_API MappedPackageWriter : boost::noncopyable
+	{
+	public:
+		explicit MappedPackageWriter(uint32_t chunk_size = 256 * 1024, uint32_t alignment = 4096);
+
+		// Compressed files fall back to stored if LZMA doesn't make them smaller
+		void AddFile(std::string_view path, void const * data, uint64_t size, bool compress);
+		void AddFile(std::string_view path, ResIdentifierPtr const & res, bool compress);
+
+		void Save(std::ostream& os);
+
+	private:
+		struct PendingFile
+		{
+			std::string path;
+			std::vector<uint8_t> data;
+			bool compress;
+		};
+
+		uint32_t chunk_size_;
+		uint32_t alignment_;
+		std::vector<PendingFile> files_;
+	};
+}
+
+#endif		// _KLAYGE_MAPPEDPACKAGE_HPP
@@ -31,7 +31,10 @@
 #include <KlayGE/Renderable.hpp>
 #include <KlayGE/RenderLayout.hpp>
 #include <KFL/Math.hpp>
+#include <KFL/ArrayRef.hpp>
 #include <KlayGE/SceneObject.hpp>
+#include <KlayGE/Meshlet.hpp>
+#include <KlayGE/SkeletalAnimation.hpp>
 
 #include <vector>
 #include <string>
@@ -119,6 +122,36 @@ namespace KlayGE
 			return rl_->StartInstanceLocation();
 		}
 
+		// LODs share the vertices, and use different ranges of the index stream
+		uint32_t NumLods() const override;
+		void NumLods(uint32_t lods);
+		void LodIndices(uint32_t lod, uint32_t start_index, uint32_t num_indices);
+		uint32_t LodStartIndexLocation(uint32_t lod) const;
+		uint32_t LodNumIndices(uint32_t lod) const;
+		int32_t LodForScreenArea(float area) const override;
+		void ActiveLod(int32_t lod) override;
+		int32_t ActiveLod() const override
+		{
+			return active_lod_;
+		}
+
+		// Meshlets of LOD 0, with a copy of its indices to compact the visible ones from
+		void AssignMeshlets(ArrayRef<Meshlet> meshlets, void const * lod0_indices);
+		std::vector<Meshlet> const & Meshlets() const
+		{
+			return meshlets_;
+		}
+		std::vector<uint8_t> const & MeshletIndices() const
+		{
+			return meshlet_indices_;
+		}
+		bool HasClusters() const override
+		{
+			return !meshlets_.empty();
+		}
+		uint32_t CullClusters(Camera const & camera, bool cull_back_faces) override;
+		void ApplyClusterCulling(bool cull) override;
+
 		int32_t MaterialID() const
 		{
 			return mtl_id_;
@@ -146,6 +179,18 @@ namespace KlayGE
 
 		int32_t mtl_id_;
 
+		std::vector<uint32_t> lod_start_indices_;
+		std::vector<uint32_t> lod_num_indices_;
+		int32_t active_lod_;
+
+		std::vector<Meshlet> meshlets_;
+		std::vector<uint8_t> meshlet_indices_;
+		std::vector<uint32_t> visible_meshlets_;
+		std::vector<uint8_t> culled_indices_;
+		bool clusters_culled_;
+		GraphicsBufferPtr full_ib_;
+		GraphicsBufferPtr culled_ib_;
+
 		std::weak_ptr<RenderModel> model_;
 
 		bool hw_res_ready_;
@@ -212,6 +257,25 @@ namespace KlayGE
 
 		void AddToRenderQueue();
 
+		uint32_t NumLods() const override;
+		int32_t LodForScreenArea(float area) const override;
+		void ActiveLod(int32_t lod) override;
+		int32_t ActiveLod() const override
+		{
+			return active_lod_;
+		}
+
+		// Screen area, as a fraction of the screen, that gets the full detail. Below it, a LOD is picked by its share
+		//  of triangles, so triangles per pixel stay about the same.
+		void FullDetailScreenArea(float area)
+		{
+			full_detail_screen_area_ = area;
+		}
+		float FullDetailScreenArea() const
+		{
+			return full_detail_screen_area_;
+		}
+
 		virtual void Pass(PassType type);
 
 		virtual bool SpecialShading() const;
@@ -238,6 +302,9 @@ namespace KlayGE
 
 		std::vector<RenderMaterialPtr> materials_;
 
+		int32_t active_lod_;
+		float full_detail_screen_area_;
+
 		bool hw_res_ready_;
 	};
 
@@ -266,7 +333,8 @@ namespace KlayGE
 
 		std::pair<std::pair<Quaternion, Quaternion>, float> Frame(float frame) const;
 	};
-	typedef std::vector<KeyFrames> KeyFramesType;
+	// What models keep after loading. The tracks stay quantized, SkeletalPoseEvaluator samples them as they are.
+	typedef std::vector<CompressedKeyFrames> KeyFramesType;
 
 	struct KLAYGE_CORE_API AABBKeyFrames
 	{
@@ -285,6 +353,16 @@ namespace KlayGE
 	};
 	typedef std::vector<AnimationAction> AnimationActionsType;
 
+	// One level of animation detail, used while the model covers at least min_screen_area of the screen
+	struct KLAYGE_CORE_API AnimationLod
+	{
+		float min_screen_area;
+		// The pose is evaluated once every update_interval frames, and blended in between
+		uint32_t update_interval;
+		// Joints deeper than this keep their first key. Roots are at depth 0.
+		uint32_t max_joint_depth;
+	};
+
 	class KLAYGE_CORE_API SkinnedModel : public RenderModel
 	{
 	public:
@@ -319,6 +397,7 @@ namespace KlayGE
 		void AssignJoints(ForwardIterator first, ForwardIterator last)
 		{
 			joints_.assign(first, last);
+			pose_evaluator_.Reset();
 			this->UpdateBinds();
 		}
 		RotationsType const & GetBindRealParts() const
@@ -356,6 +435,22 @@ namespace KlayGE
 
 		float GetFrame() const;
 		void SetFrame(float frame);
+		// Poses many models at once, spread over the thread pool
+		static void SetFrames(ArrayRef<SkinnedModel*> models, ArrayRef<float> frames);
+
+		// Levels from the biggest on screen down, none by default. With any, SetFrame picks one by the screen area
+		//  the scene manager saw since the last SetFrame. Off screen, the pose isn't evaluated, but time still runs.
+		//  Between evaluations, the joints hold the pose at the end of the interval.
+		void AnimationLods(std::vector<AnimationLod> const & lods);
+		std::vector<AnimationLod> const & AnimationLods() const
+		{
+			return animation_lods_;
+		}
+		bool WantsScreenArea() const override;
+		void ScreenArea(float area) override;
+
+		// Poses evaluated, blended between evaluations, and skipped off screen, since the last call
+		static void TakeAnimationStats(uint32_t& num_evaluated, uint32_t& num_blended, uint32_t& num_skipped);
 
 		void RebindJoints();
 		void UnbindJoints();
@@ -381,6 +476,17 @@ namespace KlayGE
 
 		std::shared_ptr<KeyFramesType> key_frames_;
 		float last_frame_;
+		SkeletalPoseEvaluator pose_evaluator_;
+
+		std::vector<AnimationLod> animation_lods_;
+		uint32_t animation_lod_;
+		float screen_area_;
+		bool pose_stale_;
+		uint32_t blend_step_;
+		RotationsType blend_from_reals_;
+		RotationsType blend_from_duals_;
+		RotationsType blend_to_reals_;
+		RotationsType blend_to_duals_;
 
 		uint32_t num_frames_;
 		uint32_t frame_rate_;
@@ -398,6 +504,10 @@ namespace KlayGE
 
 		virtual AABBox FramePosBound(uint32_t frame) const;
 		void AttachFramePosBounds(std::shared_ptr<AABBKeyFrames> const & frame_pos_aabbs);
+
+		// Passed on to the model, for animation LOD
+		bool WantsScreenArea() const override;
+		void ScreenArea(float area) override;
 		std::shared_ptr<AABBKeyFrames> const & GetFramePosBounds() const
 		{
 			return frame_pos_aabbs_;
@@ -435,13 +545,20 @@ namespace KlayGE
 		}
 	};
 
+	// merged_buff and merged_indices point into merged_data, usually the mapped model_bin itself.
+	// Each mesh has its own index size in merged_indices, and its base indices count in that size.
+	// mesh_lod_indices has (num_indices, base_index) of LOD 1 and up of each mesh. mesh_meshlets are empty for
+	//  skinned meshes.
 	KLAYGE_CORE_API void LoadModel(std::string const & meshml_name, std::vector<RenderMaterialPtr>& mtls,
-		std::vector<VertexElement>& merged_ves, char& all_is_index_16_bit,
-		std::vector<std::vector<uint8_t>>& merged_buff, std::vector<uint8_t>& merged_indices,
+		std::vector<VertexElement>& merged_ves, std::vector<char>& mesh_is_index_16_bit,
+		std::vector<ArrayRef<uint8_t>>& merged_buff, ArrayRef<uint8_t>& merged_indices,
+		std::shared_ptr<void>& merged_data,
 		std::vector<std::string>& mesh_names, std::vector<int32_t>& mtl_ids,
 		std::vector<AABBox>& pos_bbs, std::vector<AABBox>& tc_bbs,
 		std::vector<uint32_t>& mesh_num_vertices, std::vector<uint32_t>& mesh_base_vertices,
 		std::vector<uint32_t>& mesh_num_indices, std::vector<uint32_t>& mesh_base_indices,
+		std::vector<std::vector<std::pair<uint32_t, uint32_t>>>& mesh_lod_indices,
+		std::vector<std::vector<Meshlet>>& mesh_meshlets,
 		std::vector<Joint>& joints, std::shared_ptr<AnimationActionsType>& actions,
 		std::shared_ptr<KeyFramesType>& kfs, uint32_t& num_frames, uint32_t& frame_rate,
 		std::vector<std::shared_ptr<AABBKeyFrames>>& frame_pos_bbs);
@@ -453,7 +570,7 @@ namespace KlayGE
 		std::function<StaticMeshPtr(RenderModelPtr const &, std::wstring const &)> CreateMeshFactoryFunc = CreateMeshFactory<StaticMesh>());
 
 	KLAYGE_CORE_API void SaveModel(std::string const & meshml_name, std::vector<RenderMaterialPtr> const & mtls,
-		std::vector<VertexElement> const & merged_ves, char all_is_index_16_bit, 
+		std::vector<VertexElement> const & merged_ves, std::vector<char> const & mesh_is_index_16_bit,
 		std::vector<std::vector<uint8_t>> const & merged_buffs, std::vector<uint8_t> const & merged_indices,
 		std::vector<std::string> const & mesh_names, std::vector<int32_t> const & mtl_ids,
 		std::vector<AABBox> const & pos_bbs, std::vector<AABBox> const & tc_bbs,
@@ -0,0 +1,78 @@
+/**
+ * @file MeshOptimizer.hpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+#ifndef _KLAYGE_MESH_OPTIMIZER_HPP
+#define _KLAYGE_MESH_OPTIMIZER_HPP
+
+#pragma once
+
+#include <KlayGE/PreDeclare.hpp>
+#include <KFL/ArrayRef.hpp>
+
+#include <vector>
+
+namespace KlayGE
+{
+	// Offline processing of indexed triangle lists. Indices are local to one mesh, in [0, num_vertices).
+
+	struct VertexCacheStats
+	{
+		// Average cache misses per triangle, 0.5 is the best a regular grid can get
+		float acmr;
+		// Average transforms per vertex, 1 means every vertex is transformed once
+		float atvr;
+	};
+
+	// Simulates a FIFO post-transform cache, the kind GPUs have
+	KLAYGE_CORE_API VertexCacheStats AnalyzeVertexCache(ArrayRef<uint32_t> indices, uint32_t num_vertices,
+		uint32_t cache_size = 16);
+
+	// Reorders triangles to hit the post-transform cache, using Tom Forsyth's linear-speed vertex cache optimisation
+	KLAYGE_CORE_API void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t num_vertices);
+
+	// Splits the cache optimized triangles into clusters, and draws the ones facing out of the mesh first,
+	//  like Tipsify (Sander et al. 2007). A cluster is only cut where ACMR stays within threshold of the input.
+	KLAYGE_CORE_API void OptimizeOverdraw(std::vector<uint32_t>& indices, ArrayRef<float3> positions,
+		float threshold = 1.05f);
+
+	// Renumbers vertices in the order the triangles first use them. Unused vertices go last.
+	//  Returns remap, with remap[old_index] == new_index, for RemapVertices.
+	KLAYGE_CORE_API std::vector<uint32_t> OptimizeVertexFetch(std::vector<uint32_t>& indices, uint32_t num_vertices);
+	KLAYGE_CORE_API void RemapVertices(void* vertices, uint32_t stride, ArrayRef<uint32_t> remap);
+
+	// Collapses edges by quadric error (Garland & Heckbert 1997) until there are at most target_num_indices,
+	//  or the next collapse would move the surface further than target_error. Only input vertices are kept,
+	//  so LODs can share one vertex buffer. Vertices on UV/normal seams stay, borders only slide along themselves.
+	//  result_error gets the distance the surface moved.
+	KLAYGE_CORE_API std::vector<uint32_t> SimplifyMesh(ArrayRef<uint32_t> indices, ArrayRef<float3> positions,
+		uint32_t target_num_indices, float target_error, float* result_error = nullptr);
+}
+
+#endif		// _KLAYGE_MESH_OPTIMIZER_HPP
@@ -0,0 +1,79 @@
+/**
+ * @file Meshlet.hpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+
+#ifndef _KLAYGE_MESHLET_HPP
+#define _KLAYGE_MESHLET_HPP
+
+#pragma once
+
+#include <KlayGE/PreDeclare.hpp>
+#include <KFL/ArrayRef.hpp>
+#include <KFL/Math.hpp>
+
+#include <vector>
+
+namespace KlayGE
+{
+	// A cluster of triangles, contiguous in the mesh's index list, culled as a whole
+	struct Meshlet
+	{
+		// Relative to the first index of the mesh
+		uint32_t start_index;
+		uint32_t num_indices;
+
+		// Bounding sphere
+		float3 center;
+		float radius;
+
+		// All triangle normals are within the cone. cone_cos <= 0 if the cone is too wide to cull anything.
+		float3 cone_axis;
+		float cone_cos;
+		float cone_sin;
+	};
+
+	// Cuts the triangles into meshlets in their order, so a cache optimized order gives compact meshlets
+	KLAYGE_CORE_API std::vector<Meshlet> BuildMeshlets(ArrayRef<uint32_t> indices, ArrayRef<float3> positions,
+		uint32_t max_vertices = 64, uint32_t max_triangles = 124);
+
+	// Ids of the meshlets that may be seen: in the frustum, and not all back facing. Frustum and eye are in the
+	//  meshlets' space. Returns the number of indices in them.
+	KLAYGE_CORE_API uint32_t CullMeshlets(ArrayRef<Meshlet> meshlets, Frustum const & frustum, float3 const & eye_pos,
+		std::vector<uint32_t>& visible_meshlets);
+	// Frustum only, for two sided materials
+	KLAYGE_CORE_API uint32_t CullMeshlets(ArrayRef<Meshlet> meshlets, Frustum const & frustum,
+		std::vector<uint32_t>& visible_meshlets);
+
+	// Copies indices of the meshlets into one list, to draw in one call. index_size is 2 or 4.
+	KLAYGE_CORE_API void CompactMeshletIndices(ArrayRef<Meshlet> meshlets, ArrayRef<uint32_t> meshlet_ids,
+		void const * indices, uint32_t index_size, std::vector<uint8_t>& compacted);
+}
+
+#endif		// _KLAYGE_MESHLET_HPP
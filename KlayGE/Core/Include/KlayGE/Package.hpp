@@ -0,0 +1,65 @@
+/**
+ * @file Package.hpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+#ifndef _KLAYGE_PACKAGE_HPP
+#define _KLAYGE_PACKAGE_HPP
+
+#pragma once
+
+#include <KlayGE/PreDeclare.hpp>
+#include <KFL/CXX17/string_view.hpp>
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace KlayGE
+{
+	// A read-only archive that ResLoader keeps opened and opens files from.
+	class KLAYGE_CORE_API Package : boost::noncopyable
+	{
+	public:
+		virtual ~Package();
+
+		virtual uint64_t Timestamp() const = 0;
+
+		// Returns 0xFFFFFFFF if the file is not in the package
+		virtual uint32_t Find(std::string_view extract_file_path) = 0;
+		virtual ResIdentifierPtr Extract(std::string_view extract_file_path, std::string_view res_name) = 0;
+
+		virtual std::vector<std::string> const & FilePaths() const = 0;
+
+		// Budget of the memory spent on caching decompressed data. Packages that don't cache ignore it.
+		virtual void CacheBudget(uint64_t budget);
+	};
+}
+
+#endif		// _KLAYGE_PACKAGE_HPP
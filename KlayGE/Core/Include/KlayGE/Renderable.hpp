@@ -143,6 +143,10 @@ namespace KlayGE
 		{
 			return technique_;
 		}
+		RenderMaterialPtr const & Material() const
+		{
+			return mtl_;
+		}
 		virtual RenderLayout& GetRenderLayout() const = 0;
 		virtual std::wstring const & Name() const = 0;
 
@@ -198,6 +202,48 @@ namespace KlayGE
 			return static_cast<uint32_t>(subrenderables_.size());
 		}
 
+		// Levels of detail, 0 is the most detailed. The scene manager picks one per frame from the screen area.
+		virtual uint32_t NumLods() const
+		{
+			return 1;
+		}
+		virtual int32_t LodForScreenArea(float /*area*/) const
+		{
+			return 0;
+		}
+		virtual void ActiveLod(int32_t /*lod*/)
+		{
+		}
+		virtual int32_t ActiveLod() const
+		{
+			return 0;
+		}
+
+		// For renderables that do less work when small on screen. The scene manager reports the screen area of
+		//  every visible instance, in every pass, when asked to.
+		virtual bool WantsScreenArea() const
+		{
+			return false;
+		}
+		virtual void ScreenArea(float /*area*/)
+		{
+		}
+
+		// Clusters of triangles culled after the whole object is found visible. CullClusters runs on worker threads
+		//  and only touches CPU data, returning the number of triangles culled. ApplyClusterCulling binds the result
+		//  on the main thread, or all the triangles if cull is false.
+		virtual bool HasClusters() const
+		{
+			return false;
+		}
+		virtual uint32_t CullClusters(Camera const & /*camera*/, bool /*cull_back_faces*/)
+		{
+			return 0;
+		}
+		virtual void ApplyClusterCulling(bool /*cull*/)
+		{
+		}
+
 		virtual bool HWResourceReady() const
 		{
 			return true;
@@ -34,36 +34,46 @@
 #pragma once
 
 #include <KlayGE/PreDeclare.hpp>
+#include <atomic>
 #include <istream>
 #include <vector>
+#include <deque>
+#include <list>
 #include <string>
-#if defined(KLAYGE_COMPILER_MSVC)
-#pragma warning(push)
-#pragma warning(disable: 4512) // consume_via_copy in lockfree doesn't have assignment operator.
-#elif defined(KLAYGE_COMPILER_CLANG)
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-parameter" // Ignore unused parameter 'x', 'alloc'
-#endif
-#include <boost/lockfree/spsc_queue.hpp>
-#if defined(KLAYGE_COMPILER_MSVC)
-#pragma warning(pop)
-#elif defined(KLAYGE_COMPILER_CLANG)
-#pragma clang diagnostic pop
-#endif
+#include <unordered_map>
 
 #include <KFL/ResIdentifier.hpp>
 #include <KFL/Thread.hpp>
+#include <KFL/Timer.hpp>
 
 namespace KlayGE
 {
+	// Priority bands of asynchronous loading, from the most urgent to the least
+	enum ResLoadingPriority
+	{
+		RLP_Immediate = 0,	// Needed in the next frame
+		RLP_High,
+		RLP_Normal,
+		RLP_Low,			// Prefetching, loaded only when nothing else is waiting
+
+		RLP_NumPriorities
+	};
+
 	class KLAYGE_CORE_API ResLoadingDesc : boost::noncopyable
 	{
+		friend class ResLoader;
+
 	public:
 		virtual ~ResLoadingDesc()
 		{
 		}
 
 		virtual uint64_t Type() const = 0;
+		// Identifies the resource in the loading telemetry
+		virtual std::string_view Name() const
+		{
+			return std::string_view();
+		}
 
 		virtual bool StateLess() const = 0;
 
@@ -76,11 +86,81 @@ namespace KlayGE
 
 		virtual bool HasSubThreadStage() const = 0;
 
+		// A stable key built from Type() and everything Match() compares. Descs that match must have the same hash.
+		virtual size_t Hash() const = 0;
 		virtual bool Match(ResLoadingDesc const & rhs) const = 0;
 		virtual void CopyDataFrom(ResLoadingDesc const & rhs) = 0;
 		virtual std::shared_ptr<void> CloneResourceFrom(std::shared_ptr<void> const & resource) = 0;
 
 		virtual std::shared_ptr<void> Resource() const = 0;
+
+		// Memory footprint of the loaded resource, counted against the residency budget
+		virtual uint64_t CpuMemorySize() const
+		{
+			return 0;
+		}
+		virtual uint64_t GpuMemorySize() const
+		{
+			return 0;
+		}
+		// Called once the loaded resource is held by ResLoader. A desc that drops its own reference here returns
+		//  true, which lets the resource be evicted when nothing else uses it. Only textures and models do so far.
+		//  Resources of the other descs are pinned by the desc and stay off the residency list.
+		virtual bool ReleaseResource()
+		{
+			return false;
+		}
+
+		// Loads started with ResLoader::ASyncQueryDependency from SubThreadStage. MainThreadStage waits for them.
+		std::vector<ResLoadingDescPtr> const & Dependencies() const
+		{
+			return dependencies_;
+		}
+
+	private:
+		std::vector<ResLoadingDescPtr> dependencies_;
+	};
+
+	struct ResidencyStats
+	{
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		uint64_t resident_bytes;
+		uint32_t num_resident;
+	};
+
+	// One query of a resource. Times are in seconds, relative to the creation of ResLoader.
+	struct ResLoadingRecord
+	{
+		uint64_t type;
+		std::string name;
+		bool cache_hit;
+		ResLoadingPriority priority;
+
+		double request_time;
+		double queue_wait;
+		double sub_thread_start;
+		double sub_thread_time;
+		double main_thread_start;
+		double main_thread_time;
+		uint64_t bytes_read;
+
+		uint32_t sub_thread_id;
+		uint32_t main_thread_id;
+	};
+
+	// All records of one resource added up
+	struct ResLoadingSummary
+	{
+		uint64_t type;
+		std::string name;
+		uint32_t num_loads;
+		uint32_t num_cache_hits;
+		double queue_wait;
+		double sub_thread_time;
+		double main_thread_time;
+		uint64_t bytes_read;
 	};
 
 	class KLAYGE_CORE_API ResLoader : boost::noncopyable
@@ -95,6 +175,7 @@ namespace KlayGE
 		void Suspend();
 		void Resume();
 
+		// A path already in the list is not added again, so every model can add its own folder on each load
 		void AddPath(std::string const & path);
 		void DelPath(std::string const & path);
 		std::string const & LocalFolder() const
@@ -106,10 +187,53 @@ namespace KlayGE
 		std::string Locate(std::string const & name);
 		std::string AbsPath(std::string const & path);
 
+		// Opened packages (.7z, .kpk) stay resident with their directories. Each one keeps its decompressed
+		//  data cached up to the budget.
+		void PackageCacheBudget(uint64_t bytes);
+		uint64_t PackageCacheBudget() const
+		{
+			return package_cache_budget_;
+		}
+
 		std::shared_ptr<void> SyncQuery(ResLoadingDescPtr const & res_desc);
-		std::shared_ptr<void> ASyncQuery(ResLoadingDescPtr const & res_desc);
+		std::shared_ptr<void> ASyncQuery(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority = RLP_Normal);
 		void Unload(std::shared_ptr<void> const & res);
 
+		// Called from SubThreadStage of res_desc, as soon as it knows what else it needs. The dependency loads in
+		//  parallel with the same priority, and MainThreadStage of res_desc runs only after the dependency has finished.
+		std::shared_ptr<void> ASyncQueryDependency(ResLoadingDesc& res_desc, ResLoadingDescPtr const & dependency);
+
+		// The desc passed to ASyncQuery works as the handle of the request
+		void Reprioritize(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority);
+		void Cancel(ResLoadingDescPtr const & res_desc);
+		uint32_t QueueDepth(ResLoadingPriority priority);
+
+		// Loaded resources are kept resident until their total size exceeds the budget. Then the least recently
+		//  used ones that are no longer referenced outside ResLoader are evicted. Unlimited by default, which keeps
+		//  nothing resident: a loaded resource is reused only while something else holds it. Only resources whose
+		//  desc releases them (see ResLoadingDesc::ReleaseResource) are counted, which is textures and models.
+		void ResidencyBudget(uint64_t bytes);
+		uint64_t ResidencyBudget() const
+		{
+			return residency_budget_;
+		}
+		ResidencyStats GetResidencyStats();
+		void ResetResidencyStats();
+
+		// Records the queue wait, stage timings and bytes read of every query. Off by default.
+		void LoadingTelemetry(bool enable);
+		bool LoadingTelemetry() const
+		{
+			return telemetry_enabled_;
+		}
+		std::vector<ResLoadingRecord> LoadingRecords();
+		// Grouped by type and name, the most expensive first
+		std::vector<ResLoadingSummary> LoadingSummary();
+		void ClearLoadingRecords();
+		void ExportLoadingTelemetryToCSV(std::string const & file_name);
+		// In the Trace Event Format, for chrome://tracing
+		void ExportLoadingTelemetryToChromeTrace(std::string const & file_name);
+
 		template <typename T>
 		std::shared_ptr<T> SyncQueryT(ResLoadingDescPtr const & res_desc)
 		{
@@ -117,9 +241,15 @@ namespace KlayGE
 		}
 
 		template <typename T>
-		std::shared_ptr<T> ASyncQueryT(ResLoadingDescPtr const & res_desc)
+		std::shared_ptr<T> ASyncQueryT(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority = RLP_Normal)
 		{
-			return std::static_pointer_cast<T>(this->ASyncQuery(res_desc));
+			return std::static_pointer_cast<T>(this->ASyncQuery(res_desc, priority));
+		}
+
+		template <typename T>
+		std::shared_ptr<T> ASyncQueryDependencyT(ResLoadingDesc& res_desc, ResLoadingDescPtr const & dependency)
+		{
+			return std::static_pointer_cast<T>(this->ASyncQueryDependency(res_desc, dependency));
 		}
 
 		template <typename T>
@@ -128,19 +258,127 @@ namespace KlayGE
 			this->Unload(std::static_pointer_cast<void>(res));
 		}
 
+		// Runs MainThreadStage of completed loads, the most urgent first, until the per-call budgets are spent.
+		//  At least one load is finished per call. The rest are deferred to the next Update.
 		void Update();
 
+		// In seconds. Unlimited by default.
+		void UpdateTimeBudget(double seconds);
+		double UpdateTimeBudget() const
+		{
+			return update_time_budget_;
+		}
+		// Counted in CpuMemorySize() + GpuMemorySize() of the finished resources. Unlimited by default.
+		void UpdateByteBudget(uint64_t bytes);
+		uint64_t UpdateByteBudget() const
+		{
+			return update_byte_budget_;
+		}
+		// Completed loads that the last Update left for later
+		uint32_t NumDeferredLoads() const
+		{
+			return num_deferred_loads_;
+		}
+
+		void NumLoadingThreads(uint32_t num);
+		uint32_t NumLoadingThreads() const
+		{
+			return static_cast<uint32_t>(loading_threads_.size());
+		}
+
 	private:
 		std::string RealPath(std::string const & path);
 
+		enum LoadingStatus
+		{
+			LS_Loading,
+			LS_Running,		// The sub thread stage is running, only on the thread that made the transition
+			LS_Complete,
+			LS_CanBeRemoved,
+			LS_Cancelled
+		};
+
+		// One job per distinct resource in flight. Matching requests share the job.
+		struct LoadingJob
+		{
+			ResLoadingDescPtr res_desc;
+			std::atomic<LoadingStatus> status;
+			ResLoadingPriority priority;	// Guarded by loading_res_queue_mutex_ once the job is enqueued
+			uint32_t num_requests;
+
+			ResLoadingRecord record;
+
+			// Signalled when the job's sub thread stage is done
+			std::mutex status_mutex;
+			std::condition_variable status_cond;
+
+			// Loading threads, Cancel and the main thread race on the status. Only the one that makes the
+			//  transition does the work that goes with it.
+			bool Transit(LoadingStatus from, LoadingStatus to)
+			{
+				if (!status.compare_exchange_strong(from, to))
+				{
+					return false;
+				}
+				if ((LS_Loading == from) || (LS_Running == from))
+				{
+					{
+						std::lock_guard<std::mutex> lock(status_mutex);
+					}
+					status_cond.notify_all();
+				}
+				return true;
+			}
+
+			void WaitForSubThreadStage()
+			{
+				std::unique_lock<std::mutex> lock(status_mutex);
+				status_cond.wait(lock, [this] { return (status != LS_Loading) && (status != LS_Running); });
+			}
+		};
+		typedef std::shared_ptr<LoadingJob> LoadingJobPtr;
+
+		std::shared_ptr<void> ASyncQuery(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority, bool on_main_thread);
+
 		void AddLoadedResource(ResLoadingDescPtr const & res_desc, std::shared_ptr<void> const & res);
 		std::shared_ptr<void> FindMatchLoadedResource(ResLoadingDescPtr const & res_desc);
 		void RemoveUnrefResources();
 
+		void AddLoadingResource(ResLoadingDescPtr const & res_desc, LoadingJobPtr const & job);
+		LoadingJobPtr FindMatchLoadingResource(ResLoadingDescPtr const & res_desc, std::shared_ptr<void>& res);
+		LoadingJobPtr FindLoadingJob(ResLoadingDesc const & res_desc);
+		bool DependenciesReady(ResLoadingDesc const & res_desc);
+		void FinishDependencies(ResLoadingDesc const & res_desc);
+
+		void EnqueueLoadingJob(LoadingJobPtr const & job);
+		bool DequeueLoadingJob(LoadingJobPtr const & job);
+		ResLoadingPriority JobPriority(LoadingJob const & job);
+
+		struct ResidentResource
+		{
+			std::shared_ptr<void> res;
+			uint64_t size;
+		};
+
+		void AddResidentResource(ResLoadingDescPtr const & res_desc, std::shared_ptr<void> const & res);
+		void TouchResidentResource(std::shared_ptr<void> const & res);
+		void CountResidencyQuery(bool hit);
+		void EvictResidentResources();
+
+		ResIdentifierPtr OpenFile(std::string const & name);
+
+		void InitLoadingRecord(ResLoadingRecord& record, ResLoadingDescPtr const & res_desc,
+			ResLoadingPriority priority, bool cache_hit);
+		void RecordCacheHit(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority);
+		void AddLoadingRecord(ResLoadingRecord const & record);
+		void RunSubThreadStage(ResLoadingDescPtr const & res_desc, ResLoadingRecord* record);
+		void RunMainThreadStage(ResLoadingDescPtr const & res_desc, ResLoadingRecord* record);
+
+		void StartLoadingThreads(uint32_t num);
+		void StopLoadingThreads();
 		void LoadingThreadFunc();
 
-		ResIdentifierPtr LocatePkt(std::string const & name, std::string const & res_name,
-			std::string& password, std::string& internal_name);
+		PackagePtr LocatePkt(std::string const & res_name, std::string& internal_name);
 #if defined(KLAYGE_PLATFORM_ANDROID)
 		AAsset* LocateFileAndroid(std::string const & name);
 #elif defined(KLAYGE_PLATFORM_IOS)
@@ -152,27 +390,42 @@ namespace KlayGE
 	private:
 		static std::unique_ptr<ResLoader> res_loader_instance_;
 
-		enum LoadingStatus
-		{
-			LS_Loading,
-			LS_Complete,
-			LS_CanBeRemoved
-		};
-
 		std::string exe_path_;
 		std::string local_path_;
 		std::vector<std::string> paths_;
 		std::mutex paths_mutex_;
+		std::unordered_map<std::string, PackagePtr> packages_;
+		uint64_t package_cache_budget_;
 
 		std::mutex loaded_mutex_;
 		std::mutex loading_mutex_;
-		std::vector<std::pair<ResLoadingDescPtr, std::weak_ptr<void>>> loaded_res_;
-		std::vector<std::pair<ResLoadingDescPtr, std::shared_ptr<volatile LoadingStatus>>> loading_res_;
-		boost::lockfree::spsc_queue<std::pair<ResLoadingDescPtr, std::shared_ptr<volatile LoadingStatus>>,
-			boost::lockfree::capacity<1024>> loading_res_queue_;
+		std::unordered_multimap<size_t, std::pair<ResLoadingDescPtr, std::weak_ptr<void>>> loaded_res_;
+		size_t loaded_res_purge_threshold_;
+		std::vector<std::pair<ResLoadingDescPtr, LoadingJobPtr>> loading_res_;
+		std::unordered_multimap<size_t, std::pair<ResLoadingDescPtr, LoadingJobPtr>> loading_res_index_;
+
+		std::mutex loading_res_queue_mutex_;
+		std::condition_variable loading_res_queue_cond_;
+		std::deque<LoadingJobPtr> loading_res_queue_[RLP_NumPriorities];
+		uint32_t num_queued_jobs_;
+
+		std::mutex resident_mutex_;
+		std::list<ResidentResource> resident_res_;
+		std::unordered_map<void*, std::list<ResidentResource>::iterator> resident_res_index_;
+		uint64_t residency_budget_;
+		ResidencyStats residency_stats_;
+
+		std::mutex telemetry_mutex_;
+		std::atomic<bool> telemetry_enabled_;	// Read by the loading threads
+		Timer telemetry_timer_;
+		std::vector<ResLoadingRecord> loading_records_;
+
+		double update_time_budget_;
+		uint64_t update_byte_budget_;
+		uint32_t num_deferred_loads_;
 
-		std::unique_ptr<joiner<void>> loading_thread_;
-		volatile bool quit_;
+		std::vector<joiner<void>> loading_threads_;
+		bool quit_;
 	};
 }
 
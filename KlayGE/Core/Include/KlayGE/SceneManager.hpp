@@ -43,7 +43,15 @@ namespace KlayGE
 
 		void SmallObjectThreshold(float area);
 		void SceneUpdateElapse(float elapse);
+		// Culls meshlets of visible static meshes, on worker threads
+		void ClusterCulling(bool cull);
+		bool ClusterCulling() const;
+		// Threads the visibility tests run on, 0 for one per hardware thread
+		void CullingThreads(uint32_t num);
+		uint32_t CullingThreads() const;
 		virtual void ClipScene();
+		// Marks the scene objects the active camera sees through frustum, as a flush does before rendering
+		void ClipSceneByFrustum(Frustum const & frustum);
 
 		void AddCamera(CameraPtr const & camera);
 		void DelCamera(CameraPtr const & camera);
@@ -84,11 +92,26 @@ namespace KlayGE
 		uint32_t NumRenderablesRendered() const;
 		uint32_t NumPrimitivesRendered() const;
 		uint32_t NumVerticesRendered() const;
+		uint32_t NumPrimitivesClusterCulled() const;
+		// Skinned model poses in the last frame
+		uint32_t NumPosesEvaluated() const;
+		uint32_t NumPosesBlended() const;
+		uint32_t NumPosesSkipped() const;
 		uint32_t NumDrawCalls() const;
 		uint32_t NumDispatchCalls() const;
+		// Technique, material and layout switches between consecutive renderables drawn in the last frame
+		uint32_t NumStateChanges() const;
+
+		// Sort key of a render queue entry. From the most significant bits: the technique rank, the material and
+		//  layout ids, and the quantized view depth. Values too big for their field share its last value.
+		static uint64_t RenderQueueKey(uint32_t tech_rank, uint32_t mtl_id, uint32_t layout_id, uint32_t depth);
+		// Stable LSD radix sort of render queue entries on their keys
+		static void SortRenderQueue(std::vector<std::pair<uint64_t, Renderable*>>& items,
+			std::vector<std::pair<uint64_t, Renderable*>>& scratch);
 
 	protected:
 		void Flush(uint32_t urt);
+		void CullClusters(Camera const & camera);
 
 		std::vector<CameraPtr>::iterator DelCamera(std::vector<CameraPtr>::iterator iter);
 		std::vector<LightSourcePtr>::iterator DelLight(std::vector<LightSourcePtr>::iterator iter);
@@ -118,24 +141,45 @@ namespace KlayGE
 
 	private:
 		void FlushScene();
+		void UpdateBoundWS(uint32_t index);
 
 	private:
 		uint32_t urt_;
 
-		std::vector<std::pair<RenderTechnique const *, std::vector<Renderable*>>> render_queue_;
+		std::vector<Renderable*> render_queue_;
+		// Sort keys of the renderables in the queue, and the scratch space of the radix sort
+		std::vector<std::pair<uint64_t, Renderable*>> render_queue_keys_[2];
+		// Techniques, materials and layouts in the queue, numbered in the order they are first met
+		std::unordered_map<RenderTechnique const *, uint32_t> render_queue_tech_ids_;
+		std::unordered_map<void const *, uint32_t> render_queue_mtl_ids_;
+		std::unordered_map<void const *, uint32_t> render_queue_layout_ids_;
+
+		// World space bounds of scene_objs_ as min x, y, z and max x, y, z arrays, and their attributes, so that
+		//  objects are tested against the frustum several at a time. Updated when an object is added, gets its
+		//  renderable, or moves.
+		std::vector<float> bounds_ws_[6];
+		std::vector<uint32_t> obj_attribs_;
 
 		uint32_t num_objects_rendered_;
 		uint32_t num_renderables_rendered_;
 		uint32_t num_primitives_rendered_;
 		uint32_t num_vertices_rendered_;
+		uint32_t num_primitives_cluster_culled_;
+		uint32_t num_poses_evaluated_;
+		uint32_t num_poses_blended_;
+		uint32_t num_poses_skipped_;
 		uint32_t num_draw_calls_;
 		uint32_t num_dispatch_calls_;
+		uint32_t num_state_changes_;
+		uint32_t num_state_changes_just_made_;
 
 		std::mutex update_mutex_;
 		std::unique_ptr<joiner<void>> update_thread_;
 		volatile bool quit_;
 
 		bool deferred_mode_;
+		bool cluster_culling_;
+		uint32_t culling_threads_;
 	};
 }
 
@@ -53,7 +53,12 @@ namespace KlayGE
 		virtual float4x4 const & ModelMatrix() const;
 		virtual float4x4 const & AbsModelMatrix() const;
 		virtual AABBox const & PosBoundWS() const;
+		// Set when PosBoundWS changes, cleared once the scene manager has taken the new bound
+		bool PosBoundWSDirty() const;
+		void PosBoundWSDirty(bool dirty);
 		void UpdateAbsModelMatrix();
+		// Leaves the renderable's model matrix alone, so objects sharing a renderable can be updated at once
+		void UpdateAbsTransform();
 		void VisibleMark(BoundOverlap vm);
 		BoundOverlap VisibleMark() const;
 
@@ -105,6 +110,7 @@ namespace KlayGE
 		float4x4 model_;
 		float4x4 abs_model_;
 		std::unique_ptr<AABBox> pos_aabb_ws_;
+		bool pos_aabb_ws_dirty_;
 		BoundOverlap visible_mark_;
 
 		std::function<void(SceneObject&, float, float)> sub_thread_update_func_;
@@ -0,0 +1,118 @@
+/**
+ * @file SkeletalAnimation.hpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+
+#ifndef _KLAYGE_SKELETAL_ANIMATION_HPP
+#define _KLAYGE_SKELETAL_ANIMATION_HPP
+
+#pragma once
+
+#include <KlayGE/PreDeclare.hpp>
+#include <KFL/Math.hpp>
+
+#include <vector>
+
+namespace KlayGE
+{
+	struct Joint;
+	struct KeyFrames;
+
+	// One joint at a time. A mirrored joint, with a negative scale, goes through a matrix.
+	KLAYGE_CORE_API void ConcatenateJoint(Joint& joint, Joint const & parent,
+		Quaternion const & local_real, Quaternion const & local_dual, float local_scale);
+	// The scaled dual quaternion the skinning shaders take, from the bind pose to the joint's pose
+	KLAYGE_CORE_API void SkinningDualQuat(float4& bind_real, float4& bind_dual, Joint const & joint);
+
+	// A key as model_bin stores it, and as it stays in memory, 16 bytes instead of 36. The rotation keeps its three smallest components
+	//  in 15 bits each, and where the largest one was in the top bits. Translation and scale are 16 bits
+	//  within the track's range.
+	struct CompressedKey
+	{
+		uint16_t frame_id;
+		uint16_t rotation[3];
+		uint16_t translation[3];
+		uint16_t scale;
+	};
+
+	struct CompressedKeyFrames
+	{
+		float3 translation_min;
+		float3 translation_extent;
+		float scale_min;
+		float scale_extent;
+		std::vector<CompressedKey> keys;
+	};
+
+	// Drops the keys that blending their neighbours gives back within tolerance, the way the pose evaluator
+	//  blends them. A track that doesn't move keeps one key. rotation_tolerance is in radians, the others are
+	//  relative to the track's largest translation and scale.
+	KLAYGE_CORE_API void ReduceKeyFrames(KeyFrames& kf, float rotation_tolerance, float translation_tolerance,
+		float scale_tolerance);
+	// Frame ids have to fit in 16 bits
+	KLAYGE_CORE_API CompressedKeyFrames CompressKeyFrames(KeyFrames const & kf);
+	KLAYGE_CORE_API KeyFrames DecompressKeyFrames(CompressedKeyFrames const & ckf);
+	KLAYGE_CORE_API void DecompressKey(CompressedKeyFrames const & ckf, uint32_t key,
+		Quaternion& bind_real, Quaternion& bind_dual, float& bind_scale);
+
+	// Poses a whole skeleton in batches of 4 joints, one joint per SIMD lane. Joints are visited one depth level
+	//  at a time, so parents are always done. Key frames are blended linearly as dual quaternions and normalized,
+	//  which stays within a small error of sclerp between neighbouring keys, without its acos and sincos.
+	//  Mirrored joints take the scalar path. Compressed tracks are sampled as they are, only the two keys
+	//  around the frame get decompressed.
+	class KLAYGE_CORE_API SkeletalPoseEvaluator
+	{
+	public:
+		// Call when the joints change
+		void Reset();
+
+		// Joints deeper than max_depth keep their first key, roots are at depth 0
+		void Evaluate(std::vector<Joint>& joints, std::vector<KeyFrames> const & key_frames, float frame,
+			std::vector<float4>& bind_reals, std::vector<float4>& bind_duals, uint32_t max_depth = 0xFFFFFFFF);
+		void Evaluate(std::vector<Joint>& joints, std::vector<CompressedKeyFrames> const & key_frames, float frame,
+			std::vector<float4>& bind_reals, std::vector<float4>& bind_duals, uint32_t max_depth = 0xFFFFFFFF);
+
+	private:
+		void BuildLevels(std::vector<Joint> const & joints);
+
+		template <typename Track>
+		void EvaluateTracks(std::vector<Joint>& joints, std::vector<Track> const & key_frames, float frame,
+			std::vector<float4>& bind_reals, std::vector<float4>& bind_duals, uint32_t max_depth);
+
+	private:
+		// Joints ordered by depth, and where each level starts
+		std::vector<uint32_t> level_order_;
+		std::vector<uint32_t> level_starts_;
+
+		// Key of the last sample of each joint. Playing forward, the next one is at or just after it.
+		std::vector<uint32_t> key_cursors_;
+	};
+}
+
+#endif		// _KLAYGE_SKELETAL_ANIMATION_HPP
@@ -325,8 +325,15 @@ namespace KlayGE
 	KLAYGE_CORE_API void LoadTexture(ResIdentifierPtr const & tex_res, Texture::TextureType& type,
 		uint32_t& width, uint32_t& height, uint32_t& depth, uint32_t& num_mipmaps, uint32_t& array_size,
 		ElementFormat& format, std::vector<ElementInitData>& init_data, std::vector<uint8_t>& data_block);
+	// Like LoadTexture, but if tex_res is backed by memory, init_data points into it and data_block stays empty.
+	//  tex_res has to outlive init_data, and the data must not be modified.
+	KLAYGE_CORE_API void LoadTextureNoCopy(ResIdentifierPtr const & tex_res, Texture::TextureType& type,
+		uint32_t& width, uint32_t& height, uint32_t& depth, uint32_t& num_mipmaps, uint32_t& array_size,
+		ElementFormat& format, std::vector<ElementInitData>& init_data, std::vector<uint8_t>& data_block);
 	KLAYGE_CORE_API TexturePtr SyncLoadTexture(std::string const & tex_name, uint32_t access_hint);
 	KLAYGE_CORE_API TexturePtr ASyncLoadTexture(std::string const & tex_name, uint32_t access_hint);
+	KLAYGE_CORE_API TexturePtr ASyncLoadTextureDependency(ResLoadingDesc& res_desc, std::string const & tex_name,
+		uint32_t access_hint);
 
 	KLAYGE_CORE_API void SaveTexture(std::string const & tex_name, Texture::TextureType type,
 		uint32_t width, uint32_t height, uint32_t depth, uint32_t num_mipmaps, uint32_t array_size,
@@ -279,7 +279,7 @@ namespace KlayGE
 		static char const * available_sfs_array[] = { "NullShow" };
 		static char const * available_scfs_array[] = { "Python" };
 #endif
-		static char const * available_sms_array[] = { "OCTree" };
+		static char const * available_sms_array[] = { "OCTree", "BVH" };
 
 		int width = 800;
 		int height = 600;
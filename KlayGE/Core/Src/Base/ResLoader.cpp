@@ -30,12 +30,21 @@
 
 #include <KlayGE/KlayGE.hpp>
 #include <KFL/Util.hpp>
+#include <KFL/MappedFile.hpp>
 #include <KlayGE/Extract7z.hpp>
+#include <KlayGE/MappedPackage.hpp>
 #include <KFL/CXX17/filesystem.hpp>
 
+#include <atomic>
 #include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
 #include <sstream>
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/replace.hpp>
+
 #if defined KLAYGE_PLATFORM_WINDOWS_DESKTOP
 #include <windows.h>
 #elif defined KLAYGE_PLATFORM_WINDOWS_STORE
@@ -89,7 +98,81 @@ namespace
 	private:
 		AAsset* asset_;
 	};
+#else
+	// Files smaller than this are cheaper to read through a stream than to map
+	uint64_t const MIN_MAPPED_FILE_SIZE = 64 * 1024;
+
+	KlayGE::ResIdentifierPtr OpenLocalFile(std::string_view name, uint64_t timestamp, std::string const & res_name)
+	{
+		using namespace KlayGE;
+
+		// Callers have already checked the file exists
+		uint64_t const file_size = std::filesystem::file_size(std::filesystem::path(res_name));
+		if (file_size >= MIN_MAPPED_FILE_SIZE)
+		{
+			std::shared_ptr<MappedFile> mapped = MakeSharedPtr<MappedFile>();
+			if (mapped->Open(res_name))
+			{
+				return MakeSharedPtr<ResIdentifier>(name, timestamp, mapped, mapped->Data(), mapped->Size());
+			}
+		}
+
+		// The static_cast is a workaround for a bug in clang/c2
+		return MakeSharedPtr<ResIdentifier>(name, timestamp,
+			MakeSharedPtr<std::ifstream>(res_name.c_str(), static_cast<std::ios_base::openmode>(std::ios_base::binary)));
+	}
 #endif
+
+	// Bytes opened by the current thread, used to attribute reads to the loading stage running on it
+	thread_local uint64_t thread_bytes_read = 0;
+
+	std::atomic<uint32_t> next_telemetry_thread_id(0);
+
+	// Small ids in the order threads first report, which read better in a trace than native ids
+	uint32_t TelemetryThreadId()
+	{
+		thread_local uint32_t const id = next_telemetry_thread_id ++;
+		return id;
+	}
+
+	uint64_t ResourceSize(KlayGE::ResIdentifierPtr const & res)
+	{
+		if (res->MemoryView() != nullptr)
+		{
+			return res->MemoryViewSize();
+		}
+
+		res->seekg(0, std::ios_base::end);
+		std::streamoff const size = res->tellg();
+		res->seekg(0, std::ios_base::beg);
+		return size > 0 ? static_cast<uint64_t>(size) : 0;
+	}
+
+	void WriteJsonString(std::ostream& os, std::string const & str)
+	{
+		os << '"';
+		for (char ch : str)
+		{
+			if ((ch == '"') || (ch == '\\'))
+			{
+				os << '\\' << ch;
+			}
+			else if (static_cast<unsigned char>(ch) < 0x20)
+			{
+				os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(ch)
+					<< std::dec << std::setfill(' ');
+			}
+			else
+			{
+				os << ch;
+			}
+		}
+		os << '"';
+	}
+
+	// Resident resources that don't report a footprint are counted as this much, so that they still age out under
+	//  a budget
+	uint64_t const NOMINAL_RESIDENT_SIZE = 4 * 1024;
 }
 
 namespace KlayGE
@@ -97,8 +180,16 @@ namespace KlayGE
 	std::unique_ptr<ResLoader> ResLoader::res_loader_instance_;
 
 	ResLoader::ResLoader()
-		: quit_(false)
+		: package_cache_budget_(32 * 1024 * 1024),
+			loaded_res_purge_threshold_(64), num_queued_jobs_(0),
+			residency_budget_(std::numeric_limits<uint64_t>::max()), telemetry_enabled_(false),
+			update_time_budget_(std::numeric_limits<double>::max()), update_byte_budget_(std::numeric_limits<uint64_t>::max()),
+			num_deferred_loads_(0), quit_(false)
 	{
+		residency_stats_.resident_bytes = 0;
+		residency_stats_.num_resident = 0;
+		this->ResetResidencyStats();
+
 #if defined KLAYGE_PLATFORM_WINDOWS
 #if defined KLAYGE_PLATFORM_WINDOWS_DESKTOP
 		char buf[MAX_PATH];
@@ -225,14 +316,14 @@ namespace KlayGE
 #endif
 #endif
 
-		loading_thread_ = MakeUniquePtr<joiner<void>>(Context::Instance().ThreadPool()(
-				std::bind(&ResLoader::LoadingThreadFunc, this)));
+		// Leave one core for the main thread
+		uint32_t const num_cores = std::thread::hardware_concurrency();
+		this->StartLoadingThreads(num_cores > 1 ? num_cores - 1 : 1);
 	}
 
 	ResLoader::~ResLoader()
 	{
-		quit_ = true;
-		(*loading_thread_)();
+		this->StopLoadingThreads();
 	}
 
 	ResLoader& ResLoader::Instance()
@@ -313,7 +404,7 @@ namespace KlayGE
 		std::lock_guard<std::mutex> lock(paths_mutex_);
 
 		std::string real_path = this->RealPath(path);
-		if (!real_path.empty())
+		if (!real_path.empty() && (std::find(paths_.begin(), paths_.end(), real_path) == paths_.end()))
 		{
 			paths_.push_back(real_path);
 		}
@@ -361,15 +452,11 @@ namespace KlayGE
 				}
 				else
 				{
-					std::string password;
 					std::string internal_name;
-					ResIdentifierPtr pkt_file = LocatePkt(name, res_name, password, internal_name);
-					if (pkt_file && *pkt_file)
+					PackagePtr package = this->LocatePkt(res_name, internal_name);
+					if (package && (package->Find(internal_name) != 0xFFFFFFFF))
 					{
-						if (Find7z(pkt_file, password, internal_name) != 0xFFFFFFFF)
-						{
-							return res_name;
-						}
+						return res_name;
 					}
 				}
 			}
@@ -387,6 +474,16 @@ namespace KlayGE
 	}
 
 	ResIdentifierPtr ResLoader::Open(std::string const & name)
+	{
+		ResIdentifierPtr res = this->OpenFile(name);
+		if (res && telemetry_enabled_)
+		{
+			thread_bytes_read += ResourceSize(res);
+		}
+		return res;
+	}
+
+	ResIdentifierPtr ResLoader::OpenFile(std::string const & name)
 	{
 #if defined(KLAYGE_PLATFORM_ANDROID)
 		AAsset* asset = LocateFileAndroid(name);
@@ -407,8 +504,7 @@ namespace KlayGE
 			uint64_t timestamp = std::filesystem::last_write_time(res_path);
 #endif
 
-			return MakeSharedPtr<ResIdentifier>(name, timestamp,
-				MakeSharedPtr<std::ifstream>(res_name.c_str(), std::ios_base::binary));
+			return OpenLocalFile(name, timestamp, res_name);
 		}
 #else
 		{
@@ -428,20 +524,19 @@ namespace KlayGE
 #else
 					uint64_t timestamp = std::filesystem::last_write_time(res_path);
 #endif
-					// The static_cast is a workaround for a bug in clang/c2
-					return MakeSharedPtr<ResIdentifier>(name, timestamp,
-						MakeSharedPtr<std::ifstream>(res_name.c_str(), static_cast<std::ios_base::openmode>(std::ios_base::binary)));
+					return OpenLocalFile(name, timestamp, res_name);
 				}
 				else
 				{
-					std::string password;
 					std::string internal_name;
-					ResIdentifierPtr pkt_file = LocatePkt(name, res_name, password, internal_name);
-					if (pkt_file && *pkt_file)
+					PackagePtr package = this->LocatePkt(res_name, internal_name);
+					if (package)
 					{
-						std::shared_ptr<std::iostream> packet_file = MakeSharedPtr<std::stringstream>();
-						Extract7z(pkt_file, password, internal_name, packet_file);
-						return MakeSharedPtr<ResIdentifier>(name, pkt_file->Timestamp(), packet_file);
+						ResIdentifierPtr packet_file = package->Extract(internal_name, name);
+						if (packet_file)
+						{
+							return packet_file;
+						}
 					}
 				}
 			}
@@ -450,7 +545,7 @@ namespace KlayGE
 		std::string const & res_name = LocateFileWinRT(name);
 		if (!res_name.empty())
 		{
-			return this->Open(res_name);
+			return this->OpenFile(res_name);
 		}
 #endif
 #endif
@@ -460,12 +555,13 @@ namespace KlayGE
 
 	std::shared_ptr<void> ResLoader::SyncQuery(ResLoadingDescPtr const & res_desc)
 	{
-		this->RemoveUnrefResources();
-
 		std::shared_ptr<void> loaded_res = this->FindMatchLoadedResource(res_desc);
+		this->CountResidencyQuery(!!loaded_res);
 		std::shared_ptr<void> res;
 		if (loaded_res)
 		{
+			this->RecordCacheHit(res_desc, RLP_Immediate);
+
 			if (res_desc->StateLess())
 			{
 				res = loaded_res;
@@ -481,54 +577,87 @@ namespace KlayGE
 		}
 		else
 		{
-			std::shared_ptr<volatile LoadingStatus> async_is_done;
-			bool found = false;
+			LoadingJobPtr job = this->FindMatchLoadingResource(res_desc, res);
+			bool run_sub_thread_stage = true;
+			bool own_job = false;
+			if (job)
 			{
-				std::lock_guard<std::mutex> lock(loading_mutex_);
-
-				for (auto const & lrq : loading_res_)
+				this->DequeueLoadingJob(job);
+				own_job = job->Transit(LS_Loading, LS_Running);
+				if (!own_job)
 				{
-					if (lrq.first->Match(*res_desc))
-					{
-						res_desc->CopyDataFrom(*lrq.first);
-						res = lrq.first->Resource();
-						async_is_done = lrq.second;
-						found = true;
-						break;
-					}
+					// A loading thread has the job. res_desc shares its data, so wait for it instead of loading
+					//  the same data concurrently. A job cancelled before it ran still has to be loaded here.
+					job->WaitForSubThreadStage();
+					run_sub_thread_stage = (LS_Cancelled == job->status);
 				}
 			}
-
-			if (found)
-			{
-				*async_is_done = LS_Complete;
-			}
 			else
 			{
 				res = res_desc->CreateResource();
 			}
 
-			if (res_desc->HasSubThreadStage())
+			bool const telemetry = telemetry_enabled_;
+			ResLoadingRecord record;
+			if (telemetry)
 			{
-				res_desc->SubThreadStage();
+				this->InitLoadingRecord(record, res_desc, RLP_Immediate, false);
 			}
 
-			res_desc->MainThreadStage();
+			if (res_desc->HasSubThreadStage() && run_sub_thread_stage)
+			{
+				this->RunSubThreadStage(res_desc, telemetry ? &record : nullptr);
+			}
+			if (own_job)
+			{
+				job->Transit(LS_Running, LS_Complete);
+			}
+			this->FinishDependencies(*res_desc);
+
+			this->RunMainThreadStage(res_desc, telemetry ? &record : nullptr);
 			res = res_desc->Resource();
 			this->AddLoadedResource(res_desc, res);
+			this->AddResidentResource(res_desc, res);
+
+			if (telemetry)
+			{
+				this->AddLoadingRecord(record);
+			}
 		}
 
 		return res;
 	}
 
-	std::shared_ptr<void> ResLoader::ASyncQuery(ResLoadingDescPtr const & res_desc)
+	std::shared_ptr<void> ResLoader::ASyncQuery(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority)
 	{
-		this->RemoveUnrefResources();
+		return this->ASyncQuery(res_desc, priority, true);
+	}
 
+	std::shared_ptr<void> ResLoader::ASyncQueryDependency(ResLoadingDesc& res_desc, ResLoadingDescPtr const & dependency)
+	{
+		// A desc loaded by SyncQuery has no job, and the caller is waiting for it
+		ResLoadingPriority priority = RLP_Immediate;
+		LoadingJobPtr job = this->FindLoadingJob(res_desc);
+		if (job)
+		{
+			priority = this->JobPriority(*job);
+		}
+
+		std::shared_ptr<void> res = this->ASyncQuery(dependency, priority, false);
+		res_desc.dependencies_.push_back(dependency);
+		return res;
+	}
+
+	std::shared_ptr<void> ResLoader::ASyncQuery(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority,
+		bool on_main_thread)
+	{
 		std::shared_ptr<void> res;
 		std::shared_ptr<void> loaded_res = this->FindMatchLoadedResource(res_desc);
+		this->CountResidencyQuery(!!loaded_res);
 		if (loaded_res)
 		{
+			this->RecordCacheHit(res_desc, priority);
+
 			if (res_desc->StateLess())
 			{
 				res = loaded_res;
@@ -544,30 +673,24 @@ namespace KlayGE
 		}
 		else
 		{
-			std::shared_ptr<volatile LoadingStatus> async_is_done;
-			bool found = false;
+			LoadingJobPtr job = this->FindMatchLoadingResource(res_desc, res);
+			if (job)
 			{
-				std::lock_guard<std::mutex> lock(loading_mutex_);
-
-				for (auto const & lrq : loading_res_)
 				{
-					if (lrq.first->Match(*res_desc))
-					{
-						res_desc->CopyDataFrom(*lrq.first);
-						res = lrq.first->Resource();
-						async_is_done = lrq.second;
-						found = true;
-						break;
-					}
+					std::lock_guard<std::mutex> lock(loading_mutex_);
+					++ job->num_requests;
 				}
-			}
 
-			if (found)
-			{
-				if (!res_desc->StateLess())
+				// Shares the load already in flight. Stateless requests get an entry too, so the job still finishes
+				//  for them if the request that started it is cancelled.
+				this->RecordCacheHit(res_desc, priority);
+
+				this->AddLoadingResource(res_desc, job);
+
+				// A more urgent request pulls the shared job forward
+				if (priority < this->JobPriority(*job))
 				{
-					std::lock_guard<std::mutex> lock(loading_mutex_);
-					loading_res_.emplace_back(res_desc, async_is_done);
+					this->Reprioritize(res_desc, priority);
 				}
 			}
 			else
@@ -576,32 +699,144 @@ namespace KlayGE
 				{
 					res = res_desc->CreateResource();
 
-					async_is_done = MakeSharedPtr<LoadingStatus>(LS_Loading);
+					job = MakeSharedPtr<LoadingJob>();
+					job->res_desc = res_desc;
+					job->status = LS_Loading;
+					job->priority = priority;
+					job->num_requests = 1;
+					this->InitLoadingRecord(job->record, res_desc, priority, false);
 
-					{
-						std::lock_guard<std::mutex> lock(loading_mutex_);
-						loading_res_.emplace_back(res_desc, async_is_done);
-					}
-					loading_res_queue_.push(std::make_pair(res_desc, async_is_done));
+					this->AddLoadingResource(res_desc, job);
+					this->EnqueueLoadingJob(job);
+				}
+				else if (!on_main_thread)
+				{
+					// Nothing to do off the main thread. The job waits for Update to run MainThreadStage.
+					res = res_desc->CreateResource();
+
+					job = MakeSharedPtr<LoadingJob>();
+					job->res_desc = res_desc;
+					job->status = LS_Complete;
+					job->priority = priority;
+					job->num_requests = 1;
+					this->InitLoadingRecord(job->record, res_desc, priority, false);
+
+					this->AddLoadingResource(res_desc, job);
 				}
 				else
 				{
-					res_desc->MainThreadStage();
+					bool const telemetry = telemetry_enabled_;
+					ResLoadingRecord record;
+					if (telemetry)
+					{
+						this->InitLoadingRecord(record, res_desc, priority, false);
+					}
+
+					this->RunMainThreadStage(res_desc, telemetry ? &record : nullptr);
 					res = res_desc->Resource();
 					this->AddLoadedResource(res_desc, res);
+					this->AddResidentResource(res_desc, res);
+
+					if (telemetry)
+					{
+						this->AddLoadingRecord(record);
+					}
 				}
 			}
 		}
 		return res;
 	}
 
+	void ResLoader::Reprioritize(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority)
+	{
+		LoadingJobPtr job = this->FindLoadingJob(*res_desc);
+		if (job)
+		{
+			std::lock_guard<std::mutex> lock(loading_res_queue_mutex_);
+
+			if (job->priority != priority)
+			{
+				auto& old_queue = loading_res_queue_[job->priority];
+				auto iter = std::find(old_queue.begin(), old_queue.end(), job);
+				if (iter != old_queue.end())
+				{
+					old_queue.erase(iter);
+					loading_res_queue_[priority].push_back(job);
+				}
+				job->priority = priority;
+			}
+		}
+	}
+
+	void ResLoader::Cancel(ResLoadingDescPtr const & res_desc)
+	{
+		LoadingJobPtr job;
+		{
+			std::lock_guard<std::mutex> lock(loading_mutex_);
+
+			size_t const hash = res_desc->Hash();
+			auto range = loading_res_index_.equal_range(hash);
+			for (auto iter = range.first; iter != range.second; ++ iter)
+			{
+				if (iter->second.first == res_desc)
+				{
+					job = iter->second.second;
+					break;
+				}
+			}
+			if (!job || ((job->status != LS_Loading) && (job->status != LS_Running) && (job->status != LS_Complete)))
+			{
+				return;
+			}
+
+			-- job->num_requests;
+			bool const cancel_job = (0 == job->num_requests);
+
+			for (auto iter = range.first; iter != range.second;)
+			{
+				if ((iter->second.second == job) && (cancel_job || (iter->second.first == res_desc)))
+				{
+					iter = loading_res_index_.erase(iter);
+				}
+				else
+				{
+					++ iter;
+				}
+			}
+			loading_res_.erase(std::remove_if(loading_res_.begin(), loading_res_.end(),
+				[&job, &res_desc, cancel_job](std::pair<ResLoadingDescPtr, LoadingJobPtr> const & lrq)
+				{
+					return (lrq.second == job) && (cancel_job || (lrq.first == res_desc));
+				}), loading_res_.end());
+
+			if (!cancel_job)
+			{
+				return;
+			}
+		}
+
+		this->DequeueLoadingJob(job);
+		if (!job->Transit(LS_Loading, LS_Cancelled))
+		{
+			// A loading thread may have finished it in between. One that is still running it moves it to
+			//  LS_Complete, where nothing is left to pick it up.
+			job->Transit(LS_Complete, LS_Cancelled);
+		}
+	}
+
+	uint32_t ResLoader::QueueDepth(ResLoadingPriority priority)
+	{
+		std::lock_guard<std::mutex> lock(loading_res_queue_mutex_);
+		return static_cast<uint32_t>(loading_res_queue_[priority].size());
+	}
+
 	void ResLoader::Unload(std::shared_ptr<void> const & res)
 	{
 		std::lock_guard<std::mutex> lock(loaded_mutex_);
 
 		for (auto iter = loaded_res_.begin(); iter != loaded_res_.end(); ++ iter)
 		{
-			if (res == iter->second.lock())
+			if (res == iter->second.second.lock())
 			{
 				loaded_res_.erase(iter);
 				break;
@@ -613,19 +848,30 @@ namespace KlayGE
 	{
 		std::lock_guard<std::mutex> lock(loaded_mutex_);
 
+		size_t const hash = res_desc->Hash();
+
 		bool found = false;
-		for (auto& c_desc : loaded_res_)
+		auto range = loaded_res_.equal_range(hash);
+		for (auto iter = range.first; iter != range.second; ++ iter)
 		{
-			if (c_desc.first == res_desc)
+			if (iter->second.first == res_desc)
 			{
-				c_desc.second = std::weak_ptr<void>(res);
+				iter->second.second = std::weak_ptr<void>(res);
 				found = true;
 				break;
 			}
 		}
 		if (!found)
 		{
-			loaded_res_.emplace_back(res_desc, std::weak_ptr<void>(res));
+			loaded_res_.emplace(hash, std::make_pair(res_desc, std::weak_ptr<void>(res)));
+
+			// Expired entries are skipped by lookups, so they only need to be purged once in a while.
+			//  Doubling the threshold keeps the cost amortized O(1) per added resource.
+			if (loaded_res_.size() >= loaded_res_purge_threshold_)
+			{
+				this->RemoveUnrefResources();
+				loaded_res_purge_threshold_ = std::max(loaded_res_.size() * 2, static_cast<size_t>(64));
+			}
 		}
 	}
 
@@ -634,79 +880,406 @@ namespace KlayGE
 		std::lock_guard<std::mutex> lock(loaded_mutex_);
 
 		std::shared_ptr<void> loaded_res;
-		for (auto const & lr : loaded_res_)
+		auto range = loaded_res_.equal_range(res_desc->Hash());
+		for (auto iter = range.first; iter != range.second; ++ iter)
 		{
-			if (lr.first->Match(*res_desc))
+			if (iter->second.first->Match(*res_desc))
 			{
-				loaded_res = lr.second.lock();
-				break;
+				loaded_res = iter->second.second.lock();
+				if (loaded_res)
+				{
+					this->TouchResidentResource(loaded_res);
+					break;
+				}
 			}
 		}
 		return loaded_res;
 	}
 
+	// Called with loaded_mutex_ locked
 	void ResLoader::RemoveUnrefResources()
 	{
-		std::lock_guard<std::mutex> lock(loaded_mutex_);
-
 		for (auto iter = loaded_res_.begin(); iter != loaded_res_.end();)
 		{
-			if (iter->second.lock())
+			if (iter->second.second.expired())
+			{
+				iter = loaded_res_.erase(iter);
+			}
+			else
 			{
 				++ iter;
 			}
+		}
+	}
+
+	void ResLoader::AddLoadingResource(ResLoadingDescPtr const & res_desc, LoadingJobPtr const & job)
+	{
+		std::lock_guard<std::mutex> lock(loading_mutex_);
+
+		loading_res_.emplace_back(res_desc, job);
+		loading_res_index_.emplace(res_desc->Hash(), std::make_pair(res_desc, job));
+	}
+
+	ResLoader::LoadingJobPtr ResLoader::FindMatchLoadingResource(ResLoadingDescPtr const & res_desc, std::shared_ptr<void>& res)
+	{
+		std::lock_guard<std::mutex> lock(loading_mutex_);
+
+		auto range = loading_res_index_.equal_range(res_desc->Hash());
+		for (auto iter = range.first; iter != range.second; ++ iter)
+		{
+			auto const & lrq = iter->second;
+			if (lrq.first->Match(*res_desc))
+			{
+				res_desc->CopyDataFrom(*lrq.first);
+				res = lrq.first->Resource();
+				return lrq.second;
+			}
+		}
+		return LoadingJobPtr();
+	}
+
+	ResLoader::LoadingJobPtr ResLoader::FindLoadingJob(ResLoadingDesc const & res_desc)
+	{
+		std::lock_guard<std::mutex> lock(loading_mutex_);
+
+		auto range = loading_res_index_.equal_range(res_desc.Hash());
+		for (auto iter = range.first; iter != range.second; ++ iter)
+		{
+			if (iter->second.first.get() == &res_desc)
+			{
+				return iter->second.second;
+			}
+		}
+		for (auto iter = range.first; iter != range.second; ++ iter)
+		{
+			if (iter->second.first->Match(res_desc))
+			{
+				return iter->second.second;
+			}
+		}
+		return LoadingJobPtr();
+	}
+
+	bool ResLoader::DependenciesReady(ResLoadingDesc const & res_desc)
+	{
+		for (auto const & dependency : res_desc.Dependencies())
+		{
+			LoadingJobPtr job = this->FindLoadingJob(*dependency);
+			if (job && ((LS_Loading == job->status) || (LS_Running == job->status) || (LS_Complete == job->status)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Loads the dependencies on the calling thread, for SyncQuery
+	void ResLoader::FinishDependencies(ResLoadingDesc const & res_desc)
+	{
+		for (auto const & dependency : res_desc.Dependencies())
+		{
+			LoadingJobPtr job = this->FindLoadingJob(*dependency);
+			if (!job)
+			{
+				continue;
+			}
+
+			if (this->DequeueLoadingJob(job) && job->Transit(LS_Loading, LS_Running))
+			{
+				// No loading thread has picked it up yet
+				this->RunSubThreadStage(job->res_desc, telemetry_enabled_ ? &job->record : nullptr);
+				job->Transit(LS_Running, LS_Complete);
+			}
 			else
 			{
-				iter = loaded_res_.erase(iter);
+				job->WaitForSubThreadStage();
+			}
+
+			if (job->Transit(LS_Complete, LS_CanBeRemoved))
+			{
+				ResLoadingDescPtr const & dep_desc = job->res_desc;
+				this->FinishDependencies(*dep_desc);
+
+				bool const telemetry = telemetry_enabled_;
+				this->RunMainThreadStage(dep_desc, telemetry ? &job->record : nullptr);
+				std::shared_ptr<void> res = dep_desc->Resource();
+				this->AddLoadedResource(dep_desc, res);
+				this->AddResidentResource(dep_desc, res);
+
+				if (telemetry)
+				{
+					this->AddLoadingRecord(job->record);
+				}
 			}
 		}
 	}
 
+	void ResLoader::EnqueueLoadingJob(LoadingJobPtr const & job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(loading_res_queue_mutex_);
+			loading_res_queue_[job->priority].push_back(job);
+			++ num_queued_jobs_;
+		}
+		loading_res_queue_cond_.notify_one();
+	}
+
+	bool ResLoader::DequeueLoadingJob(LoadingJobPtr const & job)
+	{
+		std::lock_guard<std::mutex> lock(loading_res_queue_mutex_);
+
+		auto& queue = loading_res_queue_[job->priority];
+		auto iter = std::find(queue.begin(), queue.end(), job);
+		if (iter != queue.end())
+		{
+			queue.erase(iter);
+			-- num_queued_jobs_;
+			return true;
+		}
+		return false;
+	}
+
+	ResLoadingPriority ResLoader::JobPriority(LoadingJob const & job)
+	{
+		std::lock_guard<std::mutex> lock(loading_res_queue_mutex_);
+		return job.priority;
+	}
+
 	void ResLoader::Update()
 	{
-		std::vector<std::pair<ResLoadingDescPtr, std::shared_ptr<volatile LoadingStatus>>> tmp_loading_res;
+		std::vector<std::pair<ResLoadingPriority, std::pair<ResLoadingDescPtr, LoadingJobPtr>>> tmp_loading_res;
 		{
 			std::lock_guard<std::mutex> lock(loading_mutex_);
-			tmp_loading_res = loading_res_;
+			for (auto const & lrq : loading_res_)
+			{
+				if (LS_Complete == lrq.second->status)
+				{
+					tmp_loading_res.emplace_back(RLP_Immediate, lrq);
+				}
+			}
+		}
+		{
+			// Reprioritize can run on other threads, sort on a snapshot
+			std::lock_guard<std::mutex> lock(loading_res_queue_mutex_);
+			for (auto& pending : tmp_loading_res)
+			{
+				pending.first = pending.second.second->priority;
+			}
 		}
 
-		for (auto& lrq : tmp_loading_res)
+		// Stable, so loads of the same priority finish in the order they were requested. Within a priority, loads
+		//  with dependencies go last, which lets them finish in the same Update as their dependencies.
+		std::stable_sort(tmp_loading_res.begin(), tmp_loading_res.end(),
+			[](std::pair<ResLoadingPriority, std::pair<ResLoadingDescPtr, LoadingJobPtr>> const & lhs,
+				std::pair<ResLoadingPriority, std::pair<ResLoadingDescPtr, LoadingJobPtr>> const & rhs)
+			{
+				if (lhs.first != rhs.first)
+				{
+					return lhs.first < rhs.first;
+				}
+				return lhs.second.second->res_desc->Dependencies().empty()
+					&& !rhs.second.second->res_desc->Dependencies().empty();
+			});
+
+		Timer timer;
+		uint64_t bytes = 0;
+		uint32_t num_processed = 0;
+		num_deferred_loads_ = 0;
+		for (auto& pending : tmp_loading_res)
 		{
-			if (LS_Complete == *lrq.second)
+			auto& lrq = pending.second;
+
+			// Requests sharing a job are done once the first of them is
+			if (LS_Complete != lrq.second->status)
 			{
-				ResLoadingDescPtr const & res_desc = lrq.first;
+				continue;
+			}
+			if (!this->DependenciesReady(*lrq.second->res_desc))
+			{
+				continue;
+			}
 
-				std::shared_ptr<void> res;
-				std::shared_ptr<void> loaded_res = this->FindMatchLoadedResource(res_desc);
-				if (loaded_res)
+			if ((num_processed > 0) && ((timer.elapsed() >= update_time_budget_) || (bytes >= update_byte_budget_)))
+			{
+				++ num_deferred_loads_;
+				continue;
+			}
+
+			// Cancel may have got there first
+			if (!lrq.second->Transit(LS_Complete, LS_CanBeRemoved))
+			{
+				continue;
+			}
+
+			ResLoadingDescPtr const & res_desc = lrq.first;
+
+			std::shared_ptr<void> res;
+			std::shared_ptr<void> loaded_res = this->FindMatchLoadedResource(res_desc);
+			if (loaded_res)
+			{
+				if (!res_desc->StateLess())
+				{
+					res = res_desc->CloneResourceFrom(loaded_res);
+					if (res != loaded_res)
+					{
+						this->AddLoadedResource(res_desc, res);
+					}
+				}
+			}
+			else
+			{
+				// Requests that joined the job were recorded as cache hits, only the one that started it is timed
+				bool const telemetry = telemetry_enabled_ && (res_desc == lrq.second->res_desc);
+
+				this->RunMainThreadStage(res_desc, telemetry ? &lrq.second->record : nullptr);
+				res = res_desc->Resource();
+				bytes += res_desc->CpuMemorySize() + res_desc->GpuMemorySize();
+				++ num_processed;
+				this->AddLoadedResource(res_desc, res);
+				this->AddResidentResource(res_desc, res);
+
+				if (telemetry)
+				{
+					this->AddLoadingRecord(lrq.second->record);
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(loading_mutex_);
+			for (auto iter = loading_res_.begin(); iter != loading_res_.end();)
+			{
+				if (LS_CanBeRemoved == iter->second->status)
 				{
-					if (!res_desc->StateLess())
+					auto range = loading_res_index_.equal_range(iter->first->Hash());
+					for (auto index_iter = range.first; index_iter != range.second; ++ index_iter)
 					{
-						res = res_desc->CloneResourceFrom(loaded_res);
-						if (res != loaded_res)
+						if (index_iter->second.first == iter->first)
 						{
-							this->AddLoadedResource(res_desc, res);
+							loading_res_index_.erase(index_iter);
+							break;
 						}
 					}
+
+					iter = loading_res_.erase(iter);
 				}
 				else
 				{
-					res_desc->MainThreadStage();
-					res = res_desc->Resource();
-					this->AddLoadedResource(res_desc, res);
+					++ iter;
 				}
+			}
+		}
+
+		this->EvictResidentResources();
+	}
 
-				*lrq.second = LS_CanBeRemoved;
+	void ResLoader::ResidencyBudget(uint64_t bytes)
+	{
+		// Destruct the released resources out of the lock
+		std::list<ResidentResource> released;
+		{
+			std::lock_guard<std::mutex> lock(resident_mutex_);
+
+			residency_budget_ = bytes;
+			if (std::numeric_limits<uint64_t>::max() == bytes)
+			{
+				released.swap(resident_res_);
+				resident_res_index_.clear();
+				residency_stats_.resident_bytes = 0;
+				residency_stats_.num_resident = 0;
 			}
 		}
 
+		this->EvictResidentResources();
+	}
+
+	ResidencyStats ResLoader::GetResidencyStats()
+	{
+		std::lock_guard<std::mutex> lock(resident_mutex_);
+		return residency_stats_;
+	}
+
+	void ResLoader::ResetResidencyStats()
+	{
+		std::lock_guard<std::mutex> lock(resident_mutex_);
+
+		residency_stats_.hits = 0;
+		residency_stats_.misses = 0;
+		residency_stats_.evictions = 0;
+	}
+
+	void ResLoader::AddResidentResource(ResLoadingDescPtr const & res_desc, std::shared_ptr<void> const & res)
+	{
+		if (!res)
 		{
-			std::lock_guard<std::mutex> lock(loading_mutex_);
-			for (auto iter = loading_res_.begin(); iter != loading_res_.end();)
+			return;
+		}
+
+		uint64_t const size = std::max(res_desc->CpuMemorySize() + res_desc->GpuMemorySize(), NOMINAL_RESIDENT_SIZE);
+		if (!res_desc->ReleaseResource())
+		{
+			// The desc keeps its own reference, so the resource could never be evicted
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(resident_mutex_);
+
+		// Without a budget nothing is kept alive, a loaded resource is only reused while something else holds it
+		if ((residency_budget_ != std::numeric_limits<uint64_t>::max())
+			&& (resident_res_index_.find(res.get()) == resident_res_index_.end()))
+		{
+			resident_res_.push_front(ResidentResource{ res, size });
+			resident_res_index_.emplace(res.get(), resident_res_.begin());
+
+			residency_stats_.resident_bytes += size;
+			++ residency_stats_.num_resident;
+		}
+	}
+
+	void ResLoader::TouchResidentResource(std::shared_ptr<void> const & res)
+	{
+		std::lock_guard<std::mutex> lock(resident_mutex_);
+
+		auto iter = resident_res_index_.find(res.get());
+		if (iter != resident_res_index_.end())
+		{
+			resident_res_.splice(resident_res_.begin(), resident_res_, iter->second);
+		}
+	}
+
+	void ResLoader::CountResidencyQuery(bool hit)
+	{
+		std::lock_guard<std::mutex> lock(resident_mutex_);
+
+		if (hit)
+		{
+			++ residency_stats_.hits;
+		}
+		else
+		{
+			++ residency_stats_.misses;
+		}
+	}
+
+	void ResLoader::EvictResidentResources()
+	{
+		// Destruct the evicted resources out of the lock
+		std::vector<std::shared_ptr<void>> evicted;
+		{
+			std::lock_guard<std::mutex> lock(resident_mutex_);
+
+			for (auto iter = resident_res_.rbegin();
+				(iter != resident_res_.rend()) && (residency_stats_.resident_bytes > residency_budget_);)
 			{
-				if (LS_CanBeRemoved == *(iter->second))
+				if (iter->res.use_count() == 1)
 				{
-					iter = loading_res_.erase(iter);
+					residency_stats_.resident_bytes -= iter->size;
+					-- residency_stats_.num_resident;
+					++ residency_stats_.evictions;
+
+					resident_res_index_.erase(iter->res.get());
+					evicted.push_back(std::move(iter->res));
+					iter = std::list<ResidentResource>::reverse_iterator(resident_res_.erase(std::next(iter).base()));
 				}
 				else
 				{
@@ -716,38 +1289,334 @@ namespace KlayGE
 		}
 	}
 
+	void ResLoader::UpdateTimeBudget(double seconds)
+	{
+		update_time_budget_ = seconds;
+	}
+
+	void ResLoader::UpdateByteBudget(uint64_t bytes)
+	{
+		update_byte_budget_ = bytes;
+	}
+
+	void ResLoader::LoadingTelemetry(bool enable)
+	{
+		telemetry_enabled_ = enable;
+	}
+
+	std::vector<ResLoadingRecord> ResLoader::LoadingRecords()
+	{
+		std::lock_guard<std::mutex> lock(telemetry_mutex_);
+		return loading_records_;
+	}
+
+	std::vector<ResLoadingSummary> ResLoader::LoadingSummary()
+	{
+		std::map<std::pair<uint64_t, std::string>, ResLoadingSummary> summaries;
+		{
+			std::lock_guard<std::mutex> lock(telemetry_mutex_);
+
+			for (auto const & record : loading_records_)
+			{
+				auto iter = summaries.find(std::make_pair(record.type, record.name));
+				if (iter == summaries.end())
+				{
+					ResLoadingSummary summary;
+					summary.type = record.type;
+					summary.name = record.name;
+					summary.num_loads = 0;
+					summary.num_cache_hits = 0;
+					summary.queue_wait = 0;
+					summary.sub_thread_time = 0;
+					summary.main_thread_time = 0;
+					summary.bytes_read = 0;
+					iter = summaries.emplace(std::make_pair(record.type, record.name), summary).first;
+				}
+
+				ResLoadingSummary& summary = iter->second;
+				if (record.cache_hit)
+				{
+					++ summary.num_cache_hits;
+				}
+				else
+				{
+					++ summary.num_loads;
+				}
+				summary.queue_wait += record.queue_wait;
+				summary.sub_thread_time += record.sub_thread_time;
+				summary.main_thread_time += record.main_thread_time;
+				summary.bytes_read += record.bytes_read;
+			}
+		}
+
+		std::vector<ResLoadingSummary> ret;
+		ret.reserve(summaries.size());
+		for (auto& summary : summaries)
+		{
+			ret.push_back(std::move(summary.second));
+		}
+		std::stable_sort(ret.begin(), ret.end(),
+			[](ResLoadingSummary const & lhs, ResLoadingSummary const & rhs)
+			{
+				return lhs.sub_thread_time + lhs.main_thread_time > rhs.sub_thread_time + rhs.main_thread_time;
+			});
+		return ret;
+	}
+
+	void ResLoader::ClearLoadingRecords()
+	{
+		std::lock_guard<std::mutex> lock(telemetry_mutex_);
+		loading_records_.clear();
+	}
+
+	void ResLoader::ExportLoadingTelemetryToCSV(std::string const & file_name)
+	{
+		std::vector<ResLoadingRecord> const records = this->LoadingRecords();
+
+		std::ofstream ofs(file_name.c_str());
+		ofs << "Type" << ',' << "Name" << ',' << "Cache Hit" << ',' << "Priority" << ','
+			<< "Request (ms)" << ',' << "Queue Wait (ms)" << ',' << "Sub Thread (ms)" << ','
+			<< "Main Thread (ms)" << ',' << "Bytes Read" << std::endl;
+
+		for (auto const & record : records)
+		{
+			std::string name = record.name;
+			boost::algorithm::replace_all(name, "\"", "\"\"");
+
+			ofs << "0x" << std::hex << std::setw(16) << std::setfill('0') << record.type << std::dec << std::setfill(' ') << ','
+				<< '"' << name << '"' << ',' << (record.cache_hit ? 1 : 0) << ',' << record.priority << ','
+				<< record.request_time * 1000 << ',' << record.queue_wait * 1000 << ','
+				<< record.sub_thread_time * 1000 << ',' << record.main_thread_time * 1000 << ','
+				<< record.bytes_read << std::endl;
+		}
+	}
+
+	void ResLoader::ExportLoadingTelemetryToChromeTrace(std::string const & file_name)
+	{
+		std::vector<ResLoadingRecord> const records = this->LoadingRecords();
+
+		std::ofstream ofs(file_name.c_str());
+		ofs << "{\"traceEvents\":[";
+
+		bool first = true;
+		auto write_event = [&ofs, &first](ResLoadingRecord const & record, char const * stage,
+			double start, double duration, uint32_t thread_id)
+		{
+			if (!first)
+			{
+				ofs << ',';
+			}
+			first = false;
+
+			ofs << std::endl << "{\"name\":";
+			WriteJsonString(ofs, record.name.empty() ? std::string("(unnamed)") : record.name);
+			ofs << ",\"cat\":\"" << stage << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread_id
+				<< std::fixed << std::setprecision(3)
+				<< ",\"ts\":" << start * 1e6 << ",\"dur\":" << duration * 1e6
+				<< ",\"args\":{\"type\":\"0x" << std::hex << record.type << std::dec
+				<< "\",\"queue_wait_ms\":" << record.queue_wait * 1000
+				<< ",\"bytes_read\":" << record.bytes_read << "}}";
+			ofs.unsetf(std::ios_base::floatfield);
+			ofs << std::setprecision(6);
+		};
+
+		for (auto const & record : records)
+		{
+			if (record.cache_hit)
+			{
+				continue;
+			}
+
+			if (record.sub_thread_time > 0)
+			{
+				write_event(record, "SubThreadStage", record.sub_thread_start, record.sub_thread_time, record.sub_thread_id);
+			}
+			write_event(record, "MainThreadStage", record.main_thread_start, record.main_thread_time, record.main_thread_id);
+		}
+
+		ofs << std::endl << "]}" << std::endl;
+	}
+
+	void ResLoader::InitLoadingRecord(ResLoadingRecord& record, ResLoadingDescPtr const & res_desc,
+		ResLoadingPriority priority, bool cache_hit)
+	{
+		record.type = res_desc->Type();
+		std::string_view const name = res_desc->Name();
+		record.name.assign(name.data(), name.size());
+		record.cache_hit = cache_hit;
+		record.priority = priority;
+
+		record.request_time = telemetry_timer_.elapsed();
+		record.queue_wait = 0;
+		record.sub_thread_start = record.request_time;
+		record.sub_thread_time = 0;
+		record.main_thread_start = record.request_time;
+		record.main_thread_time = 0;
+		record.bytes_read = 0;
+
+		record.sub_thread_id = 0;
+		record.main_thread_id = 0;
+	}
+
+	void ResLoader::RecordCacheHit(ResLoadingDescPtr const & res_desc, ResLoadingPriority priority)
+	{
+		if (telemetry_enabled_)
+		{
+			ResLoadingRecord record;
+			this->InitLoadingRecord(record, res_desc, priority, true);
+			this->AddLoadingRecord(record);
+		}
+	}
+
+	void ResLoader::AddLoadingRecord(ResLoadingRecord const & record)
+	{
+		std::lock_guard<std::mutex> lock(telemetry_mutex_);
+		loading_records_.push_back(record);
+	}
+
+	void ResLoader::RunSubThreadStage(ResLoadingDescPtr const & res_desc, ResLoadingRecord* record)
+	{
+		if (record != nullptr)
+		{
+			uint64_t const bytes_before = thread_bytes_read;
+			record->sub_thread_start = telemetry_timer_.elapsed();
+			record->queue_wait = record->sub_thread_start - record->request_time;
+
+			res_desc->SubThreadStage();
+
+			record->sub_thread_time = telemetry_timer_.elapsed() - record->sub_thread_start;
+			record->bytes_read += thread_bytes_read - bytes_before;
+			record->sub_thread_id = TelemetryThreadId();
+		}
+		else
+		{
+			res_desc->SubThreadStage();
+		}
+	}
+
+	void ResLoader::RunMainThreadStage(ResLoadingDescPtr const & res_desc, ResLoadingRecord* record)
+	{
+		if (record != nullptr)
+		{
+			uint64_t const bytes_before = thread_bytes_read;
+			record->main_thread_start = telemetry_timer_.elapsed();
+			if (record->sub_thread_time <= 0)
+			{
+				record->queue_wait = record->main_thread_start - record->request_time;
+			}
+
+			res_desc->MainThreadStage();
+
+			record->main_thread_time = telemetry_timer_.elapsed() - record->main_thread_start;
+			record->bytes_read += thread_bytes_read - bytes_before;
+			record->main_thread_id = TelemetryThreadId();
+		}
+		else
+		{
+			res_desc->MainThreadStage();
+		}
+
+		// Done with them, and they'd otherwise keep their resources alive
+		res_desc->dependencies_.clear();
+	}
+
+	void ResLoader::NumLoadingThreads(uint32_t num)
+	{
+		num = std::max(num, 1U);
+		if (num != loading_threads_.size())
+		{
+			this->StopLoadingThreads();
+			this->StartLoadingThreads(num);
+		}
+	}
+
+	void ResLoader::StartLoadingThreads(uint32_t num)
+	{
+		BOOST_ASSERT(loading_threads_.empty());
+
+		quit_ = false;
+		for (uint32_t i = 0; i < num; ++ i)
+		{
+			loading_threads_.push_back(Context::Instance().ThreadPool()(
+				std::bind(&ResLoader::LoadingThreadFunc, this)));
+		}
+	}
+
+	void ResLoader::StopLoadingThreads()
+	{
+		{
+			std::lock_guard<std::mutex> lock(loading_res_queue_mutex_);
+			quit_ = true;
+		}
+		loading_res_queue_cond_.notify_all();
+
+		for (auto& thread : loading_threads_)
+		{
+			thread();
+		}
+		loading_threads_.clear();
+	}
+
 	void ResLoader::LoadingThreadFunc()
 	{
-		while (!quit_)
+		for (;;)
 		{
-			std::pair<ResLoadingDescPtr, std::shared_ptr<volatile LoadingStatus>> res_pair;
-			while (loading_res_queue_.pop(res_pair))
+			LoadingJobPtr job;
 			{
-				if (LS_Loading == *res_pair.second)
+				std::unique_lock<std::mutex> lock(loading_res_queue_mutex_);
+				loading_res_queue_cond_.wait(lock, [this] { return quit_ || (num_queued_jobs_ > 0); });
+				if (quit_)
+				{
+					break;
+				}
+
+				for (auto& queue : loading_res_queue_)
 				{
-					res_pair.first->SubThreadStage();
-					*res_pair.second = LS_Complete;
+					if (!queue.empty())
+					{
+						job = std::move(queue.front());
+						queue.pop_front();
+						-- num_queued_jobs_;
+						break;
+					}
 				}
 			}
 
-			Sleep(10);
+			if (job->Transit(LS_Loading, LS_Running))
+			{
+				this->RunSubThreadStage(job->res_desc, telemetry_enabled_ ? &job->record : nullptr);
+				job->Transit(LS_Running, LS_Complete);
+			}
 		}
 	}
 
 
-	ResIdentifierPtr ResLoader::LocatePkt(std::string const & name, std::string const & res_name,
-			std::string& password, std::string& internal_name)
+	void ResLoader::PackageCacheBudget(uint64_t bytes)
 	{
-		ResIdentifierPtr res;
+		std::lock_guard<std::mutex> lock(paths_mutex_);
+
+		package_cache_budget_ = bytes;
+		for (auto const & package : packages_)
+		{
+			package.second->CacheBudget(bytes);
+		}
+	}
+
+	// Called with paths_mutex_ held
+	PackagePtr ResLoader::LocatePkt(std::string const & res_name, std::string& internal_name)
+	{
+		PackagePtr package;
 		std::string::size_type const pkt_offset(res_name.find("//"));
 		if (pkt_offset != std::string::npos)
 		{
-			std::string pkt_name = res_name.substr(0, pkt_offset);
+			std::string const pkt_key = res_name.substr(0, pkt_offset);
+			std::string pkt_name = pkt_key;
 			std::filesystem::path pkt_path(pkt_name);
 			if (std::filesystem::exists(pkt_path)
 				&& (std::filesystem::is_regular_file(pkt_path)
 					|| std::filesystem::is_symlink(pkt_path)))
 			{
+				std::string password;
 				std::string::size_type const password_offset = pkt_name.find("|");
 				if (password_offset != std::string::npos)
 				{
@@ -761,13 +1630,38 @@ namespace KlayGE
 #else
 				uint64_t timestamp = std::filesystem::last_write_time(pkt_path);
 #endif
-				// The static_cast is a workaround for a bug in clang/c2
-				res = MakeSharedPtr<ResIdentifier>(name, timestamp,
-					MakeSharedPtr<std::ifstream>(pkt_name.c_str(), static_cast<std::ios_base::openmode>(std::ios_base::binary)));
+
+				auto iter = packages_.find(pkt_key);
+				if ((iter != packages_.end()) && (iter->second->Timestamp() == timestamp))
+				{
+					package = iter->second;
+				}
+				else
+				{
+					if (boost::algorithm::iends_with(pkt_name, ".kpk"))
+					{
+						package = MakeSharedPtr<MappedPackage>(pkt_name, timestamp);
+					}
+					else
+					{
+						// The static_cast is a workaround for a bug in clang/c2
+						ResIdentifierPtr pkt_file = MakeSharedPtr<ResIdentifier>(pkt_name, timestamp,
+							MakeSharedPtr<std::ifstream>(pkt_name.c_str(), static_cast<std::ios_base::openmode>(std::ios_base::binary)));
+						if (*pkt_file)
+						{
+							package = MakeSharedPtr<SevenZipPackage>(pkt_file, password);
+						}
+					}
+					if (package)
+					{
+						package->CacheBudget(package_cache_budget_);
+						packages_[pkt_key] = package;
+					}
+				}
 			}
 		}
 
-		return res;
+		return package;
 	}
 
 #if defined(KLAYGE_PLATFORM_ANDROID)
@@ -33,6 +33,8 @@
 
 #include <CPP/Common/MyWindows.h>
 
+#include <algorithm>
+
 #include "ArchiveExtractCallback.hpp"
 
 namespace KlayGE
@@ -47,7 +49,7 @@ namespace KlayGE
 		return S_OK;
 	}
 
-	STDMETHODIMP CArchiveExtractCallback::GetStream(UInt32 /*index*/, ISequentialOutStream** outStream, Int32 askExtractMode)
+	STDMETHODIMP CArchiveExtractCallback::GetStream(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode)
 	{
 		enum 
 		{
@@ -56,14 +58,27 @@ namespace KlayGE
 			kSkip,
 		};
 
+		*outStream = nullptr;
 		if (kExtract == askExtractMode)
 		{
-			_outFileStream->AddRef();
-			*outStream = _outFileStream.get();
-		}
-		else
-		{
-			*outStream = nullptr;
+			if (item_streams_.empty())
+			{
+				_outFileStream->AddRef();
+				*outStream = _outFileStream.get();
+			}
+			else
+			{
+				auto iter = std::lower_bound(item_streams_.begin(), item_streams_.end(), index,
+					[](std::pair<uint32_t, std::shared_ptr<ISequentialOutStream>> const & lhs, uint32_t rhs)
+					{
+						return lhs.first < rhs;
+					});
+				if ((iter != item_streams_.end()) && (iter->first == index))
+				{
+					iter->second->AddRef();
+					*outStream = iter->second.get();
+				}
+			}
 		}
 		return S_OK;
 	}
@@ -98,6 +113,17 @@ namespace KlayGE
 	void CArchiveExtractCallback::Init(std::string_view pw, std::shared_ptr<ISequentialOutStream> const & outFileStream)
 	{
 		_outFileStream = outFileStream;
+		item_streams_.clear();
+
+		password_is_defined_ = !pw.empty();
+		Convert(password_, pw);
+	}
+
+	void CArchiveExtractCallback::Init(std::string_view pw,
+		std::vector<std::pair<uint32_t, std::shared_ptr<ISequentialOutStream>>> const & item_streams)
+	{
+		_outFileStream.reset();
+		item_streams_ = item_streams;
 
 		password_is_defined_ = !pw.empty();
 		Convert(password_, pw);
@@ -35,6 +35,8 @@
 
 #include <string>
 #include <atomic>
+#include <utility>
+#include <vector>
 
 #include <CPP/7zip/Archive/IArchive.h>
 #include <CPP/7zip/IPassword.h>
@@ -107,6 +109,9 @@ namespace KlayGE
 		}
 
 		void Init(std::string_view pw, std::shared_ptr<ISequentialOutStream> const & outFileStream);
+		// One output stream per archive item, sorted by item index
+		void Init(std::string_view pw,
+			std::vector<std::pair<uint32_t, std::shared_ptr<ISequentialOutStream>>> const & item_streams);
 
 	private:
 		std::atomic<int32_t> ref_count_;
@@ -115,6 +120,7 @@ namespace KlayGE
 		std::wstring password_;
 
 		std::shared_ptr<ISequentialOutStream> _outFileStream;
+		std::vector<std::pair<uint32_t, std::shared_ptr<ISequentialOutStream>>> item_streams_;
 	};
 }
 
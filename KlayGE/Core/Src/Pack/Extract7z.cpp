@@ -33,12 +33,14 @@
 #include <KFL/Util.hpp>
 #include <KFL/ErrorHandling.hpp>
 #include <KFL/COMPtr.hpp>
+#include <KFL/ResIdentifier.hpp>
 
 #include <CPP/Common/MyWindows.h>
 
 #include <KFL/DllLoader.hpp>
 
 #include <string>
+#include <sstream>
 #include <algorithm>
 
 #include <boost/assert.hpp>
@@ -147,13 +149,81 @@ namespace
 	};
 
 
-	void GetArchiveIndex(std::shared_ptr<IInArchive>& archive, uint32_t& real_index,
-								ResIdentifierPtr const & archive_is,
-								std::string_view password,
-								std::string_view extract_file_path)
+	HRESULT GetArchiveItemSize(std::shared_ptr<IInArchive> const & archive, uint32_t index, uint64_t& result)
+	{
+		PROPVARIANT prop;
+		prop.vt = VT_EMPTY;
+		TIFHR(archive->GetProperty(index, kpidSize, &prop));
+		switch (prop.vt)
+		{
+		case VT_UI8:
+			result = prop.uhVal.QuadPart;
+			return S_OK;
+
+		case VT_UI4:
+			result = prop.ulVal;
+			return S_OK;
+
+		case VT_EMPTY:
+			result = 0;
+			return S_OK;
+
+		default:
+			return E_FAIL;
+		}
+	}
+
+	// Empty files and non-solid items have no block
+	HRESULT GetArchiveItemBlock(std::shared_ptr<IInArchive> const & archive, uint32_t index, uint32_t& result)
+	{
+		PROPVARIANT prop;
+		prop.vt = VT_EMPTY;
+		TIFHR(archive->GetProperty(index, kpidBlock, &prop));
+		switch (prop.vt)
+		{
+		case VT_UI4:
+			result = prop.ulVal;
+			return S_OK;
+
+		case VT_EMPTY:
+			result = 0xFFFFFFFF;
+			return S_OK;
+
+		default:
+			return E_FAIL;
+		}
+	}
+
+	HRESULT IsArchiveItemExtractable(std::shared_ptr<IInArchive> const & archive, uint32_t index, bool& result)
+	{
+		result = false;
+
+		PROPVARIANT prop;
+		prop.vt = VT_EMPTY;
+		TIFHR(archive->GetProperty(index, kpidIsAnti, &prop));
+		if ((VT_BOOL == prop.vt) && (VARIANT_FALSE == prop.boolVal))
+		{
+			prop.vt = VT_EMPTY;
+			TIFHR(archive->GetProperty(index, kpidPosition, &prop));
+			result = (VT_EMPTY == prop.vt) || ((VT_UI8 == prop.vt) && (0 == prop.uhVal.QuadPart));
+		}
+
+		return S_OK;
+	}
+
+	std::string NormalizeItemPath(std::string_view path)
+	{
+		std::string ret(path);
+		std::replace(ret.begin(), ret.end(), '\\', '/');
+		boost::algorithm::to_lower(ret);
+		return ret;
+	}
+
+	std::shared_ptr<IInArchive> OpenArchive(ResIdentifierPtr const & archive_is, std::string_view password)
 	{
 		BOOST_ASSERT(archive_is);
 
+		std::shared_ptr<IInArchive> archive;
 		{
 			IInArchive* tmp;
 			TIFHR(SevenZipLoader::Instance().CreateObject(&CLSID_CFormat7z, &IID_IInArchive, reinterpret_cast<void**>(&tmp)));
@@ -167,10 +237,16 @@ namespace
 		checked_pointer_cast<CArchiveOpenCallback>(ocb)->Init(password);
 		TIFHR(archive->Open(file.get(), 0, ocb.get()));
 
-		real_index = 0xFFFFFFFF;
+		return archive;
+	}
+
+	// For the one-off Find7z and Extract7z. Stops at the first match, without building a directory or a block cache.
+	uint32_t FindArchiveItem(std::shared_ptr<IInArchive> const & archive, std::string_view extract_file_path)
+	{
+		std::string const path = NormalizeItemPath(extract_file_path);
+
 		uint32_t num_items;
 		TIFHR(archive->GetNumberOfItems(&num_items));
-
 		for (uint32_t i = 0; i < num_items; ++ i)
 		{
 			bool is_folder = true;
@@ -179,50 +255,242 @@ namespace
 			{
 				std::string file_path;
 				TIFHR(GetArchiveItemPath(archive, i, file_path));
-				std::replace(file_path.begin(), file_path.end(), '\\', '/');
-				if (!boost::algorithm::ilexicographical_compare(extract_file_path, file_path)
-					&& !boost::algorithm::ilexicographical_compare(file_path, extract_file_path))
+				if (NormalizeItemPath(file_path) == path)
 				{
-					real_index = i;
-					break;
+					bool extractable = false;
+					TIFHR(IsArchiveItemExtractable(archive, i, extractable));
+					return extractable ? i : 0xFFFFFFFF;
+				}
+			}
+		}
+		return 0xFFFFFFFF;
+	}
+}
+
+namespace KlayGE
+{
+	SevenZipPackage::SevenZipPackage(ResIdentifierPtr const & archive_is, std::string_view password)
+		: archive_is_(archive_is), password_(password),
+			cache_budget_(32 * 1024 * 1024), cache_size_(0), num_block_decodes_(0)
+	{
+		archive_ = OpenArchive(archive_is, password);
+
+		uint32_t num_items;
+		TIFHR(archive_->GetNumberOfItems(&num_items));
+
+		for (uint32_t i = 0; i < num_items; ++ i)
+		{
+			bool is_folder = true;
+			TIFHR(IsArchiveItemFolder(archive_, i, is_folder));
+			if (is_folder)
+			{
+				continue;
+			}
+
+			bool extractable = false;
+			TIFHR(IsArchiveItemExtractable(archive_, i, extractable));
+			if (!extractable)
+			{
+				continue;
+			}
+
+			std::string file_path;
+			TIFHR(GetArchiveItemPath(archive_, i, file_path));
+			std::replace(file_path.begin(), file_path.end(), '\\', '/');
+			if (!directory_.emplace(NormalizeItemPath(file_path), i).second)
+			{
+				continue;
+			}
+
+			ItemInfo item;
+			TIFHR(GetArchiveItemSize(archive_, i, item.size));
+			TIFHR(GetArchiveItemBlock(archive_, i, item.block));
+			item.offset = 0;
+			if (item.block != 0xFFFFFFFF)
+			{
+				if (item.block >= block_items_.size())
+				{
+					block_items_.resize(item.block + 1);
+					block_sizes_.resize(item.block + 1, 0);
 				}
+				item.offset = block_sizes_[item.block];
+				block_sizes_[item.block] += item.size;
+				block_items_[item.block].push_back(i);
 			}
+
+			items_.emplace(i, item);
+			file_paths_.push_back(file_path);
+		}
+	}
+
+	SevenZipPackage::~SevenZipPackage()
+	{
+	}
+
+	uint64_t SevenZipPackage::Timestamp() const
+	{
+		return archive_is_->Timestamp();
+	}
+
+	uint32_t SevenZipPackage::Find(std::string_view extract_file_path)
+	{
+		auto iter = directory_.find(NormalizeItemPath(extract_file_path));
+		if (iter != directory_.end())
+		{
+			return iter->second;
+		}
+		else
+		{
+			return 0xFFFFFFFF;
 		}
+	}
+
+	ResIdentifierPtr SevenZipPackage::Extract(std::string_view extract_file_path, std::string_view res_name)
+	{
+		uint32_t const index = this->Find(extract_file_path);
+		if (0xFFFFFFFF == index)
+		{
+			return ResIdentifierPtr();
+		}
+
+		ItemInfo const & item = items_.find(index)->second;
+		if (item.block != 0xFFFFFFFF)
+		{
+			std::shared_ptr<SolidBlock const> block = this->DecodeBlock(item.block);
+			if (block)
+			{
+				// The decoded block stays alive as long as a stream reads from it
+				return MakeSharedPtr<ResIdentifier>(res_name, this->Timestamp(), block,
+					block->data.data() + item.offset, item.size);
+			}
+		}
+
+		std::shared_ptr<std::iostream> packet_file = MakeSharedPtr<std::stringstream>();
+		this->Extract(extract_file_path, packet_file);
+		return MakeSharedPtr<ResIdentifier>(res_name, this->Timestamp(), packet_file);
+	}
+
+	void SevenZipPackage::Extract(std::string_view extract_file_path, std::shared_ptr<std::ostream> const & os)
+	{
+		uint32_t real_index = this->Find(extract_file_path);
 		if (real_index != 0xFFFFFFFF)
 		{
-			PROPVARIANT prop;
-			prop.vt = VT_EMPTY;
-			TIFHR(archive->GetProperty(real_index, kpidIsAnti, &prop));
-			if ((VT_BOOL == prop.vt) && (VARIANT_FALSE == prop.boolVal))
+			std::shared_ptr<ISequentialOutStream> out_stream = MakeCOMPtr(new COutStream);
+			checked_pointer_cast<COutStream>(out_stream)->Attach(os);
+
+			std::shared_ptr<IArchiveExtractCallback> ecb = MakeCOMPtr(new CArchiveExtractCallback);
+			checked_pointer_cast<CArchiveExtractCallback>(ecb)->Init(password_, out_stream);
+
+			std::lock_guard<std::mutex> lock(archive_mutex_);
+			TIFHR(archive_->Extract(&real_index, 1, false, ecb.get()));
+		}
+	}
+
+	void SevenZipPackage::CacheBudget(uint64_t budget)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		cache_budget_ = budget;
+		this->EvictBlocks();
+	}
+
+	// The cache is only locked to look the block up and to publish it. Other blocks can be read from the cache while
+	//  this one decodes, and threads that want the same block wait for it instead of decoding it again.
+	std::shared_ptr<SevenZipPackage::SolidBlock const> SevenZipPackage::DecodeBlock(uint32_t block)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			for (;;)
 			{
-				prop.vt = VT_EMPTY;
-				TIFHR(archive->GetProperty(real_index, kpidPosition, &prop));
-				if (prop.vt != VT_EMPTY)
+				auto iter = cached_block_index_.find(block);
+				if (iter != cached_block_index_.end())
+				{
+					cached_blocks_.splice(cached_blocks_.begin(), cached_blocks_, iter->second);
+					return cached_blocks_.front();
+				}
+
+				// A block that can never fit falls back to extracting single files
+				if (block_sizes_[block] > cache_budget_)
+				{
+					return SolidBlockPtr();
+				}
+
+				if (decoding_blocks_.find(block) == decoding_blocks_.end())
 				{
-					if ((prop.vt != VT_UI8) || (prop.uhVal.QuadPart != 0))
-					{
-						real_index = 0xFFFFFFFF;
-					}
+					break;
 				}
+				decoded_cond_.wait(lock);
 			}
-			else
+
+			decoding_blocks_.insert(block);
+		}
+
+		SolidBlockPtr solid_block = MakeSharedPtr<SolidBlock>();
+		solid_block->block = block;
+		solid_block->data.resize(static_cast<size_t>(block_sizes_[block]));
+
+		std::vector<uint32_t> const & indices = block_items_[block];
+		std::vector<std::pair<uint32_t, std::shared_ptr<ISequentialOutStream>>> item_streams;
+		item_streams.reserve(indices.size());
+		for (auto index : indices)
+		{
+			ItemInfo const & item = items_.find(index)->second;
+
+			std::shared_ptr<ISequentialOutStream> out_stream = MakeCOMPtr(new CMemOutStream);
+			checked_pointer_cast<CMemOutStream>(out_stream)->Attach(solid_block->data.data() + item.offset, item.size);
+			item_streams.emplace_back(index, out_stream);
+		}
+
+		std::shared_ptr<IArchiveExtractCallback> ecb = MakeCOMPtr(new CArchiveExtractCallback);
+		checked_pointer_cast<CArchiveExtractCallback>(ecb)->Init(password_, item_streams);
+
+		try
+		{
+			std::lock_guard<std::mutex> lock(archive_mutex_);
+			TIFHR(archive_->Extract(indices.data(), static_cast<uint32_t>(indices.size()), false, ecb.get()));
+		}
+		catch (...)
+		{
 			{
-				real_index = 0xFFFFFFFF;
+				std::lock_guard<std::mutex> lock(mutex_);
+				decoding_blocks_.erase(block);
 			}
+			decoded_cond_.notify_all();
+			throw;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++ num_block_decodes_;
+			decoding_blocks_.erase(block);
+
+			cached_blocks_.push_front(solid_block);
+			cached_block_index_.emplace(block, cached_blocks_.begin());
+			cache_size_ += solid_block->data.size();
+			this->EvictBlocks();
 		}
+		decoded_cond_.notify_all();
+
+		return solid_block;
 	}
-}
 
-namespace KlayGE
-{
+	// Called with mutex_ held. Blocks still read by opened files stay alive through their streams.
+	void SevenZipPackage::EvictBlocks()
+	{
+		while ((cache_size_ > cache_budget_) && !cached_blocks_.empty())
+		{
+			SolidBlockPtr const & solid_block = cached_blocks_.back();
+			cache_size_ -= solid_block->data.size();
+			cached_block_index_.erase(solid_block->block);
+			cached_blocks_.pop_back();
+		}
+	}
+
+
 	uint32_t Find7z(ResIdentifierPtr const & archive_is,
 								std::string_view password,
 								std::string_view extract_file_path)
 	{
-		std::shared_ptr<IInArchive> archive;
-		uint32_t real_index;
-		GetArchiveIndex(archive, real_index, archive_is, password, extract_file_path);
-		return real_index;
+		return FindArchiveItem(OpenArchive(archive_is, password), extract_file_path);
 	}
 
 	void Extract7z(ResIdentifierPtr const & archive_is,
@@ -230,9 +498,8 @@ namespace KlayGE
 							   std::string_view extract_file_path,
 		std::shared_ptr<std::ostream> const & os)
 	{
-		std::shared_ptr<IInArchive> archive;
-		uint32_t real_index;
-		GetArchiveIndex(archive, real_index, archive_is, password, extract_file_path);
+		std::shared_ptr<IInArchive> archive = OpenArchive(archive_is, password);
+		uint32_t real_index = FindArchiveItem(archive, extract_file_path);
 		if (real_index != 0xFFFFFFFF)
 		{
 			std::shared_ptr<ISequentialOutStream> out_stream = MakeCOMPtr(new COutStream);
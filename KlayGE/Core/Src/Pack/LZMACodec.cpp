@@ -33,6 +33,7 @@
 #include <KlayGE/ResLoader.hpp>
 #include <KFL/DllLoader.hpp>
 #include <KFL/Thread.hpp>
+#include <KlayGE/Context.hpp>
 
 #include <cstring>
 
@@ -113,11 +114,42 @@ namespace
 		static std::unique_ptr<LZMALoader> instance_;
 	};
 	std::unique_ptr<LZMALoader> LZMALoader::instance_;
+
+	// Starts a chunked stream. A single LZMA stream starts with its lc/lp/pb byte, which is never larger than 224.
+	uint8_t const CHUNKED_MAGIC[] = { 0xFF, 'L', 'Z', 'C' };
+
+	// Followed by num_chunks uint32_t compressed sizes, then the chunks. Every chunk but the last has chunk_size bytes
+	//  once decoded. A chunk that doesn't shrink is stored as is.
+	struct ChunkedHeader
+	{
+		uint8_t magic[4];
+		uint32_t num_chunks;
+		uint32_t chunk_size;
+	};
+	static_assert(sizeof(ChunkedHeader) == 12, "ChunkedHeader must be packed");
+
+	// Points into the resource's memory at the current read position and skips len bytes,
+	//  or returns nullptr if the resource is only a stream.
+	uint8_t const * ConsumeView(ResIdentifierPtr const & is, uint64_t len)
+	{
+		uint8_t const * view = static_cast<uint8_t const *>(is->MemoryView());
+		if (view != nullptr)
+		{
+			std::streamoff const pos = is->tellg();
+			if ((pos >= 0) && (static_cast<uint64_t>(pos) + len <= is->MemoryViewSize()))
+			{
+				is->seekg(static_cast<std::streamoff>(len), std::ios_base::cur);
+				return view + pos;
+			}
+		}
+		return nullptr;
+	}
 }
 
 namespace KlayGE
 {
 	LZMACodec::LZMACodec()
+		: max_decode_threads_(std::max(std::thread::hardware_concurrency(), 1U))
 	{
 	}
 
@@ -164,13 +196,57 @@ namespace KlayGE
 		output.resize(LZMA_PROPS_SIZE + out_len);
 	}
 
-	uint64_t LZMACodec::Decode(std::ostream& os, ResIdentifierPtr const & is, uint64_t len, uint64_t original_len)
+	uint64_t LZMACodec::EncodeChunked(std::ostream& os, void const * input, uint64_t len, uint32_t chunk_size)
 	{
-		std::vector<uint8_t> in_data(static_cast<size_t>(len));
-		is->read(&in_data[0], static_cast<size_t>(len));
+		std::vector<uint8_t> output;
+		this->EncodeChunked(output, input, len, chunk_size);
+		os.write(reinterpret_cast<char*>(&output[0]), output.size() * sizeof(output[0]));
+		return output.size();
+	}
+
+	void LZMACodec::EncodeChunked(std::vector<uint8_t>& output, void const * input, uint64_t len, uint32_t chunk_size)
+	{
+		BOOST_ASSERT(chunk_size > 0);
+
+		uint8_t const * p = static_cast<uint8_t const *>(input);
+		uint32_t const num_chunks = static_cast<uint32_t>(std::max<uint64_t>((len + chunk_size - 1) / chunk_size, 1));
+
+		std::vector<std::vector<uint8_t>> chunks(num_chunks);
+		parallel_for(Context::Instance().ThreadPool(), num_chunks, 0,
+			[this, &chunks, p, len, chunk_size](uint32_t index)
+			{
+				std::vector<uint8_t>& chunk = chunks[index];
+				uint8_t const * chunk_input = p + static_cast<size_t>(index) * chunk_size;
+				uint64_t const chunk_len = std::min<uint64_t>(chunk_size, len - static_cast<uint64_t>(index) * chunk_size);
+				this->Encode(chunk, chunk_input, chunk_len);
+				if (chunk.size() >= chunk_len)
+				{
+					chunk.assign(chunk_input, chunk_input + chunk_len);
+				}
+			});
+
+		ChunkedHeader header;
+		std::memcpy(header.magic, CHUNKED_MAGIC, sizeof(CHUNKED_MAGIC));
+		header.num_chunks = Native2LE(num_chunks);
+		header.chunk_size = Native2LE(chunk_size);
+
+		output.resize(sizeof(header) + num_chunks * sizeof(uint32_t));
+		std::memcpy(&output[0], &header, sizeof(header));
+		for (uint32_t i = 0; i < num_chunks; ++ i)
+		{
+			uint32_t const compressed_size = Native2LE(static_cast<uint32_t>(chunks[i].size()));
+			std::memcpy(&output[sizeof(header) + i * sizeof(uint32_t)], &compressed_size, sizeof(compressed_size));
+		}
+		for (auto const & chunk : chunks)
+		{
+			output.insert(output.end(), chunk.begin(), chunk.end());
+		}
+	}
 
+	uint64_t LZMACodec::Decode(std::ostream& os, ResIdentifierPtr const & is, uint64_t len, uint64_t original_len)
+	{
 		std::vector<uint8_t> output;
-		this->Decode(output, &in_data[0], len, original_len);
+		this->Decode(output, is, len, original_len);
 
 		os.write(reinterpret_cast<char*>(&output[0]), static_cast<std::streamsize>(output.size()));
 
@@ -189,6 +265,13 @@ namespace KlayGE
 
 	void LZMACodec::Decode(std::vector<uint8_t>& output, ResIdentifierPtr const & is, uint64_t len, uint64_t original_len)
 	{
+		uint8_t const * view = ConsumeView(is, len);
+		if (view != nullptr)
+		{
+			this->Decode(output, view, len, original_len);
+			return;
+		}
+
 		std::vector<uint8_t> in_data(static_cast<size_t>(len));
 		is->read(&in_data[0], static_cast<size_t>(len));
 
@@ -204,15 +287,67 @@ namespace KlayGE
 	void LZMACodec::Decode(void* output, void const * input, uint64_t len, uint64_t original_len)
 	{
 		uint8_t const * p = static_cast<uint8_t const *>(input);
-
-		std::vector<uint8_t> in_data(static_cast<size_t>(len));
-		std::memcpy(&in_data[0], p, static_cast<std::streamsize>(in_data.size()));
+		if ((len >= sizeof(ChunkedHeader)) && (0 == std::memcmp(p, CHUNKED_MAGIC, sizeof(CHUNKED_MAGIC))))
+		{
+			this->DecodeChunked(output, input, len, original_len);
+			return;
+		}
 
 		SizeT s_out_len = static_cast<SizeT>(original_len);
 
 		SizeT s_src_len = static_cast<SizeT>(len - LZMA_PROPS_SIZE);
-		int res = LZMALoader::Instance().LzmaUncompress(static_cast<Byte*>(output), &s_out_len, &in_data[LZMA_PROPS_SIZE], &s_src_len,
-			&in_data[0], LZMA_PROPS_SIZE);
+		int res = LZMALoader::Instance().LzmaUncompress(static_cast<Byte*>(output), &s_out_len, p + LZMA_PROPS_SIZE, &s_src_len,
+			p, LZMA_PROPS_SIZE);
 		Verify(0 == res);
 	}
+
+	void LZMACodec::DecodeChunked(void* output, void const * input, uint64_t len, uint64_t original_len)
+	{
+		uint8_t const * p = static_cast<uint8_t const *>(input);
+
+		ChunkedHeader header;
+		std::memcpy(&header, p, sizeof(header));
+		uint32_t const num_chunks = LE2Native(header.num_chunks);
+		uint32_t const chunk_size = LE2Native(header.chunk_size);
+		if ((0 == num_chunks) || (len < sizeof(header) + num_chunks * sizeof(uint32_t)))
+		{
+			TMSG("Corrupted chunked LZMA stream");
+		}
+
+		std::vector<uint64_t> chunk_offsets(num_chunks + 1);
+		chunk_offsets[0] = sizeof(header) + num_chunks * sizeof(uint32_t);
+		for (uint32_t i = 0; i < num_chunks; ++ i)
+		{
+			uint32_t compressed_size;
+			std::memcpy(&compressed_size, p + sizeof(header) + i * sizeof(uint32_t), sizeof(compressed_size));
+			chunk_offsets[i + 1] = chunk_offsets[i] + LE2Native(compressed_size);
+		}
+		if ((chunk_offsets[num_chunks] > len) || (static_cast<uint64_t>(num_chunks - 1) * chunk_size > original_len)
+			|| (static_cast<uint64_t>(num_chunks) * chunk_size < original_len))
+		{
+			TMSG("Corrupted chunked LZMA stream");
+		}
+
+		uint8_t* dst = static_cast<uint8_t*>(output);
+		parallel_for(Context::Instance().ThreadPool(), num_chunks, max_decode_threads_,
+			[this, p, dst, &chunk_offsets, chunk_size, original_len](uint32_t index)
+			{
+				uint64_t const chunk_offset = static_cast<uint64_t>(index) * chunk_size;
+				uint64_t const chunk_len = std::min<uint64_t>(chunk_size, original_len - chunk_offset);
+				uint64_t const compressed_size = chunk_offsets[index + 1] - chunk_offsets[index];
+				if (compressed_size == chunk_len)
+				{
+					std::memcpy(dst + chunk_offset, p + chunk_offsets[index], static_cast<size_t>(chunk_len));
+				}
+				else
+				{
+					this->Decode(dst + chunk_offset, p + chunk_offsets[index], compressed_size, chunk_len);
+				}
+			});
+	}
+
+	void LZMACodec::MaxDecodeThreads(uint32_t num)
+	{
+		max_decode_threads_ = std::max(num, 1U);
+	}
 }
@@ -0,0 +1,490 @@
+/**
+ * @file MappedPackage.cpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Util.hpp>
+#include <KFL/ErrorHandling.hpp>
+#include <KFL/Hash.hpp>
+#include <KFL/MappedFile.hpp>
+#include <KFL/ResIdentifier.hpp>
+#include <KFL/Thread.hpp>
+#include <KlayGE/Context.hpp>
+#include <KlayGE/LZMACodec.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <ostream>
+#include <utility>
+
+#include <KlayGE/MappedPackage.hpp>
+
+namespace
+{
+	using namespace KlayGE;
+
+	uint32_t const KPK_VERSION = 1;
+
+	struct KpkHeader
+	{
+		uint32_t fourcc;
+		uint32_t version;
+		uint32_t num_entries;
+		uint32_t num_chunks;
+		uint32_t chunk_size;
+		uint32_t alignment;
+		uint64_t names_size;
+	};
+	static_assert(sizeof(KpkHeader) == 32, "sizeof(KpkHeader) must be 32");
+
+	// num_chunks == 0 means the file is stored uncompressed at offset
+	struct KpkEntry
+	{
+		uint64_t name_hash;
+		uint64_t offset;
+		uint64_t size;
+		uint32_t name_offset;
+		uint32_t name_length;
+		uint32_t first_chunk;
+		uint32_t num_chunks;
+	};
+	static_assert(sizeof(KpkEntry) == 40, "sizeof(KpkEntry) must be 40");
+
+	// compressed_size == original_size means the chunk is stored
+	struct KpkChunk
+	{
+		uint64_t offset;
+		uint32_t compressed_size;
+		uint32_t original_size;
+	};
+	static_assert(sizeof(KpkChunk) == 16, "sizeof(KpkChunk) must be 16");
+
+	// Has to be the same on every platform, so size_t based RT_HASH can't be used
+	uint64_t HashPath(std::string_view path)
+	{
+		uint64_t seed = 0;
+		for (char ch : path)
+		{
+			if ('\\' == ch)
+			{
+				ch = '/';
+			}
+			else if ((ch >= 'A') && (ch <= 'Z'))
+			{
+				ch = static_cast<char>(ch - 'A' + 'a');
+			}
+			HashCombineImpl(seed, static_cast<uint64_t>(static_cast<uint8_t>(ch)));
+		}
+		return seed;
+	}
+
+	bool PathEqual(std::string_view lhs, std::string_view rhs)
+	{
+		if (lhs.size() != rhs.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < lhs.size(); ++ i)
+		{
+			char l = lhs[i];
+			char r = rhs[i];
+			if ('\\' == l)
+			{
+				l = '/';
+			}
+			if ('\\' == r)
+			{
+				r = '/';
+			}
+			if (std::tolower(static_cast<uint8_t>(l)) != std::tolower(static_cast<uint8_t>(r)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	uint64_t AlignUp(uint64_t offset, uint32_t alignment)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	template <typename T>
+	void WritePod(std::ostream& os, T const & v)
+	{
+		os.write(reinterpret_cast<char const *>(&v), sizeof(v));
+	}
+}
+
+namespace KlayGE
+{
+	MappedPackage::MappedPackage(std::string const & pkt_name, uint64_t timestamp)
+		: file_(MakeSharedPtr<MappedFile>()), timestamp_(timestamp)
+	{
+		if (!file_->Open(pkt_name))
+		{
+			TMSG("Could not map " + pkt_name);
+		}
+
+		uint8_t const * base = static_cast<uint8_t const *>(file_->Data());
+		uint64_t const file_size = file_->Size();
+
+		KpkHeader header;
+		if (file_size < sizeof(header))
+		{
+			TMSG(pkt_name + " is not a valid package");
+		}
+		std::memcpy(&header, base, sizeof(header));
+		header.fourcc = LE2Native(header.fourcc);
+		header.version = LE2Native(header.version);
+		header.num_entries = LE2Native(header.num_entries);
+		header.num_chunks = LE2Native(header.num_chunks);
+		header.names_size = LE2Native(header.names_size);
+		if ((header.fourcc != MakeFourCC<'K', 'P', 'K', ' '>::value) || (header.version != KPK_VERSION))
+		{
+			TMSG(pkt_name + " is not a valid package");
+		}
+
+		uint64_t const entries_offset = sizeof(header);
+		uint64_t const chunks_offset = entries_offset + header.num_entries * sizeof(KpkEntry);
+		uint64_t const names_offset = chunks_offset + header.num_chunks * sizeof(KpkChunk);
+		if (names_offset + header.names_size > file_size)
+		{
+			TMSG(pkt_name + " is truncated");
+		}
+
+		chunks_.resize(header.num_chunks);
+		for (uint32_t i = 0; i < header.num_chunks; ++ i)
+		{
+			KpkChunk kpk_chunk;
+			std::memcpy(&kpk_chunk, base + chunks_offset + i * sizeof(kpk_chunk), sizeof(kpk_chunk));
+
+			Chunk& chunk = chunks_[i];
+			chunk.offset = LE2Native(kpk_chunk.offset);
+			chunk.compressed_size = LE2Native(kpk_chunk.compressed_size);
+			chunk.original_size = LE2Native(kpk_chunk.original_size);
+			if (chunk.offset + chunk.compressed_size > file_size)
+			{
+				TMSG(pkt_name + " is truncated");
+			}
+		}
+
+		char const * names = reinterpret_cast<char const *>(base + names_offset);
+		entries_.resize(header.num_entries);
+		file_paths_.resize(header.num_entries);
+		for (uint32_t i = 0; i < header.num_entries; ++ i)
+		{
+			KpkEntry kpk_entry;
+			std::memcpy(&kpk_entry, base + entries_offset + i * sizeof(kpk_entry), sizeof(kpk_entry));
+
+			Entry& entry = entries_[i];
+			entry.name_hash = LE2Native(kpk_entry.name_hash);
+			entry.offset = LE2Native(kpk_entry.offset);
+			entry.size = LE2Native(kpk_entry.size);
+			entry.first_chunk = LE2Native(kpk_entry.first_chunk);
+			entry.num_chunks = LE2Native(kpk_entry.num_chunks);
+			entry.path_index = i;
+
+			uint32_t const name_offset = LE2Native(kpk_entry.name_offset);
+			uint32_t const name_length = LE2Native(kpk_entry.name_length);
+			if ((name_offset + static_cast<uint64_t>(name_length) > header.names_size)
+				|| ((0 == entry.num_chunks) && (entry.offset + entry.size > file_size))
+				|| (entry.first_chunk + static_cast<uint64_t>(entry.num_chunks) > chunks_.size()))
+			{
+				TMSG(pkt_name + " is corrupted");
+			}
+			file_paths_[i].assign(names + name_offset, name_length);
+		}
+	}
+
+	MappedPackage::~MappedPackage()
+	{
+	}
+
+	uint64_t MappedPackage::Timestamp() const
+	{
+		return timestamp_;
+	}
+
+	uint32_t MappedPackage::Find(std::string_view extract_file_path)
+	{
+		uint64_t const hash = HashPath(extract_file_path);
+		auto iter = std::lower_bound(entries_.begin(), entries_.end(), hash,
+			[](Entry const & lhs, uint64_t rhs)
+			{
+				return lhs.name_hash < rhs;
+			});
+		for (; (iter != entries_.end()) && (iter->name_hash == hash); ++ iter)
+		{
+			if (PathEqual(file_paths_[iter->path_index], extract_file_path))
+			{
+				return static_cast<uint32_t>(iter - entries_.begin());
+			}
+		}
+
+		return 0xFFFFFFFF;
+	}
+
+	ResIdentifierPtr MappedPackage::Extract(std::string_view extract_file_path, std::string_view res_name)
+	{
+		uint32_t const index = this->Find(extract_file_path);
+		if (0xFFFFFFFF == index)
+		{
+			return ResIdentifierPtr();
+		}
+
+		Entry const & entry = entries_[index];
+		if (0 == entry.num_chunks)
+		{
+			return MakeSharedPtr<ResIdentifier>(res_name, timestamp_, file_,
+				static_cast<uint8_t const *>(file_->Data()) + entry.offset, entry.size);
+		}
+		else
+		{
+			std::shared_ptr<std::vector<uint8_t>> data = MakeSharedPtr<std::vector<uint8_t>>(static_cast<size_t>(entry.size));
+			this->DecodeChunks(entry, data->data());
+			return MakeSharedPtr<ResIdentifier>(res_name, timestamp_, data, data->data(), data->size());
+		}
+	}
+
+	void MappedPackage::DecodeChunks(Entry const & entry, uint8_t* output) const
+	{
+		uint8_t const * base = static_cast<uint8_t const *>(file_->Data());
+
+		std::vector<uint64_t> output_offsets(entry.num_chunks);
+		uint64_t output_offset = 0;
+		for (uint32_t i = 0; i < entry.num_chunks; ++ i)
+		{
+			Chunk const & chunk = chunks_[entry.first_chunk + i];
+			output_offsets[i] = output_offset;
+			output_offset += chunk.original_size;
+		}
+		if (output_offset != entry.size)
+		{
+			TMSG("Chunks don't match the file size");
+		}
+
+		auto decode_chunk = [this, &entry, base, output, &output_offsets](uint32_t index)
+		{
+			Chunk const & chunk = chunks_[entry.first_chunk + index];
+			uint8_t* dst = output + output_offsets[index];
+			if (chunk.compressed_size == chunk.original_size)
+			{
+				std::memcpy(dst, base + chunk.offset, chunk.original_size);
+			}
+			else
+			{
+				LZMACodec lzma;
+				lzma.Decode(dst, base + chunk.offset, chunk.compressed_size, chunk.original_size);
+			}
+		};
+
+		// Chunks are independent, so they are spread over at most one thread per hardware thread
+		parallel_for(Context::Instance().ThreadPool(), entry.num_chunks, 0, decode_chunk);
+	}
+
+
+	MappedPackageWriter::MappedPackageWriter(uint32_t chunk_size, uint32_t alignment)
+		: chunk_size_(chunk_size), alignment_(std::max(alignment, 1U))
+	{
+		BOOST_ASSERT(chunk_size_ > 0);
+	}
+
+	void MappedPackageWriter::AddFile(std::string_view path, void const * data, uint64_t size, bool compress)
+	{
+		PendingFile file;
+		file.path = std::string(path);
+		std::replace(file.path.begin(), file.path.end(), '\\', '/');
+		uint8_t const * p = static_cast<uint8_t const *>(data);
+		file.data.assign(p, p + size);
+		file.compress = compress;
+		files_.push_back(std::move(file));
+	}
+
+	void MappedPackageWriter::AddFile(std::string_view path, ResIdentifierPtr const & res, bool compress)
+	{
+		res->seekg(0, std::ios_base::end);
+		uint64_t const size = res->tellg();
+		res->seekg(0, std::ios_base::beg);
+
+		std::vector<uint8_t> data(static_cast<size_t>(size));
+		res->read(data.data(), data.size());
+		this->AddFile(path, data.data(), size, compress);
+	}
+
+	void MappedPackageWriter::Save(std::ostream& os)
+	{
+		std::sort(files_.begin(), files_.end(),
+			[](PendingFile const & lhs, PendingFile const & rhs)
+			{
+				return HashPath(lhs.path) < HashPath(rhs.path);
+			});
+
+		// Compress every chunk of every file in parallel
+		std::vector<std::vector<std::vector<uint8_t>>> file_chunks(files_.size());
+		std::vector<std::pair<size_t, uint32_t>> work_items;
+		for (size_t i = 0; i < files_.size(); ++ i)
+		{
+			PendingFile const & file = files_[i];
+			if (file.compress && !file.data.empty())
+			{
+				uint32_t const num_chunks = static_cast<uint32_t>((file.data.size() + chunk_size_ - 1) / chunk_size_);
+				file_chunks[i].resize(num_chunks);
+				for (uint32_t c = 0; c < num_chunks; ++ c)
+				{
+					work_items.emplace_back(i, c);
+				}
+			}
+		}
+		parallel_for(Context::Instance().ThreadPool(), static_cast<uint32_t>(work_items.size()), 0,
+			[this, &file_chunks, &work_items](uint32_t index)
+			{
+				size_t const i = work_items[index].first;
+				uint32_t const c = work_items[index].second;
+				std::vector<uint8_t> const & data = files_[i].data;
+				std::vector<uint8_t>& output = file_chunks[i][c];
+				uint8_t const * input = data.data() + static_cast<size_t>(c) * chunk_size_;
+				uint64_t const len = std::min<uint64_t>(chunk_size_, data.size() - static_cast<size_t>(c) * chunk_size_);
+
+				LZMACodec lzma;
+				lzma.Encode(output, input, len);
+				if (output.size() >= len)
+				{
+					output.assign(input, input + len);
+				}
+			});
+
+		std::vector<KpkEntry> entries(files_.size());
+		std::vector<KpkChunk> chunks;
+		std::string names;
+
+		uint32_t num_chunks = 0;
+		for (auto const & fc : file_chunks)
+		{
+			num_chunks += static_cast<uint32_t>(fc.size());
+		}
+		for (auto const & file : files_)
+		{
+			names += file.path;
+		}
+
+		uint64_t offset = sizeof(KpkHeader) + files_.size() * sizeof(KpkEntry) + num_chunks * sizeof(KpkChunk) + names.size();
+		uint32_t name_offset = 0;
+		for (size_t i = 0; i < files_.size(); ++ i)
+		{
+			PendingFile const & file = files_[i];
+			KpkEntry& entry = entries[i];
+			entry.name_hash = HashPath(file.path);
+			entry.size = file.data.size();
+			entry.name_offset = name_offset;
+			entry.name_length = static_cast<uint32_t>(file.path.size());
+			entry.first_chunk = static_cast<uint32_t>(chunks.size());
+			entry.num_chunks = static_cast<uint32_t>(file_chunks[i].size());
+			name_offset += entry.name_length;
+
+			if (0 == entry.num_chunks)
+			{
+				offset = AlignUp(offset, alignment_);
+				entry.offset = offset;
+				offset += file.data.size();
+			}
+			else
+			{
+				entry.offset = 0;
+				for (uint32_t c = 0; c < entry.num_chunks; ++ c)
+				{
+					KpkChunk chunk;
+					chunk.offset = offset;
+					chunk.compressed_size = static_cast<uint32_t>(file_chunks[i][c].size());
+					chunk.original_size = static_cast<uint32_t>(std::min<uint64_t>(chunk_size_,
+						file.data.size() - static_cast<size_t>(c) * chunk_size_));
+					chunks.push_back(chunk);
+					offset += chunk.compressed_size;
+				}
+			}
+		}
+
+		KpkHeader header;
+		header.fourcc = Native2LE(static_cast<uint32_t>(MakeFourCC<'K', 'P', 'K', ' '>::value));
+		header.version = Native2LE(KPK_VERSION);
+		header.num_entries = Native2LE(static_cast<uint32_t>(entries.size()));
+		header.num_chunks = Native2LE(static_cast<uint32_t>(chunks.size()));
+		header.chunk_size = Native2LE(chunk_size_);
+		header.alignment = Native2LE(alignment_);
+		header.names_size = Native2LE(static_cast<uint64_t>(names.size()));
+		WritePod(os, header);
+
+		for (auto const & entry : entries)
+		{
+			KpkEntry le_entry;
+			le_entry.name_hash = Native2LE(entry.name_hash);
+			le_entry.offset = Native2LE(entry.offset);
+			le_entry.size = Native2LE(entry.size);
+			le_entry.name_offset = Native2LE(entry.name_offset);
+			le_entry.name_length = Native2LE(entry.name_length);
+			le_entry.first_chunk = Native2LE(entry.first_chunk);
+			le_entry.num_chunks = Native2LE(entry.num_chunks);
+			WritePod(os, le_entry);
+		}
+		for (auto const & chunk : chunks)
+		{
+			KpkChunk le_chunk;
+			le_chunk.offset = Native2LE(chunk.offset);
+			le_chunk.compressed_size = Native2LE(chunk.compressed_size);
+			le_chunk.original_size = Native2LE(chunk.original_size);
+			WritePod(os, le_chunk);
+		}
+		os.write(names.data(), names.size());
+
+		uint64_t written = sizeof(KpkHeader) + files_.size() * sizeof(KpkEntry) + num_chunks * sizeof(KpkChunk) + names.size();
+		for (size_t i = 0; i < files_.size(); ++ i)
+		{
+			if (file_chunks[i].empty())
+			{
+				uint64_t const padding = entries[i].offset - written;
+				static char const zeros[256] = { 0 };
+				for (uint64_t p = 0; p < padding; p += sizeof(zeros))
+				{
+					os.write(zeros, static_cast<std::streamsize>(std::min<uint64_t>(sizeof(zeros), padding - p)));
+				}
+				os.write(reinterpret_cast<char const *>(files_[i].data.data()), files_[i].data.size());
+				written += padding + files_[i].data.size();
+			}
+			else
+			{
+				for (auto const & chunk : file_chunks[i])
+				{
+					os.write(reinterpret_cast<char const *>(chunk.data()), chunk.size());
+					written += chunk.size();
+				}
+			}
+		}
+	}
+}
@@ -31,6 +31,9 @@
 #include <KlayGE/KlayGE.hpp>
 #include <KlayGE/ResLoader.hpp>
 
+#include <algorithm>
+#include <cstring>
+
 #include <boost/assert.hpp>
 
 #include <CPP/Common/MyWindows.h>
@@ -150,4 +153,31 @@ namespace KlayGE
 	{
 		return E_NOTIMPL;
 	}
+
+
+	//////////////////////////
+	// CMemOutStream
+
+	void CMemOutStream::Attach(void* begin, uint64_t size)
+	{
+		begin_ = static_cast<uint8_t*>(begin);
+		size_ = size;
+		pos_ = 0;
+	}
+
+	STDMETHODIMP CMemOutStream::Write(const void *data, UInt32 size, UInt32* processedSize)
+	{
+		uint32_t const copy_size = static_cast<uint32_t>(std::min<uint64_t>(size, size_ - pos_));
+		if (copy_size > 0)
+		{
+			std::memcpy(begin_ + pos_, data, copy_size);
+			pos_ += copy_size;
+		}
+		if (processedSize)
+		{
+			*processedSize = copy_size;
+		}
+
+		return (copy_size == size) ? S_OK : E_FAIL;
+	}
 }
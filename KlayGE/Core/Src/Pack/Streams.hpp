@@ -161,6 +161,61 @@ namespace KlayGE
 
 		std::shared_ptr<std::ostream> os_;
 	};
+
+	// Writes straight into a caller-owned buffer, used to decode a whole solid block in one pass
+	class CMemOutStream : boost::noncopyable, public ISequentialOutStream
+	{
+	public:
+		STDMETHOD_(ULONG, AddRef)()
+		{
+			++ ref_count_;
+			return ref_count_;
+		}
+		STDMETHOD_(ULONG, Release)()
+		{
+			-- ref_count_;
+			if (0 == ref_count_)
+			{
+				delete this;
+				return 0;
+			}
+			return ref_count_;
+		}
+
+		STDMETHOD(QueryInterface)(REFGUID iid, void** outObject)
+		{
+			if (IID_ISequentialOutStream == iid)
+			{
+				*outObject = static_cast<void*>(this);
+				this->AddRef();
+				return S_OK;
+			}
+			else
+			{
+				return E_NOINTERFACE;
+			}
+		}
+
+		CMemOutStream()
+			: ref_count_(1),
+				begin_(nullptr), size_(0), pos_(0)
+		{
+		}
+		virtual ~CMemOutStream()
+		{
+		}
+
+		void Attach(void* begin, uint64_t size);
+
+		STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize);
+
+	private:
+		std::atomic<int32_t> ref_count_;
+
+		uint8_t* begin_;
+		uint64_t size_;
+		uint64_t pos_;
+	};
 }
 
 #endif		// _KFL_STREAMS_HPP
@@ -746,6 +746,11 @@ namespace
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return font_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return true;
@@ -782,6 +787,14 @@ namespace
 			return true;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, font_desc_.res_name.begin(), font_desc_.res_name.end());
+			HashCombine(seed, font_desc_.flag);
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
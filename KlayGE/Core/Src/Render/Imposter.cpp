@@ -73,6 +73,11 @@ namespace KlayGE
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return imposter_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return true;
@@ -124,6 +129,13 @@ namespace KlayGE
 			return true;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, imposter_desc_.res_name.begin(), imposter_desc_.res_name.end());
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
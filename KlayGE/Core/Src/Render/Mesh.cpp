@@ -33,11 +33,13 @@
 #include <KlayGE/Light.hpp>
 #include <KlayGE/RenderMaterial.hpp>
 #include <KFL/Hash.hpp>
+#include <KFL/ErrorHandling.hpp>
 
 #include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <cstring>
+#include <atomic>
 
 #include <MeshMLLib/MeshMLLib.hpp>
 
@@ -47,7 +49,57 @@ namespace
 {
 	using namespace KlayGE;
 
-	uint32_t const MODEL_BIN_VERSION = 14;
+	uint32_t const MODEL_BIN_VERSION = 19;
+
+	// Models can be posed on several threads at once
+	std::atomic<uint32_t> num_poses_evaluated(0);
+	std::atomic<uint32_t> num_poses_blended(0);
+	std::atomic<uint32_t> num_poses_skipped(0);
+
+	// Vertex streams and indices of a model_bin. They are read in place from the mapped file, so this only owns
+	//  copies for files that can't be mapped, and for streams that have to be converted for the device.
+	struct ModelBinBlobs
+	{
+		ResIdentifierPtr res;
+		std::vector<std::vector<uint8_t>> copies;
+	};
+
+	std::vector<uint8_t>& CopyModelBinBlob(ModelBinBlobs& blobs, uint64_t offset, uint64_t size)
+	{
+		blobs.copies.emplace_back(static_cast<size_t>(size));
+		std::vector<uint8_t>& copy = blobs.copies.back();
+
+		uint8_t const * view = static_cast<uint8_t const *>(blobs.res->MemoryView());
+		if ((view != nullptr) && (offset + size <= blobs.res->MemoryViewSize()))
+		{
+			std::memcpy(copy.data(), view + offset, copy.size());
+		}
+		else
+		{
+			blobs.res->seekg(offset, std::ios_base::beg);
+			blobs.res->read(copy.data(), copy.size());
+		}
+		return copy;
+	}
+
+	void RejectModelBin(std::string const & name, char const * reason)
+	{
+		LogError("%s is not a valid model: %s.", name.c_str(), reason);
+		TERRC(std::errc::invalid_argument);
+	}
+
+	ArrayRef<uint8_t> MapModelBinBlob(ModelBinBlobs& blobs, uint64_t offset, uint64_t size)
+	{
+		uint8_t const * view = static_cast<uint8_t const *>(blobs.res->MemoryView());
+		if ((view != nullptr) && (offset + size <= blobs.res->MemoryViewSize()))
+		{
+			return ArrayRef<uint8_t>(view + offset, static_cast<size_t>(size));
+		}
+		else
+		{
+			return CopyModelBinBlob(blobs, offset, size);
+		}
+	}
 
 	class RenderModelLoadingDesc : public ResLoadingDesc
 	{
@@ -63,9 +115,10 @@ namespace
 			{
 				std::vector<RenderMaterialPtr> mtls;
 				std::vector<VertexElement> merged_ves;
-				char all_is_index_16_bit;
-				std::vector<std::vector<uint8_t>> merged_buff;
-				std::vector<uint8_t> merged_indices;
+				std::vector<char> mesh_is_index_16_bit;
+				std::vector<ArrayRef<uint8_t>> merged_buff;
+				ArrayRef<uint8_t> merged_indices;
+				std::shared_ptr<void> merged_data;
 				std::vector<GraphicsBufferPtr> merged_vbs;
 				GraphicsBufferPtr merged_ib;
 				std::vector<std::string> mesh_names;
@@ -76,12 +129,15 @@ namespace
 				std::vector<uint32_t> mesh_base_vertices;
 				std::vector<uint32_t> mesh_num_indices;
 				std::vector<uint32_t> mesh_start_indices;
+				std::vector<std::vector<std::pair<uint32_t, uint32_t>>> mesh_lod_indices;
+				std::vector<std::vector<Meshlet>> mesh_meshlets;
 				std::vector<Joint> joints;
 				std::shared_ptr<AnimationActionsType> actions;
 				std::shared_ptr<KeyFramesType> kfs;
 				uint32_t num_frames;
 				uint32_t frame_rate;
 				std::vector<std::shared_ptr<AABBKeyFrames>> frame_pos_bbs;
+				std::vector<TexturePtr> textures;
 			};
 			std::shared_ptr<ModelData> model_data;
 
@@ -107,6 +163,11 @@ namespace
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return model_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return false;
@@ -130,16 +191,31 @@ namespace
 			}
 
 			LoadModel(model_desc_.res_name, model_desc_.model_data->mtls, model_desc_.model_data->merged_ves,
-				model_desc_.model_data->all_is_index_16_bit,
+				model_desc_.model_data->mesh_is_index_16_bit,
 				model_desc_.model_data->merged_buff, model_desc_.model_data->merged_indices,
-				model_desc_.model_data->mesh_names, model_desc_.model_data->mtl_ids,
+				model_desc_.model_data->merged_data, model_desc_.model_data->mesh_names, model_desc_.model_data->mtl_ids,
 				model_desc_.model_data->pos_bbs, model_desc_.model_data->tc_bbs,
 				model_desc_.model_data->mesh_num_vertices, model_desc_.model_data->mesh_base_vertices,
 				model_desc_.model_data->mesh_num_indices, model_desc_.model_data->mesh_start_indices,
+				model_desc_.model_data->mesh_lod_indices, model_desc_.model_data->mesh_meshlets,
 				model_desc_.model_data->joints, model_desc_.model_data->actions, model_desc_.model_data->kfs,
 				model_desc_.model_data->num_frames, model_desc_.model_data->frame_rate,
 				model_desc_.model_data->frame_pos_bbs);
 
+			// Textures load in parallel with the rest of the model, instead of after BuildMeshInfo asks for them
+			this->AddsSubPath();
+			for (auto const & mtl : model_desc_.model_data->mtls)
+			{
+				for (auto const & tex_name : mtl->tex_names)
+				{
+					if (!tex_name.empty() && !ResLoader::Instance().Locate(tex_name).empty())
+					{
+						model_desc_.model_data->textures.push_back(
+							ASyncLoadTextureDependency(*this, tex_name, EAH_GPU_Read | EAH_Immutable));
+					}
+				}
+			}
+
 			RenderFactory& rf = Context::Instance().RenderFactoryInstance();
 			RenderDeviceCaps const & caps = rf.RenderEngineInstance().DeviceCaps();
 			if (caps.multithread_res_creating_support)
@@ -159,6 +235,14 @@ namespace
 			return true;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, model_desc_.res_name.begin(), model_desc_.res_name.end());
+			HashCombine(seed, model_desc_.access_hint);
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
@@ -215,12 +299,25 @@ namespace
 						mesh->AddVertexStream(rhs_rl.GetVertexStream(ve_index),
 							rhs_rl.VertexStreamFormat(ve_index)[0]);
 					}
-					mesh->AddIndexStream(rhs_rl.GetIndexStream(), rhs_rl.IndexStreamFormat());
+					mesh->AddIndexStream(rhs_rl.GetIndexStream(), rhs_mesh->GetRenderLayout().IndexStreamFormat());
 
 					mesh->NumVertices(rhs_mesh->NumVertices());
-					mesh->NumIndices(rhs_mesh->NumIndices());
+					mesh->NumIndices(rhs_mesh->LodNumIndices(0));
 					mesh->StartVertexLocation(rhs_mesh->StartVertexLocation());
-					mesh->StartIndexLocation(rhs_mesh->StartIndexLocation());
+					mesh->StartIndexLocation(rhs_mesh->LodStartIndexLocation(0));
+
+					if (rhs_mesh->NumLods() > 1)
+					{
+						mesh->NumLods(rhs_mesh->NumLods());
+						for (uint32_t lod = 1; lod < rhs_mesh->NumLods(); ++ lod)
+						{
+							mesh->LodIndices(lod, rhs_mesh->LodStartIndexLocation(lod), rhs_mesh->LodNumIndices(lod));
+						}
+					}
+					if (rhs_mesh->HasClusters())
+					{
+						mesh->AssignMeshlets(rhs_mesh->Meshlets(), rhs_mesh->MeshletIndices().data());
+					}
 				}
 
 				BOOST_ASSERT(model->IsSkinned() == rhs_model->IsSkinned());
@@ -268,6 +365,34 @@ namespace
 			return *model_desc_.model;
 		}
 
+		uint64_t GpuMemorySize() const override
+		{
+			RenderModelPtr const & model = *model_desc_.model;
+			if (!model || (model->NumSubrenderables() == 0))
+			{
+				return 0;
+			}
+
+			// All meshes share the merged vertex and index buffers
+			uint64_t size = 0;
+			RenderLayout const & rl = model->Subrenderable(0)->GetRenderLayout();
+			for (uint32_t i = 0; i < rl.NumVertexStreams(); ++ i)
+			{
+				size += rl.GetVertexStream(i)->Size();
+			}
+			if (rl.GetIndexStream())
+			{
+				size += rl.GetIndexStream()->Size();
+			}
+			return size;
+		}
+
+		bool ReleaseResource() override
+		{
+			model_desc_.model = MakeSharedPtr<RenderModelPtr>();
+			return true;
+		}
+
 	private:
 		void FillModel()
 		{
@@ -307,12 +432,31 @@ namespace
 				{
 					mesh->AddVertexStream(model_desc_.model_data->merged_vbs[ve_index], model_desc_.model_data->merged_ves[ve_index]);
 				}
-				mesh->AddIndexStream(model_desc_.model_data->merged_ib, model_desc_.model_data->all_is_index_16_bit ? EF_R16UI : EF_R32UI);
+				bool const is_index_16_bit = model_desc_.model_data->mesh_is_index_16_bit[mesh_index] != 0;
+				mesh->AddIndexStream(model_desc_.model_data->merged_ib, is_index_16_bit ? EF_R16UI : EF_R32UI);
 
 				mesh->NumVertices(model_desc_.model_data->mesh_num_vertices[mesh_index]);
 				mesh->NumIndices(model_desc_.model_data->mesh_num_indices[mesh_index]);
 				mesh->StartVertexLocation(model_desc_.model_data->mesh_base_vertices[mesh_index]);
 				mesh->StartIndexLocation(model_desc_.model_data->mesh_start_indices[mesh_index]);
+
+				auto const & lod_indices = model_desc_.model_data->mesh_lod_indices[mesh_index];
+				if (!lod_indices.empty())
+				{
+					mesh->NumLods(static_cast<uint32_t>(lod_indices.size() + 1));
+					for (uint32_t lod = 1; lod <= lod_indices.size(); ++ lod)
+					{
+						mesh->LodIndices(lod, lod_indices[lod - 1].second, lod_indices[lod - 1].first);
+					}
+				}
+
+				auto const & meshlets = model_desc_.model_data->mesh_meshlets[mesh_index];
+				if (!meshlets.empty())
+				{
+					uint32_t const index_size = is_index_16_bit ? 2 : 4;
+					mesh->AssignMeshlets(meshlets, model_desc_.model_data->merged_indices.data()
+						+ model_desc_.model_data->mesh_start_indices[mesh_index] * index_size);
+				}
 			}
 
 			if (model_desc_.model_data->kfs && !model_desc_.model_data->kfs->empty())
@@ -361,9 +505,9 @@ namespace
 
 				for (size_t i = 0; i < model_desc_.model_data->merged_buff.size(); ++ i)
 				{
-					model_desc_.model_data->merged_vbs[i]->CreateHWResource(&model_desc_.model_data->merged_buff[i][0]);
+					model_desc_.model_data->merged_vbs[i]->CreateHWResource(model_desc_.model_data->merged_buff[i].data());
 				}
-				model_desc_.model_data->merged_ib->CreateHWResource(&model_desc_.model_data->merged_indices[0]);
+				model_desc_.model_data->merged_ib->CreateHWResource(model_desc_.model_data->merged_indices.data());
 
 				this->AddsSubPath();
 
@@ -387,6 +531,7 @@ namespace KlayGE
 {
 	RenderModel::RenderModel(std::wstring const & name)
 		: name_(name),
+			active_lod_(0), full_detail_screen_area_(0.2f),
 			hw_res_ready_(false)
 	{
 	}
@@ -399,6 +544,53 @@ namespace KlayGE
 		}
 	}
 
+	uint32_t RenderModel::NumLods() const
+	{
+		uint32_t num_lods = 1;
+		for (auto const & mesh : subrenderables_)
+		{
+			num_lods = std::max(num_lods, mesh->NumLods());
+		}
+		return num_lods;
+	}
+
+	int32_t RenderModel::LodForScreenArea(float area) const
+	{
+		uint32_t const num_lods = this->NumLods();
+		if ((num_lods > 1) && (area < full_detail_screen_area_))
+		{
+			uint32_t full_num_indices = 0;
+			for (auto const & mesh : subrenderables_)
+			{
+				full_num_indices += checked_pointer_cast<StaticMesh>(mesh)->LodNumIndices(0);
+			}
+
+			// The coarsest LOD that still has enough triangles for the area
+			for (int32_t lod = num_lods - 1; lod > 0; -- lod)
+			{
+				uint32_t num_indices = 0;
+				for (auto const & mesh : subrenderables_)
+				{
+					num_indices += checked_pointer_cast<StaticMesh>(mesh)->LodNumIndices(lod);
+				}
+				if (area * full_num_indices <= full_detail_screen_area_ * num_indices)
+				{
+					return lod;
+				}
+			}
+		}
+		return 0;
+	}
+
+	void RenderModel::ActiveLod(int32_t lod)
+	{
+		active_lod_ = lod;
+		for (auto const & mesh : subrenderables_)
+		{
+			mesh->ActiveLod(lod);
+		}
+	}
+
 	void RenderModel::OnRenderBegin()
 	{
 		for (auto const & mesh : subrenderables_)
@@ -514,7 +706,7 @@ namespace KlayGE
 
 
 	StaticMesh::StaticMesh(RenderModelPtr const & model, std::wstring const & name)
-		: name_(name), model_(model),
+		: name_(name), active_lod_(0), clusters_culled_(false), model_(model),
 			hw_res_ready_(false)
 	{
 		rl_ = Context::Instance().RenderFactoryInstance().MakeRenderLayout();
@@ -620,34 +812,150 @@ namespace KlayGE
 		rl_->BindIndexStream(index_stream, format);
 	}
 
+	uint32_t StaticMesh::NumLods() const
+	{
+		return std::max(static_cast<uint32_t>(lod_num_indices_.size()), 1U);
+	}
 
-	std::pair<std::pair<Quaternion, Quaternion>, float> KeyFrames::Frame(float frame) const
+	void StaticMesh::NumLods(uint32_t lods)
 	{
-		std::pair<std::pair<Quaternion, Quaternion>, float> ret;
-		if (frame_id.size() == 1)
+		lod_start_indices_.resize(lods, rl_->StartIndexLocation());
+		lod_num_indices_.resize(lods, rl_->NumIndices());
+	}
+
+	void StaticMesh::LodIndices(uint32_t lod, uint32_t start_index, uint32_t num_indices)
+	{
+		BOOST_ASSERT(lod < lod_num_indices_.size());
+
+		lod_start_indices_[lod] = start_index;
+		lod_num_indices_[lod] = num_indices;
+		if (static_cast<int32_t>(lod) == active_lod_)
+		{
+			rl_->StartIndexLocation(start_index);
+			rl_->NumIndices(num_indices);
+		}
+	}
+
+	uint32_t StaticMesh::LodStartIndexLocation(uint32_t lod) const
+	{
+		return lod_start_indices_.empty() ? rl_->StartIndexLocation()
+			: lod_start_indices_[std::min(lod, static_cast<uint32_t>(lod_start_indices_.size() - 1))];
+	}
+
+	uint32_t StaticMesh::LodNumIndices(uint32_t lod) const
+	{
+		return lod_num_indices_.empty() ? rl_->NumIndices()
+			: lod_num_indices_[std::min(lod, static_cast<uint32_t>(lod_num_indices_.size() - 1))];
+	}
+
+	int32_t StaticMesh::LodForScreenArea(float area) const
+	{
+		uint32_t const num_lods = this->NumLods();
+		RenderModelPtr model = model_.lock();
+		if ((num_lods > 1) && model && (area < model->FullDetailScreenArea()))
 		{
-			ret.first.first = bind_real[0];
-			ret.first.second = bind_dual[0];
-			ret.second = bind_scale[0];
+			for (int32_t lod = num_lods - 1; lod > 0; -- lod)
+			{
+				if (area * lod_num_indices_[0] <= model->FullDetailScreenArea() * lod_num_indices_[lod])
+				{
+					return lod;
+				}
+			}
+		}
+		return 0;
+	}
+
+	void StaticMesh::ActiveLod(int32_t lod)
+	{
+		active_lod_ = MathLib::clamp(lod, 0, static_cast<int32_t>(this->NumLods()) - 1);
+		if (!lod_num_indices_.empty())
+		{
+			rl_->StartIndexLocation(lod_start_indices_[active_lod_]);
+			rl_->NumIndices(lod_num_indices_[active_lod_]);
+		}
+	}
+
+	void StaticMesh::AssignMeshlets(ArrayRef<Meshlet> meshlets, void const * lod0_indices)
+	{
+		meshlets_.assign(meshlets.begin(), meshlets.end());
+
+		// The full index range has to be known to go back to it
+		if (lod_num_indices_.empty())
+		{
+			this->NumLods(1);
+		}
+
+		uint32_t const index_size = NumFormatBytes(rl_->IndexStreamFormat());
+		uint8_t const * src = static_cast<uint8_t const *>(lod0_indices);
+		meshlet_indices_.assign(src, src + lod_num_indices_[0] * index_size);
+
+		full_ib_ = rl_->GetIndexStream();
+		clusters_culled_ = false;
+	}
+
+	uint32_t StaticMesh::CullClusters(Camera const & camera, bool cull_back_faces)
+	{
+		// Instances share one index list, and only LOD 0 has meshlets
+		clusters_culled_ = (0 == active_lod_) && (instances_.size() <= 1);
+		if (!clusters_culled_)
+		{
+			return 0;
+		}
+
+		float4x4 const clip = model_mat_ * camera.ViewProjMatrixWOAdjust();
+		Frustum frustum;
+		frustum.ClipMatrix(clip, MathLib::inverse(clip));
+
+		// A mirroring transform flips the winding
+		uint32_t num_indices;
+		if (cull_back_faces && (MathLib::determinant(model_mat_) > 0))
+		{
+			float3 const eye_pos = MathLib::transform_coord(camera.EyePos(), MathLib::inverse(model_mat_));
+			num_indices = CullMeshlets(meshlets_, frustum, eye_pos, visible_meshlets_);
 		}
 		else
 		{
-			frame = std::fmod(frame, static_cast<float>(frame_id.back() + 1));
+			num_indices = CullMeshlets(meshlets_, frustum, visible_meshlets_);
+		}
 
-			auto iter = std::upper_bound(frame_id.begin(), frame_id.end(), frame);
-			int index = static_cast<int>(iter - frame_id.begin());
+		CompactMeshletIndices(meshlets_, visible_meshlets_, meshlet_indices_.data(),
+			NumFormatBytes(rl_->IndexStreamFormat()), culled_indices_);
 
-			int index0 = index - 1;
-			int index1 = index % frame_id.size();
-			int frame0 = frame_id[index0];
-			int frame1 = frame_id[index1];
-			float factor = (frame - frame0) / (frame1 - frame0);
-			ret.first = MathLib::sclerp(bind_real[index0], bind_dual[index0], bind_real[index1], bind_dual[index1], factor);
-			ret.second = MathLib::lerp(bind_scale[index0], bind_scale[index1], factor);
+		return (lod_num_indices_[0] - num_indices) / 3;
+	}
+
+	void StaticMesh::ApplyClusterCulling(bool cull)
+	{
+		ElementFormat const format = rl_->IndexStreamFormat();
+		if (cull && clusters_culled_)
+		{
+			uint32_t const size = static_cast<uint32_t>(culled_indices_.size());
+			if (size > 0)
+			{
+				if (!culled_ib_ || (culled_ib_->Size() < size))
+				{
+					RenderFactory& rf = Context::Instance().RenderFactoryInstance();
+					culled_ib_ = rf.MakeIndexBuffer(BU_Dynamic, EAH_CPU_Write | EAH_GPU_Read, static_cast<uint32_t>(meshlet_indices_.size()), nullptr);
+				}
+
+				{
+					GraphicsBuffer::Mapper mapper(*culled_ib_, BA_Write_Only);
+					std::memcpy(mapper.Pointer<uint8_t>(), culled_indices_.data(), size);
+				}
+				rl_->BindIndexStream(culled_ib_, format);
+			}
+			rl_->StartIndexLocation(0);
+			rl_->NumIndices(size / NumFormatBytes(format));
+		}
+		else
+		{
+			rl_->BindIndexStream(full_ib_, format);
+			rl_->StartIndexLocation(lod_start_indices_[active_lod_]);
+			rl_->NumIndices(lod_num_indices_[active_lod_]);
 		}
-		return ret;
 	}
 
+
 	AABBox AABBKeyFrames::Frame(float frame) const
 	{
 		if (frame_id.size() == 1)
@@ -675,160 +983,154 @@ namespace KlayGE
 	SkinnedModel::SkinnedModel(std::wstring const & name)
 		: RenderModel(name),
 			last_frame_(-1),
+			animation_lod_(0), screen_area_(0), pose_stale_(true), blend_step_(0),
 			num_frames_(0), frame_rate_(0)
 	{
 	}
 	
 	void SkinnedModel::BuildBones(float frame)
 	{
+		pose_evaluator_.Evaluate(joints_, *key_frames_, frame, bind_reals_, bind_duals_);
+	}
+
+	void SkinnedModel::UpdateBinds()
+	{
+		bind_reals_.resize(joints_.size());
+		bind_duals_.resize(joints_.size());
 		for (size_t i = 0; i < joints_.size(); ++ i)
 		{
-			Joint& joint = joints_[i];
-			KeyFrames const & kf = (*key_frames_)[i];
-
-			std::pair<std::pair<Quaternion, Quaternion>, float> key_dq = kf.Frame(frame);
-
-			if (joint.parent != -1)
-			{
-				Joint const & parent(joints_[joint.parent]);
+			SkinningDualQuat(bind_reals_[i], bind_duals_[i], joints_[i]);
+		}
+	}
 
-				if (MathLib::dot(key_dq.first.first, parent.bind_real) < 0)
-				{
-					key_dq.first.first = -key_dq.first.first;
-					key_dq.first.second = -key_dq.first.second;
-				}
+	float SkinnedModel::GetFrame() const
+	{
+		return last_frame_;
+	}
 
-				if ((MathLib::SignBit(key_dq.second) > 0) && (MathLib::SignBit(parent.bind_scale) > 0))
-				{
-					joint.bind_real = MathLib::mul_real(key_dq.first.first, parent.bind_real);
-					joint.bind_dual = MathLib::mul_dual(key_dq.first.first, key_dq.first.second * parent.bind_scale, parent.bind_real, parent.bind_dual);
-					joint.bind_scale = key_dq.second * parent.bind_scale;
-				}
-				else
-				{
-					float4x4 tmp_mat = MathLib::scaling(MathLib::abs(key_dq.second), MathLib::abs(key_dq.second), key_dq.second)
-						* MathLib::to_matrix(key_dq.first.first)
-						* MathLib::translation(MathLib::udq_to_trans(key_dq.first.first, key_dq.first.second))
-						* MathLib::scaling(MathLib::abs(parent.bind_scale), MathLib::abs(parent.bind_scale), parent.bind_scale)
-						* MathLib::to_matrix(parent.bind_real)
-						* MathLib::translation(MathLib::udq_to_trans(parent.bind_real, parent.bind_dual));
-
-					float flip = 1;
-					if (MathLib::dot(MathLib::cross(float3(tmp_mat(0, 0), tmp_mat(0, 1), tmp_mat(0, 2)),
-						float3(tmp_mat(1, 0), tmp_mat(1, 1), tmp_mat(1, 2))),
-						float3(tmp_mat(2, 0), tmp_mat(2, 1), tmp_mat(2, 2))) < 0)
-					{
-						tmp_mat(2, 0) = -tmp_mat(2, 0);
-						tmp_mat(2, 1) = -tmp_mat(2, 1);
-						tmp_mat(2, 2) = -tmp_mat(2, 2);
+	void SkinnedModel::SetFrame(float frame)
+	{
+		if (last_frame_ != frame)
+		{
+			float const step = frame - last_frame_;
+			last_frame_ = frame;
 
-						flip = -1;
-					}
+			if (animation_lods_.empty())
+			{
+				this->BuildBones(frame);
+				++ num_poses_evaluated;
+				return;
+			}
 
-					float3 scale;
-					Quaternion rot;
-					float3 trans;
-					MathLib::decompose(scale, rot, trans, tmp_mat);
+			float const area = screen_area_;
+			screen_area_ = 0;
+			if (area <= 0)
+			{
+				pose_stale_ = true;
+				++ num_poses_skipped;
+				return;
+			}
 
-					joint.bind_real = rot;
-					joint.bind_dual = MathLib::quat_trans_to_udq(rot, trans);
-					joint.bind_scale = flip * scale.x();
-				}
+			uint32_t lod = 0;
+			while ((lod + 1 < animation_lods_.size()) && (area < animation_lods_[lod].min_screen_area))
+			{
+				++ lod;
 			}
-			else
+			if (lod != animation_lod_)
 			{
-				joint.bind_real = key_dq.first.first;
-				joint.bind_dual = key_dq.first.second;
-				joint.bind_scale = key_dq.second;
+				animation_lod_ = lod;
+				pose_stale_ = true;
 			}
-		}
-
-		this->UpdateBinds();
-	}
-
-	void SkinnedModel::UpdateBinds()
-	{
-		bind_reals_.resize(joints_.size());
-		bind_duals_.resize(joints_.size());
-		for (size_t i = 0; i < joints_.size(); ++ i)
-		{
-			Joint const & joint = joints_[i];
 
-			Quaternion bind_real, bind_dual;
-			float bind_scale;
-			if ((MathLib::SignBit(joint.inverse_origin_scale) > 0) && (MathLib::SignBit(joint.bind_scale) > 0))
+			AnimationLod const & anim_lod = animation_lods_[lod];
+			if ((anim_lod.update_interval <= 1) || pose_stale_ || (step <= 0))
 			{
-				bind_real = MathLib::mul_real(joint.inverse_origin_real, joint.bind_real);
-				bind_dual = MathLib::mul_dual(joint.inverse_origin_real, joint.inverse_origin_dual,
-					joint.bind_real, joint.bind_dual);
-				bind_scale = joint.inverse_origin_scale * joint.bind_scale;
+				pose_evaluator_.Evaluate(joints_, *key_frames_, frame, bind_reals_, bind_duals_, anim_lod.max_joint_depth);
+				pose_stale_ = false;
+				blend_step_ = 0;
+				++ num_poses_evaluated;
+				return;
+			}
 
-				if (MathLib::SignBit(bind_real.w()) < 0)
-				{
-					bind_real = -bind_real;
-					bind_dual = -bind_dual;
-				}
+			if (0 == blend_step_)
+			{
+				// Where the pose will be at the end of the interval, if time keeps its pace. Blends there from the
+				//  pose on screen.
+				blend_from_reals_ = bind_reals_;
+				blend_from_duals_ = bind_duals_;
+				pose_evaluator_.Evaluate(joints_, *key_frames_, frame + step * (anim_lod.update_interval - 1),
+					blend_to_reals_, blend_to_duals_, anim_lod.max_joint_depth);
+				++ num_poses_evaluated;
 			}
 			else
 			{
-				float4x4 tmp_mat = MathLib::scaling(MathLib::abs(joint.inverse_origin_scale), MathLib::abs(joint.inverse_origin_scale), joint.inverse_origin_scale)
-					* MathLib::to_matrix(joint.inverse_origin_real)
-					* MathLib::translation(MathLib::udq_to_trans(joint.inverse_origin_real, joint.inverse_origin_dual))
-					* MathLib::scaling(MathLib::abs(joint.bind_scale), MathLib::abs(joint.bind_scale), joint.bind_scale)
-					* MathLib::to_matrix(joint.bind_real)
-					* MathLib::translation(MathLib::udq_to_trans(joint.bind_real, joint.bind_dual));
-
-				float flip = 1;
-				if (MathLib::dot(MathLib::cross(float3(tmp_mat(0, 0), tmp_mat(0, 1), tmp_mat(0, 2)),
-					float3(tmp_mat(1, 0), tmp_mat(1, 1), tmp_mat(1, 2))),
-					float3(tmp_mat(2, 0), tmp_mat(2, 1), tmp_mat(2, 2))) < 0)
-				{
-					tmp_mat(2, 0) = -tmp_mat(2, 0);
-					tmp_mat(2, 1) = -tmp_mat(2, 1);
-					tmp_mat(2, 2) = -tmp_mat(2, 2);
-
-					flip = -1;
-				}
+				++ num_poses_blended;
+			}
 
-				float3 scale;
-				Quaternion rot;
-				float3 trans;
-				MathLib::decompose(scale, rot, trans, tmp_mat);
+			++ blend_step_;
+			float const factor = static_cast<float>(blend_step_) / anim_lod.update_interval;
+			for (size_t i = 0; i < bind_reals_.size(); ++ i)
+			{
+				// The real parts carry the bind scale. The unit dual quaternions are blended and renormalized, the
+				//  scale is blended on its own, so the mesh doesn't shrink in between.
+				float const from_scale = MathLib::length(blend_from_reals_[i]);
+				float const to_scale = MathLib::length(blend_to_reals_[i]);
+				float const sign = (MathLib::dot(blend_from_reals_[i], blend_to_reals_[i]) < 0) ? -1.0f : 1.0f;
+				float4 const real = MathLib::lerp(blend_from_reals_[i] * (1 / from_scale),
+					blend_to_reals_[i] * (sign / to_scale), factor);
+				float4 const dual = MathLib::lerp(blend_from_duals_[i], blend_to_duals_[i] * sign, factor);
+				float const inv_len = 1 / MathLib::length(real);
+				bind_reals_[i] = real * (MathLib::lerp(from_scale, to_scale, factor) * inv_len);
+				bind_duals_[i] = dual * inv_len;
+			}
+			if (blend_step_ == anim_lod.update_interval)
+			{
+				blend_step_ = 0;
+			}
+		}
+	}
 
-				bind_real = rot;
-				bind_dual = MathLib::quat_trans_to_udq(rot, trans);
-				bind_scale = scale.x();
+	void SkinnedModel::SetFrames(ArrayRef<SkinnedModel*> models, ArrayRef<float> frames)
+	{
+		BOOST_ASSERT(models.size() == frames.size());
 
-				if (flip * MathLib::SignBit(bind_real.w()) < 0)
-				{
-					bind_real = -bind_real;
-					bind_dual = -bind_dual;
-				}
-			}
+		// Skeletons are small, a thread per handful of them is enough
+		uint32_t const num_models = static_cast<uint32_t>(models.size());
+		uint32_t const max_threads = std::min((num_models + 7) / 8, std::max(std::thread::hardware_concurrency(), 1U));
+		parallel_for(Context::Instance().ThreadPool(), num_models, std::max(max_threads, 1U),
+			[&models, &frames](uint32_t index)
+			{
+				models[index]->SetFrame(frames[index]);
+			});
+	}
 
-			bind_reals_[i] = float4(bind_real.x(), bind_real.y(), bind_real.z(), bind_real.w()) * bind_scale;
-			bind_duals_[i] = float4(bind_dual.x(), bind_dual.y(), bind_dual.z(), bind_dual.w());
-		}
+	void SkinnedModel::AnimationLods(std::vector<AnimationLod> const & lods)
+	{
+		animation_lods_ = lods;
+		pose_stale_ = true;
 	}
 
-	float SkinnedModel::GetFrame() const
+	bool SkinnedModel::WantsScreenArea() const
 	{
-		return last_frame_;
+		return !animation_lods_.empty();
 	}
 
-	void SkinnedModel::SetFrame(float frame)
+	void SkinnedModel::ScreenArea(float area)
 	{
-		if (last_frame_ != frame)
-		{
-			last_frame_ = frame;
+		screen_area_ = std::max(screen_area_, area);
+	}
 
-			this->BuildBones(frame);
-		}
+	void SkinnedModel::TakeAnimationStats(uint32_t& num_evaluated, uint32_t& num_blended, uint32_t& num_skipped)
+	{
+		num_evaluated = num_poses_evaluated.exchange(0);
+		num_blended = num_poses_blended.exchange(0);
+		num_skipped = num_poses_skipped.exchange(0);
 	}
 
 	void SkinnedModel::RebindJoints()
 	{
 		this->BuildBones(last_frame_);
+		pose_stale_ = true;
 	}
 
 	void SkinnedModel::UnbindJoints()
@@ -898,6 +1200,21 @@ namespace KlayGE
 		frame_pos_aabbs_ = frame_pos_aabbs;
 	}
 
+	bool SkinnedMesh::WantsScreenArea() const
+	{
+		auto model = model_.lock();
+		return model && model->WantsScreenArea();
+	}
+
+	void SkinnedMesh::ScreenArea(float area)
+	{
+		auto model = model_.lock();
+		if (model)
+		{
+			model->ScreenArea(area);
+		}
+	}
+
 
 	std::string const jit_ext_name = ".model_bin";
 
@@ -999,12 +1316,15 @@ namespace KlayGE
 	}
 
 	void LoadModel(std::string const & meshml_name, std::vector<RenderMaterialPtr>& mtls,
-		std::vector<VertexElement>& merged_ves, char& all_is_index_16_bit,
-		std::vector<std::vector<uint8_t>>& merged_buff, std::vector<uint8_t>& merged_indices,
+		std::vector<VertexElement>& merged_ves, std::vector<char>& mesh_is_index_16_bit,
+		std::vector<ArrayRef<uint8_t>>& merged_buff, ArrayRef<uint8_t>& merged_indices,
+		std::shared_ptr<void>& merged_data,
 		std::vector<std::string>& mesh_names, std::vector<int32_t>& mtl_ids,
 		std::vector<AABBox>& pos_bbs, std::vector<AABBox>& tc_bbs,
 		std::vector<uint32_t>& mesh_num_vertices, std::vector<uint32_t>& mesh_base_vertices,
 		std::vector<uint32_t>& mesh_num_indices, std::vector<uint32_t>& mesh_base_indices,
+		std::vector<std::vector<std::pair<uint32_t, uint32_t>>>& mesh_lod_indices,
+		std::vector<std::vector<Meshlet>>& mesh_meshlets,
 		std::vector<Joint>& joints, std::shared_ptr<AnimationActionsType>& actions,
 		std::shared_ptr<KeyFramesType>& kfs, uint32_t& num_frames, uint32_t& frame_rate,
 		std::vector<std::shared_ptr<AABBKeyFrames>>& frame_pos_bbs)
@@ -1036,17 +1356,27 @@ namespace KlayGE
 			}
 			lzma_file = ResLoader::Instance().Open(no_packing_name + jit_ext_name);
 		}
+		std::string const & file_name = lzma_file->ResName();
+
+		lzma_file->seekg(0, std::ios_base::end);
+		uint64_t const file_size = static_cast<uint64_t>(lzma_file->tellg());
+		lzma_file->seekg(0, std::ios_base::beg);
+
 		uint32_t fourcc;
 		lzma_file->read(&fourcc, sizeof(fourcc));
 		fourcc = LE2Native(fourcc);
-		BOOST_ASSERT((fourcc == MakeFourCC<'K', 'L', 'M', ' '>::value));
+		if (fourcc != MakeFourCC<'K', 'L', 'M', ' '>::value)
+		{
+			RejectModelBin(file_name, "wrong fourcc");
+		}
 
 		uint32_t ver;
 		lzma_file->read(&ver, sizeof(ver));
 		ver = LE2Native(ver);
-		BOOST_ASSERT(MODEL_BIN_VERSION == ver);
-
-		std::shared_ptr<std::stringstream> ss = MakeSharedPtr<std::stringstream>();
+		if (ver != MODEL_BIN_VERSION)
+		{
+			RejectModelBin(file_name, "wrong version");
+		}
 
 		uint64_t original_len, len;
 		lzma_file->read(&original_len, sizeof(original_len));
@@ -1054,10 +1384,45 @@ namespace KlayGE
 		lzma_file->read(&len, sizeof(len));
 		len = LE2Native(len);
 
+		uint32_t num_blobs;
+		lzma_file->read(&num_blobs, sizeof(num_blobs));
+		num_blobs = LE2Native(num_blobs);
+		uint32_t reserved;
+		lzma_file->read(&reserved, sizeof(reserved));
+
+		// The blob table is mapped straight into vertex and index buffers, nothing in it can be trusted
+		uint64_t const table_offset = static_cast<uint64_t>(lzma_file->tellg());
+		if ((num_blobs < 1) || (table_offset > file_size) || (num_blobs * 2ULL * sizeof(uint64_t) > file_size - table_offset))
+		{
+			RejectModelBin(file_name, "blob count out of range");
+		}
+		std::vector<uint64_t> blob_table(num_blobs * 2);
+		lzma_file->read(blob_table.data(), blob_table.size() * sizeof(blob_table[0]));
+		for (auto& entry : blob_table)
+		{
+			entry = LE2Native(entry);
+		}
+		for (uint32_t i = 0; i < num_blobs; ++ i)
+		{
+			uint64_t const offset = blob_table[i * 2 + 0];
+			uint64_t const size = blob_table[i * 2 + 1];
+			if ((size > file_size) || (offset > file_size - size))
+			{
+				RejectModelBin(file_name, "blob out of the file");
+			}
+		}
+		if (len > file_size - table_offset - blob_table.size() * sizeof(blob_table[0]))
+		{
+			RejectModelBin(file_name, "compressed size out of range");
+		}
+
+		// Decodes straight from the mapped file when there is one, and reads the result in place
+		std::shared_ptr<std::vector<uint8_t>> decoded_data = MakeSharedPtr<std::vector<uint8_t>>();
 		LZMACodec lzma;
-		lzma.Decode(*ss, lzma_file, len, original_len);
+		lzma.Decode(*decoded_data, lzma_file, len, original_len);
 
-		ResIdentifierPtr decoded = MakeSharedPtr<ResIdentifier>(lzma_file->ResName(), lzma_file->Timestamp(), ss);
+		ResIdentifierPtr decoded = MakeSharedPtr<ResIdentifier>(lzma_file->ResName(), lzma_file->Timestamp(),
+			decoded_data, decoded_data->data(), decoded_data->size());
 
 		uint32_t num_mtls;
 		decoded->read(&num_mtls, sizeof(num_mtls));
@@ -1164,27 +1529,49 @@ namespace KlayGE
 		}
 
 		uint32_t all_num_vertices;
-		uint32_t all_num_indices;
+		uint32_t index_bytes;
 		decoded->read(&all_num_vertices, sizeof(all_num_vertices));
 		all_num_vertices = LE2Native(all_num_vertices);
-		decoded->read(&all_num_indices, sizeof(all_num_indices));
-		all_num_indices = LE2Native(all_num_indices);
-		decoded->read(&all_is_index_16_bit, sizeof(all_is_index_16_bit));
+		decoded->read(&index_bytes, sizeof(index_bytes));
+		index_bytes = LE2Native(index_bytes);
+
+		if (num_blobs != merged_ves.size() + 1)
+		{
+			RejectModelBin(file_name, "blob count doesn't match the vertex streams");
+		}
 
-		int const index_elem_size = all_is_index_16_bit ? 2 : 4;
+		std::shared_ptr<ModelBinBlobs> blobs = MakeSharedPtr<ModelBinBlobs>();
+		blobs->res = lzma_file;
+		merged_data = blobs;
 
 		RenderFactory& rf = Context::Instance().RenderFactoryInstance();
+		RenderDeviceCaps const & caps = rf.RenderEngineInstance().DeviceCaps();
 		merged_buff.resize(merged_ves.size());
 		for (size_t i = 0; i < merged_buff.size(); ++ i)
 		{
-			merged_buff[i].resize(all_num_vertices * merged_ves[i].element_size());
-			decoded->read(&merged_buff[i][0], merged_buff[i].size() * sizeof(merged_buff[i][0]));
+			uint64_t const offset = blob_table[i * 2 + 0];
+			uint64_t const size = blob_table[i * 2 + 1];
+			if (size != static_cast<uint64_t>(all_num_vertices) * merged_ves[i].element_size())
+			{
+				RejectModelBin(file_name, "vertex stream size mismatch");
+			}
+
+			// Only a stream in a format the device can't take is copied out of the file
+			if (((EF_A2BGR10 != merged_ves[i].format) || caps.vertex_format_support(EF_A2BGR10))
+				&& ((EF_ARGB8 != merged_ves[i].format) || caps.vertex_format_support(EF_ARGB8)))
+			{
+				merged_buff[i] = MapModelBinBlob(*blobs, offset, size);
+				continue;
+			}
 
-			if ((EF_A2BGR10 == merged_ves[i].format) && !rf.RenderEngineInstance().DeviceCaps().vertex_format_support(EF_A2BGR10))
+			std::vector<uint8_t>& converted = CopyModelBinBlob(*blobs, offset, size);
+			merged_buff[i] = converted;
+
+			if ((EF_A2BGR10 == merged_ves[i].format) && !caps.vertex_format_support(EF_A2BGR10))
 			{
 				merged_ves[i].format = EF_ARGB8;
 
-				uint32_t* p = reinterpret_cast<uint32_t*>(&merged_buff[i][0]);
+				uint32_t* p = reinterpret_cast<uint32_t*>(converted.data());
 				for (uint32_t j = 0; j < all_num_vertices; ++ j)
 				{
 					float x = ((p[j] >>  0) & 0x3FF) / 1023.0f;
@@ -1198,13 +1585,13 @@ namespace KlayGE
 						| (MathLib::clamp<uint32_t>(static_cast<uint32_t>(w * 255), 0, 255) << 24);
 				}
 			}
-			if ((EF_ARGB8 == merged_ves[i].format) && !rf.RenderEngineInstance().DeviceCaps().vertex_format_support(EF_ARGB8))
+			if ((EF_ARGB8 == merged_ves[i].format) && !caps.vertex_format_support(EF_ARGB8))
 			{
-				BOOST_ASSERT(rf.RenderEngineInstance().DeviceCaps().vertex_format_support(EF_ABGR8));
+				BOOST_ASSERT(caps.vertex_format_support(EF_ABGR8));
 
 				merged_ves[i].format = EF_ABGR8;
 
-				uint32_t* p = reinterpret_cast<uint32_t*>(&merged_buff[i][0]);
+				uint32_t* p = reinterpret_cast<uint32_t*>(converted.data());
 				for (uint32_t j = 0; j < all_num_vertices; ++ j)
 				{
 					float x = ((p[j] >> 16) & 0xFF) / 255.0f;
@@ -1219,8 +1606,11 @@ namespace KlayGE
 				}
 			}
 		}
-		merged_indices.resize(all_num_indices * index_elem_size);
-		decoded->read(&merged_indices[0], merged_indices.size() * sizeof(merged_indices[0]));
+		if (blob_table[merged_ves.size() * 2 + 1] != index_bytes)
+		{
+			RejectModelBin(file_name, "index stream size mismatch");
+		}
+		merged_indices = MapModelBinBlob(*blobs, blob_table[merged_ves.size() * 2 + 0], blob_table[merged_ves.size() * 2 + 1]);
 
 		mesh_names.resize(num_meshes);
 		mtl_ids.resize(num_meshes);
@@ -1228,8 +1618,11 @@ namespace KlayGE
 		tc_bbs.resize(num_meshes);
 		mesh_num_vertices.resize(num_meshes);
 		mesh_base_vertices.resize(num_meshes);
+		mesh_is_index_16_bit.resize(num_meshes);
 		mesh_num_indices.resize(num_meshes);
 		mesh_base_indices.resize(num_meshes);
+		mesh_lod_indices.resize(num_meshes);
+		mesh_meshlets.resize(num_meshes);
 		for (uint32_t mesh_index = 0; mesh_index < num_meshes; ++ mesh_index)
 		{
 			mesh_names[mesh_index] = ReadShortString(decoded);
@@ -1264,10 +1657,50 @@ namespace KlayGE
 			mesh_num_vertices[mesh_index] = LE2Native(mesh_num_vertices[mesh_index]);
 			decoded->read(&mesh_base_vertices[mesh_index], sizeof(mesh_base_vertices[mesh_index]));
 			mesh_base_vertices[mesh_index] = LE2Native(mesh_base_vertices[mesh_index]);
+			decoded->read(&mesh_is_index_16_bit[mesh_index], sizeof(mesh_is_index_16_bit[mesh_index]));
 			decoded->read(&mesh_num_indices[mesh_index], sizeof(mesh_num_indices[mesh_index]));
 			mesh_num_indices[mesh_index] = LE2Native(mesh_num_indices[mesh_index]);
 			decoded->read(&mesh_base_indices[mesh_index], sizeof(mesh_base_indices[mesh_index]));
 			mesh_base_indices[mesh_index] = LE2Native(mesh_base_indices[mesh_index]);
+
+			uint32_t num_lods;
+			decoded->read(&num_lods, sizeof(num_lods));
+			num_lods = LE2Native(num_lods);
+			BOOST_ASSERT(num_lods > 0);
+			mesh_lod_indices[mesh_index].resize(num_lods - 1);
+			for (auto& lod_indices : mesh_lod_indices[mesh_index])
+			{
+				decoded->read(&lod_indices.first, sizeof(lod_indices.first));
+				lod_indices.first = LE2Native(lod_indices.first);
+				decoded->read(&lod_indices.second, sizeof(lod_indices.second));
+				lod_indices.second = LE2Native(lod_indices.second);
+			}
+
+			uint32_t num_meshlets;
+			decoded->read(&num_meshlets, sizeof(num_meshlets));
+			num_meshlets = LE2Native(num_meshlets);
+			mesh_meshlets[mesh_index].resize(num_meshlets);
+			for (auto& meshlet : mesh_meshlets[mesh_index])
+			{
+				decoded->read(&meshlet.start_index, sizeof(meshlet.start_index));
+				meshlet.start_index = LE2Native(meshlet.start_index);
+				decoded->read(&meshlet.num_indices, sizeof(meshlet.num_indices));
+				meshlet.num_indices = LE2Native(meshlet.num_indices);
+
+				float4 sphere;
+				decoded->read(&sphere, sizeof(sphere));
+				meshlet.center.x() = LE2Native(sphere.x());
+				meshlet.center.y() = LE2Native(sphere.y());
+				meshlet.center.z() = LE2Native(sphere.z());
+				meshlet.radius = LE2Native(sphere.w());
+				float4 cone;
+				decoded->read(&cone, sizeof(cone));
+				meshlet.cone_axis.x() = LE2Native(cone.x());
+				meshlet.cone_axis.y() = LE2Native(cone.y());
+				meshlet.cone_axis.z() = LE2Native(cone.z());
+				meshlet.cone_cos = LE2Native(cone.w());
+				meshlet.cone_sin = std::sqrt(std::max(1 - meshlet.cone_cos * meshlet.cone_cos, 0.0f));
+			}
 		}
 
 		joints.resize(num_joints);
@@ -1333,6 +1766,8 @@ namespace KlayGE
 			frame_rate = LE2Native(frame_rate);
 
 			kfs = MakeSharedPtr<KeyFramesType>(joints.size());
+			// Tracks of joints the model doesn't have are read past
+			CompressedKeyFrames skipped;
 			for (uint32_t kf_index = 0; kf_index < num_kfs; ++ kf_index)
 			{
 				uint32_t joint_index = kf_index;
@@ -1341,37 +1776,30 @@ namespace KlayGE
 				decoded->read(&num_kf, sizeof(num_kf));
 				num_kf = LE2Native(num_kf);
 
-				KeyFrames kf;
-				kf.frame_id.resize(num_kf);
-				kf.bind_real.resize(num_kf);
-				kf.bind_dual.resize(num_kf);
-				kf.bind_scale.resize(num_kf);
-				for (uint32_t k_index = 0; k_index < num_kf; ++ k_index)
+				CompressedKeyFrames& ckf = (joint_index < num_joints) ? (*kfs)[joint_index] : skipped;
+				decoded->read(&ckf.translation_min, sizeof(ckf.translation_min));
+				decoded->read(&ckf.translation_extent, sizeof(ckf.translation_extent));
+				for (uint32_t i = 0; i < 3; ++ i)
 				{
-					decoded->read(&kf.frame_id[k_index], sizeof(kf.frame_id[k_index]));
-					kf.frame_id[k_index] = LE2Native(kf.frame_id[k_index]);
-					decoded->read(&kf.bind_real[k_index], sizeof(kf.bind_real[k_index]));
-					kf.bind_real[k_index][0] = LE2Native(kf.bind_real[k_index][0]);
-					kf.bind_real[k_index][1] = LE2Native(kf.bind_real[k_index][1]);
-					kf.bind_real[k_index][2] = LE2Native(kf.bind_real[k_index][2]);
-					kf.bind_real[k_index][3] = LE2Native(kf.bind_real[k_index][3]);
-					decoded->read(&kf.bind_dual[k_index], sizeof(kf.bind_dual[k_index]));
-					kf.bind_dual[k_index][0] = LE2Native(kf.bind_dual[k_index][0]);
-					kf.bind_dual[k_index][1] = LE2Native(kf.bind_dual[k_index][1]);
-					kf.bind_dual[k_index][2] = LE2Native(kf.bind_dual[k_index][2]);
-					kf.bind_dual[k_index][3] = LE2Native(kf.bind_dual[k_index][3]);
-
-					float flip = MathLib::SignBit(kf.bind_real[k_index].w());
-
-					kf.bind_scale[k_index] = MathLib::length(kf.bind_real[k_index]);
-					kf.bind_real[k_index] /= kf.bind_scale[k_index];
-
-					kf.bind_scale[k_index] *= flip;
+					ckf.translation_min[i] = LE2Native(ckf.translation_min[i]);
+					ckf.translation_extent[i] = LE2Native(ckf.translation_extent[i]);
 				}
-
-				if (joint_index < num_joints)
+				decoded->read(&ckf.scale_min, sizeof(ckf.scale_min));
+				ckf.scale_min = LE2Native(ckf.scale_min);
+				decoded->read(&ckf.scale_extent, sizeof(ckf.scale_extent));
+				ckf.scale_extent = LE2Native(ckf.scale_extent);
+
+				ckf.keys.resize(num_kf);
+				decoded->read(ckf.keys.data(), ckf.keys.size() * sizeof(ckf.keys[0]));
+				for (auto& key : ckf.keys)
 				{
-					(*kfs)[joint_index] = kf;
+					key.frame_id = LE2Native(key.frame_id);
+					for (uint32_t i = 0; i < 3; ++ i)
+					{
+						key.rotation[i] = LE2Native(key.rotation[i]);
+						key.translation[i] = LE2Native(key.translation[i]);
+					}
+					key.scale = LE2Native(key.scale);
 				}
 			}
 
@@ -1444,7 +1872,7 @@ namespace KlayGE
 	}
 
 	void SaveModel(std::string const & meshml_name, std::vector<RenderMaterialPtr> const & mtls,
-		std::vector<VertexElement> const & merged_ves, char all_is_index_16_bit, 
+		std::vector<VertexElement> const & merged_ves, std::vector<char> const & mesh_is_index_16_bit,
 		std::vector<std::vector<uint8_t>> const & merged_buffs, std::vector<uint8_t> const & merged_indices,
 		std::vector<std::string> const & mesh_names, std::vector<int32_t> const & mtl_ids,
 		std::vector<AABBox> const & pos_bbs, std::vector<AABBox> const & tc_bbs,
@@ -1713,7 +2141,7 @@ namespace KlayGE
 			{
 				int tri_id = obj.AllocTriangle(mesh_id);
 				int index[3];
-				if (all_is_index_16_bit)
+				if (mesh_is_index_16_bit[i])
 				{
 					uint16_t const * src = reinterpret_cast<uint16_t const *>(&merged_indices[(mesh_base_indices[i] + t) * sizeof(uint16_t)]);
 					index[0] = src[0];
@@ -1738,10 +2166,11 @@ namespace KlayGE
 				int kfs_id = obj.AllocKeyframes();
 				obj.SetKeyframes(kfs_id, joint_map[i]);
 
-				for (size_t k = 0; k < (*kfs)[i].frame_id.size(); ++ k)
+				KeyFrames const kf = DecompressKeyFrames((*kfs)[i]);
+				for (size_t k = 0; k < kf.frame_id.size(); ++ k)
 				{
 					int kf_id = obj.AllocKeyframe(kfs_id);
-					obj.SetKeyframe(kfs_id, kf_id, (*kfs)[i].frame_id[k], (*kfs)[i].bind_real[k] * (*kfs)[i].bind_scale[k], (*kfs)[i].bind_dual[k]);
+					obj.SetKeyframe(kfs_id, kf_id, kf.frame_id[k], kf.bind_real[k] * kf.bind_scale[k], kf.bind_dual[k]);
 				}
 			}
 
@@ -1783,9 +2212,9 @@ namespace KlayGE
 
 		std::vector<VertexElement> merged_ves;
 		std::vector<std::vector<uint8_t>> merged_buffs;
-		char all_is_index_16_bit = false;
 		std::vector<uint8_t> merged_indices;
 		std::vector<std::string> mesh_names(model->NumSubrenderables());
+		std::vector<char> mesh_is_index_16_bit(mesh_names.size());
 		std::vector<int32_t> mtl_ids(mesh_names.size());
 		std::vector<AABBox> pos_bbs(mesh_names.size());
 		std::vector<AABBox> tc_bbs(mesh_names.size());
@@ -1819,16 +2248,6 @@ namespace KlayGE
 					std::memcpy(&merged_buffs[j][0], mapper.Pointer<uint8_t>(), size);
 				}
 
-				if (EF_R16UI == rl.IndexStreamFormat())
-				{
-					all_is_index_16_bit = true;
-				}
-				else
-				{
-					BOOST_ASSERT(EF_R32UI == rl.IndexStreamFormat());
-					all_is_index_16_bit = false;
-				}
-
 				{
 					GraphicsBufferPtr ib = rl.GetIndexStream();
 					uint32_t size = ib->Size();
@@ -1852,10 +2271,20 @@ namespace KlayGE
 				pos_bbs[mesh_index] = mesh.PosBound();
 				tc_bbs[mesh_index] = mesh.TexcoordBound();
 
+				if (EF_R16UI == mesh.GetRenderLayout().IndexStreamFormat())
+				{
+					mesh_is_index_16_bit[mesh_index] = true;
+				}
+				else
+				{
+					BOOST_ASSERT(EF_R32UI == mesh.GetRenderLayout().IndexStreamFormat());
+					mesh_is_index_16_bit[mesh_index] = false;
+				}
+
 				mesh_num_vertices[mesh_index] = mesh.NumVertices();
 				mesh_base_vertices[mesh_index] = mesh.StartVertexLocation();
-				mesh_num_indices[mesh_index] = mesh.NumIndices();
-				mesh_base_indices[mesh_index] =  mesh.StartIndexLocation();
+				mesh_num_indices[mesh_index] = mesh.LodNumIndices(0);
+				mesh_base_indices[mesh_index] = mesh.LodStartIndexLocation(0);
 			}
 		}
 
@@ -1914,7 +2343,7 @@ namespace KlayGE
 			kfs = skinned->GetKeyFrames();
 		}
 
-		SaveModel(meshml_name, mtls, merged_ves, all_is_index_16_bit, merged_buffs, merged_indices,
+		SaveModel(meshml_name, mtls, merged_ves, mesh_is_index_16_bit, merged_buffs, merged_indices,
 			mesh_names, mtl_ids, pos_bbs, tc_bbs,
 			mesh_num_vertices, mesh_base_vertices, mesh_num_indices, mesh_base_indices,
 			joints, actions, kfs, num_frame, frame_rate);
@@ -0,0 +1,799 @@
+/**
+ * @file MeshOptimizer.cpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Math.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include <KlayGE/MeshOptimizer.hpp>
+
+namespace
+{
+	using namespace KlayGE;
+
+	// Forsyth's cache is modelled as LRU, bigger than the real FIFO one so the scores look ahead a little
+	uint32_t const FORSYTH_CACHE_SIZE = 32;
+	float const FORSYTH_CACHE_DECAY_POWER = 1.5f;
+	float const FORSYTH_LAST_TRI_SCORE = 0.75f;
+	float const FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+	float const FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+	float ForsythVertexScore(int32_t cache_position, uint32_t remaining_valence)
+	{
+		if (0 == remaining_valence)
+		{
+			// Nothing left to draw with it
+			return -1;
+		}
+
+		float score = 0;
+		if (cache_position >= 0)
+		{
+			if (cache_position < 3)
+			{
+				// Used by the last triangle. A fixed score, so the next triangle doesn't just strip along.
+				score = FORSYTH_LAST_TRI_SCORE;
+			}
+			else
+			{
+				float const scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+				score = std::pow(1.0f - (cache_position - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+			}
+		}
+
+		// Finishes off vertices with few triangles left, so they don't linger
+		score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remaining_valence), -FORSYTH_VALENCE_BOOST_POWER);
+		return score;
+	}
+
+	// Triangles of each vertex, as offsets into one array
+	void BuildVertexTriangles(ArrayRef<uint32_t> indices, uint32_t num_vertices,
+		std::vector<uint32_t>& offsets, std::vector<uint32_t>& triangles)
+	{
+		offsets.assign(num_vertices + 1, 0);
+		for (auto index : indices)
+		{
+			++ offsets[index + 1];
+		}
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		triangles.resize(indices.size());
+		for (size_t i = 0; i < indices.size(); ++ i)
+		{
+			triangles[fill[indices[i]] ++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	// Symmetric 4x4 matrix of a quadric, plus the total weight of the planes in it. Double, so the small errors of
+	//  nearly flat areas survive the sums.
+	struct Quadric
+	{
+		double a00, a01, a02, a03;
+		double a11, a12, a13;
+		double a22, a23;
+		double a33;
+		double weight;
+	};
+
+	Quadric PlaneQuadric(float3 const & normal, float3 const & point, double weight)
+	{
+		double const a = normal.x();
+		double const b = normal.y();
+		double const c = normal.z();
+		double const d = -MathLib::dot(normal, point);
+
+		Quadric q;
+		q.a00 = a * a * weight;
+		q.a01 = a * b * weight;
+		q.a02 = a * c * weight;
+		q.a03 = a * d * weight;
+		q.a11 = b * b * weight;
+		q.a12 = b * c * weight;
+		q.a13 = b * d * weight;
+		q.a22 = c * c * weight;
+		q.a23 = c * d * weight;
+		q.a33 = d * d * weight;
+		q.weight = weight;
+		return q;
+	}
+
+	void AddQuadric(Quadric& lhs, Quadric const & rhs)
+	{
+		lhs.a00 += rhs.a00;
+		lhs.a01 += rhs.a01;
+		lhs.a02 += rhs.a02;
+		lhs.a03 += rhs.a03;
+		lhs.a11 += rhs.a11;
+		lhs.a12 += rhs.a12;
+		lhs.a13 += rhs.a13;
+		lhs.a22 += rhs.a22;
+		lhs.a23 += rhs.a23;
+		lhs.a33 += rhs.a33;
+		lhs.weight += rhs.weight;
+	}
+
+	// Weighted average of squared distances from the point to the planes
+	double QuadricError(Quadric const & q, float3 const & p)
+	{
+		double const x = p.x();
+		double const y = p.y();
+		double const z = p.z();
+
+		double const rx = q.a00 * x + q.a01 * y + q.a02 * z + q.a03;
+		double const ry = q.a01 * x + q.a11 * y + q.a12 * z + q.a13;
+		double const rz = q.a02 * x + q.a12 * y + q.a22 * z + q.a23;
+		double const rw = q.a03 * x + q.a13 * y + q.a23 * z + q.a33;
+		double const error = rx * x + ry * y + rz * z + rw;
+		return (q.weight > 0) ? std::max(error, 0.0) / q.weight : 0.0;
+	}
+
+	uint64_t EdgeKey(uint32_t a, uint32_t b)
+	{
+		return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	}
+
+	// The first vertex of each position. Seams split a position into vertices with different normals or UVs.
+	std::vector<uint32_t> BuildPositionIds(ArrayRef<float3> positions)
+	{
+		uint32_t const num_vertices = static_cast<uint32_t>(positions.size());
+		std::vector<uint32_t> sorted(num_vertices);
+		std::iota(sorted.begin(), sorted.end(), 0);
+		std::stable_sort(sorted.begin(), sorted.end(),
+			[&positions](uint32_t lhs, uint32_t rhs)
+			{
+				float3 const & l = positions[lhs];
+				float3 const & r = positions[rhs];
+				return (l.x() < r.x()) || ((l.x() == r.x()) && ((l.y() < r.y()) || ((l.y() == r.y()) && (l.z() < r.z()))));
+			});
+
+		std::vector<uint32_t> pos_ids(num_vertices);
+		for (uint32_t i = 0; i < num_vertices; ++ i)
+		{
+			uint32_t const v = sorted[i];
+			pos_ids[v] = ((i > 0) && (positions[sorted[i - 1]] == positions[v])) ? pos_ids[sorted[i - 1]] : v;
+		}
+		return pos_ids;
+	}
+
+	// Edges, by position, used by only one triangle
+	std::vector<uint64_t> BuildBorderEdges(ArrayRef<uint32_t> indices, std::vector<uint32_t> const & pos_ids)
+	{
+		std::vector<uint64_t> edges(indices.size());
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				edges[i + j] = EdgeKey(pos_ids[indices[i + j]], pos_ids[indices[i + (j + 1) % 3]]);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		std::vector<uint64_t> border_edges;
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i + 1;
+			while ((j < edges.size()) && (edges[j] == edges[i]))
+			{
+				++ j;
+			}
+			if (j - i == 1)
+			{
+				border_edges.push_back(edges[i]);
+			}
+			i = j;
+		}
+		return border_edges;
+	}
+}
+
+namespace KlayGE
+{
+	VertexCacheStats AnalyzeVertexCache(ArrayRef<uint32_t> indices, uint32_t num_vertices, uint32_t cache_size)
+	{
+		BOOST_ASSERT(cache_size > 0);
+
+		// A vertex is in the cache if it was added within the last cache_size misses
+		std::vector<uint32_t> cache_timestamps(num_vertices, 0);
+		uint32_t timestamp = cache_size + 1;
+		uint32_t misses = 0;
+		for (auto index : indices)
+		{
+			BOOST_ASSERT(index < num_vertices);
+			if (timestamp - cache_timestamps[index] > cache_size)
+			{
+				cache_timestamps[index] = timestamp;
+				++ timestamp;
+				++ misses;
+			}
+		}
+
+		std::vector<bool> used(num_vertices, false);
+		uint32_t num_used = 0;
+		for (auto index : indices)
+		{
+			if (!used[index])
+			{
+				used[index] = true;
+				++ num_used;
+			}
+		}
+
+		VertexCacheStats stats;
+		uint32_t const num_triangles = static_cast<uint32_t>(indices.size() / 3);
+		stats.acmr = (num_triangles > 0) ? static_cast<float>(misses) / num_triangles : 0.0f;
+		stats.atvr = (num_used > 0) ? static_cast<float>(misses) / num_used : 0.0f;
+		return stats;
+	}
+
+	void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t num_vertices)
+	{
+		BOOST_ASSERT(indices.size() % 3 == 0);
+
+		uint32_t const num_triangles = static_cast<uint32_t>(indices.size() / 3);
+		if (0 == num_triangles)
+		{
+			return;
+		}
+
+		std::vector<uint32_t> vertex_tri_offsets;
+		std::vector<uint32_t> vertex_tris;
+		BuildVertexTriangles(indices, num_vertices, vertex_tri_offsets, vertex_tris);
+
+		std::vector<uint32_t> remaining_valence(num_vertices);
+		for (uint32_t v = 0; v < num_vertices; ++ v)
+		{
+			remaining_valence[v] = vertex_tri_offsets[v + 1] - vertex_tri_offsets[v];
+		}
+
+		std::vector<int32_t> cache_positions(num_vertices, -1);
+		std::vector<float> vertex_scores(num_vertices);
+		for (uint32_t v = 0; v < num_vertices; ++ v)
+		{
+			vertex_scores[v] = ForsythVertexScore(-1, remaining_valence[v]);
+		}
+
+		std::vector<float> tri_scores(num_triangles);
+		for (uint32_t t = 0; t < num_triangles; ++ t)
+		{
+			tri_scores[t] = vertex_scores[indices[t * 3 + 0]] + vertex_scores[indices[t * 3 + 1]]
+				+ vertex_scores[indices[t * 3 + 2]];
+		}
+
+		std::vector<bool> emitted(num_triangles, false);
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+
+		// 3 extra slots hold the vertices pushed out by the triangle just added
+		std::vector<uint32_t> cache;
+		cache.reserve(FORSYTH_CACHE_SIZE + 3);
+		std::vector<uint32_t> new_cache;
+		new_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+		uint32_t best_tri = static_cast<uint32_t>(std::max_element(tri_scores.begin(), tri_scores.end()) - tri_scores.begin());
+		uint32_t scan_pos = 0;
+		for (uint32_t num_emitted = 0; num_emitted < num_triangles; ++ num_emitted)
+		{
+			if (best_tri >= num_triangles)
+			{
+				// Nothing in the cache to continue from, take the next triangle in input order
+				while (emitted[scan_pos])
+				{
+					++ scan_pos;
+				}
+				best_tri = scan_pos;
+			}
+
+			emitted[best_tri] = true;
+			uint32_t const * tri = &indices[best_tri * 3];
+			output.insert(output.end(), tri, tri + 3);
+
+			new_cache.assign(tri, tri + 3);
+			for (uint32_t i = 0; i < 3; ++ i)
+			{
+				uint32_t const v = tri[i];
+				-- remaining_valence[v];
+
+				// Moves the triangle to the back of the vertex's list, so the live ones come first
+				uint32_t* begin = &vertex_tris[vertex_tri_offsets[v]];
+				uint32_t* end = begin + remaining_valence[v] + 1;
+				std::swap(*std::find(begin, end, best_tri), *(end - 1));
+			}
+			for (auto v : cache)
+			{
+				if ((v != tri[0]) && (v != tri[1]) && (v != tri[2]))
+				{
+					new_cache.push_back(v);
+				}
+			}
+			cache.swap(new_cache);
+
+			for (uint32_t i = 0; i < cache.size(); ++ i)
+			{
+				uint32_t const v = cache[i];
+				cache_positions[v] = (i < FORSYTH_CACHE_SIZE) ? static_cast<int32_t>(i) : -1;
+
+				float const new_score = ForsythVertexScore(cache_positions[v], remaining_valence[v]);
+				float const diff = new_score - vertex_scores[v];
+				vertex_scores[v] = new_score;
+				for (uint32_t j = 0; j < remaining_valence[v]; ++ j)
+				{
+					tri_scores[vertex_tris[vertex_tri_offsets[v] + j]] += diff;
+				}
+			}
+			if (cache.size() > FORSYTH_CACHE_SIZE)
+			{
+				cache.resize(FORSYTH_CACHE_SIZE);
+			}
+
+			// Only triangles of cached vertices change score, so the best one is among them
+			best_tri = num_triangles;
+			float best_score = -1e10f;
+			for (auto v : cache)
+			{
+				for (uint32_t j = 0; j < remaining_valence[v]; ++ j)
+				{
+					uint32_t const t = vertex_tris[vertex_tri_offsets[v] + j];
+					if (tri_scores[t] > best_score)
+					{
+						best_score = tri_scores[t];
+						best_tri = t;
+					}
+				}
+			}
+		}
+
+		indices.swap(output);
+	}
+
+	void OptimizeOverdraw(std::vector<uint32_t>& indices, ArrayRef<float3> positions, float threshold)
+	{
+		BOOST_ASSERT(indices.size() % 3 == 0);
+
+		uint32_t const num_triangles = static_cast<uint32_t>(indices.size() / 3);
+		uint32_t const num_vertices = static_cast<uint32_t>(positions.size());
+		if (num_triangles < 2)
+		{
+			return;
+		}
+
+		uint32_t const cache_size = 16;
+		float const mesh_acmr = AnalyzeVertexCache(indices, num_vertices, cache_size).acmr;
+
+		// Clusters can be drawn in any order, so each one is simulated from an empty cache. A cluster ends once its
+		//  own ACMR is good enough, keeping the whole mesh near its cache optimized ACMR. A triangle missing all
+		//  3 vertices starts over anyway, so it's a free cut.
+		std::vector<uint32_t> cluster_starts(1, 0);
+		{
+			std::vector<uint32_t> cache_timestamps(num_vertices, 0);
+			uint32_t timestamp = cache_size + 1;
+			uint32_t cluster_misses = 0;
+			for (uint32_t t = 0; t < num_triangles; ++ t)
+			{
+				uint32_t tri_misses = 0;
+				for (uint32_t i = 0; i < 3; ++ i)
+				{
+					uint32_t const v = indices[t * 3 + i];
+					if (timestamp - cache_timestamps[v] > cache_size)
+					{
+						cache_timestamps[v] = timestamp;
+						++ timestamp;
+						++ tri_misses;
+					}
+				}
+
+				if ((3 == tri_misses) && (t > cluster_starts.back()))
+				{
+					cluster_starts.push_back(t);
+					cluster_misses = 0;
+				}
+				cluster_misses += tri_misses;
+
+				uint32_t const cluster_size = t + 1 - cluster_starts.back();
+				if ((cluster_size >= 32) && (t + 1 < num_triangles)
+					&& (static_cast<float>(cluster_misses) / cluster_size <= mesh_acmr * threshold))
+				{
+					cluster_starts.push_back(t + 1);
+					cluster_misses = 0;
+					timestamp += cache_size + 1;
+				}
+			}
+			cluster_starts.push_back(num_triangles);
+		}
+
+		uint32_t const num_clusters = static_cast<uint32_t>(cluster_starts.size() - 1);
+		if (num_clusters < 2)
+		{
+			return;
+		}
+
+		float3 mesh_centroid(0, 0, 0);
+		for (auto const & pos : positions)
+		{
+			mesh_centroid += pos;
+		}
+		mesh_centroid /= static_cast<float>(num_vertices);
+
+		// Clusters facing away from the center are in front of the rest from most view points
+		std::vector<std::pair<float, uint32_t>> cluster_keys(num_clusters);
+		for (uint32_t c = 0; c < num_clusters; ++ c)
+		{
+			float3 centroid(0, 0, 0);
+			float3 normal(0, 0, 0);
+			float area = 0;
+			for (uint32_t t = cluster_starts[c]; t < cluster_starts[c + 1]; ++ t)
+			{
+				float3 const & p0 = positions[indices[t * 3 + 0]];
+				float3 const & p1 = positions[indices[t * 3 + 1]];
+				float3 const & p2 = positions[indices[t * 3 + 2]];
+				float3 const n = MathLib::cross(p1 - p0, p2 - p0);
+				float const tri_area = MathLib::length(n);
+
+				centroid += (p0 + p1 + p2) * (tri_area / 3);
+				normal += n;
+				area += tri_area;
+			}
+			if (area > 0)
+			{
+				centroid /= area;
+			}
+			float const normal_length = MathLib::length(normal);
+			if (normal_length > 0)
+			{
+				normal /= normal_length;
+			}
+
+			cluster_keys[c] = std::make_pair(-MathLib::dot(centroid - mesh_centroid, normal), c);
+		}
+		std::stable_sort(cluster_keys.begin(), cluster_keys.end(),
+			[](std::pair<float, uint32_t> const & lhs, std::pair<float, uint32_t> const & rhs)
+			{
+				return lhs.first < rhs.first;
+			});
+
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+		for (auto const & key : cluster_keys)
+		{
+			uint32_t const c = key.second;
+			output.insert(output.end(), indices.begin() + cluster_starts[c] * 3, indices.begin() + cluster_starts[c + 1] * 3);
+		}
+		indices.swap(output);
+	}
+
+	std::vector<uint32_t> OptimizeVertexFetch(std::vector<uint32_t>& indices, uint32_t num_vertices)
+	{
+		uint32_t const unused = 0xFFFFFFFF;
+
+		std::vector<uint32_t> remap(num_vertices, unused);
+		uint32_t next_vertex = 0;
+		for (auto& index : indices)
+		{
+			BOOST_ASSERT(index < num_vertices);
+			if (unused == remap[index])
+			{
+				remap[index] = next_vertex;
+				++ next_vertex;
+			}
+			index = remap[index];
+		}
+		for (auto& r : remap)
+		{
+			if (unused == r)
+			{
+				r = next_vertex;
+				++ next_vertex;
+			}
+		}
+
+		return remap;
+	}
+
+	void RemapVertices(void* vertices, uint32_t stride, ArrayRef<uint32_t> remap)
+	{
+		uint8_t* p = static_cast<uint8_t*>(vertices);
+		std::vector<uint8_t> old_vertices(p, p + remap.size() * stride);
+		for (size_t i = 0; i < remap.size(); ++ i)
+		{
+			std::memcpy(p + remap[i] * stride, &old_vertices[i * stride], stride);
+		}
+	}
+
+	std::vector<uint32_t> SimplifyMesh(ArrayRef<uint32_t> indices, ArrayRef<float3> positions,
+		uint32_t target_num_indices, float target_error, float* result_error)
+	{
+		BOOST_ASSERT(indices.size() % 3 == 0);
+
+		uint32_t const num_vertices = static_cast<uint32_t>(positions.size());
+		std::vector<uint32_t> output(indices.begin(), indices.end());
+		double max_error = 0;
+
+		std::vector<uint32_t> const pos_ids = BuildPositionIds(positions);
+
+		// A vertex sharing its position with another is on a seam, and locked. Collapsing it would tear the seam.
+		std::vector<bool> seam(num_vertices, false);
+		for (uint32_t v = 0; v < num_vertices; ++ v)
+		{
+			if (pos_ids[v] != v)
+			{
+				seam[v] = true;
+				seam[pos_ids[v]] = true;
+			}
+		}
+
+		std::vector<uint64_t> border_edges = BuildBorderEdges(output, pos_ids);
+		std::vector<bool> border(num_vertices, false);
+		for (size_t i = 0; i < output.size(); i += 3)
+		{
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				uint32_t const a = output[i + j];
+				uint32_t const b = output[i + (j + 1) % 3];
+				if (std::binary_search(border_edges.begin(), border_edges.end(), EdgeKey(pos_ids[a], pos_ids[b])))
+				{
+					border[a] = true;
+					border[b] = true;
+				}
+			}
+		}
+
+		// Planes of the triangles around each vertex, and planes perpendicular to the border edges to keep borders in place
+		std::vector<Quadric> quadrics(num_vertices);
+		std::memset(quadrics.data(), 0, quadrics.size() * sizeof(quadrics[0]));
+		for (size_t i = 0; i < output.size(); i += 3)
+		{
+			float3 const & p0 = positions[output[i + 0]];
+			float3 const & p1 = positions[output[i + 1]];
+			float3 const & p2 = positions[output[i + 2]];
+			float3 normal = MathLib::cross(p1 - p0, p2 - p0);
+			float const area = MathLib::length(normal);
+			if (area <= 0)
+			{
+				continue;
+			}
+			normal /= area;
+
+			Quadric const q = PlaneQuadric(normal, p0, area);
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				AddQuadric(quadrics[output[i + j]], q);
+			}
+
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				uint32_t const a = output[i + j];
+				uint32_t const b = output[i + (j + 1) % 3];
+				if (std::binary_search(border_edges.begin(), border_edges.end(), EdgeKey(pos_ids[a], pos_ids[b])))
+				{
+					float3 const edge = positions[b] - positions[a];
+					float const length = MathLib::length(edge);
+					if (length > 0)
+					{
+						float3 const edge_normal = MathLib::normalize(MathLib::cross(edge, normal));
+						Quadric const eq = PlaneQuadric(edge_normal, positions[a], length * length * 10);
+						AddQuadric(quadrics[a], eq);
+						AddQuadric(quadrics[b], eq);
+					}
+				}
+			}
+		}
+
+		double const max_cost = static_cast<double>(target_error) * target_error;
+
+		struct Collapse
+		{
+			double cost;
+			uint32_t from;
+			uint32_t to;
+		};
+		std::vector<Collapse> collapses;
+		std::vector<uint64_t> edges;
+		std::vector<uint32_t> vertex_tri_offsets;
+		std::vector<uint32_t> vertex_tris;
+		std::vector<bool> locked(num_vertices);
+		std::vector<uint32_t> remap(num_vertices);
+
+		// Each pass takes the cheap collapses that don't touch each other, then rebuilds
+		bool limit_pass_error = true;
+		while (output.size() > target_num_indices)
+		{
+			edges.resize(output.size());
+			for (size_t i = 0; i < output.size(); i += 3)
+			{
+				for (uint32_t j = 0; j < 3; ++ j)
+				{
+					edges[i + j] = EdgeKey(output[i + j], output[i + (j + 1) % 3]);
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+			edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+			border_edges = BuildBorderEdges(output, pos_ids);
+
+			auto can_collapse = [&](uint32_t from, uint32_t to)
+			{
+				if (seam[from])
+				{
+					return false;
+				}
+				if (border[from])
+				{
+					return std::binary_search(border_edges.begin(), border_edges.end(), EdgeKey(pos_ids[from], pos_ids[to]));
+				}
+				return true;
+			};
+
+			collapses.clear();
+			for (auto edge : edges)
+			{
+				uint32_t const a = static_cast<uint32_t>(edge >> 32);
+				uint32_t const b = static_cast<uint32_t>(edge & 0xFFFFFFFF);
+
+				Collapse c;
+				c.cost = -1;
+				if (can_collapse(a, b))
+				{
+					c.cost = QuadricError(quadrics[a], positions[b]);
+					c.from = a;
+					c.to = b;
+				}
+				if (can_collapse(b, a))
+				{
+					double const cost = QuadricError(quadrics[b], positions[a]);
+					if ((c.cost < 0) || (cost < c.cost))
+					{
+						c.cost = cost;
+						c.from = b;
+						c.to = a;
+					}
+				}
+				if ((c.cost >= 0) && (c.cost <= max_cost))
+				{
+					collapses.push_back(c);
+				}
+			}
+			if (collapses.empty())
+			{
+				break;
+			}
+			std::sort(collapses.begin(), collapses.end(),
+				[](Collapse const & lhs, Collapse const & rhs)
+				{
+					return lhs.cost < rhs.cost;
+				});
+
+			// Later collapses in a pass are blocked by the earlier ones, and would be costlier than what the next pass offers
+			double const pass_max_cost = limit_pass_error ? collapses[collapses.size() / 4].cost * 1.5 : max_cost;
+
+			BuildVertexTriangles(output, num_vertices, vertex_tri_offsets, vertex_tris);
+			locked.assign(num_vertices, false);
+			std::iota(remap.begin(), remap.end(), 0);
+
+			uint32_t num_triangles = static_cast<uint32_t>(output.size() / 3);
+			uint32_t const target_num_triangles = target_num_indices / 3;
+			uint32_t num_collapsed = 0;
+			for (auto const & c : collapses)
+			{
+				if ((c.cost > pass_max_cost) || (num_triangles <= target_num_triangles))
+				{
+					break;
+				}
+				if (locked[c.from] || locked[c.to])
+				{
+					continue;
+				}
+
+				// Triangles around from move to, none of them may flip
+				bool flipped = false;
+				uint32_t num_removed = 0;
+				for (uint32_t i = vertex_tri_offsets[c.from]; i < vertex_tri_offsets[c.from + 1]; ++ i)
+				{
+					uint32_t const * tri = &output[vertex_tris[i] * 3];
+					if ((tri[0] == c.to) || (tri[1] == c.to) || (tri[2] == c.to))
+					{
+						++ num_removed;
+						continue;
+					}
+
+					float3 p[3] = { positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+					float3 const old_normal = MathLib::cross(p[1] - p[0], p[2] - p[0]);
+					for (uint32_t j = 0; j < 3; ++ j)
+					{
+						if (tri[j] == c.from)
+						{
+							p[j] = positions[c.to];
+						}
+					}
+					float3 const new_normal = MathLib::cross(p[1] - p[0], p[2] - p[0]);
+					if (MathLib::dot(old_normal, new_normal) <= 0)
+					{
+						flipped = true;
+						break;
+					}
+				}
+				if (flipped)
+				{
+					continue;
+				}
+
+				remap[c.from] = c.to;
+				AddQuadric(quadrics[c.to], quadrics[c.from]);
+				for (uint32_t i = vertex_tri_offsets[c.from]; i < vertex_tri_offsets[c.from + 1]; ++ i)
+				{
+					uint32_t const * tri = &output[vertex_tris[i] * 3];
+					locked[tri[0]] = true;
+					locked[tri[1]] = true;
+					locked[tri[2]] = true;
+				}
+
+				max_error = std::max(max_error, c.cost);
+				num_triangles -= num_removed;
+				++ num_collapsed;
+			}
+
+			if (0 == num_collapsed)
+			{
+				if (limit_pass_error)
+				{
+					limit_pass_error = false;
+					continue;
+				}
+				break;
+			}
+			limit_pass_error = true;
+
+			size_t num_indices = 0;
+			for (size_t i = 0; i < output.size(); i += 3)
+			{
+				uint32_t const v0 = remap[output[i + 0]];
+				uint32_t const v1 = remap[output[i + 1]];
+				uint32_t const v2 = remap[output[i + 2]];
+				if ((v0 != v1) && (v1 != v2) && (v2 != v0))
+				{
+					output[num_indices + 0] = v0;
+					output[num_indices + 1] = v1;
+					output[num_indices + 2] = v2;
+					num_indices += 3;
+				}
+			}
+			output.resize(num_indices);
+		}
+
+		if (result_error)
+		{
+			*result_error = static_cast<float>(std::sqrt(max_error));
+		}
+		return output;
+	}
+}
@@ -0,0 +1,239 @@
+/**
+ * @file Meshlet.cpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Math.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <KlayGE/Meshlet.hpp>
+
+namespace
+{
+	using namespace KlayGE;
+
+	void MeshletBounds(Meshlet& meshlet, ArrayRef<uint32_t> indices, ArrayRef<float3> positions)
+	{
+		uint32_t const * tris = &indices[meshlet.start_index];
+
+		float3 min_pos = positions[tris[0]];
+		float3 max_pos = min_pos;
+		for (uint32_t i = 1; i < meshlet.num_indices; ++ i)
+		{
+			min_pos = MathLib::minimize(min_pos, positions[tris[i]]);
+			max_pos = MathLib::maximize(max_pos, positions[tris[i]]);
+		}
+		meshlet.center = (min_pos + max_pos) * 0.5f;
+		meshlet.radius = 0;
+		for (uint32_t i = 0; i < meshlet.num_indices; ++ i)
+		{
+			meshlet.radius = std::max(meshlet.radius, MathLib::length(positions[tris[i]] - meshlet.center));
+		}
+
+		std::vector<float3> normals;
+		normals.reserve(meshlet.num_indices / 3);
+		float3 axis(0, 0, 0);
+		for (uint32_t i = 0; i < meshlet.num_indices; i += 3)
+		{
+			float3 const & p0 = positions[tris[i + 0]];
+			float3 const & p1 = positions[tris[i + 1]];
+			float3 const & p2 = positions[tris[i + 2]];
+			float3 const n = MathLib::cross(p1 - p0, p2 - p0);
+			float const length = MathLib::length(n);
+			if (length > 0)
+			{
+				normals.push_back(n / length);
+				axis += normals.back();
+			}
+		}
+
+		float const axis_length = MathLib::length(axis);
+		if (axis_length > 1e-6f)
+		{
+			meshlet.cone_axis = axis / axis_length;
+			meshlet.cone_cos = 1;
+			for (auto const & n : normals)
+			{
+				meshlet.cone_cos = std::min(meshlet.cone_cos, MathLib::dot(meshlet.cone_axis, n));
+			}
+		}
+		else
+		{
+			meshlet.cone_axis = float3(0, 0, 1);
+			meshlet.cone_cos = -1;
+		}
+		meshlet.cone_sin = std::sqrt(std::max(1 - meshlet.cone_cos * meshlet.cone_cos, 0.0f));
+	}
+
+	// All triangles face away if every normal is within 90 degrees of the direction from the eye to any point
+	//  of the sphere. The normals are at most the cone angle off the axis, so the cone angle plus the axis' angle
+	//  to the center has to leave room for the sphere.
+	bool MeshletBackFacing(Meshlet const & meshlet, float3 const & eye_pos)
+	{
+		if (meshlet.cone_cos <= 0)
+		{
+			return false;
+		}
+
+		float3 const to_center = meshlet.center - eye_pos;
+		float const dist = MathLib::length(to_center);
+		if (dist <= meshlet.radius)
+		{
+			return false;
+		}
+
+		float const cos_to_center = MathLib::dot(meshlet.cone_axis, to_center) / dist;
+		float const sin_to_center = std::sqrt(std::max(1 - cos_to_center * cos_to_center, 0.0f));
+		float const cos_sum = cos_to_center * meshlet.cone_cos - sin_to_center * meshlet.cone_sin;
+		return dist * cos_sum >= meshlet.radius;
+	}
+}
+
+namespace KlayGE
+{
+	std::vector<Meshlet> BuildMeshlets(ArrayRef<uint32_t> indices, ArrayRef<float3> positions,
+		uint32_t max_vertices, uint32_t max_triangles)
+	{
+		BOOST_ASSERT(indices.size() % 3 == 0);
+		BOOST_ASSERT(max_vertices >= 3);
+
+		std::vector<Meshlet> meshlets;
+		if (indices.empty())
+		{
+			return meshlets;
+		}
+
+		// Which meshlet last used each vertex
+		std::vector<uint32_t> vertex_meshlets(positions.size(), 0xFFFFFFFF);
+
+		Meshlet meshlet;
+		meshlet.start_index = 0;
+		meshlet.num_indices = 0;
+		uint32_t num_vertices = 0;
+		for (uint32_t i = 0; i < indices.size(); i += 3)
+		{
+			uint32_t const meshlet_id = static_cast<uint32_t>(meshlets.size());
+
+			uint32_t num_new_vertices = 0;
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				if (vertex_meshlets[indices[i + j]] != meshlet_id)
+				{
+					++ num_new_vertices;
+				}
+			}
+			if ((num_vertices + num_new_vertices > max_vertices) || (meshlet.num_indices / 3 >= max_triangles))
+			{
+				MeshletBounds(meshlet, indices, positions);
+				meshlets.push_back(meshlet);
+
+				meshlet.start_index = i;
+				meshlet.num_indices = 0;
+				num_vertices = 0;
+				num_new_vertices = 3;
+			}
+
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				vertex_meshlets[indices[i + j]] = static_cast<uint32_t>(meshlets.size());
+			}
+			num_vertices += num_new_vertices;
+			meshlet.num_indices += 3;
+		}
+		MeshletBounds(meshlet, indices, positions);
+		meshlets.push_back(meshlet);
+
+		return meshlets;
+	}
+
+	uint32_t CullMeshlets(ArrayRef<Meshlet> meshlets, Frustum const & frustum, float3 const & eye_pos,
+		std::vector<uint32_t>& visible_meshlets)
+	{
+		visible_meshlets.clear();
+
+		uint32_t num_indices = 0;
+		for (uint32_t i = 0; i < meshlets.size(); ++ i)
+		{
+			Meshlet const & meshlet = meshlets[i];
+			if (!MeshletBackFacing(meshlet, eye_pos)
+				&& (frustum.Intersect(Sphere(meshlet.center, meshlet.radius)) != BO_No))
+			{
+				visible_meshlets.push_back(i);
+				num_indices += meshlet.num_indices;
+			}
+		}
+		return num_indices;
+	}
+
+	uint32_t CullMeshlets(ArrayRef<Meshlet> meshlets, Frustum const & frustum,
+		std::vector<uint32_t>& visible_meshlets)
+	{
+		visible_meshlets.clear();
+
+		uint32_t num_indices = 0;
+		for (uint32_t i = 0; i < meshlets.size(); ++ i)
+		{
+			Meshlet const & meshlet = meshlets[i];
+			if (frustum.Intersect(Sphere(meshlet.center, meshlet.radius)) != BO_No)
+			{
+				visible_meshlets.push_back(i);
+				num_indices += meshlet.num_indices;
+			}
+		}
+		return num_indices;
+	}
+
+	void CompactMeshletIndices(ArrayRef<Meshlet> meshlets, ArrayRef<uint32_t> meshlet_ids,
+		void const * indices, uint32_t index_size, std::vector<uint8_t>& compacted)
+	{
+		BOOST_ASSERT((2 == index_size) || (4 == index_size));
+
+		uint8_t const * src = static_cast<uint8_t const *>(indices);
+
+		compacted.clear();
+		for (size_t i = 0; i < meshlet_ids.size();)
+		{
+			// Meshlets next to each other in the mesh copy in one go
+			uint32_t const start_index = meshlets[meshlet_ids[i]].start_index;
+			uint32_t end_index = start_index + meshlets[meshlet_ids[i]].num_indices;
+			++ i;
+			while ((i < meshlet_ids.size()) && (meshlets[meshlet_ids[i]].start_index == end_index))
+			{
+				end_index += meshlets[meshlet_ids[i]].num_indices;
+				++ i;
+			}
+
+			compacted.insert(compacted.end(), src + start_index * index_size, src + end_index * index_size);
+		}
+	}
+}
@@ -113,6 +113,11 @@ namespace
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return ps_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return false;
@@ -346,6 +351,13 @@ namespace
 			return true;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, ps_desc_.res_name.begin(), ps_desc_.res_name.end());
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
@@ -83,6 +83,11 @@ namespace
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return pp_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return false;
@@ -190,6 +195,14 @@ namespace
 			return true;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, pp_desc_.res_name.begin(), pp_desc_.res_name.end());
+			HashRange(seed, pp_desc_.pp_name.begin(), pp_desc_.pp_name.end());
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
@@ -2673,6 +2673,11 @@ namespace KlayGE
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return effect_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return false;
@@ -2693,6 +2698,13 @@ namespace KlayGE
 			return false;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, effect_desc_.res_name.begin(), effect_desc_.res_name.end());
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
@@ -121,6 +121,11 @@ namespace
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return mtl_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return true;
@@ -361,6 +366,13 @@ namespace
 			return true;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, mtl_desc_.res_name.begin(), mtl_desc_.res_name.end());
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
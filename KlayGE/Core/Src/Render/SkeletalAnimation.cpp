@@ -0,0 +1,904 @@
+/**
+ * @file SkeletalAnimation.cpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Math.hpp>
+#include <KFL/SIMDMath.hpp>
+#include <KlayGE/Mesh.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include <KlayGE/SkeletalAnimation.hpp>
+
+namespace
+{
+	using namespace KlayGE;
+
+	uint32_t const NUM_LANES = 4;
+
+	inline SIMDVectorF4 Set(float const (&fs)[NUM_LANES])
+	{
+		return SIMDMathLib::SetVector(fs[0], fs[1], fs[2], fs[3]);
+	}
+
+	inline void Store(float (&fs)[NUM_LANES], SIMDVectorF4 const & lanes)
+	{
+		fs[0] = SIMDMathLib::GetX(lanes);
+		fs[1] = SIMDMathLib::GetY(lanes);
+		fs[2] = SIMDMathLib::GetZ(lanes);
+		fs[3] = SIMDMathLib::GetW(lanes);
+	}
+
+	// Component k of NUM_LANES quaternions
+	struct QuatLanes
+	{
+		SIMDVectorF4 x, y, z, w;
+	};
+
+	// The same product as MathLib::mul, lane by lane
+	inline QuatLanes MulQuat(QuatLanes const & lhs, QuatLanes const & rhs)
+	{
+		using namespace SIMDMathLib;
+		return QuatLanes{
+			Add(Add(Multiply(lhs.x, rhs.w), Multiply(lhs.w, rhs.x)), Substract(Multiply(lhs.z, rhs.y), Multiply(lhs.y, rhs.z))),
+			Add(Add(Multiply(lhs.y, rhs.w), Multiply(lhs.w, rhs.y)), Substract(Multiply(lhs.x, rhs.z), Multiply(lhs.z, rhs.x))),
+			Add(Add(Multiply(lhs.z, rhs.w), Multiply(lhs.w, rhs.z)), Substract(Multiply(lhs.y, rhs.x), Multiply(lhs.x, rhs.y))),
+			Substract(Substract(Multiply(lhs.w, rhs.w), Multiply(lhs.x, rhs.x)), Add(Multiply(lhs.y, rhs.y), Multiply(lhs.z, rhs.z)))
+		};
+	}
+
+	inline QuatLanes AddQuat(QuatLanes const & lhs, QuatLanes const & rhs)
+	{
+		using namespace SIMDMathLib;
+		return QuatLanes{ Add(lhs.x, rhs.x), Add(lhs.y, rhs.y), Add(lhs.z, rhs.z), Add(lhs.w, rhs.w) };
+	}
+
+	inline QuatLanes ScaleQuat(QuatLanes const & lhs, SIMDVectorF4 const & rhs)
+	{
+		using namespace SIMDMathLib;
+		return QuatLanes{ Multiply(lhs.x, rhs), Multiply(lhs.y, rhs), Multiply(lhs.z, rhs), Multiply(lhs.w, rhs) };
+	}
+
+	inline QuatLanes LerpQuat(QuatLanes const & lhs, QuatLanes const & rhs, SIMDVectorF4 const & s)
+	{
+		using namespace SIMDMathLib;
+		return QuatLanes{
+			Add(lhs.x, Multiply(Substract(rhs.x, lhs.x), s)),
+			Add(lhs.y, Multiply(Substract(rhs.y, lhs.y), s)),
+			Add(lhs.z, Multiply(Substract(rhs.z, lhs.z), s)),
+			Add(lhs.w, Multiply(Substract(rhs.w, lhs.w), s))
+		};
+	}
+
+	inline SIMDVectorF4 DotQuat(QuatLanes const & lhs, QuatLanes const & rhs)
+	{
+		using namespace SIMDMathLib;
+		return Add(Add(Multiply(lhs.x, rhs.x), Multiply(lhs.y, rhs.y)), Add(Multiply(lhs.z, rhs.z), Multiply(lhs.w, rhs.w)));
+	}
+
+	// Quaternions and float4s both keep x, y, z, w in a row
+	inline QuatLanes GatherQuat(float const * const (&qs)[NUM_LANES])
+	{
+		using namespace SIMDMathLib;
+		return QuatLanes{
+			SetVector(qs[0][0], qs[1][0], qs[2][0], qs[3][0]),
+			SetVector(qs[0][1], qs[1][1], qs[2][1], qs[3][1]),
+			SetVector(qs[0][2], qs[1][2], qs[2][2], qs[3][2]),
+			SetVector(qs[0][3], qs[1][3], qs[2][3], qs[3][3])
+		};
+	}
+
+	inline void ScatterQuat(float* const (&qs)[NUM_LANES], QuatLanes const & lanes)
+	{
+		float xs[NUM_LANES];
+		float ys[NUM_LANES];
+		float zs[NUM_LANES];
+		float ws[NUM_LANES];
+		Store(xs, lanes.x);
+		Store(ys, lanes.y);
+		Store(zs, lanes.z);
+		Store(ws, lanes.w);
+		for (uint32_t i = 0; i < NUM_LANES; ++ i)
+		{
+			qs[i][0] = xs[i];
+			qs[i][1] = ys[i];
+			qs[i][2] = zs[i];
+			qs[i][3] = ws[i];
+		}
+	}
+
+	// The evaluator takes tracks as they are authored, or as they stay in memory after loading
+	uint32_t NumKeys(KeyFrames const & kf)
+	{
+		return static_cast<uint32_t>(kf.frame_id.size());
+	}
+	uint32_t NumKeys(CompressedKeyFrames const & ckf)
+	{
+		return static_cast<uint32_t>(ckf.keys.size());
+	}
+
+	uint32_t KeyFrameId(KeyFrames const & kf, uint32_t key)
+	{
+		return kf.frame_id[key];
+	}
+	uint32_t KeyFrameId(CompressedKeyFrames const & ckf, uint32_t key)
+	{
+		return ckf.keys[key].frame_id;
+	}
+
+	// The first key after frame
+	uint32_t UpperBoundKey(KeyFrames const & kf, float frame)
+	{
+		return static_cast<uint32_t>(std::upper_bound(kf.frame_id.begin(), kf.frame_id.end(), frame) - kf.frame_id.begin());
+	}
+	uint32_t UpperBoundKey(CompressedKeyFrames const & ckf, float frame)
+	{
+		return static_cast<uint32_t>(std::upper_bound(ckf.keys.begin(), ckf.keys.end(), frame,
+			[](float f, CompressedKey const & key)
+			{
+				return f < key.frame_id;
+			}) - ckf.keys.begin());
+	}
+
+	void SampleKey(KeyFrames const & kf, uint32_t key, Quaternion& real, Quaternion& dual, float& scale)
+	{
+		real = kf.bind_real[key];
+		dual = kf.bind_dual[key];
+		scale = kf.bind_scale[key];
+	}
+	void SampleKey(CompressedKeyFrames const & ckf, uint32_t key, Quaternion& real, Quaternion& dual, float& scale)
+	{
+		DecompressKey(ckf, key, real, dual, scale);
+	}
+
+	// The two keys around frame, and how far between them, as KeyFrames::Frame finds them
+	template <typename Track>
+	void FindKeys(Track const & kf, float frame, uint32_t& cursor, uint32_t& key0, uint32_t& key1, float& factor)
+	{
+		uint32_t const num_keys = NumKeys(kf);
+		if (1 == num_keys)
+		{
+			key0 = 0;
+			key1 = 0;
+			factor = 0;
+			return;
+		}
+
+		frame = std::fmod(frame, static_cast<float>(KeyFrameId(kf, num_keys - 1) + 1));
+
+		if ((cursor >= num_keys) || (KeyFrameId(kf, cursor) > frame))
+		{
+			cursor = UpperBoundKey(kf, frame) - 1;
+		}
+		else
+		{
+			while ((cursor + 1 < num_keys) && (KeyFrameId(kf, cursor + 1) <= frame))
+			{
+				++ cursor;
+			}
+		}
+
+		key0 = cursor;
+		key1 = (cursor + 1) % num_keys;
+		int const frame0 = KeyFrameId(kf, key0);
+		int const frame1 = KeyFrameId(kf, key1);
+		factor = (frame - frame0) / (frame1 - frame0);
+	}
+
+	struct KeyPose
+	{
+		Quaternion real;
+		Quaternion dual;
+		float scale;
+	};
+
+	// Scalar version of how SkeletalPoseEvaluator blends two keys
+	KeyPose BlendKeys(KeyFrames const & kf, uint32_t key0, uint32_t key1, float factor)
+	{
+		float const sign = (MathLib::dot(kf.bind_real[key0], kf.bind_real[key1]) < 0) ? -1.0f : 1.0f;
+
+		KeyPose ret;
+		ret.real = kf.bind_real[key0] + (kf.bind_real[key1] * sign - kf.bind_real[key0]) * factor;
+		ret.dual = kf.bind_dual[key0] + (kf.bind_dual[key1] * sign - kf.bind_dual[key0]) * factor;
+		ret.scale = MathLib::lerp(kf.bind_scale[key0], kf.bind_scale[key1], factor);
+
+		float const inv_length = MathLib::recip_sqrt(MathLib::dot(ret.real, ret.real));
+		ret.real *= inv_length;
+		ret.dual *= inv_length;
+		ret.dual -= ret.real * MathLib::dot(ret.real, ret.dual);
+		return ret;
+	}
+
+	bool CloseToKey(KeyFrames const & kf, uint32_t key, KeyPose const & pose,
+		float rotation_tolerance, float translation_tolerance, float scale_tolerance)
+	{
+		// From the chord between the quaternions, acos loses too much near 1
+		Quaternion const & real = kf.bind_real[key];
+		float const chord = MathLib::length((MathLib::dot(real, pose.real) < 0) ? real + pose.real : real - pose.real);
+		if (4 * std::asin(std::min(chord / 2, 1.0f)) > rotation_tolerance)
+		{
+			return false;
+		}
+		if (MathLib::length(MathLib::udq_to_trans(kf.bind_real[key], kf.bind_dual[key])
+			- MathLib::udq_to_trans(pose.real, pose.dual)) > translation_tolerance)
+		{
+			return false;
+		}
+		return std::abs(kf.bind_scale[key] - pose.scale) <= scale_tolerance;
+	}
+
+	uint16_t Quantize(float v, float min_v, float extent)
+	{
+		if (extent <= 0)
+		{
+			return 0;
+		}
+		float const n = MathLib::clamp((v - min_v) / extent, 0.0f, 1.0f);
+		return static_cast<uint16_t>(n * 65535 + 0.5f);
+	}
+
+	float Dequantize(uint16_t v, float min_v, float extent)
+	{
+		return min_v + v * (extent / 65535);
+	}
+
+	// The smallest three components are within +-1/sqrt(2)
+	float const SMALLEST_THREE_RANGE = 0.7071068f;
+
+	void QuantizeRotation(uint16_t (&rotation)[3], Quaternion const & real)
+	{
+		uint32_t largest = 0;
+		for (uint32_t i = 1; i < 4; ++ i)
+		{
+			if (std::abs(real[i]) > std::abs(real[largest]))
+			{
+				largest = i;
+			}
+		}
+		float const sign = (real[largest] < 0) ? -1.0f : 1.0f;
+
+		uint32_t c = 0;
+		for (uint32_t i = 0; i < 4; ++ i)
+		{
+			if (i != largest)
+			{
+				float const n = MathLib::clamp((real[i] * sign / SMALLEST_THREE_RANGE + 1) / 2, 0.0f, 1.0f);
+				rotation[c] = static_cast<uint16_t>(n * 32767 + 0.5f);
+				++ c;
+			}
+		}
+		rotation[0] |= static_cast<uint16_t>((largest & 1) << 15);
+		rotation[1] |= static_cast<uint16_t>((largest >> 1) << 15);
+	}
+
+	Quaternion DequantizeRotation(uint16_t const (&rotation)[3])
+	{
+		uint32_t const largest = (rotation[0] >> 15) | ((rotation[1] >> 15) << 1);
+
+		Quaternion real;
+		float sum_sq = 0;
+		uint32_t c = 0;
+		for (uint32_t i = 0; i < 4; ++ i)
+		{
+			if (i != largest)
+			{
+				real[i] = ((rotation[c] & 0x7FFF) / 32767.0f * 2 - 1) * SMALLEST_THREE_RANGE;
+				sum_sq += real[i] * real[i];
+				++ c;
+			}
+		}
+		real[largest] = std::sqrt(std::max(1 - sum_sq, 0.0f));
+		return MathLib::normalize(real);
+	}
+}
+
+namespace KlayGE
+{
+	std::pair<std::pair<Quaternion, Quaternion>, float> KeyFrames::Frame(float frame) const
+	{
+		std::pair<std::pair<Quaternion, Quaternion>, float> ret;
+		if (frame_id.size() == 1)
+		{
+			ret.first.first = bind_real[0];
+			ret.first.second = bind_dual[0];
+			ret.second = bind_scale[0];
+		}
+		else
+		{
+			frame = std::fmod(frame, static_cast<float>(frame_id.back() + 1));
+
+			auto iter = std::upper_bound(frame_id.begin(), frame_id.end(), frame);
+			int index = static_cast<int>(iter - frame_id.begin());
+
+			int index0 = index - 1;
+			int index1 = index % frame_id.size();
+			int frame0 = frame_id[index0];
+			int frame1 = frame_id[index1];
+			float factor = (frame - frame0) / (frame1 - frame0);
+			ret.first = MathLib::sclerp(bind_real[index0], bind_dual[index0], bind_real[index1], bind_dual[index1], factor);
+			ret.second = MathLib::lerp(bind_scale[index0], bind_scale[index1], factor);
+		}
+		return ret;
+	}
+
+	void ConcatenateJoint(Joint& joint, Joint const & parent,
+		Quaternion const & local_real, Quaternion const & local_dual, float local_scale)
+	{
+		Quaternion key_real = local_real;
+		Quaternion key_dual = local_dual;
+		if (MathLib::dot(key_real, parent.bind_real) < 0)
+		{
+			key_real = -key_real;
+			key_dual = -key_dual;
+		}
+
+		if ((MathLib::SignBit(local_scale) > 0) && (MathLib::SignBit(parent.bind_scale) > 0))
+		{
+			joint.bind_real = MathLib::mul_real(key_real, parent.bind_real);
+			joint.bind_dual = MathLib::mul_dual(key_real, key_dual * parent.bind_scale, parent.bind_real, parent.bind_dual);
+			joint.bind_scale = local_scale * parent.bind_scale;
+		}
+		else
+		{
+			float4x4 tmp_mat = MathLib::scaling(MathLib::abs(local_scale), MathLib::abs(local_scale), local_scale)
+				* MathLib::to_matrix(key_real)
+				* MathLib::translation(MathLib::udq_to_trans(key_real, key_dual))
+				* MathLib::scaling(MathLib::abs(parent.bind_scale), MathLib::abs(parent.bind_scale), parent.bind_scale)
+				* MathLib::to_matrix(parent.bind_real)
+				* MathLib::translation(MathLib::udq_to_trans(parent.bind_real, parent.bind_dual));
+
+			float flip = 1;
+			if (MathLib::dot(MathLib::cross(float3(tmp_mat(0, 0), tmp_mat(0, 1), tmp_mat(0, 2)),
+				float3(tmp_mat(1, 0), tmp_mat(1, 1), tmp_mat(1, 2))),
+				float3(tmp_mat(2, 0), tmp_mat(2, 1), tmp_mat(2, 2))) < 0)
+			{
+				tmp_mat(2, 0) = -tmp_mat(2, 0);
+				tmp_mat(2, 1) = -tmp_mat(2, 1);
+				tmp_mat(2, 2) = -tmp_mat(2, 2);
+
+				flip = -1;
+			}
+
+			float3 scale;
+			Quaternion rot;
+			float3 trans;
+			MathLib::decompose(scale, rot, trans, tmp_mat);
+
+			joint.bind_real = rot;
+			joint.bind_dual = MathLib::quat_trans_to_udq(rot, trans);
+			joint.bind_scale = flip * scale.x();
+		}
+	}
+
+	void SkinningDualQuat(float4& bind_real_out, float4& bind_dual_out, Joint const & joint)
+	{
+		Quaternion bind_real, bind_dual;
+		float bind_scale;
+		if ((MathLib::SignBit(joint.inverse_origin_scale) > 0) && (MathLib::SignBit(joint.bind_scale) > 0))
+		{
+			bind_real = MathLib::mul_real(joint.inverse_origin_real, joint.bind_real);
+			bind_dual = MathLib::mul_dual(joint.inverse_origin_real, joint.inverse_origin_dual,
+				joint.bind_real, joint.bind_dual);
+			bind_scale = joint.inverse_origin_scale * joint.bind_scale;
+
+			if (MathLib::SignBit(bind_real.w()) < 0)
+			{
+				bind_real = -bind_real;
+				bind_dual = -bind_dual;
+			}
+		}
+		else
+		{
+			float4x4 tmp_mat = MathLib::scaling(MathLib::abs(joint.inverse_origin_scale), MathLib::abs(joint.inverse_origin_scale), joint.inverse_origin_scale)
+				* MathLib::to_matrix(joint.inverse_origin_real)
+				* MathLib::translation(MathLib::udq_to_trans(joint.inverse_origin_real, joint.inverse_origin_dual))
+				* MathLib::scaling(MathLib::abs(joint.bind_scale), MathLib::abs(joint.bind_scale), joint.bind_scale)
+				* MathLib::to_matrix(joint.bind_real)
+				* MathLib::translation(MathLib::udq_to_trans(joint.bind_real, joint.bind_dual));
+
+			float flip = 1;
+			if (MathLib::dot(MathLib::cross(float3(tmp_mat(0, 0), tmp_mat(0, 1), tmp_mat(0, 2)),
+				float3(tmp_mat(1, 0), tmp_mat(1, 1), tmp_mat(1, 2))),
+				float3(tmp_mat(2, 0), tmp_mat(2, 1), tmp_mat(2, 2))) < 0)
+			{
+				tmp_mat(2, 0) = -tmp_mat(2, 0);
+				tmp_mat(2, 1) = -tmp_mat(2, 1);
+				tmp_mat(2, 2) = -tmp_mat(2, 2);
+
+				flip = -1;
+			}
+
+			float3 scale;
+			Quaternion rot;
+			float3 trans;
+			MathLib::decompose(scale, rot, trans, tmp_mat);
+
+			bind_real = rot;
+			bind_dual = MathLib::quat_trans_to_udq(rot, trans);
+			bind_scale = scale.x();
+
+			if (flip * MathLib::SignBit(bind_real.w()) < 0)
+			{
+				bind_real = -bind_real;
+				bind_dual = -bind_dual;
+			}
+		}
+
+		bind_real_out = float4(bind_real.x(), bind_real.y(), bind_real.z(), bind_real.w()) * bind_scale;
+		bind_dual_out = float4(bind_dual.x(), bind_dual.y(), bind_dual.z(), bind_dual.w());
+	}
+
+
+	void ReduceKeyFrames(KeyFrames& kf, float rotation_tolerance, float translation_tolerance, float scale_tolerance)
+	{
+		uint32_t const num_keys = static_cast<uint32_t>(kf.frame_id.size());
+		if (num_keys <= 1)
+		{
+			return;
+		}
+
+		float max_translation = 0;
+		float max_scale = 0;
+		for (uint32_t i = 0; i < num_keys; ++ i)
+		{
+			max_translation = std::max(max_translation, MathLib::length(MathLib::udq_to_trans(kf.bind_real[i], kf.bind_dual[i])));
+			max_scale = std::max(max_scale, std::abs(kf.bind_scale[i]));
+		}
+		translation_tolerance *= std::max(max_translation, 1e-6f);
+		scale_tolerance *= std::max(max_scale, 1e-6f);
+
+		std::vector<uint32_t> kept;
+		kept.push_back(0);
+
+		bool constant = true;
+		KeyPose const first = { kf.bind_real[0], kf.bind_dual[0], kf.bind_scale[0] };
+		for (uint32_t i = 1; (i < num_keys) && constant; ++ i)
+		{
+			constant = CloseToKey(kf, i, first, rotation_tolerance, translation_tolerance, scale_tolerance);
+		}
+		if (!constant)
+		{
+			// Grows each segment until blending its ends misses a key in between. The first and last keys stay,
+			//  so the loop keeps its length.
+			uint32_t start = 0;
+			for (uint32_t end = 2; end < num_keys; ++ end)
+			{
+				float const duration = static_cast<float>(kf.frame_id[end] - kf.frame_id[start]);
+				for (uint32_t i = start + 1; i < end; ++ i)
+				{
+					KeyPose const pose = BlendKeys(kf, start, end, (kf.frame_id[i] - kf.frame_id[start]) / duration);
+					if (!CloseToKey(kf, i, pose, rotation_tolerance, translation_tolerance, scale_tolerance))
+					{
+						start = end - 1;
+						kept.push_back(start);
+						break;
+					}
+				}
+			}
+			kept.push_back(num_keys - 1);
+		}
+
+		KeyFrames reduced;
+		for (auto key : kept)
+		{
+			reduced.frame_id.push_back(kf.frame_id[key]);
+			reduced.bind_real.push_back(kf.bind_real[key]);
+			reduced.bind_dual.push_back(kf.bind_dual[key]);
+			reduced.bind_scale.push_back(kf.bind_scale[key]);
+		}
+		kf = std::move(reduced);
+	}
+
+	CompressedKeyFrames CompressKeyFrames(KeyFrames const & kf)
+	{
+		uint32_t const num_keys = static_cast<uint32_t>(kf.frame_id.size());
+
+		std::vector<float3> translations(num_keys);
+		float3 translation_max(-1e10f, -1e10f, -1e10f);
+		CompressedKeyFrames ckf;
+		ckf.translation_min = float3(+1e10f, +1e10f, +1e10f);
+		ckf.scale_min = +1e10f;
+		float scale_max = -1e10f;
+		for (uint32_t i = 0; i < num_keys; ++ i)
+		{
+			translations[i] = MathLib::udq_to_trans(kf.bind_real[i], kf.bind_dual[i]);
+			ckf.translation_min = MathLib::minimize(ckf.translation_min, translations[i]);
+			translation_max = MathLib::maximize(translation_max, translations[i]);
+			ckf.scale_min = std::min(ckf.scale_min, kf.bind_scale[i]);
+			scale_max = std::max(scale_max, kf.bind_scale[i]);
+		}
+		if (0 == num_keys)
+		{
+			ckf.translation_min = float3(0, 0, 0);
+			translation_max = float3(0, 0, 0);
+			ckf.scale_min = 1;
+			scale_max = 1;
+		}
+		ckf.translation_extent = translation_max - ckf.translation_min;
+		ckf.scale_extent = scale_max - ckf.scale_min;
+
+		ckf.keys.resize(num_keys);
+		for (uint32_t i = 0; i < num_keys; ++ i)
+		{
+			CompressedKey& key = ckf.keys[i];
+
+			BOOST_ASSERT(kf.frame_id[i] <= 0xFFFF);
+			key.frame_id = static_cast<uint16_t>(kf.frame_id[i]);
+			QuantizeRotation(key.rotation, kf.bind_real[i]);
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				key.translation[j] = Quantize(translations[i][j], ckf.translation_min[j], ckf.translation_extent[j]);
+			}
+			key.scale = Quantize(kf.bind_scale[i], ckf.scale_min, ckf.scale_extent);
+		}
+
+		return ckf;
+	}
+
+	KeyFrames DecompressKeyFrames(CompressedKeyFrames const & ckf)
+	{
+		uint32_t const num_keys = static_cast<uint32_t>(ckf.keys.size());
+
+		KeyFrames kf;
+		kf.frame_id.resize(num_keys);
+		kf.bind_real.resize(num_keys);
+		kf.bind_dual.resize(num_keys);
+		kf.bind_scale.resize(num_keys);
+		for (uint32_t i = 0; i < num_keys; ++ i)
+		{
+			kf.frame_id[i] = ckf.keys[i].frame_id;
+			DecompressKey(ckf, i, kf.bind_real[i], kf.bind_dual[i], kf.bind_scale[i]);
+		}
+
+		return kf;
+	}
+
+	void DecompressKey(CompressedKeyFrames const & ckf, uint32_t key,
+		Quaternion& bind_real, Quaternion& bind_dual, float& bind_scale)
+	{
+		CompressedKey const & ck = ckf.keys[key];
+
+		// Keeps w positive, as the loader always did
+		bind_real = DequantizeRotation(ck.rotation);
+		if (bind_real.w() < 0)
+		{
+			bind_real = -bind_real;
+		}
+		float3 translation;
+		for (uint32_t j = 0; j < 3; ++ j)
+		{
+			translation[j] = Dequantize(ck.translation[j], ckf.translation_min[j], ckf.translation_extent[j]);
+		}
+		bind_dual = MathLib::quat_trans_to_udq(bind_real, translation);
+		bind_scale = Dequantize(ck.scale, ckf.scale_min, ckf.scale_extent);
+	}
+
+
+	void SkeletalPoseEvaluator::Reset()
+	{
+		level_order_.clear();
+		level_starts_.clear();
+		key_cursors_.clear();
+	}
+
+	void SkeletalPoseEvaluator::BuildLevels(std::vector<Joint> const & joints)
+	{
+		uint32_t const num_joints = static_cast<uint32_t>(joints.size());
+
+		// Parents come before their children
+		std::vector<uint32_t> depths(num_joints);
+		for (uint32_t i = 0; i < num_joints; ++ i)
+		{
+			BOOST_ASSERT(joints[i].parent < static_cast<int32_t>(i));
+			depths[i] = (joints[i].parent < 0) ? 0 : depths[joints[i].parent] + 1;
+		}
+
+		level_order_.resize(num_joints);
+		for (uint32_t i = 0; i < num_joints; ++ i)
+		{
+			level_order_[i] = i;
+		}
+		std::stable_sort(level_order_.begin(), level_order_.end(),
+			[&depths](uint32_t lhs, uint32_t rhs)
+			{
+				return depths[lhs] < depths[rhs];
+			});
+
+		level_starts_.clear();
+		for (uint32_t i = 0; i < num_joints; ++ i)
+		{
+			if ((0 == i) || (depths[level_order_[i]] != depths[level_order_[i - 1]]))
+			{
+				level_starts_.push_back(i);
+			}
+		}
+		level_starts_.push_back(num_joints);
+
+		key_cursors_.assign(num_joints, 0);
+	}
+
+	void SkeletalPoseEvaluator::Evaluate(std::vector<Joint>& joints, std::vector<KeyFrames> const & key_frames,
+		float frame, std::vector<float4>& bind_reals, std::vector<float4>& bind_duals, uint32_t max_depth)
+	{
+		this->EvaluateTracks(joints, key_frames, frame, bind_reals, bind_duals, max_depth);
+	}
+
+	void SkeletalPoseEvaluator::Evaluate(std::vector<Joint>& joints, std::vector<CompressedKeyFrames> const & key_frames,
+		float frame, std::vector<float4>& bind_reals, std::vector<float4>& bind_duals, uint32_t max_depth)
+	{
+		this->EvaluateTracks(joints, key_frames, frame, bind_reals, bind_duals, max_depth);
+	}
+
+	template <typename Track>
+	void SkeletalPoseEvaluator::EvaluateTracks(std::vector<Joint>& joints, std::vector<Track> const & key_frames,
+		float frame, std::vector<float4>& bind_reals, std::vector<float4>& bind_duals, uint32_t max_depth)
+	{
+		BOOST_ASSERT(key_frames.size() >= joints.size());
+
+		if (level_order_.size() != joints.size())
+		{
+			this->BuildLevels(joints);
+		}
+
+		bind_reals.resize(joints.size());
+		bind_duals.resize(joints.size());
+
+		// Roots concatenate with the identity, so they go down the same path
+		static Joint const root_parent = []
+		{
+			Joint joint;
+			joint.bind_real = Quaternion::Identity();
+			joint.bind_dual = Quaternion(0, 0, 0, 0);
+			joint.bind_scale = 1;
+			joint.parent = -1;
+			return joint;
+		}();
+
+		for (size_t level = 0; level + 1 < level_starts_.size(); ++ level)
+		{
+			for (uint32_t group = level_starts_[level]; group < level_starts_[level + 1]; group += NUM_LANES)
+			{
+				uint32_t const num_lanes = std::min(NUM_LANES, level_starts_[level + 1] - group);
+
+				// Unused lanes repeat the last joint, and write to a scratch pad
+				uint32_t ids[NUM_LANES];
+				Joint const * parents[NUM_LANES];
+				Quaternion key_reals0[NUM_LANES];
+				Quaternion key_duals0[NUM_LANES];
+				Quaternion key_reals1[NUM_LANES];
+				Quaternion key_duals1[NUM_LANES];
+				float key_scales0[NUM_LANES];
+				float key_scales1[NUM_LANES];
+				float const * reals0[NUM_LANES];
+				float const * duals0[NUM_LANES];
+				float const * reals1[NUM_LANES];
+				float const * duals1[NUM_LANES];
+				float const * parent_reals[NUM_LANES];
+				float const * parent_duals[NUM_LANES];
+				float const * origin_reals[NUM_LANES];
+				float const * origin_duals[NUM_LANES];
+				float* world_reals[NUM_LANES];
+				float* world_duals[NUM_LANES];
+				float* out_reals[NUM_LANES];
+				float* out_duals[NUM_LANES];
+				float factors[NUM_LANES];
+				float key_signs[NUM_LANES];
+				float local_scales[NUM_LANES];
+				float parent_scales[NUM_LANES];
+				float world_scales[NUM_LANES];
+				float origin_scales[NUM_LANES];
+				float scratch[NUM_LANES][4];
+				bool any_mirrored = false;
+				bool mirrored[NUM_LANES];
+				for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+				{
+					uint32_t const id = level_order_[group + std::min(lane, num_lanes - 1)];
+					ids[lane] = id;
+
+					Joint& joint = joints[id];
+					Track const & kf = key_frames[id];
+					uint32_t key0, key1;
+					float& factor = factors[lane];
+					if (level <= max_depth)
+					{
+						FindKeys(kf, frame, key_cursors_[id], key0, key1, factor);
+					}
+					else
+					{
+						key0 = 0;
+						key1 = 0;
+						factor = 0;
+					}
+					SampleKey(kf, key0, key_reals0[lane], key_duals0[lane], key_scales0[lane]);
+					SampleKey(kf, key1, key_reals1[lane], key_duals1[lane], key_scales1[lane]);
+					reals0[lane] = &key_reals0[lane][0];
+					duals0[lane] = &key_duals0[lane][0];
+					reals1[lane] = &key_reals1[lane][0];
+					duals1[lane] = &key_duals1[lane][0];
+					key_signs[lane] = (MathLib::dot(key_reals0[lane], key_reals1[lane]) < 0) ? -1.0f : 1.0f;
+					local_scales[lane] = MathLib::lerp(key_scales0[lane], key_scales1[lane], factor);
+
+					Joint const & parent = (joint.parent < 0) ? root_parent : joints[joint.parent];
+					parents[lane] = &parent;
+					parent_reals[lane] = &parent.bind_real[0];
+					parent_duals[lane] = &parent.bind_dual[0];
+					parent_scales[lane] = parent.bind_scale;
+
+					origin_reals[lane] = &joint.inverse_origin_real[0];
+					origin_duals[lane] = &joint.inverse_origin_dual[0];
+					origin_scales[lane] = joint.inverse_origin_scale;
+
+					mirrored[lane] = (MathLib::SignBit(local_scales[lane]) < 0) || (MathLib::SignBit(parent.bind_scale) < 0);
+					if (lane < num_lanes)
+					{
+						world_reals[lane] = &joint.bind_real[0];
+						world_duals[lane] = &joint.bind_dual[0];
+						any_mirrored |= mirrored[lane];
+					}
+					else
+					{
+						world_reals[lane] = scratch[lane];
+						world_duals[lane] = scratch[lane];
+					}
+				}
+
+				// Local pose
+				SIMDVectorF4 const factor = Set(factors);
+				SIMDVectorF4 const key_sign = Set(key_signs);
+				QuatLanes local_real = LerpQuat(GatherQuat(reals0), ScaleQuat(GatherQuat(reals1), key_sign), factor);
+				QuatLanes local_dual = LerpQuat(GatherQuat(duals0), ScaleQuat(GatherQuat(duals1), key_sign), factor);
+
+				float inv_lengths[NUM_LANES];
+				Store(inv_lengths, DotQuat(local_real, local_real));
+				for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+				{
+					inv_lengths[lane] = MathLib::recip_sqrt(inv_lengths[lane]);
+				}
+				SIMDVectorF4 const inv_length = Set(inv_lengths);
+				local_real = ScaleQuat(local_real, inv_length);
+				local_dual = ScaleQuat(local_dual, inv_length);
+				// A unit dual quaternion's dual part is orthogonal to its real part
+				SIMDVectorF4 const real_dot_dual = DotQuat(local_real, local_dual);
+				local_dual.x = SIMDMathLib::Substract(local_dual.x, SIMDMathLib::Multiply(local_real.x, real_dot_dual));
+				local_dual.y = SIMDMathLib::Substract(local_dual.y, SIMDMathLib::Multiply(local_real.y, real_dot_dual));
+				local_dual.z = SIMDMathLib::Substract(local_dual.z, SIMDMathLib::Multiply(local_real.z, real_dot_dual));
+				local_dual.w = SIMDMathLib::Substract(local_dual.w, SIMDMathLib::Multiply(local_real.w, real_dot_dual));
+
+				// Concatenated with the parent, on the parent's side of the double cover
+				QuatLanes const parent_real = GatherQuat(parent_reals);
+				float signs[NUM_LANES];
+				Store(signs, DotQuat(local_real, parent_real));
+				for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+				{
+					signs[lane] = ((signs[lane] < 0) && (parents[lane] != &root_parent)) ? -1.0f : 1.0f;
+				}
+				SIMDVectorF4 const sign = Set(signs);
+				local_real = ScaleQuat(local_real, sign);
+				local_dual = ScaleQuat(local_dual, sign);
+
+				SIMDVectorF4 const parent_scale = Set(parent_scales);
+				QuatLanes const world_real = MulQuat(local_real, parent_real);
+				QuatLanes const world_dual = AddQuat(MulQuat(local_real, GatherQuat(parent_duals)),
+					MulQuat(ScaleQuat(local_dual, parent_scale), parent_real));
+				Store(world_scales, SIMDMathLib::Multiply(Set(local_scales), parent_scale));
+				ScatterQuat(world_reals, world_real);
+				ScatterQuat(world_duals, world_dual);
+				for (uint32_t lane = 0; lane < num_lanes; ++ lane)
+				{
+					joints[ids[lane]].bind_scale = world_scales[lane];
+				}
+
+				if (any_mirrored)
+				{
+					Quaternion local_reals[NUM_LANES];
+					Quaternion local_duals[NUM_LANES];
+					float* local_real_ptrs[NUM_LANES];
+					float* local_dual_ptrs[NUM_LANES];
+					for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+					{
+						local_real_ptrs[lane] = &local_reals[lane][0];
+						local_dual_ptrs[lane] = &local_duals[lane][0];
+					}
+					ScatterQuat(local_real_ptrs, local_real);
+					ScatterQuat(local_dual_ptrs, local_dual);
+					for (uint32_t lane = 0; lane < num_lanes; ++ lane)
+					{
+						if (mirrored[lane])
+						{
+							ConcatenateJoint(joints[ids[lane]], *parents[lane],
+								local_reals[lane], local_duals[lane], local_scales[lane]);
+						}
+					}
+				}
+
+				// Skinning dual quaternions. The joint's pose comes from the lanes, except where it was mirrored.
+				QuatLanes joint_real = world_real;
+				QuatLanes joint_dual = world_dual;
+				float joint_scales[NUM_LANES];
+				for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+				{
+					joint_scales[lane] = joints[ids[lane]].bind_scale;
+				}
+				if (any_mirrored)
+				{
+					float const * joint_reals[NUM_LANES];
+					float const * joint_duals[NUM_LANES];
+					for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+					{
+						joint_reals[lane] = &joints[ids[lane]].bind_real[0];
+						joint_duals[lane] = &joints[ids[lane]].bind_dual[0];
+					}
+					joint_real = GatherQuat(joint_reals);
+					joint_dual = GatherQuat(joint_duals);
+				}
+
+				QuatLanes const origin_real = GatherQuat(origin_reals);
+				QuatLanes bind_real = MulQuat(origin_real, joint_real);
+				QuatLanes bind_dual = AddQuat(MulQuat(origin_real, joint_dual), MulQuat(GatherQuat(origin_duals), joint_real));
+				SIMDVectorF4 const bind_scale = SIMDMathLib::Multiply(Set(joint_scales), Set(origin_scales));
+
+				Store(signs, bind_real.w);
+				for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+				{
+					signs[lane] = (MathLib::SignBit(signs[lane]) < 0) ? -1.0f : 1.0f;
+				}
+				SIMDVectorF4 const bind_sign = Set(signs);
+				bind_real = ScaleQuat(bind_real, SIMDMathLib::Multiply(bind_scale, bind_sign));
+				bind_dual = ScaleQuat(bind_dual, bind_sign);
+
+				for (uint32_t lane = 0; lane < NUM_LANES; ++ lane)
+				{
+					if (lane < num_lanes)
+					{
+						out_reals[lane] = &bind_reals[ids[lane]][0];
+						out_duals[lane] = &bind_duals[ids[lane]][0];
+					}
+					else
+					{
+						out_reals[lane] = scratch[lane];
+						out_duals[lane] = scratch[lane];
+					}
+				}
+				ScatterQuat(out_reals, bind_real);
+				ScatterQuat(out_duals, bind_dual);
+				for (uint32_t lane = 0; lane < num_lanes; ++ lane)
+				{
+					uint32_t const id = ids[lane];
+					if ((MathLib::SignBit(origin_scales[lane]) < 0) || (MathLib::SignBit(joint_scales[lane]) < 0))
+					{
+						SkinningDualQuat(bind_reals[id], bind_duals[id], joints[id]);
+					}
+				}
+			}
+		}
+	}
+}
@@ -1093,6 +1093,9 @@ namespace
 				ElementFormat format;
 				std::vector<ElementInitData> init_data;
 				std::vector<uint8_t> data_block;
+
+				// Keeps the memory alive when init_data points straight into the resource
+				ResIdentifierPtr res;
 			};
 			std::shared_ptr<TexData> tex_data;
 
@@ -1114,6 +1117,11 @@ namespace
 			return type;
 		}
 
+		std::string_view Name() const override
+		{
+			return tex_desc_.res_name;
+		}
+
 		bool StateLess() const override
 		{
 			return true;
@@ -1256,6 +1264,14 @@ namespace
 			return true;
 		}
 
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(this->Type());
+			HashRange(seed, tex_desc_.res_name.begin(), tex_desc_.res_name.end());
+			HashCombine(seed, tex_desc_.access_hint);
+			return seed;
+		}
+
 		bool Match(ResLoadingDesc const & rhs) const override
 		{
 			if (this->Type() == rhs.Type())
@@ -1288,12 +1304,56 @@ namespace
 			return *tex_desc_.tex;
 		}
 
+		uint64_t GpuMemorySize() const override
+		{
+			TexturePtr const & tex = *tex_desc_.tex;
+			if (!tex)
+			{
+				return 0;
+			}
+
+			uint32_t array_size = tex->ArraySize();
+			if (Texture::TT_Cube == tex->Type())
+			{
+				array_size *= 6;
+			}
+
+			ElementFormat const format = tex->Format();
+			uint32_t const elem_size = NumFormatBytes(format);
+			uint64_t size = 0;
+			for (uint32_t level = 0; level < tex->NumMipMaps(); ++ level)
+			{
+				uint32_t const width = tex->Width(level);
+				uint32_t const height = tex->Height(level);
+				uint32_t const depth = tex->Depth(level);
+
+				uint64_t slice_size;
+				if (IsCompressedFormat(format))
+				{
+					slice_size = static_cast<uint64_t>((width + 3) & ~3) * ((height + 3) / 4) * elem_size;
+				}
+				else
+				{
+					slice_size = static_cast<uint64_t>(width) * height * elem_size;
+				}
+				size += slice_size * depth;
+			}
+			return size * array_size;
+		}
+
+		bool ReleaseResource() override
+		{
+			tex_desc_.tex = MakeSharedPtr<TexturePtr>();
+			return true;
+		}
+
 	private:
 		void LoadDDS()
 		{
 			TexDesc::TexData& tex_data = *tex_desc_.tex_data;
 
-			LoadTexture(tex_desc_.res_name, tex_data.type,
+			tex_data.res = ResLoader::Instance().Open(tex_desc_.res_name);
+			LoadTextureNoCopy(tex_data.res, tex_data.type,
 				tex_data.width, tex_data.height, tex_data.depth,
 				tex_data.num_mipmaps, tex_data.array_size, tex_data.format,
 				tex_data.init_data, tex_data.data_block);
@@ -1304,6 +1364,7 @@ namespace
 			{
 				tex_data.type = Texture::TT_2D;
 				tex_data.height *= tex_data.depth;
+				tex_data.init_data[0].slice_pitch *= tex_data.depth;
 				tex_data.depth = 1;
 				tex_data.num_mipmaps = 1;
 				tex_data.init_data.resize(1);
@@ -1318,6 +1379,8 @@ namespace
 			if (((EF_BC5 == tex_data.format) && !caps.texture_format_support(EF_BC5))
 				|| ((EF_BC5_SRGB == tex_data.format) && !caps.texture_format_support(EF_BC5_SRGB)))
 			{
+				this->MakeDataWritable();
+
 				BC1Block tmp;
 				for (size_t i = 0; i < tex_data.init_data.size(); ++ i)
 				{
@@ -1342,6 +1405,8 @@ namespace
 			if (((EF_BC4 == tex_data.format) && !caps.texture_format_support(EF_BC4))
 				|| ((EF_BC4_SRGB == tex_data.format) && !caps.texture_format_support(EF_BC4_SRGB)))
 			{
+				this->MakeDataWritable();
+
 				BC1Block tmp;
 				for (size_t i = 0; i < tex_data.init_data.size(); ++ i)
 				{
@@ -1445,6 +1510,10 @@ namespace
 
 							new_data_block.resize(new_data_block_size);
 						}
+						else
+						{
+							this->MakeDataWritable();
+						}
 
 						for (size_t index = 0; index < array_size; ++ index)
 						{
@@ -1516,6 +1585,41 @@ namespace
 			}
 		}
 
+		// The data may still point into a mapped file or a shared package block. Copy it out before converting in place.
+		void MakeDataWritable()
+		{
+			TexDesc::TexData& tex_data = *tex_desc_.tex_data;
+			if (!tex_data.res || tex_data.init_data.empty())
+			{
+				return;
+			}
+
+			uint8_t const * view = static_cast<uint8_t const *>(tex_data.res->MemoryView());
+			uint8_t const * view_end = view + tex_data.res->MemoryViewSize();
+			uint8_t const * first = static_cast<uint8_t const *>(tex_data.init_data[0].data);
+			if ((view != nullptr) && (first >= view) && (first < view_end))
+			{
+				// Only the sub-resources are copied, not the header or anything else in the view
+				uint8_t const * begin = view_end;
+				uint8_t const * end = view;
+				for (size_t i = 0; i < tex_data.init_data.size(); ++ i)
+				{
+					uint32_t const depth = std::max(1U, tex_data.depth >> (i % tex_data.num_mipmaps));
+					uint8_t const * data = static_cast<uint8_t const *>(tex_data.init_data[i].data);
+					begin = std::min(begin, data);
+					end = std::max(end, data + tex_data.init_data[i].slice_pitch * depth);
+				}
+				end = std::min(end, view_end);
+
+				tex_data.data_block.assign(begin, end);
+				for (auto& init_data : tex_data.init_data)
+				{
+					init_data.data = &tex_data.data_block[static_cast<uint8_t const *>(init_data.data) - begin];
+				}
+			}
+			tex_data.res.reset();
+		}
+
 		TexturePtr CreateTexture()
 		{
 			TexDesc::TexData const & tex_data = *tex_desc_.tex_data;
@@ -1565,6 +1669,204 @@ namespace
 		TexDesc tex_desc_;
 		std::mutex main_thread_stage_mutex_;
 	};
+
+	void LoadTextureImpl(ResIdentifierPtr const & tex_res, Texture::TextureType& type,
+		uint32_t& width, uint32_t& height, uint32_t& depth, uint32_t& num_mipmaps, uint32_t& array_size,
+		ElementFormat& format, std::vector<ElementInitData>& init_data, std::vector<uint8_t>& data_block,
+		bool no_copy)
+	{
+		uint32_t row_pitch, slice_pitch;
+		GetImageInfo(tex_res, type, width, height, depth, num_mipmaps, array_size, format,
+			row_pitch, slice_pitch);
+
+		uint32_t const fmt_size = NumFormatBytes(format);
+		bool padding = false;
+		if (!IsCompressedFormat(format))
+		{
+			if (row_pitch != width * fmt_size)
+			{
+				BOOST_ASSERT(row_pitch == ((width + 3) & ~3) * fmt_size);
+				padding = true;
+			}
+		}
+
+		// Offsets of every sub resource from the start of the pixel data. They are stored back to back,
+		//  so the data can be read in one go, or used in place if the resource is in memory.
+		std::vector<size_t> base;
+		size_t data_size = 0;
+		switch (type)
+		{
+		case Texture::TT_1D:
+			{
+				init_data.resize(array_size * num_mipmaps);
+				base.resize(array_size * num_mipmaps);
+				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
+				{
+					uint32_t the_width = width;
+					for (uint32_t level = 0; level < num_mipmaps; ++ level)
+					{
+						size_t const index = array_index * num_mipmaps + level;
+						uint32_t image_size;
+						if (IsCompressedFormat(format))
+						{
+							uint32_t const block_size = NumFormatBytes(format) * 4;
+							image_size = ((the_width + 3) / 4) * block_size;
+						}
+						else
+						{
+							image_size = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
+						}
+
+						base[index] = data_size;
+						data_size += image_size;
+						init_data[index].row_pitch = image_size;
+						init_data[index].slice_pitch = image_size;
+
+						the_width = std::max<uint32_t>(the_width / 2, 1);
+					}
+				}
+			}
+			break;
+
+		case Texture::TT_2D:
+			{
+				init_data.resize(array_size * num_mipmaps);
+				base.resize(array_size * num_mipmaps);
+				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
+				{
+					uint32_t the_width = width;
+					uint32_t the_height = height;
+					for (uint32_t level = 0; level < num_mipmaps; ++ level)
+					{
+						size_t const index = array_index * num_mipmaps + level;
+						if (IsCompressedFormat(format))
+						{
+							uint32_t const block_size = NumFormatBytes(format) * 4;
+							uint32_t image_size = ((the_width + 3) / 4) * ((the_height + 3) / 4) * block_size;
+
+							base[index] = data_size;
+							data_size += image_size;
+							init_data[index].row_pitch = (the_width + 3) / 4 * block_size;
+							init_data[index].slice_pitch = image_size;
+						}
+						else
+						{
+							init_data[index].row_pitch = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
+							init_data[index].slice_pitch = init_data[index].row_pitch * the_height;
+							base[index] = data_size;
+							data_size += init_data[index].slice_pitch;
+						}
+
+						the_width = std::max<uint32_t>(the_width / 2, 1);
+						the_height = std::max<uint32_t>(the_height / 2, 1);
+					}
+				}
+			}
+			break;
+
+		case Texture::TT_3D:
+			{
+				init_data.resize(array_size * num_mipmaps);
+				base.resize(array_size * num_mipmaps);
+				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
+				{
+					uint32_t the_width = width;
+					uint32_t the_height = height;
+					uint32_t the_depth = depth;
+					for (uint32_t level = 0; level < num_mipmaps; ++ level)
+					{
+						size_t const index = array_index * num_mipmaps + level;
+						if (IsCompressedFormat(format))
+						{
+							uint32_t const block_size = NumFormatBytes(format) * 4;
+							uint32_t image_size = ((the_width + 3) / 4) * ((the_height + 3) / 4) * the_depth * block_size;
+
+							base[index] = data_size;
+							data_size += image_size;
+							init_data[index].row_pitch = (the_width + 3) / 4 * block_size;
+							init_data[index].slice_pitch = ((the_width + 3) / 4) * ((the_height + 3) / 4) * block_size;
+						}
+						else
+						{
+							init_data[index].row_pitch = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
+							init_data[index].slice_pitch = init_data[index].row_pitch * the_height;
+							base[index] = data_size;
+							data_size += init_data[index].slice_pitch * the_depth;
+						}
+
+						the_width = std::max<uint32_t>(the_width / 2, 1);
+						the_height = std::max<uint32_t>(the_height / 2, 1);
+						the_depth = std::max<uint32_t>(the_depth / 2, 1);
+					}
+				}
+			}
+			break;
+
+		case Texture::TT_Cube:
+			{
+				init_data.resize(array_size * 6 * num_mipmaps);
+				base.resize(array_size * 6 * num_mipmaps);
+				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
+				{
+					for (uint32_t face = Texture::CF_Positive_X; face <= Texture::CF_Negative_Z; ++ face)
+					{
+						uint32_t the_width = width;
+						uint32_t the_height = height;
+						for (uint32_t level = 0; level < num_mipmaps; ++ level)
+						{
+							size_t const index = (array_index * 6 + face - Texture::CF_Positive_X) * num_mipmaps + level;
+							if (IsCompressedFormat(format))
+							{
+								uint32_t const block_size = NumFormatBytes(format) * 4;
+								uint32_t image_size = ((the_width + 3) / 4) * ((the_height + 3) / 4) * block_size;
+
+								base[index] = data_size;
+								data_size += image_size;
+								init_data[index].row_pitch = (the_width + 3) / 4 * block_size;
+								init_data[index].slice_pitch = image_size;
+							}
+							else
+							{
+								init_data[index].row_pitch = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
+								init_data[index].slice_pitch = init_data[index].row_pitch * the_width;
+								base[index] = data_size;
+								data_size += init_data[index].slice_pitch;
+							}
+
+							the_width = std::max<uint32_t>(the_width / 2, 1);
+							the_height = std::max<uint32_t>(the_height / 2, 1);
+						}
+					}
+				}
+			}
+			break;
+		}
+
+		if (no_copy)
+		{
+			uint8_t const * view = static_cast<uint8_t const *>(tex_res->MemoryView());
+			std::streamoff const pos = tex_res->tellg();
+			if ((view != nullptr) && (pos >= 0) && (static_cast<uint64_t>(pos) + data_size <= tex_res->MemoryViewSize()))
+			{
+				tex_res->seekg(static_cast<std::streamoff>(data_size), std::ios_base::cur);
+				for (size_t i = 0; i < base.size(); ++ i)
+				{
+					init_data[i].data = view + pos + base[i];
+				}
+				return;
+			}
+		}
+
+		size_t const start = data_block.size();
+		data_block.resize(start + data_size);
+		tex_res->read(&data_block[start], static_cast<std::streamsize>(data_size));
+		BOOST_ASSERT(tex_res->gcount() == static_cast<std::streamsize>(data_size));
+
+		for (size_t i = 0; i < base.size(); ++ i)
+		{
+			init_data[i].data = &data_block[start + base[i]];
+		}
+	}
 }
 
 namespace KlayGE
@@ -1998,195 +2300,16 @@ namespace KlayGE
 		uint32_t& width, uint32_t& height, uint32_t& depth, uint32_t& num_mipmaps, uint32_t& array_size,
 		ElementFormat& format, std::vector<ElementInitData>& init_data, std::vector<uint8_t>& data_block)
 	{
-		uint32_t row_pitch, slice_pitch;
-		GetImageInfo(tex_res, type, width, height, depth, num_mipmaps, array_size, format,
-			row_pitch, slice_pitch);
-
-		uint32_t const fmt_size = NumFormatBytes(format);
-		bool padding = false;
-		if (!IsCompressedFormat(format))
-		{
-			if (row_pitch != width * fmt_size)
-			{
-				BOOST_ASSERT(row_pitch == ((width + 3) & ~3) * fmt_size);
-				padding = true;
-			}
-		}
-
-		std::vector<size_t> base;
-		switch (type)
-		{
-		case Texture::TT_1D:
-			{
-				init_data.resize(array_size * num_mipmaps);
-				base.resize(array_size * num_mipmaps);
-				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
-				{
-					uint32_t the_width = width;
-					for (uint32_t level = 0; level < num_mipmaps; ++ level)
-					{
-						size_t const index = array_index * num_mipmaps + level;
-						uint32_t image_size;
-						if (IsCompressedFormat(format))
-						{
-							uint32_t const block_size = NumFormatBytes(format) * 4;
-							image_size = ((the_width + 3) / 4) * block_size;
-						}
-						else
-						{
-							image_size = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
-						}
-
-						base[index] = data_block.size();
-						data_block.resize(base[index] + image_size);
-						init_data[index].row_pitch = image_size;
-						init_data[index].slice_pitch = image_size;
-
-						tex_res->read(&data_block[base[index]], static_cast<std::streamsize>(image_size));
-						BOOST_ASSERT(tex_res->gcount() == static_cast<int>(image_size));
-
-						the_width = std::max<uint32_t>(the_width / 2, 1);
-					}
-				}
-			}
-			break;
-
-		case Texture::TT_2D:
-			{
-				init_data.resize(array_size * num_mipmaps);
-				base.resize(array_size * num_mipmaps);
-				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
-				{
-					uint32_t the_width = width;
-					uint32_t the_height = height;
-					for (uint32_t level = 0; level < num_mipmaps; ++ level)
-					{
-						size_t const index = array_index * num_mipmaps + level;
-						if (IsCompressedFormat(format))
-						{
-							uint32_t const block_size = NumFormatBytes(format) * 4;
-							uint32_t image_size = ((the_width + 3) / 4) * ((the_height + 3) / 4) * block_size;
-
-							base[index] = data_block.size();
-							data_block.resize(base[index] + image_size);
-							init_data[index].row_pitch = (the_width + 3) / 4 * block_size;
-							init_data[index].slice_pitch = image_size;
-
-							tex_res->read(&data_block[base[index]], static_cast<std::streamsize>(image_size));
-							BOOST_ASSERT(tex_res->gcount() == static_cast<int>(image_size));
-						}
-						else
-						{
-							init_data[index].row_pitch = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
-							init_data[index].slice_pitch = init_data[index].row_pitch * the_height;
-							base[index] = data_block.size();
-							data_block.resize(base[index] + init_data[index].slice_pitch);
-
-							tex_res->read(&data_block[base[index]], static_cast<std::streamsize>(init_data[index].slice_pitch));
-							BOOST_ASSERT(tex_res->gcount() == static_cast<int>(init_data[index].slice_pitch));
-						}
-
-						the_width = std::max<uint32_t>(the_width / 2, 1);
-						the_height = std::max<uint32_t>(the_height / 2, 1);
-					}
-				}
-			}
-			break;
-
-		case Texture::TT_3D:
-			{
-				init_data.resize(array_size * num_mipmaps);
-				base.resize(array_size * num_mipmaps);
-				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
-				{
-					uint32_t the_width = width;
-					uint32_t the_height = height;
-					uint32_t the_depth = depth;
-					for (uint32_t level = 0; level < num_mipmaps; ++ level)
-					{
-						size_t const index = array_index * num_mipmaps + level;
-						if (IsCompressedFormat(format))
-						{
-							uint32_t const block_size = NumFormatBytes(format) * 4;
-							uint32_t image_size = ((the_width + 3) / 4) * ((the_height + 3) / 4) * the_depth * block_size;
-
-							base[index] = data_block.size();
-							data_block.resize(base[index] + image_size);
-							init_data[index].row_pitch = (the_width + 3) / 4 * block_size;
-							init_data[index].slice_pitch = ((the_width + 3) / 4) * ((the_height + 3) / 4) * block_size;
-
-							tex_res->read(&data_block[base[index]], static_cast<std::streamsize>(image_size));
-							BOOST_ASSERT(tex_res->gcount() == static_cast<int>(image_size));
-						}
-						else
-						{
-							init_data[index].row_pitch = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
-							init_data[index].slice_pitch = init_data[index].row_pitch * the_height;
-							base[index] = data_block.size();
-							data_block.resize(base[index] + init_data[index].slice_pitch * the_depth);
-
-							tex_res->read(&data_block[base[index]], static_cast<std::streamsize>(init_data[index].slice_pitch * the_depth));
-							BOOST_ASSERT(tex_res->gcount() == static_cast<int>(init_data[index].slice_pitch * the_depth));
-						}
-
-						the_width = std::max<uint32_t>(the_width / 2, 1);
-						the_height = std::max<uint32_t>(the_height / 2, 1);
-						the_depth = std::max<uint32_t>(the_depth / 2, 1);
-					}
-				}
-			}
-			break;
-
-		case Texture::TT_Cube:
-			{
-				init_data.resize(array_size * 6 * num_mipmaps);
-				base.resize(array_size * 6 * num_mipmaps);
-				for (uint32_t array_index = 0; array_index < array_size; ++ array_index)
-				{
-					for (uint32_t face = Texture::CF_Positive_X; face <= Texture::CF_Negative_Z; ++ face)
-					{
-						uint32_t the_width = width;
-						uint32_t the_height = height;
-						for (uint32_t level = 0; level < num_mipmaps; ++ level)
-						{
-							size_t const index = (array_index * 6 + face - Texture::CF_Positive_X) * num_mipmaps + level;
-							if (IsCompressedFormat(format))
-							{
-								uint32_t const block_size = NumFormatBytes(format) * 4;
-								uint32_t image_size = ((the_width + 3) / 4) * ((the_height + 3) / 4) * block_size;
-
-								base[index] = data_block.size();
-								data_block.resize(base[index] + image_size);
-								init_data[index].row_pitch = (the_width + 3) / 4 * block_size;
-								init_data[index].slice_pitch = image_size;
-
-								tex_res->read(&data_block[base[index]], static_cast<std::streamsize>(image_size));
-								BOOST_ASSERT(tex_res->gcount() == static_cast<int>(image_size));
-							}
-							else
-							{
-								init_data[index].row_pitch = (padding ? ((the_width + 3) & ~3) : the_width) * fmt_size;
-								init_data[index].slice_pitch = init_data[index].row_pitch * the_width;
-								base[index] = data_block.size();
-								data_block.resize(base[index] + init_data[index].slice_pitch);
-
-								tex_res->read(&data_block[base[index]], static_cast<std::streamsize>(init_data[index].slice_pitch));
-								BOOST_ASSERT(tex_res->gcount() == static_cast<int>(init_data[index].slice_pitch));
-							}
-
-							the_width = std::max<uint32_t>(the_width / 2, 1);
-							the_height = std::max<uint32_t>(the_height / 2, 1);
-						}
-					}
-				}
-			}
-			break;
-		}
+		LoadTextureImpl(tex_res, type, width, height, depth, num_mipmaps, array_size,
+			format, init_data, data_block, false);
+	}
 
-		for (size_t i = 0; i < base.size(); ++ i)
-		{
-			init_data[i].data = &data_block[base[i]];
-		}
+	void LoadTextureNoCopy(ResIdentifierPtr const & tex_res, Texture::TextureType& type,
+		uint32_t& width, uint32_t& height, uint32_t& depth, uint32_t& num_mipmaps, uint32_t& array_size,
+		ElementFormat& format, std::vector<ElementInitData>& init_data, std::vector<uint8_t>& data_block)
+	{
+		LoadTextureImpl(tex_res, type, width, height, depth, num_mipmaps, array_size,
+			format, init_data, data_block, true);
 	}
 
 	TexturePtr SyncLoadTexture(std::string const & tex_name, uint32_t access_hint)
@@ -2199,6 +2322,12 @@ namespace KlayGE
 		return ResLoader::Instance().ASyncQueryT<Texture>(MakeSharedPtr<TextureLoadingDesc>(tex_name, access_hint));
 	}
 
+	TexturePtr ASyncLoadTextureDependency(ResLoadingDesc& res_desc, std::string const & tex_name, uint32_t access_hint)
+	{
+		return ResLoader::Instance().ASyncQueryDependencyT<Texture>(res_desc,
+			MakeSharedPtr<TextureLoadingDesc>(tex_name, access_hint));
+	}
+
 	void SaveTexture(std::string const & tex_name, Texture::TextureType type,
 		uint32_t width, uint32_t height, uint32_t depth, uint32_t numMipMaps, uint32_t array_size,
 		ElementFormat format, ArrayRef<ElementInitData> init_data)
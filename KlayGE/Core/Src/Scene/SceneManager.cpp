@@ -39,6 +39,7 @@
 #include <KFL/Util.hpp>
 #include <KlayGE/Context.hpp>
 #include <KFL/Math.hpp>
+#include <KFL/SIMDMath.hpp>
 #include <KlayGE/App3D.hpp>
 #include <KlayGE/Window.hpp>
 #include <KlayGE/Viewport.hpp>
@@ -47,19 +48,109 @@
 #include <KlayGE/RenderFactory.hpp>
 #include <KlayGE/Renderable.hpp>
 #include <KlayGE/RenderEffect.hpp>
+#include <KlayGE/RenderStateObject.hpp>
 #include <KlayGE/Light.hpp>
 #include <KlayGE/SceneObject.hpp>
+#include <KlayGE/Mesh.hpp>
 #include <KlayGE/Input.hpp>
 #include <KlayGE/InputFactory.hpp>
 #include <KlayGE/FrameBuffer.hpp>
 #include <KlayGE/DeferredRenderingLayer.hpp>
 #include <KFL/Hash.hpp>
+#include <KFL/Thread.hpp>
 
 #include <map>
 #include <algorithm>
+#include <array>
+#include <atomic>
 
 #include <KlayGE/SceneManager.hpp>
 
+namespace
+{
+	using namespace KlayGE;
+
+	// Meshlet cones only tell which triangles turn their clockwise side away from the eye
+	bool CullsBackFaces(RenderTechnique const & tech)
+	{
+		for (uint32_t i = 0; i < tech.NumPasses(); ++ i)
+		{
+			RasterizerStateDesc const & rs_desc = tech.Pass(i).GetRenderStateObject()->GetRasterizerStateDesc();
+			if (rs_desc.cull_mode != (rs_desc.front_face_ccw ? CM_Front : CM_Back))
+			{
+				return false;
+			}
+		}
+		return tech.NumPasses() > 0;
+	}
+
+	// Render queue sort keys, from the most significant bits: the technique, ranked by its weight; the material
+	//  and the layout, for opaque techniques; the view depth, for opaque techniques without discard, so that they
+	//  are drawn front to back. The sort is stable, renderables with equal keys are drawn in the order they are added.
+	uint32_t const QUEUE_KEY_DEPTH_BITS = 24;
+	uint32_t const QUEUE_KEY_LAYOUT_BITS = 16;
+	uint32_t const QUEUE_KEY_MTL_BITS = 12;
+	uint32_t const QUEUE_KEY_TECH_BITS = 12;
+	uint32_t const QUEUE_KEY_LAYOUT_SHIFT = QUEUE_KEY_DEPTH_BITS;
+	uint32_t const QUEUE_KEY_MTL_SHIFT = QUEUE_KEY_LAYOUT_SHIFT + QUEUE_KEY_LAYOUT_BITS;
+	uint32_t const QUEUE_KEY_TECH_SHIFT = QUEUE_KEY_MTL_SHIFT + QUEUE_KEY_MTL_BITS;
+	static_assert(QUEUE_KEY_TECH_SHIFT + QUEUE_KEY_TECH_BITS == 64, "Render queue keys should use all 64 bits");
+
+	// Numbers states in the order they are first met
+	template <typename T>
+	uint32_t QueueStateId(std::unordered_map<T, uint32_t>& ids, T state)
+	{
+		return ids.emplace(state, static_cast<uint32_t>(ids.size())).first->second;
+	}
+
+	// Values too big for a key field share the last one
+	uint64_t QueueKeyField(uint64_t value, uint32_t bits, uint32_t shift)
+	{
+		return std::min<uint64_t>(value, (1ULL << bits) - 1) << shift;
+	}
+
+	// Nearest view depth of the instances of a renderable, quantized between the near and far planes
+	uint32_t QueueDepth(Renderable const & renderable, float4 const & view_mat_z, float near_plane, float inv_depth_range)
+	{
+		float md = 1e10f;
+		for (uint32_t i = 0; i < renderable.NumInstances(); ++ i)
+		{
+			AABBox const & box = renderable.GetInstance(i)->PosBoundWS();
+			float3 const center = box.Center();
+			float3 const extent = box.HalfSize();
+			md = std::min(md, center.x() * view_mat_z.x() + center.y() * view_mat_z.y() + center.z() * view_mat_z.z() + view_mat_z.w()
+				- (extent.x() * std::abs(view_mat_z.x()) + extent.y() * std::abs(view_mat_z.y()) + extent.z() * std::abs(view_mat_z.z())));
+		}
+
+		float t = (md - near_plane) * inv_depth_range;
+		if (!(t > 0))
+		{
+			t = 0;
+		}
+		else if (t > 1)
+		{
+			t = 1;
+		}
+		return static_cast<uint32_t>(t * ((1ULL << QUEUE_KEY_DEPTH_BITS) - 1));
+	}
+
+	// Small enough to balance threads, big enough to make taking a chunk cheap
+	uint32_t const CULL_CHUNK_SIZE = 512;
+
+	// Calls func(chunk, begin, end) for [0, num) in chunks on up to max_threads threads. A chunk only writes its own
+	//  output, and outputs are merged in chunk order, so the result doesn't depend on the number of threads.
+	template <typename F>
+	void ForEachChunk(uint32_t num, uint32_t max_threads, F const & func)
+	{
+		uint32_t const num_chunks = (num + CULL_CHUNK_SIZE - 1) / CULL_CHUNK_SIZE;
+		parallel_for(Context::Instance().ThreadPool(), num_chunks, max_threads,
+			[&func, num](uint32_t c)
+			{
+				func(c, c * CULL_CHUNK_SIZE, std::min(num, (c + 1) * CULL_CHUNK_SIZE));
+			});
+	}
+}
+
 namespace KlayGE
 {
 	// 캯
@@ -69,9 +160,10 @@ namespace KlayGE
 			small_obj_threshold_(0),
 			update_elapse_(1.0f / 60),
 			num_objects_rendered_(0), num_renderables_rendered_(0),
-			num_primitives_rendered_(0), num_vertices_rendered_(0),
-			num_draw_calls_(0), num_dispatch_calls_(0),
-			quit_(false), deferred_mode_(false)
+			num_primitives_rendered_(0), num_vertices_rendered_(0), num_primitives_cluster_culled_(0),
+			num_poses_evaluated_(0), num_poses_blended_(0), num_poses_skipped_(0),
+			num_draw_calls_(0), num_dispatch_calls_(0), num_state_changes_(0), num_state_changes_just_made_(0),
+			quit_(false), deferred_mode_(false), cluster_culling_(true), culling_threads_(0)
 	{
 	}
 
@@ -80,7 +172,10 @@ namespace KlayGE
 	SceneManager::~SceneManager()
 	{
 		quit_ = true;
-		(*update_thread_)();
+		if (update_thread_)
+		{
+			(*update_thread_)();
+		}
 
 		this->ClearLight();
 		this->ClearCamera();
@@ -107,6 +202,26 @@ namespace KlayGE
 		update_elapse_ = elapse;
 	}
 
+	void SceneManager::ClusterCulling(bool cull)
+	{
+		cluster_culling_ = cull;
+	}
+
+	bool SceneManager::ClusterCulling() const
+	{
+		return cluster_culling_;
+	}
+
+	void SceneManager::CullingThreads(uint32_t num)
+	{
+		culling_threads_ = num;
+	}
+
+	uint32_t SceneManager::CullingThreads() const
+	{
+		return culling_threads_;
+	}
+
 	// ü
 	/////////////////////////////////////////////////////////////////////////////////
 	void SceneManager::ClipScene()
@@ -125,52 +240,169 @@ namespace KlayGE
 			}
 		}
 
-		for (auto const & obj : scene_objs_)
+		float3 const view_dir = camera.ForwardVec();
+		float3 const eye_pos = camera.EyePos();
+		bool const omni_directional = camera.OmniDirectionalMode();
+
+		// A child goes by the mark of its parent, so the objects are tested one depth after another
+		std::vector<std::vector<uint32_t>> levels(1);
+		for (uint32_t i = 0; i < scene_objs_.size(); ++ i)
 		{
-			auto so = obj.get();
-			BoundOverlap visible;
-			uint32_t const attr = so->Attrib();
-			if (so->Visible())
+			// Static objects can be placed after Update too, such as in DoUpdate
+			if (scene_objs_[i]->PosBoundWSDirty())
+			{
+				this->UpdateBoundWS(i);
+			}
+
+			uint32_t depth = 0;
+			for (SceneObject const * parent = scene_objs_[i]->Parent(); parent; parent = parent->Parent())
+			{
+				++ depth;
+			}
+			if (depth >= levels.size())
 			{
-				visible = this->VisibleTestFromParent(so, camera.ForwardVec(), camera.EyePos(), view_proj);
-				if (BO_Partial == visible)
+				levels.resize(depth + 1);
+			}
+			levels[depth].push_back(i);
+		}
+
+		std::vector<std::vector<SceneObject*>> moved;
+		for (auto const & level : levels)
+		{
+			uint32_t const num_objs = static_cast<uint32_t>(level.size());
+			moved.assign((num_objs + CULL_CHUNK_SIZE - 1) / CULL_CHUNK_SIZE, std::vector<SceneObject*>());
+			ForEachChunk(num_objs, culling_threads_,
+				[this, &level, &moved, &view_dir, &eye_pos, &view_proj, omni_directional]
+				(uint32_t chunk, uint32_t begin, uint32_t end)
 				{
-					if (attr & SceneObject::SOA_Moveable)
+					// Objects are moved first, so that the whole chunk is tested against the frustum in one go
+					for (uint32_t i = begin; i < end; ++ i)
+					{
+						uint32_t const index = level[i];
+						auto so = scene_objs_[index].get();
+						SceneObject const * parent = so->Parent();
+						if ((obj_attribs_[index] & SceneObject::SOA_Moveable) && so->Visible()
+							&& (!parent || (parent->VisibleMark() != BO_No)))
+						{
+							so->UpdateAbsTransform();
+							this->UpdateBoundWS(index);
+							moved[chunk].push_back(so);
+						}
+					}
+
+					uint32_t const num_chunk_objs = end - begin;
+					std::array<BoundOverlap, CULL_CHUNK_SIZE> frustum_bos;
+					if (!frustum_)
+					{
+						frustum_bos.fill(BO_Yes);
+					}
+					else if (level[end - 1] - level[begin] == num_chunk_objs - 1)
+					{
+						uint32_t const first = level[begin];
+						SIMDMathLib::IntersectAABBsFrustum(&bounds_ws_[0][first], &bounds_ws_[1][first], &bounds_ws_[2][first],
+							&bounds_ws_[3][first], &bounds_ws_[4][first], &bounds_ws_[5][first], num_chunk_objs,
+							*frustum_, frustum_bos.data());
+					}
+					else
 					{
-						so->UpdateAbsModelMatrix();
+						// Objects of a level are apart when other levels are between them
+						std::array<std::array<float, CULL_CHUNK_SIZE>, 6> bounds;
+						for (uint32_t i = begin; i < end; ++ i)
+						{
+							for (size_t j = 0; j < bounds.size(); ++ j)
+							{
+								bounds[j][i - begin] = bounds_ws_[j][level[i]];
+							}
+						}
+						SIMDMathLib::IntersectAABBsFrustum(bounds[0].data(), bounds[1].data(), bounds[2].data(),
+							bounds[3].data(), bounds[4].data(), bounds[5].data(), num_chunk_objs,
+							*frustum_, frustum_bos.data());
 					}
 
-					if (attr & SceneObject::SOA_Cullable)
+					for (uint32_t i = begin; i < end; ++ i)
 					{
-						if (small_obj_threshold_ > 0)
+						uint32_t const index = level[i];
+						auto so = scene_objs_[index].get();
+						uint32_t const attr = obj_attribs_[index];
+						SceneObject const * parent = so->Parent();
+						BoundOverlap const parent_bo = parent ? parent->VisibleMark() : BO_Partial;
+
+						BoundOverlap visible;
+						if (!so->Visible() || (BO_No == parent_bo))
 						{
-							visible = ((MathLib::ortho_area(camera.ForwardVec(), so->PosBoundWS()) > small_obj_threshold_)
-								&& (MathLib::perspective_area(camera.EyePos(), view_proj, so->PosBoundWS()) > small_obj_threshold_))
-								? BO_Yes : BO_No;
+							visible = BO_No;
 						}
 						else
 						{
-							visible = BO_Yes;
+							if ((attr & SceneObject::SOA_Cullable) && (small_obj_threshold_ > 0)
+								&& ((MathLib::ortho_area(view_dir, so->PosBoundWS()) <= small_obj_threshold_)
+									|| (MathLib::perspective_area(eye_pos, view_proj, so->PosBoundWS()) <= small_obj_threshold_)))
+							{
+								visible = BO_No;
+							}
+							else if (BO_Partial == parent_bo)
+							{
+								visible = (!omni_directional && (attr & SceneObject::SOA_Cullable))
+									? frustum_bos[i - begin] : BO_Yes;
+							}
+							else
+							{
+								visible = parent_bo;
+							}
 						}
+
+						so->VisibleMark(visible);
 					}
-					else
-					{
-						visible = BO_Yes;
-					}
+				});
 
-					if (!camera.OmniDirectionalMode() && (attr & SceneObject::SOA_Cullable)
-						&& (BO_Yes == visible))
+			// Objects can share a renderable. Setting its matrix in object order gives what a single thread would.
+			for (auto const & chunk_moved : moved)
+			{
+				for (auto so : chunk_moved)
+				{
+					if (so->GetRenderable())
 					{
-						visible = this->AABBVisible(so->PosBoundWS());
+						so->GetRenderable()->ModelMatrix(so->AbsModelMatrix());
 					}
 				}
 			}
-			else
+		}
+	}
+
+	void SceneManager::ClipSceneByFrustum(Frustum const & frustum)
+	{
+		for (auto const & scene_obj : scene_objs_)
+		{
+			scene_obj->VisibleMark(BO_No);
+		}
+
+		frustum_ = &frustum;
+		this->ClipScene();
+	}
+
+	void SceneManager::UpdateBoundWS(uint32_t index)
+	{
+		SceneObject& obj = *scene_objs_[index];
+		uint32_t const attr = obj.Attrib();
+		obj_attribs_[index] = attr;
+		obj.PosBoundWSDirty(false);
+
+		// Only these objects have a bound
+		if (attr & (SceneObject::SOA_Cullable | SceneObject::SOA_Moveable))
+		{
+			AABBox const & aabb = obj.PosBoundWS();
+			for (int i = 0; i < 3; ++ i)
 			{
-				visible = BO_No;
+				bounds_ws_[i][index] = aabb.Min()[i];
+				bounds_ws_[i + 3][index] = aabb.Max()[i];
+			}
+		}
+		else
+		{
+			for (auto& bounds : bounds_ws_)
+			{
+				bounds[index] = 0;
 			}
-
-			so->VisibleMark(visible);
 		}
 	}
 
@@ -267,6 +499,12 @@ namespace KlayGE
 			}
 
 			scene_objs_.push_back(obj);
+			for (auto& bounds : bounds_ws_)
+			{
+				bounds.resize(scene_objs_.size());
+			}
+			obj_attribs_.resize(scene_objs_.size());
+			this->UpdateBoundWS(static_cast<uint32_t>(scene_objs_.size() - 1));
 			this->OnAddSceneObject(obj);
 		}
 	}
@@ -300,6 +538,13 @@ namespace KlayGE
 	std::vector<SceneObjectPtr>::iterator SceneManager::DelSceneObjectLocked(std::vector<SceneObjectPtr>::iterator iter)
 	{
 		this->OnDelSceneObject(iter);
+
+		auto const index = iter - scene_objs_.begin();
+		for (auto& bounds : bounds_ws_)
+		{
+			bounds.erase(bounds.begin() + index);
+		}
+		obj_attribs_.erase(obj_attribs_.begin() + index);
 		return scene_objs_.erase(iter);
 	}
 
@@ -355,22 +600,8 @@ namespace KlayGE
 
 			if (add)
 			{
-				RenderTechnique const * obj_tech = obj->GetRenderTechnique();
-				BOOST_ASSERT(obj_tech);
-				bool found = false;
-				for (auto& items : render_queue_)
-				{
-					if (items.first == obj_tech)
-					{
-						items.second.push_back(obj);
-						found = true;
-						break;
-					}
-				}
-				if (!found)
-				{
-					render_queue_.emplace_back(obj_tech, std::vector<Renderable*>(1, obj));
-				}
+				BOOST_ASSERT(obj->GetRenderTechnique());
+				render_queue_.push_back(obj);
 			}
 		}
 	}
@@ -453,6 +684,11 @@ namespace KlayGE
 		std::lock_guard<std::mutex> lock(update_mutex_);
 		scene_objs_.resize(0);
 		overlay_scene_objs_.resize(0);
+		for (auto& bounds : bounds_ws_)
+		{
+			bounds.resize(0);
+		}
+		obj_attribs_.resize(0);
 	}
 
 	// ³
@@ -468,6 +704,8 @@ namespace KlayGE
 		RenderEngine& re = Context::Instance().RenderFactoryInstance().RenderEngineInstance();
 		re.BeginFrame();
 
+		SkinnedModel::TakeAnimationStats(num_poses_evaluated_, num_poses_blended_, num_poses_skipped_);
+
 		this->FlushScene();
 
 		if (!update_thread_ && !quit_)
@@ -480,12 +718,16 @@ namespace KlayGE
 		{
 			std::lock_guard<std::mutex> lock(update_mutex_);
 
-			for (auto const & scene_obj : scene_objs_)
+			for (uint32_t i = 0; i < scene_objs_.size(); ++ i)
 			{
+				auto const & scene_obj = scene_objs_[i];
 				if (scene_obj->MainThreadUpdate(app_time, frame_time))
 				{
 					added_scene_objs.push_back(scene_obj);
 				}
+
+				// The update functions may have placed the object somewhere else
+				this->UpdateBoundWS(i);
 			}
 
 			overlay_scene_objs_.clear();
@@ -549,6 +791,7 @@ namespace KlayGE
 		num_renderables_rendered_ = 0;
 		num_primitives_rendered_ = 0;
 		num_vertices_rendered_ = 0;
+		num_primitives_cluster_culled_ = 0;
 
 		Camera& camera = app.ActiveCamera();
 		auto const & scene_objs = (urt & App3DFramework::URV_Overlay) ? overlay_scene_objs_ : scene_objs_;
@@ -604,91 +847,146 @@ namespace KlayGE
 			}
 		}
 
-		for (auto const & obj : scene_objs)
-		{
-			auto so = obj.get();
-			if ((so->VisibleMark() != BO_No) && (0 == so->NumChildren()))
+		// Visible leaves and their screen areas, gathered in chunks and kept in scene order
+		uint32_t const num_objs = static_cast<uint32_t>(scene_objs.size());
+		std::vector<std::vector<std::pair<SceneObject*, float>>> visibles((num_objs + CULL_CHUNK_SIZE - 1) / CULL_CHUNK_SIZE);
+		float3 const eye_pos = camera.EyePos();
+		float4x4 const & view_proj = camera.ViewProjMatrix();
+		ForEachChunk(num_objs, culling_threads_,
+			[&scene_objs, &visibles, &eye_pos, &view_proj](uint32_t chunk, uint32_t begin, uint32_t end)
 			{
-				auto renderable = so->GetRenderable().get();
-				if (renderable)
+				for (uint32_t i = begin; i < end; ++ i)
 				{
-					renderable->ClearInstances();
+					auto so = scene_objs[i].get();
+					if ((so->VisibleMark() != BO_No) && (0 == so->NumChildren()))
+					{
+						auto renderable = so->GetRenderable().get();
+						if (renderable)
+						{
+							float area = 0;
+							if ((renderable->NumLods() > 1) || renderable->WantsScreenArea())
+							{
+								area = MathLib::perspective_area(eye_pos, view_proj, so->PosBoundWS());
+							}
+							visibles[chunk].emplace_back(so, area);
+						}
+					}
 				}
+			});
+
+		for (auto const & chunk_visibles : visibles)
+		{
+			for (auto const & visible : chunk_visibles)
+			{
+				visible.first->GetRenderable()->ClearInstances();
 			}
 		}
 
-		for (auto const & obj : scene_objs)
+		for (auto const & chunk_visibles : visibles)
 		{
-			auto so = obj.get();
-			if ((so->VisibleMark() != BO_No) && (0 == so->NumChildren()))
+			for (auto const & visible : chunk_visibles)
 			{
+				auto so = visible.first;
 				auto renderable = so->GetRenderable().get();
-				if (renderable)
+				bool const has_lods = renderable->NumLods() > 1;
+				bool const wants_area = renderable->WantsScreenArea();
+				if (has_lods || wants_area)
 				{
-					if (0 == renderable->NumInstances())
+					float const area = visible.second;
+					if (has_lods)
 					{
-						renderable->AddToRenderQueue();
+						// Instances share the renderable, the biggest one on screen decides
+						int32_t lod = renderable->LodForScreenArea(area);
+						if (renderable->NumInstances() > 0)
+						{
+							lod = std::min(lod, renderable->ActiveLod());
+						}
+						renderable->ActiveLod(lod);
 					}
-					renderable->AddInstance(so);
-					++ num_objects_rendered_;
+					if (wants_area)
+					{
+						renderable->ScreenArea(area);
+					}
+				}
+
+				if (0 == renderable->NumInstances())
+				{
+					renderable->AddToRenderQueue();
 				}
+				renderable->AddInstance(so);
+				++ num_objects_rendered_;
 			}
 		}
 
-		std::sort(render_queue_.begin(), render_queue_.end(),
-			[](std::pair<RenderTechnique const *, std::vector<Renderable*>> const & lhs,
-				std::pair<RenderTechnique const *, std::vector<Renderable*>> const & rhs)
-			{
-				BOOST_ASSERT(lhs.first);
-				BOOST_ASSERT(rhs.first);
+		this->CullClusters(camera);
 
-				return lhs.first->Weight() < rhs.first->Weight();
-			});
+		// Techniques are ranked by weight, then by the order they are first met
+		auto& items = render_queue_keys_[0];
+		items.resize(render_queue_.size());
+		for (size_t i = 0; i < render_queue_.size(); ++ i)
+		{
+			items[i] = std::make_pair(QueueStateId<RenderTechnique const *>(render_queue_tech_ids_,
+				render_queue_[i]->GetRenderTechnique()), render_queue_[i]);
+		}
+		std::vector<std::pair<float, uint32_t>> tech_weights;
+		tech_weights.reserve(render_queue_tech_ids_.size());
+		for (auto const & tech_id : render_queue_tech_ids_)
+		{
+			tech_weights.emplace_back(tech_id.first->Weight(), tech_id.second);
+		}
+		std::sort(tech_weights.begin(), tech_weights.end());
+		std::vector<uint32_t> tech_ranks(tech_weights.size());
+		for (size_t i = 0; i < tech_weights.size(); ++ i)
+		{
+			tech_ranks[tech_weights[i].second] = static_cast<uint32_t>(i);
+		}
 
 		float4 const & view_mat_z = camera.ViewMatrix().Col(2);
-		for (auto& items : render_queue_)
+		float const near_plane = camera.NearPlane();
+		float const inv_depth_range = 1 / (camera.FarPlane() - near_plane);
+		for (auto& item : items)
 		{
-			if (!items.first->Transparent() && !items.first->HasDiscard() && (items.second.size() > 1))
+			Renderable const & renderable = *item.second;
+			RenderTechnique const & tech = *renderable.GetRenderTechnique();
+			uint32_t mtl_id = 0;
+			uint32_t layout_id = 0;
+			uint32_t depth = 0;
+			if (!tech.Transparent())
 			{
-				std::vector<std::pair<float, uint32_t>> min_depths(items.second.size());
-				for (size_t j = 0; j < min_depths.size(); ++ j)
-				{
-					Renderable const * renderable = items.second[j];
-					AABBox const & box = renderable->PosBound();
-					uint32_t const num = renderable->NumInstances();
-					float md = 1e10f;
-					for (uint32_t i = 0; i < num; ++ i)
-					{
-						float4x4 const & mat = renderable->GetInstance(i)->ModelMatrix();
-						float4 const zvec(MathLib::dot(mat.Row(0), view_mat_z),
-							MathLib::dot(mat.Row(1), view_mat_z), MathLib::dot(mat.Row(2), view_mat_z),
-							MathLib::dot(mat.Row(3), view_mat_z));
-						for (int k = 0; k < 8; ++ k)
-						{
-							float3 const v = box.Corner(k);
-							md = std::min(md, v.x() * zvec.x() + v.y() * zvec.y() + v.z() * zvec.z() + zvec.w());
-						}
-					}
-
-					min_depths[j] = std::make_pair(md, static_cast<uint32_t>(j));
-				}
-
-				std::sort(min_depths.begin(), min_depths.end());
-
-				std::vector<Renderable*> sorted_items(min_depths.size());
-				for (size_t j = 0; j < min_depths.size(); ++ j)
+				mtl_id = QueueStateId<void const *>(render_queue_mtl_ids_, renderable.Material().get());
+				layout_id = QueueStateId<void const *>(render_queue_layout_ids_, &renderable.GetRenderLayout());
+				if (!tech.HasDiscard())
 				{
-					sorted_items[j] = items.second[min_depths[j].second];
+					depth = QueueDepth(renderable, view_mat_z, near_plane, inv_depth_range);
 				}
-				items.second.swap(sorted_items);
 			}
+			item.first = RenderQueueKey(tech_ranks[item.first], mtl_id, layout_id, depth);
+		}
 
-			for (auto const & item : items.second)
-			{
-				item->Render();
-			}
-			num_renderables_rendered_ += static_cast<uint32_t>(items.second.size());
+		SortRenderQueue(items, render_queue_keys_[1]);
+
+		RenderTechnique const * last_tech = nullptr;
+		RenderMaterial const * last_mtl = nullptr;
+		RenderLayout const * last_layout = nullptr;
+		for (auto const & item : items)
+		{
+			Renderable* renderable = item.second;
+			RenderTechnique const * tech = renderable->GetRenderTechnique();
+			RenderMaterial const * mtl = renderable->Material().get();
+			RenderLayout const * layout = &renderable->GetRenderLayout();
+			num_state_changes_just_made_ += (tech != last_tech) + (mtl != last_mtl) + (layout != last_layout);
+			last_tech = tech;
+			last_mtl = mtl;
+			last_layout = layout;
+
+			renderable->Render();
 		}
+		num_renderables_rendered_ += static_cast<uint32_t>(items.size());
+
+		items.clear();
+		render_queue_tech_ids_.clear();
+		render_queue_mtl_ids_.clear();
+		render_queue_layout_ids_.clear();
 		render_queue_.resize(0);
 
 		num_primitives_rendered_ += re.NumPrimitivesJustRendered();
@@ -725,6 +1023,62 @@ namespace KlayGE
 		return num_vertices_rendered_;
 	}
 
+	void SceneManager::CullClusters(Camera const & camera)
+	{
+		std::vector<std::pair<Renderable*, bool>> items;
+		for (auto const & renderable : render_queue_)
+		{
+			if (renderable->HasClusters())
+			{
+				items.emplace_back(renderable, CullsBackFaces(*renderable->GetRenderTechnique()));
+			}
+		}
+		if (items.empty())
+		{
+			return;
+		}
+
+		if (cluster_culling_)
+		{
+			// Camera matrices are computed lazily, not on the workers
+			camera.ViewProjMatrixWOAdjust();
+
+			std::atomic<uint32_t> num_culled(0);
+			parallel_for(Context::Instance().ThreadPool(), static_cast<uint32_t>(items.size()), culling_threads_,
+				[&items, &num_culled, &camera](uint32_t i)
+				{
+					num_culled += items[i].first->CullClusters(camera, items[i].second);
+				});
+
+			num_primitives_cluster_culled_ += num_culled;
+		}
+
+		for (auto const & item : items)
+		{
+			item.first->ApplyClusterCulling(cluster_culling_);
+		}
+	}
+
+	uint32_t SceneManager::NumPrimitivesClusterCulled() const
+	{
+		return num_primitives_cluster_culled_;
+	}
+
+	uint32_t SceneManager::NumPosesEvaluated() const
+	{
+		return num_poses_evaluated_;
+	}
+
+	uint32_t SceneManager::NumPosesBlended() const
+	{
+		return num_poses_blended_;
+	}
+
+	uint32_t SceneManager::NumPosesSkipped() const
+	{
+		return num_poses_skipped_;
+	}
+
 	uint32_t SceneManager::NumDrawCalls() const
 	{
 		return num_draw_calls_;
@@ -735,6 +1089,62 @@ namespace KlayGE
 		return num_dispatch_calls_;
 	}
 
+	uint32_t SceneManager::NumStateChanges() const
+	{
+		return num_state_changes_;
+	}
+
+	uint64_t SceneManager::RenderQueueKey(uint32_t tech_rank, uint32_t mtl_id, uint32_t layout_id, uint32_t depth)
+	{
+		return QueueKeyField(tech_rank, QUEUE_KEY_TECH_BITS, QUEUE_KEY_TECH_SHIFT)
+			| QueueKeyField(mtl_id, QUEUE_KEY_MTL_BITS, QUEUE_KEY_MTL_SHIFT)
+			| QueueKeyField(layout_id, QUEUE_KEY_LAYOUT_BITS, QUEUE_KEY_LAYOUT_SHIFT)
+			| QueueKeyField(depth, QUEUE_KEY_DEPTH_BITS, 0);
+	}
+
+	// 8 bits a pass. Passes on a byte all keys share are skipped.
+	void SceneManager::SortRenderQueue(std::vector<std::pair<uint64_t, Renderable*>>& items,
+		std::vector<std::pair<uint64_t, Renderable*>>& scratch)
+	{
+		uint32_t const num = static_cast<uint32_t>(items.size());
+		if (num < 2)
+		{
+			return;
+		}
+
+		std::array<std::array<uint32_t, 256>, 8> counts = {};
+		for (auto const & item : items)
+		{
+			for (uint32_t d = 0; d < 8; ++ d)
+			{
+				++ counts[d][(item.first >> (d * 8)) & 0xFF];
+			}
+		}
+
+		scratch.resize(num);
+		for (uint32_t d = 0; d < 8; ++ d)
+		{
+			auto& offsets = counts[d];
+			if (offsets[(items[0].first >> (d * 8)) & 0xFF] == num)
+			{
+				continue;
+			}
+
+			uint32_t offset = 0;
+			for (auto& c : offsets)
+			{
+				uint32_t const n = c;
+				c = offset;
+				offset += n;
+			}
+			for (auto const & item : items)
+			{
+				scratch[offsets[(item.first >> (d * 8)) & 0xFF] ++] = item;
+			}
+			items.swap(scratch);
+		}
+	}
+
 	void SceneManager::FlushScene()
 	{
 		RenderEngine& re = Context::Instance().RenderFactoryInstance().RenderEngineInstance();
@@ -775,6 +1185,8 @@ namespace KlayGE
 
 		num_draw_calls_ = re.NumDrawsJustCalled();
 		num_dispatch_calls_ = re.NumDispatchesJustCalled();
+		num_state_changes_ = num_state_changes_just_made_;
+		num_state_changes_just_made_ = 0;
 	}
 
 	void SceneManager::UpdateThreadFunc()
@@ -29,7 +29,7 @@ namespace KlayGE
 	SceneObject::SceneObject(uint32_t attrib)
 		: attrib_(attrib), parent_(nullptr), renderable_hw_res_ready_(false),
 			model_(float4x4::Identity()), abs_model_(float4x4::Identity()),
-			visible_mark_(BO_No)
+			pos_aabb_ws_dirty_(false), visible_mark_(BO_No)
 	{
 		if (!(attrib & SOA_Overlay) && (attrib & (SOA_Cullable | SOA_Moveable)))
 		{
@@ -87,7 +87,27 @@ namespace KlayGE
 		return *pos_aabb_ws_;
 	}
 
+	bool SceneObject::PosBoundWSDirty() const
+	{
+		return pos_aabb_ws_dirty_;
+	}
+
+	void SceneObject::PosBoundWSDirty(bool dirty)
+	{
+		pos_aabb_ws_dirty_ = dirty;
+	}
+
 	void SceneObject::UpdateAbsModelMatrix()
+	{
+		this->UpdateAbsTransform();
+
+		if (renderable_)
+		{
+			renderable_->ModelMatrix(abs_model_);
+		}
+	}
+
+	void SceneObject::UpdateAbsTransform()
 	{
 		if (parent_)
 		{
@@ -98,14 +118,10 @@ namespace KlayGE
 			abs_model_ = model_;
 		}
 
-		if (renderable_)
+		if (renderable_ && pos_aabb_ws_)
 		{
-			if (pos_aabb_ws_)
-			{
-				*pos_aabb_ws_ = MathLib::transform_aabb(renderable_->PosBound(), abs_model_);
-			}
-
-			renderable_->ModelMatrix(abs_model_);
+			*pos_aabb_ws_ = MathLib::transform_aabb(renderable_->PosBound(), abs_model_);
+			pos_aabb_ws_dirty_ = true;
 		}
 	}
 
@@ -0,0 +1,119 @@
+/**
+ * @file BVH.hpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+#ifndef KLAYGE_PLUGINS_BVH_HPP
+#define KLAYGE_PLUGINS_BVH_HPP
+
+#pragma once
+
+#include <KlayGE/PreDeclare.hpp>
+#include <KlayGE/SceneManager.hpp>
+#include <KFL/AABBox.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+namespace KlayGE
+{
+	// A dynamic AABB tree over all cullable objects, static and moveable alike. Leaves of moveable objects
+	//  have fat bounds, so an object only leaves its place in the tree when it moves out of them. Inserting
+	//  and removing a leaf rotate the nodes on its path to keep the tree balanced, and a few more nodes are rotated
+	//  in every clip to tighten it.
+	class BVH : public SceneManager
+	{
+	public:
+		BVH();
+
+		// Fat bounds are the bounds grown by this ratio of their size on each side
+		void FatMargin(float margin);
+		float FatMargin() const;
+		// Nodes tried for a tighter rotation in each ClipScene
+		void RebalanceBudget(uint32_t num_nodes);
+		uint32_t RebalanceBudget() const;
+
+		uint32_t NumNodes() const;
+		uint32_t TreeHeight() const;
+		// Leaves moved to another place in the tree in the last ClipScene
+		uint32_t NumLeavesReinserted() const;
+
+		virtual void ClipScene() override;
+
+		virtual void ClearObject() override;
+
+	private:
+		virtual void OnAddSceneObject(SceneObjectPtr const & obj) override;
+		virtual void OnDelSceneObject(std::vector<SceneObjectPtr>::iterator iter) override;
+		virtual void DoSuspend() override;
+		virtual void DoResume() override;
+
+		int AllocNode();
+		void FreeNode(int index);
+
+		void InsertLeaf(int leaf);
+		void RemoveLeaf(int leaf);
+		void Refit(int index);
+		int Balance(int index);
+		void Rotate(int index);
+		void Rebalance();
+
+		AABBox FatBound(SceneObject const & obj) const;
+		void MarkLeaves(float3 const & view_dir, float3 const & eye_pos, float4x4 const & view_proj, bool omni_directional);
+
+	private:
+		BVH(BVH const & rhs);
+		BVH& operator=(BVH const & rhs);
+
+	private:
+		struct bvh_node_t
+		{
+			AABBox bb;
+			int parent;
+			int children[2];
+			// 0 for leaves, -1 for free nodes
+			int height;
+
+			SceneObject* obj;
+		};
+
+		std::vector<bvh_node_t> nodes_;
+		std::vector<int> free_nodes_;
+		int root_;
+
+		std::unordered_map<SceneObject*, int> leaves_;
+
+		float fat_margin_;
+		uint32_t rebalance_budget_;
+		uint32_t rebalance_cursor_;
+
+		uint32_t num_leaves_reinserted_;
+	};
+}
+
+#endif		// KLAYGE_PLUGINS_BVH_HPP
@@ -29,6 +29,7 @@
 #include <KlayGE/SceneManager.hpp>
 #include <KFL/AABBox.hpp>
 
+#include <unordered_map>
 #include <vector>
 
 namespace KlayGE
@@ -41,6 +42,12 @@ namespace KlayGE
 		void MaxTreeDepth(uint32_t max_tree_depth);
 		uint32_t MaxTreeDepth() const;
 
+		// Objects placed or removed, nodes split or merged, and root growths in the last frame
+		uint32_t NumNodeOperations() const
+		{
+			return num_node_ops_last_frame_;
+		}
+
 		virtual void ClipScene() override;
 
 		virtual BoundOverlap AABBVisible(AABBox const & aabb) const override;
@@ -55,7 +62,13 @@ namespace KlayGE
 		virtual void DoSuspend() override;
 		virtual void DoResume() override;
 
-		void DivideNode(size_t index, uint32_t curr_depth);
+		void ResetRoot(AABBox const & aabb);
+		void InsertObj(SceneObject* so);
+		void RemoveObj(SceneObject* so);
+		void GrowRoot(AABBox const & aabb);
+		void SplitNode(int index);
+		bool MergeNode(int index);
+		int AllocChildren(int parent);
 		void NodeVisible(size_t index);
 		void MarkNodeObjs(size_t index, bool force);
 
@@ -72,6 +85,7 @@ namespace KlayGE
 		struct octree_node_t
 		{
 			AABBox bb;
+			int parent;
 			int first_child_index;
 			BoundOverlap visible;
 
@@ -80,9 +94,23 @@ namespace KlayGE
 
 		std::vector<octree_node_t> octree_;
 
+		// Blocks of 8 children left by merged nodes
+		std::vector<int> free_child_blocks_;
+
+		// The node of each static object, -1 while it waits in pending_objs_, -2 if it is in outside_objs_
+		std::unordered_map<SceneObject*, int> obj_nodes_;
+		// Objects are placed in the next clip, when their bounds are up to date
+		std::vector<SceneObject*> pending_objs_;
+		// Objects the root can't hold, such as ones with infinite bounds. They are tested one by one.
+		std::vector<SceneObject*> outside_objs_;
+
 		uint32_t max_tree_depth_;
+		// Each growth puts the old root one level deeper
+		uint32_t num_root_growths_;
 
-		bool rebuild_tree_;
+		uint32_t num_node_ops_;
+		uint32_t num_node_ops_last_frame_;
+		uint32_t stats_frame_;
 
 #ifdef KLAYGE_DRAW_NODES
 		RenderablePtr node_renderable_;
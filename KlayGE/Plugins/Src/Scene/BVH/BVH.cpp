@@ -0,0 +1,584 @@
+/**
+ * @file BVH.cpp
+ * @author Minmin Gong
+ *
+ * @section DESCRIPTION
+ *
+ * This source file is part of KlayGE
+ * For the latest info, see http://www.klayge.org
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * You may alternatively use this source under the terms of
+ * the KlayGE Proprietary License (KPL). You can obtained such a license
+ * from http://www.klayge.org/licensing/.
+ */
+
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Util.hpp>
+#include <KFL/Math.hpp>
+#include <KlayGE/SceneObject.hpp>
+#include <KlayGE/Camera.hpp>
+#include <KlayGE/App3D.hpp>
+#include <KlayGE/Context.hpp>
+#include <KlayGE/DeferredRenderingLayer.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <boost/assert.hpp>
+
+#include <KlayGE/BVH/BVH.hpp>
+
+namespace
+{
+	using namespace KlayGE;
+
+	// Half of the surface area, enough to compare costs
+	float SurfaceArea(AABBox const & aabb)
+	{
+		float3 const size = aabb.Max() - aabb.Min();
+		return size.x() * size.y() + size.y() * size.z() + size.z() * size.x();
+	}
+
+	bool Contains(AABBox const & outer, AABBox const & inner)
+	{
+		return (outer.Min().x() <= inner.Min().x()) && (outer.Min().y() <= inner.Min().y()) && (outer.Min().z() <= inner.Min().z())
+			&& (outer.Max().x() >= inner.Max().x()) && (outer.Max().y() >= inner.Max().y()) && (outer.Max().z() >= inner.Max().z());
+	}
+}
+
+namespace KlayGE
+{
+	BVH::BVH()
+		: root_(-1), fat_margin_(0.1f), rebalance_budget_(64), rebalance_cursor_(0), num_leaves_reinserted_(0)
+	{
+	}
+
+	void BVH::FatMargin(float margin)
+	{
+		fat_margin_ = std::max(margin, 0.0f);
+	}
+
+	float BVH::FatMargin() const
+	{
+		return fat_margin_;
+	}
+
+	void BVH::RebalanceBudget(uint32_t num_nodes)
+	{
+		rebalance_budget_ = num_nodes;
+	}
+
+	uint32_t BVH::RebalanceBudget() const
+	{
+		return rebalance_budget_;
+	}
+
+	uint32_t BVH::NumNodes() const
+	{
+		return static_cast<uint32_t>(nodes_.size() - free_nodes_.size());
+	}
+
+	uint32_t BVH::TreeHeight() const
+	{
+		return (-1 == root_) ? 0 : nodes_[root_].height;
+	}
+
+	uint32_t BVH::NumLeavesReinserted() const
+	{
+		return num_leaves_reinserted_;
+	}
+
+	void BVH::ClipScene()
+	{
+		App3DFramework& app = Context::Instance().AppInstance();
+		Camera& camera = app.ActiveCamera();
+
+		float4x4 view_proj = camera.ViewProjMatrix();
+		auto drl = Context::Instance().DeferredRenderingLayerInstance();
+		if (drl)
+		{
+			int32_t cas_index = drl->CurrCascadeIndex();
+			if (cas_index >= 0)
+			{
+				view_proj *= drl->GetCascadedShadowLayer()->CascadeCropMatrix(cas_index);
+			}
+		}
+
+		float3 const view_dir = camera.ForwardVec();
+		float3 const eye_pos = camera.EyePos();
+
+		// Leaves are moved first, so that the tree is walked with the objects where they are now
+		num_leaves_reinserted_ = 0;
+		for (auto const & obj : scene_objs_)
+		{
+			uint32_t const attr = obj->Attrib();
+			if ((attr & SceneObject::SOA_Moveable) && obj->Visible())
+			{
+				obj->UpdateAbsModelMatrix();
+
+				if (attr & SceneObject::SOA_Cullable)
+				{
+					auto iter = leaves_.find(obj.get());
+					BOOST_ASSERT(iter != leaves_.end());
+
+					int const leaf = iter->second;
+					if (!Contains(nodes_[leaf].bb, obj->PosBoundWS()))
+					{
+						this->RemoveLeaf(leaf);
+						nodes_[leaf].bb = this->FatBound(*obj);
+						this->InsertLeaf(leaf);
+						++ num_leaves_reinserted_;
+					}
+				}
+			}
+		}
+
+		this->Rebalance();
+
+		if (root_ != -1)
+		{
+			this->MarkLeaves(view_dir, eye_pos, view_proj, camera.OmniDirectionalMode() || !frustum_);
+		}
+
+		for (auto const & obj : scene_objs_)
+		{
+			BoundOverlap visible;
+			if (obj->Visible())
+			{
+				uint32_t const attr = obj->Attrib();
+				SceneObject const * parent = obj->Parent();
+				BoundOverlap const parent_bo = parent ? parent->VisibleMark() : BO_Partial;
+				if (BO_No == parent_bo)
+				{
+					visible = BO_No;
+				}
+				else if (!(attr & SceneObject::SOA_Cullable))
+				{
+					visible = (BO_Partial == parent_bo) ? BO_Yes : parent_bo;
+				}
+				else if (BO_Partial == parent_bo)
+				{
+					// Marked by the tree walk, left BO_No if the walk didn't get to it
+					visible = obj->VisibleMark();
+				}
+				else if ((small_obj_threshold_ > 0)
+					&& ((MathLib::ortho_area(view_dir, obj->PosBoundWS()) <= small_obj_threshold_)
+						|| (MathLib::perspective_area(eye_pos, view_proj, obj->PosBoundWS()) <= small_obj_threshold_)))
+				{
+					visible = BO_No;
+				}
+				else
+				{
+					visible = parent_bo;
+				}
+			}
+			else
+			{
+				visible = BO_No;
+			}
+
+			obj->VisibleMark(visible);
+		}
+	}
+
+	void BVH::ClearObject()
+	{
+		SceneManager::ClearObject();
+
+		nodes_.clear();
+		free_nodes_.clear();
+		root_ = -1;
+		leaves_.clear();
+		rebalance_cursor_ = 0;
+	}
+
+	void BVH::OnAddSceneObject(SceneObjectPtr const & obj)
+	{
+		if (obj->Attrib() & SceneObject::SOA_Cullable)
+		{
+			int leaf;
+			auto iter = leaves_.find(obj.get());
+			if (iter == leaves_.end())
+			{
+				leaf = this->AllocNode();
+				nodes_[leaf].obj = obj.get();
+				leaves_.emplace(obj.get(), leaf);
+			}
+			else
+			{
+				// Added again when its renderable is loaded, with a new bound
+				leaf = iter->second;
+				this->RemoveLeaf(leaf);
+			}
+
+			nodes_[leaf].bb = this->FatBound(*obj);
+			this->InsertLeaf(leaf);
+		}
+	}
+
+	void BVH::OnDelSceneObject(std::vector<SceneObjectPtr>::iterator iter)
+	{
+		BOOST_ASSERT(iter != scene_objs_.end());
+
+		auto leaf_iter = leaves_.find(iter->get());
+		if (leaf_iter != leaves_.end())
+		{
+			this->RemoveLeaf(leaf_iter->second);
+			this->FreeNode(leaf_iter->second);
+			leaves_.erase(leaf_iter);
+		}
+	}
+
+	void BVH::DoSuspend()
+	{
+	}
+
+	void BVH::DoResume()
+	{
+	}
+
+	int BVH::AllocNode()
+	{
+		int index;
+		if (free_nodes_.empty())
+		{
+			index = static_cast<int>(nodes_.size());
+			nodes_.emplace_back();
+		}
+		else
+		{
+			index = free_nodes_.back();
+			free_nodes_.pop_back();
+		}
+
+		bvh_node_t& node = nodes_[index];
+		node.parent = -1;
+		node.children[0] = node.children[1] = -1;
+		node.height = 0;
+		node.obj = nullptr;
+		return index;
+	}
+
+	void BVH::FreeNode(int index)
+	{
+		nodes_[index].height = -1;
+		nodes_[index].obj = nullptr;
+		free_nodes_.push_back(index);
+	}
+
+	void BVH::InsertLeaf(int leaf)
+	{
+		if (-1 == root_)
+		{
+			root_ = leaf;
+			nodes_[leaf].parent = -1;
+			return;
+		}
+
+		// Goes down to the sibling that adds the least surface area to the tree
+		AABBox const leaf_bb = nodes_[leaf].bb;
+		int index = root_;
+		while (nodes_[index].height > 0)
+		{
+			bvh_node_t const & node = nodes_[index];
+			float const area = SurfaceArea(node.bb);
+			float const combined_area = SurfaceArea(node.bb | leaf_bb);
+
+			// Pairing the leaf with this node makes a new parent, going further grows this node anyway
+			float const cost = 2 * combined_area;
+			float const inheritance_cost = 2 * (combined_area - area);
+
+			float child_costs[2];
+			for (int i = 0; i < 2; ++ i)
+			{
+				bvh_node_t const & child = nodes_[node.children[i]];
+				child_costs[i] = SurfaceArea(child.bb | leaf_bb) + inheritance_cost;
+				if (child.height > 0)
+				{
+					child_costs[i] -= SurfaceArea(child.bb);
+				}
+			}
+
+			if ((cost < child_costs[0]) && (cost < child_costs[1]))
+			{
+				break;
+			}
+
+			index = node.children[(child_costs[0] <= child_costs[1]) ? 0 : 1];
+		}
+
+		int const sibling = index;
+		int const old_parent = nodes_[sibling].parent;
+		int const new_parent = this->AllocNode();
+		{
+			bvh_node_t& node = nodes_[new_parent];
+			node.parent = old_parent;
+			node.bb = leaf_bb | nodes_[sibling].bb;
+			node.height = nodes_[sibling].height + 1;
+			node.children[0] = sibling;
+			node.children[1] = leaf;
+		}
+		nodes_[sibling].parent = new_parent;
+		nodes_[leaf].parent = new_parent;
+
+		if (-1 == old_parent)
+		{
+			root_ = new_parent;
+		}
+		else
+		{
+			bvh_node_t& node = nodes_[old_parent];
+			node.children[(node.children[0] == sibling) ? 0 : 1] = new_parent;
+		}
+
+		this->Refit(new_parent);
+	}
+
+	void BVH::RemoveLeaf(int leaf)
+	{
+		if (leaf == root_)
+		{
+			root_ = -1;
+			return;
+		}
+
+		int const parent = nodes_[leaf].parent;
+		int const grand_parent = nodes_[parent].parent;
+		int const sibling = nodes_[parent].children[(nodes_[parent].children[0] == leaf) ? 1 : 0];
+
+		nodes_[leaf].parent = -1;
+		nodes_[sibling].parent = grand_parent;
+		this->FreeNode(parent);
+
+		if (-1 == grand_parent)
+		{
+			root_ = sibling;
+		}
+		else
+		{
+			bvh_node_t& node = nodes_[grand_parent];
+			node.children[(node.children[0] == parent) ? 0 : 1] = sibling;
+			this->Refit(grand_parent);
+		}
+	}
+
+	// Fixes the bounds and heights from a node up to the root, balancing on the way
+	void BVH::Refit(int index)
+	{
+		while (index != -1)
+		{
+			index = this->Balance(index);
+
+			bvh_node_t& node = nodes_[index];
+			bvh_node_t const & child0 = nodes_[node.children[0]];
+			bvh_node_t const & child1 = nodes_[node.children[1]];
+			node.height = 1 + std::max(child0.height, child1.height);
+			node.bb = child0.bb | child1.bb;
+
+			index = node.parent;
+		}
+	}
+
+	// Lifts the taller child when the heights of the children differ by more than 1. Returns the node now in its place.
+	int BVH::Balance(int index)
+	{
+		bvh_node_t& a = nodes_[index];
+		if (a.height < 2)
+		{
+			return index;
+		}
+
+		int const balance = nodes_[a.children[1]].height - nodes_[a.children[0]].height;
+		if (std::abs(balance) <= 1)
+		{
+			return index;
+		}
+
+		int const slot = (balance > 0) ? 1 : 0;
+		int const ix = a.children[slot];
+		int const iy = a.children[1 - slot];
+		bvh_node_t& x = nodes_[ix];
+		bvh_node_t const & y = nodes_[iy];
+
+		x.parent = a.parent;
+		a.parent = ix;
+		if (-1 == x.parent)
+		{
+			root_ = ix;
+		}
+		else
+		{
+			bvh_node_t& node = nodes_[x.parent];
+			node.children[(node.children[0] == index) ? 0 : 1] = ix;
+		}
+
+		// The taller grandchild stays with x, the other one takes the place of x under a
+		bool const first_taller = nodes_[x.children[0]].height > nodes_[x.children[1]].height;
+		int const ikeep = x.children[first_taller ? 0 : 1];
+		int const igive = x.children[first_taller ? 1 : 0];
+		bvh_node_t& keep = nodes_[ikeep];
+		bvh_node_t& give = nodes_[igive];
+
+		x.children[0] = index;
+		x.children[1] = ikeep;
+		a.children[slot] = igive;
+		give.parent = index;
+
+		a.bb = y.bb | give.bb;
+		a.height = 1 + std::max(y.height, give.height);
+		x.bb = a.bb | keep.bb;
+		x.height = 1 + std::max(a.height, keep.height);
+
+		return ix;
+	}
+
+	// Swaps a grandchild with its uncle if that shrinks the child between them and keeps the heights balanced.
+	//  The leaves under the node stay the same, so only the heights above it change.
+	void BVH::Rotate(int index)
+	{
+		bvh_node_t const & a = nodes_[index];
+
+		float best_gain = 0;
+		int best_slot = -1;
+		int best_grand_slot = -1;
+		AABBox best_bb;
+		for (int slot = 0; slot < 2; ++ slot)
+		{
+			bvh_node_t const & x = nodes_[a.children[slot]];
+			bvh_node_t const & y = nodes_[a.children[1 - slot]];
+			if (x.height > 0)
+			{
+				float const area = SurfaceArea(x.bb);
+				for (int grand_slot = 0; grand_slot < 2; ++ grand_slot)
+				{
+					bvh_node_t const & up = nodes_[x.children[grand_slot]];
+					bvh_node_t const & stay = nodes_[x.children[1 - grand_slot]];
+					int const new_height = 1 + std::max(y.height, stay.height);
+					if ((std::abs(y.height - stay.height) <= 1) && (std::abs(new_height - up.height) <= 1))
+					{
+						AABBox const new_bb = y.bb | stay.bb;
+						float const gain = area - SurfaceArea(new_bb);
+						if (gain > best_gain)
+						{
+							best_gain = gain;
+							best_slot = slot;
+							best_grand_slot = grand_slot;
+							best_bb = new_bb;
+						}
+					}
+				}
+			}
+		}
+
+		if (best_slot >= 0)
+		{
+			int const ix = a.children[best_slot];
+			int const iy = a.children[1 - best_slot];
+			bvh_node_t& x = nodes_[ix];
+			int const iup = x.children[best_grand_slot];
+
+			x.children[best_grand_slot] = iy;
+			nodes_[iy].parent = ix;
+			nodes_[index].children[1 - best_slot] = iup;
+			nodes_[iup].parent = index;
+
+			x.bb = best_bb;
+			x.height = 1 + std::max(nodes_[x.children[0]].height, nodes_[x.children[1]].height);
+			for (int p = index; p != -1; p = nodes_[p].parent)
+			{
+				bvh_node_t& node = nodes_[p];
+				node.height = 1 + std::max(nodes_[node.children[0]].height, nodes_[node.children[1]].height);
+			}
+		}
+	}
+
+	// Goes on from where the last one stopped, so the whole tree gets tightened over a number of frames
+	void BVH::Rebalance()
+	{
+		uint32_t const num_nodes = static_cast<uint32_t>(nodes_.size());
+		for (uint32_t i = 0; (i < rebalance_budget_) && (i < num_nodes); ++ i)
+		{
+			if (rebalance_cursor_ >= num_nodes)
+			{
+				rebalance_cursor_ = 0;
+			}
+
+			int const index = static_cast<int>(rebalance_cursor_);
+			++ rebalance_cursor_;
+			if (nodes_[index].height >= 2)
+			{
+				this->Rotate(index);
+			}
+		}
+	}
+
+	AABBox BVH::FatBound(SceneObject const & obj) const
+	{
+		AABBox const & aabb = obj.PosBoundWS();
+		if (obj.Attrib() & SceneObject::SOA_Moveable)
+		{
+			float3 const margin = (aabb.Max() - aabb.Min()) * fat_margin_;
+			return AABBox(aabb.Min() - margin, aabb.Max() + margin);
+		}
+		else
+		{
+			return aabb;
+		}
+	}
+
+	// Marks the leaves in the frustum. Leaves under a culled node keep the BO_No they got before the clip.
+	void BVH::MarkLeaves(float3 const & view_dir, float3 const & eye_pos, float4x4 const & view_proj, bool omni_directional)
+	{
+		// Nodes to visit, and whether their parent is all in the frustum
+		std::vector<std::pair<int, bool>> stack;
+		stack.reserve(nodes_[root_].height * 2 + 2);
+		stack.emplace_back(root_, omni_directional);
+		while (!stack.empty())
+		{
+			int const index = stack.back().first;
+			bool const inside = stack.back().second;
+			stack.pop_back();
+
+			bvh_node_t const & node = nodes_[index];
+			bool const is_leaf = (0 == node.height);
+
+			// Leaves are tested with the bounds of their objects, which are tighter than the fat ones
+			AABBox const & bb = is_leaf ? node.obj->PosBoundWS() : node.bb;
+			if ((small_obj_threshold_ > 0)
+				&& ((MathLib::ortho_area(view_dir, bb) <= small_obj_threshold_)
+					|| (MathLib::perspective_area(eye_pos, view_proj, bb) <= small_obj_threshold_)))
+			{
+				continue;
+			}
+
+			BoundOverlap const bo = inside ? BO_Yes : frustum_->Intersect(bb);
+			if (bo != BO_No)
+			{
+				if (is_leaf)
+				{
+					node.obj->VisibleMark(bo);
+				}
+				else
+				{
+					stack.emplace_back(node.children[0], BO_Yes == bo);
+					stack.emplace_back(node.children[1], BO_Yes == bo);
+				}
+			}
+		}
+	}
+}
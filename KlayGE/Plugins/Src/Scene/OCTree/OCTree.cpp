@@ -35,6 +35,7 @@
 #include <KlayGE/DeferredRenderingLayer.hpp>
 
 #include <algorithm>
+#include <cmath>
 #include <functional>
 #include <boost/assert.hpp>
 
@@ -96,10 +97,85 @@ namespace
 }
 #endif
 
+namespace
+{
+	using namespace KlayGE;
+
+	// A leaf with more objects than this is split on the next insertion into it,
+	// and a node whose children hold no more than half of it is merged.
+	uint32_t const NODE_SPLIT_THRESHOLD = 8;
+	// Limits how far the root grows toward an object far away from the others
+	uint32_t const MAX_ROOT_GROWTHS = 32;
+
+	int const PENDING_NODE = -1;
+	int const OUTSIDE_NODE = -2;
+
+	// Octant of a node that holds the whole box, or -1 if the box is across the node center
+	int ChildContaining(AABBox const & node_bb, AABBox const & aabb)
+	{
+		float3 const center = node_bb.Center();
+		int child = 0;
+		for (int i = 0; i < 3; ++ i)
+		{
+			if (aabb.Min()[i] >= center[i])
+			{
+				child |= 1 << i;
+			}
+			else if (aabb.Max()[i] > center[i])
+			{
+				return -1;
+			}
+		}
+		return child;
+	}
+
+	bool ContainsAABB(AABBox const & outer, AABBox const & inner)
+	{
+		return (outer.Min().x() <= inner.Min().x()) && (outer.Min().y() <= inner.Min().y()) && (outer.Min().z() <= inner.Min().z())
+			&& (outer.Max().x() >= inner.Max().x()) && (outer.Max().y() >= inner.Max().y()) && (outer.Max().z() >= inner.Max().z());
+	}
+
+	// Doubles a root toward the box. Returns the octant the old root takes in the new one.
+	int GrowBound(AABBox& bb, AABBox const & toward)
+	{
+		float3 const size = bb.Max() - bb.Min();
+		float3 new_min = bb.Min();
+		float3 new_max = bb.Max();
+		int octant = 0;
+		for (int i = 0; i < 3; ++ i)
+		{
+			if (toward.Min()[i] < bb.Min()[i])
+			{
+				new_min[i] -= size[i];
+				octant |= 1 << i;
+			}
+			else
+			{
+				new_max[i] += size[i];
+			}
+		}
+		bb = AABBox(new_min, new_max);
+		return octant;
+	}
+
+	bool IsFinite(AABBox const & aabb)
+	{
+		for (int i = 0; i < 3; ++ i)
+		{
+			if (!std::isfinite(aabb.Min()[i]) || !std::isfinite(aabb.Max()[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
 namespace KlayGE
 {
 	OCTree::OCTree()
-		: max_tree_depth_(4), rebuild_tree_(false)
+		: max_tree_depth_(4), num_root_growths_(0),
+			num_node_ops_(0), num_node_ops_last_frame_(0), stats_frame_(0)
 	{
 	}
 
@@ -115,32 +191,44 @@ namespace KlayGE
 
 	void OCTree::ClipScene()
 	{
-		if (rebuild_tree_)
+		App3DFramework& app = Context::Instance().AppInstance();
+
+		uint32_t const frame = app.TotalNumFrames();
+		if (frame != stats_frame_)
+		{
+			num_node_ops_last_frame_ = num_node_ops_;
+			num_node_ops_ = 0;
+			stats_frame_ = frame;
+		}
+
+		if (octree_.empty())
 		{
-			octree_.resize(1);
+			// Fits the first root to all objects placed together, as a full build would
 			AABBox bb_root(float3(0, 0, 0), float3(0, 0, 0));
-			octree_[0].first_child_index = -1;
-			octree_[0].visible = BO_No;
-			for (auto const & obj : scene_objs_)
+			bool first = true;
+			for (auto so : pending_objs_)
 			{
-				uint32_t const attr = obj->Attrib();
-				if ((attr & SceneObject::SOA_Cullable)
-					&& !(attr & SceneObject::SOA_Moveable))
+				auto iter = obj_nodes_.find(so);
+				if ((iter != obj_nodes_.end()) && (PENDING_NODE == iter->second) && IsFinite(so->PosBoundWS()))
 				{
-					bb_root |= obj->PosBoundWS();
-					octree_[0].obj_ptrs.push_back(obj.get());
+					bb_root = first ? so->PosBoundWS() : (bb_root | so->PosBoundWS());
+					first = false;
 				}
 			}
-			float3 const & center = bb_root.Center();
-			float3 const & extent = bb_root.HalfSize();
-			float longest_dim = std::max(std::max(extent.x(), extent.y()), extent.z());
-			float3 new_extent(longest_dim, longest_dim, longest_dim);
-			octree_[0].bb = AABBox(center - new_extent, center + new_extent);
-
-			this->DivideNode(0, 1);
-
-			rebuild_tree_ = false;
+			if (!first)
+			{
+				this->ResetRoot(bb_root);
+			}
+		}
+		for (auto so : pending_objs_)
+		{
+			auto iter = obj_nodes_.find(so);
+			if ((iter != obj_nodes_.end()) && (PENDING_NODE == iter->second))
+			{
+				this->InsertObj(so);
+			}
 		}
+		pending_objs_.clear();
 
 #ifdef KLAYGE_DRAW_NODES
 		if (!node_renderable_)
@@ -155,7 +243,6 @@ namespace KlayGE
 			this->NodeVisible(0);
 		}
 
-		App3DFramework& app = Context::Instance().AppInstance();
 		Camera& camera = app.ActiveCamera();
 
 		float4x4 view_proj = camera.ViewProjMatrix();
@@ -211,6 +298,21 @@ namespace KlayGE
 				this->MarkNodeObjs(0, false);
 			}
 
+			// Not under any node, so not culled with one
+			for (auto so : outside_objs_)
+			{
+				if ((BO_No == so->VisibleMark()) && so->Visible())
+				{
+					BoundOverlap visible = this->VisibleTestFromParent(so, camera.ForwardVec(), camera.EyePos(), view_proj);
+					if (BO_Partial == visible)
+					{
+						AABBox const & aabb_ws = so->PosBoundWS();
+						visible = IsFinite(aabb_ws) ? frustum_->Intersect(aabb_ws) : BO_Yes;
+					}
+					so->VisibleMark(visible);
+				}
+			}
+
 			for (auto const & obj : scene_objs_)
 			{
 				if (obj->Visible())
@@ -230,10 +332,12 @@ namespace KlayGE
 							{
 								obj->VisibleMark(this->AABBVisible(obj->PosBoundWS()));
 							}
-							else
+							else if (obj->Parent())
 							{
-								obj->VisibleMark(visible);
+								// The tree may have reached it before its parent
+								obj->VisibleMark(frustum_->Intersect(obj->PosBoundWS()));
 							}
+							// Otherwise already marked by the tree
 						}
 						else
 						{
@@ -258,7 +362,11 @@ namespace KlayGE
 		SceneManager::ClearObject();
 
 		octree_.clear();
-		rebuild_tree_ = true;
+		free_child_blocks_.clear();
+		obj_nodes_.clear();
+		pending_objs_.clear();
+		outside_objs_.clear();
+		num_root_growths_ = 0;
 	}
 
 	void OCTree::OnAddSceneObject(SceneObjectPtr const & obj)
@@ -267,7 +375,16 @@ namespace KlayGE
 		if ((attr & SceneObject::SOA_Cullable)
 			&& !(attr & SceneObject::SOA_Moveable))
 		{
-			rebuild_tree_ = true;
+			// Also called again when the renderable of an object is loaded. The object
+			// is taken out and placed again with its new bound.
+			SceneObject* so = obj.get();
+			auto iter = obj_nodes_.find(so);
+			if ((iter == obj_nodes_.end()) || (iter->second != PENDING_NODE))
+			{
+				this->RemoveObj(so);
+				obj_nodes_.emplace(so, PENDING_NODE);
+				pending_objs_.push_back(so);
+			}
 		}
 	}
 
@@ -279,7 +396,7 @@ namespace KlayGE
 		if ((attr & SceneObject::SOA_Cullable)
 			&& !(attr & SceneObject::SOA_Moveable))
 		{
-			rebuild_tree_ = true;
+			this->RemoveObj(iter->get());
 		}
 	}
 
@@ -293,58 +410,250 @@ namespace KlayGE
 		// TODO
 	}
 
-	void OCTree::DivideNode(size_t index, uint32_t curr_depth)
+	void OCTree::ResetRoot(AABBox const & aabb)
+	{
+		float3 const & center = aabb.Center();
+		float3 const & extent = aabb.HalfSize();
+		float longest_dim = std::max(std::max(std::max(extent.x(), extent.y()), extent.z()), 1e-3f);
+		float3 new_extent(longest_dim, longest_dim, longest_dim);
+
+		octree_.resize(1);
+		octree_[0].bb = AABBox(center - new_extent, center + new_extent);
+		octree_[0].parent = -1;
+		octree_[0].first_child_index = -1;
+		octree_[0].visible = BO_No;
+		octree_[0].obj_ptrs.clear();
+		num_root_growths_ = 0;
+	}
+
+	void OCTree::InsertObj(SceneObject* so)
 	{
-		if (octree_[index].obj_ptrs.size() > 1)
-		{
-			size_t const this_size = octree_.size();
-			AABBox const parent_bb = octree_[index].bb;
-			float3 const parent_center = parent_bb.Center();
-			octree_[index].first_child_index = static_cast<int>(this_size);
-			octree_[index].visible = BO_No;
-
-			octree_.resize(this_size + 8);
-			for (auto so : octree_[index].obj_ptrs)
-			{
-				AABBox const & aabb = so->PosBoundWS();
-				int mark[6];
-				mark[0] = aabb.Min().x() >= parent_center.x() ? 1 : 0;
-				mark[1] = aabb.Min().y() >= parent_center.y() ? 2 : 0;
-				mark[2] = aabb.Min().z() >= parent_center.z() ? 4 : 0;
-				mark[3] = aabb.Max().x() >= parent_center.x() ? 1 : 0;
-				mark[4] = aabb.Max().y() >= parent_center.y() ? 2 : 0;
-				mark[5] = aabb.Max().z() >= parent_center.z() ? 4 : 0;
-				for (int j = 0; j < 8; ++ j)
+		AABBox const & aabb = so->PosBoundWS();
+		bool const finite = IsFinite(aabb);
+
+		if (finite)
+		{
+			if (octree_.empty())
+			{
+				this->ResetRoot(aabb);
+			}
+			else
+			{
+				// Grows only if the root can reach the object
+				AABBox bb = octree_[0].bb;
+				uint32_t num_growths = 0;
+				for (; (num_growths < MAX_ROOT_GROWTHS) && !ContainsAABB(bb, aabb); ++ num_growths)
 				{
-					if (j == ((j & 1) ? mark[3] : mark[0])
-						+ ((j & 2) ? mark[4] : mark[1])
-						+ ((j & 4) ? mark[5] : mark[2]))
+					GrowBound(bb, aabb);
+				}
+				if (ContainsAABB(bb, aabb))
+				{
+					for (uint32_t i = 0; i < num_growths; ++ i)
 					{
-						octree_[this_size + j].obj_ptrs.push_back(so);
+						this->GrowRoot(aabb);
 					}
 				}
 			}
+		}
+		if (!finite || !ContainsAABB(octree_[0].bb, aabb))
+		{
+			outside_objs_.push_back(so);
+			obj_nodes_[so] = OUTSIDE_NODE;
+			++ num_node_ops_;
+			return;
+		}
 
-			for (size_t j = 0; j < 8; ++ j)
+		// Goes down to the deepest node that holds the whole bound. Leaves are split when full.
+		uint32_t const max_depth = max_tree_depth_ + num_root_growths_;
+		int index = 0;
+		uint32_t depth = 1;
+		for (;;)
+		{
+			if (-1 == octree_[index].first_child_index)
 			{
-				octree_node_t& new_node = octree_[this_size + j];
-				new_node.first_child_index = -1;
-				new_node.bb = AABBox(float3((j & 1) ? parent_center.x() : parent_bb.Min().x(),
-						(j & 2) ? parent_center.y() : parent_bb.Min().y(),
-						(j & 4) ? parent_center.z() : parent_bb.Min().z()),
-					float3((j & 1) ? parent_bb.Max().x() : parent_center.x(),
-						(j & 2) ? parent_bb.Max().y() : parent_center.y(),
-						(j & 4) ? parent_bb.Max().z() : parent_center.z()));
-
-				if (curr_depth < max_tree_depth_)
+				if ((octree_[index].obj_ptrs.size() < NODE_SPLIT_THRESHOLD) || (depth > max_depth))
 				{
-					this->DivideNode(this_size + j, curr_depth + 1);
+					break;
 				}
+
+				this->SplitNode(index);
+			}
+
+			int const child = ChildContaining(octree_[index].bb, aabb);
+			if (child < 0)
+			{
+				break;
+			}
+
+			index = octree_[index].first_child_index + child;
+			++ depth;
+		}
+
+		octree_[index].obj_ptrs.push_back(so);
+		obj_nodes_[so] = index;
+		++ num_node_ops_;
+	}
+
+	void OCTree::RemoveObj(SceneObject* so)
+	{
+		auto iter = obj_nodes_.find(so);
+		if (iter == obj_nodes_.end())
+		{
+			return;
+		}
+
+		int const index = iter->second;
+		obj_nodes_.erase(iter);
+		if (OUTSIDE_NODE == index)
+		{
+			auto obj_iter = std::find(outside_objs_.begin(), outside_objs_.end(), so);
+			BOOST_ASSERT(obj_iter != outside_objs_.end());
+			*obj_iter = outside_objs_.back();
+			outside_objs_.pop_back();
+			++ num_node_ops_;
+			return;
+		}
+		if (PENDING_NODE == index)
+		{
+			// Skipped when the pending objects are placed
+			return;
+		}
+
+		std::vector<SceneObject*>& obj_ptrs = octree_[index].obj_ptrs;
+		auto obj_iter = std::find(obj_ptrs.begin(), obj_ptrs.end(), so);
+		BOOST_ASSERT(obj_iter != obj_ptrs.end());
+		*obj_iter = obj_ptrs.back();
+		obj_ptrs.pop_back();
+		++ num_node_ops_;
+
+		for (int node = (-1 == octree_[index].first_child_index) ? octree_[index].parent : index;
+			(node != -1) && this->MergeNode(node); node = octree_[node].parent);
+	}
+
+	void OCTree::GrowRoot(AABBox const & aabb)
+	{
+		// The old root becomes one of the octants of the new one
+		AABBox new_bb = octree_[0].bb;
+		int const octant = GrowBound(new_bb, aabb);
+
+		octree_node_t old_root = std::move(octree_[0]);
+		octree_[0].bb = new_bb;
+		octree_[0].parent = -1;
+		octree_[0].first_child_index = -1;
+		octree_[0].visible = BO_No;
+		octree_[0].obj_ptrs.clear();
+
+		int const first = this->AllocChildren(0);
+		int const slot = first + octant;
+		octree_[0].first_child_index = first;
+		octree_[slot] = std::move(old_root);
+		octree_[slot].parent = 0;
+
+		if (octree_[slot].first_child_index != -1)
+		{
+			for (int i = 0; i < 8; ++ i)
+			{
+				octree_[octree_[slot].first_child_index + i].parent = slot;
+			}
+		}
+		for (auto so : octree_[slot].obj_ptrs)
+		{
+			obj_nodes_[so] = slot;
+		}
+
+		++ num_root_growths_;
+		++ num_node_ops_;
+	}
+
+	void OCTree::SplitNode(int index)
+	{
+		int const first = this->AllocChildren(index);
+		octree_[index].first_child_index = first;
+
+		// Objects that fit in an octant go down, the others stay
+		std::vector<SceneObject*> obj_ptrs;
+		obj_ptrs.swap(octree_[index].obj_ptrs);
+		for (auto so : obj_ptrs)
+		{
+			int const child = ChildContaining(octree_[index].bb, so->PosBoundWS());
+			int const node = (child < 0) ? index : first + child;
+			octree_[node].obj_ptrs.push_back(so);
+			obj_nodes_[so] = node;
+		}
+
+		++ num_node_ops_;
+	}
+
+	bool OCTree::MergeNode(int index)
+	{
+		int const first = octree_[index].first_child_index;
+		BOOST_ASSERT(first != -1);
+
+		size_t num_objs = octree_[index].obj_ptrs.size();
+		for (int i = 0; i < 8; ++ i)
+		{
+			if (octree_[first + i].first_child_index != -1)
+			{
+				return false;
+			}
+			num_objs += octree_[first + i].obj_ptrs.size();
+		}
+		if (num_objs > NODE_SPLIT_THRESHOLD / 2)
+		{
+			return false;
+		}
+
+		for (int i = 0; i < 8; ++ i)
+		{
+			octree_node_t& child = octree_[first + i];
+			for (auto so : child.obj_ptrs)
+			{
+				octree_[index].obj_ptrs.push_back(so);
+				obj_nodes_[so] = index;
 			}
+			child.obj_ptrs.clear();
+			child.visible = BO_No;
+		}
+
+		octree_[index].first_child_index = -1;
+		free_child_blocks_.push_back(first);
+		++ num_node_ops_;
+
+		return true;
+	}
 
-			octree_[index].obj_ptrs.clear();
-			octree_[index].obj_ptrs.shrink_to_fit();
+	int OCTree::AllocChildren(int parent)
+	{
+		int first;
+		if (free_child_blocks_.empty())
+		{
+			first = static_cast<int>(octree_.size());
+			octree_.resize(octree_.size() + 8);
+		}
+		else
+		{
+			first = free_child_blocks_.back();
+			free_child_blocks_.pop_back();
 		}
+
+		AABBox const parent_bb = octree_[parent].bb;
+		float3 const parent_center = parent_bb.Center();
+		for (int j = 0; j < 8; ++ j)
+		{
+			octree_node_t& new_node = octree_[first + j];
+			new_node.bb = AABBox(float3((j & 1) ? parent_center.x() : parent_bb.Min().x(),
+					(j & 2) ? parent_center.y() : parent_bb.Min().y(),
+					(j & 4) ? parent_center.z() : parent_bb.Min().z()),
+				float3((j & 1) ? parent_bb.Max().x() : parent_center.x(),
+					(j & 2) ? parent_bb.Max().y() : parent_center.y(),
+					(j & 4) ? parent_bb.Max().z() : parent_center.z()));
+			new_node.parent = parent;
+			new_node.first_child_index = -1;
+			new_node.visible = BO_No;
+			BOOST_ASSERT(new_node.obj_ptrs.empty());
+		}
+
+		return first;
 	}
 
 	void OCTree::NodeVisible(size_t index)
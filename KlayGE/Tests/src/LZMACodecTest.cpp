@@ -0,0 +1,132 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Util.hpp>
+#include <KFL/Timer.hpp>
+#include <KlayGE/LZMACodec.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	// Looks like vertex data: smooth positions and normals with a bit of noise, compresses about as well
+	std::vector<uint8_t> MakeModelLikeData(uint32_t size)
+	{
+		std::vector<float> floats(size / sizeof(float));
+		std::minstd_rand rng(size);
+		std::uniform_real_distribution<float> noise(-0.001f, 0.001f);
+		for (size_t i = 0; i < floats.size(); ++ i)
+		{
+			floats[i] = static_cast<float>(i % 997) * 0.01f + noise(rng);
+		}
+
+		std::vector<uint8_t> data(size, 0);
+		std::memcpy(data.data(), floats.data(), floats.size() * sizeof(float));
+		return data;
+	}
+}
+
+TEST(LZMACodecTest, ChunkedRoundTrip)
+{
+	std::vector<uint8_t> const input = MakeModelLikeData(300 * 1024);
+
+	LZMACodec lzma;
+
+	std::vector<uint8_t> single;
+	lzma.Encode(single, input.data(), input.size());
+	std::vector<uint8_t> chunked;
+	lzma.EncodeChunked(chunked, input.data(), input.size(), 64 * 1024);
+	EXPECT_NE(single, chunked);
+
+	// Both forms go through the same Decode
+	std::vector<uint8_t> output;
+	lzma.Decode(output, single.data(), single.size(), input.size());
+	EXPECT_TRUE(input == output);
+
+	output.clear();
+	lzma.Decode(output, chunked.data(), chunked.size(), input.size());
+	EXPECT_TRUE(input == output);
+
+	lzma.MaxDecodeThreads(1);
+	output.clear();
+	lzma.Decode(output, chunked.data(), chunked.size(), input.size());
+	EXPECT_TRUE(input == output);
+
+	// A chunk that doesn't shrink is stored as is
+	std::vector<uint8_t> random(100 * 1024);
+	std::minstd_rand rng(1);
+	for (auto& r : random)
+	{
+		r = static_cast<uint8_t>(rng());
+	}
+	lzma.EncodeChunked(chunked, random.data(), random.size(), 32 * 1024);
+	output.clear();
+	lzma.Decode(output, chunked.data(), chunked.size(), random.size());
+	EXPECT_TRUE(random == output);
+}
+
+TEST(LZMACodecTest, CorruptChunkThrows)
+{
+	std::vector<uint8_t> const input = MakeModelLikeData(300 * 1024);
+
+	LZMACodec lzma;
+	std::vector<uint8_t> chunked;
+	lzma.EncodeChunked(chunked, input.data(), input.size(), 64 * 1024);
+
+	// The header is magic, chunk count and chunk size, followed by one size per chunk. Invalid LZMA properties in
+	//  every chunk make each decode fail, on the calling thread and on the pool.
+	uint32_t num_chunks;
+	std::memcpy(&num_chunks, &chunked[4], sizeof(num_chunks));
+	num_chunks = LE2Native(num_chunks);
+	std::fill(chunked.begin() + 12 + num_chunks * sizeof(uint32_t), chunked.end(), static_cast<uint8_t>(0xFF));
+
+	std::vector<uint8_t> output;
+	EXPECT_ANY_THROW(lzma.Decode(output, chunked.data(), chunked.size(), input.size()));
+}
+
+// Encodes 16MB several times, only runs when KLAYGE_BENCHMARK_LZMA is set
+TEST(LZMACodecTest, ChunkedDecodeBenchmark)
+{
+	if (std::getenv("KLAYGE_BENCHMARK_LZMA") == nullptr)
+	{
+		cout << "KLAYGE_BENCHMARK_LZMA is not set, skipped" << endl;
+		return;
+	}
+
+	uint32_t const size = 16 * 1024 * 1024;
+	std::vector<uint8_t> const input = MakeModelLikeData(size);
+
+	LZMACodec lzma;
+	std::vector<uint8_t> single;
+	lzma.Encode(single, input.data(), input.size());
+	std::vector<uint8_t> chunked;
+	lzma.EncodeChunked(chunked, input.data(), input.size());
+
+	std::vector<uint8_t> output(size);
+	{
+		Timer timer;
+		lzma.Decode(output.data(), single.data(), single.size(), size);
+		double const elapsed = timer.elapsed();
+		cout << "Single stream: " << size / elapsed / 1024 / 1024 << " MB/s" << endl;
+	}
+
+	uint32_t const num_threads[] = { 1, 2, 4, 8 };
+	for (auto num : num_threads)
+	{
+		lzma.MaxDecodeThreads(num);
+
+		Timer timer;
+		lzma.Decode(output.data(), chunked.data(), chunked.size(), size);
+		double const elapsed = timer.elapsed();
+		cout << "Chunked, " << num << " thread(s): " << size / elapsed / 1024 / 1024 << " MB/s" << endl;
+	}
+	EXPECT_TRUE(input == output);
+}
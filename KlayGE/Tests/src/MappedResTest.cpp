@@ -0,0 +1,233 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Util.hpp>
+#include <KFL/Timer.hpp>
+#include <KFL/ResIdentifier.hpp>
+#include <KlayGE/ResLoader.hpp>
+#include <KlayGE/Texture.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(KLAYGE_PLATFORM_WINDOWS_DESKTOP)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(KLAYGE_PLATFORM_LINUX) || defined(KLAYGE_PLATFORM_ANDROID)
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	// Resident set of the process in bytes, or 0 if the platform doesn't tell
+	uint64_t ResidentBytes()
+	{
+#if defined(KLAYGE_PLATFORM_WINDOWS_DESKTOP)
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(pmc)))
+		{
+			return pmc.WorkingSetSize;
+		}
+		return 0;
+#elif defined(KLAYGE_PLATFORM_LINUX) || defined(KLAYGE_PLATFORM_ANDROID)
+		std::ifstream statm("/proc/self/statm");
+		uint64_t total_pages = 0;
+		uint64_t resident_pages = 0;
+		statm >> total_pages >> resident_pages;
+		return resident_pages * ::sysconf(_SC_PAGESIZE);
+#else
+		return 0;
+#endif
+	}
+
+	uint32_t Checksum(void const * data, size_t size)
+	{
+		uint8_t const * p = static_cast<uint8_t const *>(data);
+		uint32_t sum = 0;
+		for (size_t i = 0; i < size; ++ i)
+		{
+			sum = sum * 31 + p[i];
+		}
+		return sum;
+	}
+
+	void WriteTestFile(std::string const & name, uint32_t size)
+	{
+		std::vector<uint8_t> data(size);
+		for (uint32_t i = 0; i < size; ++ i)
+		{
+			data[i] = static_cast<uint8_t>(i * 7 + i / 4096);
+		}
+
+		std::ofstream ofs(name.c_str(), std::ios_base::binary);
+		ofs.write(reinterpret_cast<char const *>(data.data()), data.size());
+	}
+}
+
+TEST(MappedResTest, OpenLocalFile)
+{
+	std::string const small_name = "MappedResTestSmall.bin";
+	std::string const large_name = "MappedResTestLarge.bin";
+	WriteTestFile(small_name, 1000);
+	WriteTestFile(large_name, 1024 * 1024);
+
+	{
+		ResIdentifierPtr small_res = ResLoader::Instance().Open(small_name);
+		ASSERT_TRUE(small_res);
+		EXPECT_EQ(nullptr, small_res->MemoryView());
+
+		ResIdentifierPtr large_res = ResLoader::Instance().Open(large_name);
+		ASSERT_TRUE(large_res);
+		ASSERT_NE(nullptr, large_res->MemoryView());
+		EXPECT_EQ(1024 * 1024U, large_res->MemoryViewSize());
+
+		// The stream and the view see the same bytes
+		std::vector<uint8_t> streamed(1024 * 1024);
+		large_res->read(streamed.data(), streamed.size());
+		EXPECT_EQ(static_cast<std::streamsize>(streamed.size()), large_res->gcount());
+		EXPECT_EQ(Checksum(streamed.data(), streamed.size()), Checksum(large_res->MemoryView(), large_res->MemoryViewSize()));
+	}
+
+	std::remove(small_name.c_str());
+	std::remove(large_name.c_str());
+}
+
+// Stands in for model_bin: reading a large binary file through the stream, compared to using the mapped view
+TEST(MappedResTest, BinaryReadBenchmark)
+{
+	std::string const name = "MappedResTestBinary.bin";
+	uint32_t const size = 64 * 1024 * 1024;
+	WriteTestFile(name, size);
+
+	uint32_t stream_sum;
+	double stream_time;
+	uint64_t stream_rss;
+	{
+		uint64_t const rss_before = ResidentBytes();
+		Timer timer;
+		ResIdentifierPtr res = MakeSharedPtr<ResIdentifier>(name, 0,
+			MakeSharedPtr<std::ifstream>(name.c_str(), std::ios_base::binary));
+		std::vector<uint8_t> data(size);
+		res->read(data.data(), data.size());
+		stream_sum = Checksum(data.data(), data.size());
+		stream_time = timer.elapsed();
+		stream_rss = ResidentBytes() - rss_before;
+	}
+
+	uint32_t view_sum;
+	double view_time;
+	uint64_t view_rss;
+	{
+		uint64_t const rss_before = ResidentBytes();
+		Timer timer;
+		ResIdentifierPtr res = ResLoader::Instance().Open(name);
+		ASSERT_TRUE(res);
+		ASSERT_NE(nullptr, res->MemoryView());
+		view_sum = Checksum(res->MemoryView(), res->MemoryViewSize());
+		view_time = timer.elapsed();
+		view_rss = ResidentBytes() - rss_before;
+	}
+
+	EXPECT_EQ(stream_sum, view_sum);
+
+	cout << "Read " << size / 1024 / 1024 << " MB: stream " << stream_time * 1000 << " ms, +"
+		<< stream_rss / 1024 << " KB resident; mapped " << view_time * 1000 << " ms, +"
+		<< view_rss / 1024 << " KB resident" << endl;
+
+	std::remove(name.c_str());
+}
+
+TEST(MappedResTest, TextureLoadBenchmark)
+{
+	std::string const name = "MappedResTestTexture.dds";
+	uint32_t const width = 2048;
+	uint32_t const height = 2048;
+	uint32_t const num_mipmaps = 12;
+	{
+		std::vector<std::vector<uint8_t>> levels(num_mipmaps);
+		std::vector<ElementInitData> init_data(num_mipmaps);
+		uint32_t the_width = width;
+		uint32_t the_height = height;
+		for (uint32_t level = 0; level < num_mipmaps; ++ level)
+		{
+			levels[level].resize(the_width * the_height * 4);
+			for (size_t i = 0; i < levels[level].size(); ++ i)
+			{
+				levels[level][i] = static_cast<uint8_t>(i + level);
+			}
+
+			init_data[level].data = levels[level].data();
+			init_data[level].row_pitch = the_width * 4;
+			init_data[level].slice_pitch = the_width * the_height * 4;
+
+			the_width = std::max<uint32_t>(the_width / 2, 1);
+			the_height = std::max<uint32_t>(the_height / 2, 1);
+		}
+
+		SaveTexture(name, Texture::TT_2D, width, height, 1, num_mipmaps, 1, EF_ARGB8, init_data);
+	}
+
+	Texture::TextureType type;
+	uint32_t tex_width, tex_height, tex_depth, tex_num_mipmaps, tex_array_size;
+	ElementFormat format;
+
+	uint32_t copy_sum = 0;
+	double copy_time;
+	uint64_t copy_rss;
+	{
+		uint64_t const rss_before = ResidentBytes();
+		Timer timer;
+		std::vector<ElementInitData> init_data;
+		std::vector<uint8_t> data_block;
+		LoadTexture(name, type, tex_width, tex_height, tex_depth, tex_num_mipmaps, tex_array_size,
+			format, init_data, data_block);
+		for (auto const & level : init_data)
+		{
+			copy_sum ^= Checksum(level.data, level.slice_pitch);
+		}
+		copy_time = timer.elapsed();
+		copy_rss = ResidentBytes() - rss_before;
+
+		EXPECT_FALSE(data_block.empty());
+	}
+
+	uint32_t view_sum = 0;
+	double view_time;
+	uint64_t view_rss;
+	{
+		uint64_t const rss_before = ResidentBytes();
+		Timer timer;
+		std::vector<ElementInitData> init_data;
+		std::vector<uint8_t> data_block;
+		ResIdentifierPtr res = ResLoader::Instance().Open(name);
+		ASSERT_TRUE(res);
+		LoadTextureNoCopy(res, type, tex_width, tex_height, tex_depth, tex_num_mipmaps, tex_array_size,
+			format, init_data, data_block);
+		for (auto const & level : init_data)
+		{
+			view_sum ^= Checksum(level.data, level.slice_pitch);
+		}
+		view_time = timer.elapsed();
+		view_rss = ResidentBytes() - rss_before;
+
+		EXPECT_TRUE(data_block.empty());
+		EXPECT_EQ(num_mipmaps, init_data.size());
+	}
+
+	EXPECT_EQ(width, tex_width);
+	EXPECT_EQ(num_mipmaps, tex_num_mipmaps);
+	EXPECT_EQ(EF_ARGB8, format);
+	EXPECT_EQ(copy_sum, view_sum);
+
+	cout << "Load " << width << "x" << height << " texture: copy " << copy_time * 1000 << " ms, +"
+		<< copy_rss / 1024 << " KB resident; mapped " << view_time * 1000 << " ms, +"
+		<< view_rss / 1024 << " KB resident" << endl;
+
+	std::remove(name.c_str());
+}
@@ -0,0 +1,278 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Math.hpp>
+#include <KlayGE/MeshOptimizer.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	uint32_t const GRID_SIZE = 64;
+
+	// A bumpy height field, with triangles in random order like an exporter would give
+	void MakeShuffledGrid(std::vector<uint32_t>& indices, std::vector<float3>& positions)
+	{
+		positions.clear();
+		for (uint32_t y = 0; y <= GRID_SIZE; ++ y)
+		{
+			for (uint32_t x = 0; x <= GRID_SIZE; ++ x)
+			{
+				positions.push_back(float3(static_cast<float>(x), static_cast<float>(y), std::sin(x * 0.3f) * std::cos(y * 0.3f)));
+			}
+		}
+
+		std::vector<std::array<uint32_t, 3>> triangles;
+		for (uint32_t y = 0; y < GRID_SIZE; ++ y)
+		{
+			for (uint32_t x = 0; x < GRID_SIZE; ++ x)
+			{
+				uint32_t const v0 = y * (GRID_SIZE + 1) + x;
+				uint32_t const v1 = v0 + 1;
+				uint32_t const v2 = v0 + GRID_SIZE + 1;
+				uint32_t const v3 = v2 + 1;
+				triangles.push_back({ { v0, v1, v2 } });
+				triangles.push_back({ { v2, v1, v3 } });
+			}
+		}
+		std::shuffle(triangles.begin(), triangles.end(), std::minstd_rand(1));
+
+		indices.clear();
+		for (auto const & tri : triangles)
+		{
+			indices.insert(indices.end(), tri.begin(), tri.end());
+		}
+	}
+
+	// Area of the triangles projected on XY. It stays the grid's if borders hold and nothing flips.
+	float ProjectedArea(std::vector<uint32_t> const & indices, std::vector<float3> const & positions)
+	{
+		float area = 0;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			float3 const & p0 = positions[indices[i + 0]];
+			float3 const & p1 = positions[indices[i + 1]];
+			float3 const & p2 = positions[indices[i + 2]];
+			area += ((p1.x() - p0.x()) * (p2.y() - p0.y()) - (p2.x() - p0.x()) * (p1.y() - p0.y())) / 2;
+		}
+		return area;
+	}
+
+	// Largest vertical distance from the grid vertices to the simplified height field
+	float MaxHeightError(std::vector<uint32_t> const & indices, std::vector<float3> const & positions)
+	{
+		float max_error = 0;
+		for (uint32_t v = 0; v < (GRID_SIZE + 1) * (GRID_SIZE + 1); ++ v)
+		{
+			float3 const & p = positions[v];
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				float3 const & p0 = positions[indices[i + 0]];
+				float3 const & p1 = positions[indices[i + 1]];
+				float3 const & p2 = positions[indices[i + 2]];
+				float const det = (p1.x() - p0.x()) * (p2.y() - p0.y()) - (p2.x() - p0.x()) * (p1.y() - p0.y());
+				float const b1 = ((p.x() - p0.x()) * (p2.y() - p0.y()) - (p2.x() - p0.x()) * (p.y() - p0.y())) / det;
+				float const b2 = ((p1.x() - p0.x()) * (p.y() - p0.y()) - (p.x() - p0.x()) * (p1.y() - p0.y())) / det;
+				if ((b1 >= -1e-4f) && (b2 >= -1e-4f) && (b1 + b2 <= 1 + 1e-4f))
+				{
+					float const z = p0.z() + (p1.z() - p0.z()) * b1 + (p2.z() - p0.z()) * b2;
+					max_error = std::max(max_error, std::abs(z - p.z()));
+					break;
+				}
+			}
+		}
+		return max_error;
+	}
+
+	// Rotates each triangle to start from its smallest index, so the comparison keeps winding
+	std::vector<std::array<uint32_t, 3>> SortedTriangles(std::vector<uint32_t> const & indices)
+	{
+		std::vector<std::array<uint32_t, 3>> triangles;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			std::array<uint32_t, 3> tri = { { indices[i + 0], indices[i + 1], indices[i + 2] } };
+			std::rotate(tri.begin(), std::min_element(tri.begin(), tri.end()), tri.end());
+			triangles.push_back(tri);
+		}
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	}
+}
+
+TEST(MeshOptimizerTest, VertexCache)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeShuffledGrid(indices, positions);
+	uint32_t const num_vertices = static_cast<uint32_t>(positions.size());
+
+	VertexCacheStats const before = AnalyzeVertexCache(indices, num_vertices);
+	auto const triangles = SortedTriangles(indices);
+
+	OptimizeVertexCache(indices, num_vertices);
+	VertexCacheStats const after = AnalyzeVertexCache(indices, num_vertices);
+
+	EXPECT_TRUE(SortedTriangles(indices) == triangles);
+	EXPECT_GT(before.acmr, 2.0f);
+	EXPECT_LT(after.acmr, 0.8f);
+	EXPECT_LT(after.atvr, 1.6f);
+	EXPECT_LT(after.acmr, before.acmr * 0.5f);
+}
+
+TEST(MeshOptimizerTest, Overdraw)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeShuffledGrid(indices, positions);
+	uint32_t const num_vertices = static_cast<uint32_t>(positions.size());
+
+	auto const triangles = SortedTriangles(indices);
+
+	OptimizeVertexCache(indices, num_vertices);
+	float const cache_acmr = AnalyzeVertexCache(indices, num_vertices).acmr;
+
+	std::vector<uint32_t> const cache_indices = indices;
+	float const threshold = 1.05f;
+	OptimizeOverdraw(indices, positions, threshold);
+	EXPECT_TRUE(SortedTriangles(indices) == triangles);
+	EXPECT_NE(indices, cache_indices);
+
+	// Cutting clusters costs a few misses at each boundary, but not many
+	EXPECT_LT(AnalyzeVertexCache(indices, num_vertices).acmr, cache_acmr * threshold * 1.1f);
+}
+
+TEST(MeshOptimizerTest, Simplify)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeShuffledGrid(indices, positions);
+	float const grid_area = static_cast<float>(GRID_SIZE * GRID_SIZE);
+
+	uint32_t const target_num_indices = static_cast<uint32_t>(indices.size() / 4) / 3 * 3;
+	float error;
+	std::vector<uint32_t> lod = SimplifyMesh(indices, positions, target_num_indices, 1.0f, &error);
+	EXPECT_LE(lod.size(), target_num_indices);
+	EXPECT_GT(lod.size(), target_num_indices * 9 / 10);
+	EXPECT_NEAR(ProjectedArea(lod, positions), grid_area, grid_area * 1e-4f);
+	EXPECT_LE(error, 1.0f);
+	float const lod_height_error = MaxHeightError(lod, positions);
+	EXPECT_LT(lod_height_error, 0.25f);
+
+	// Down from the last LOD, like a LOD chain
+	std::vector<uint32_t> const lod2 = SimplifyMesh(lod, positions, target_num_indices / 4 / 3 * 3, 1.0f);
+	EXPECT_LE(lod2.size(), target_num_indices / 4);
+	EXPECT_NEAR(ProjectedArea(lod2, positions), grid_area, grid_area * 1e-4f);
+	EXPECT_GE(MaxHeightError(lod2, positions), lod_height_error);
+
+	// A tight error bound stops early
+	lod = SimplifyMesh(indices, positions, 0, 0.01f, &error);
+	EXPECT_GT(lod.size(), target_num_indices);
+	EXPECT_LE(error, 0.01f);
+	EXPECT_LT(MaxHeightError(lod, positions), 0.05f);
+
+	// A flat grid collapses to almost nothing without error, but keeps its outline
+	for (auto& pos : positions)
+	{
+		pos.z() = 0;
+	}
+	lod = SimplifyMesh(indices, positions, 0, 1e-4f, &error);
+	EXPECT_LT(lod.size(), indices.size() / 50);
+	EXPECT_NEAR(ProjectedArea(lod, positions), grid_area, grid_area * 1e-4f);
+	EXPECT_LT(error, 1e-4f);
+}
+
+TEST(MeshOptimizerTest, SimplifySeams)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeShuffledGrid(indices, positions);
+
+	// Splits the middle column into two vertices, one for each side, as a UV seam would
+	uint32_t const seam_x = GRID_SIZE / 2;
+	std::vector<uint32_t> seam_vertices;
+	for (uint32_t y = 0; y <= GRID_SIZE; ++ y)
+	{
+		uint32_t const v = y * (GRID_SIZE + 1) + seam_x;
+		seam_vertices.push_back(v);
+		seam_vertices.push_back(static_cast<uint32_t>(positions.size()));
+		positions.push_back(positions[v]);
+	}
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		bool right = false;
+		for (uint32_t j = 0; j < 3; ++ j)
+		{
+			right |= (positions[indices[i + j]].x() > seam_x);
+		}
+		if (right)
+		{
+			for (uint32_t j = 0; j < 3; ++ j)
+			{
+				uint32_t const v = indices[i + j];
+				if (positions[v].x() == seam_x)
+				{
+					indices[i + j] = (GRID_SIZE + 1) * (GRID_SIZE + 1) + v / (GRID_SIZE + 1);
+				}
+			}
+		}
+	}
+
+	std::vector<uint32_t> const lod = SimplifyMesh(indices, positions, static_cast<uint32_t>(indices.size() / 8) / 3 * 3, 1.0f);
+	EXPECT_LT(lod.size(), indices.size() / 4);
+
+	// Every seam vertex is still used, so the two sides still meet
+	std::vector<bool> used(positions.size(), false);
+	for (auto index : lod)
+	{
+		used[index] = true;
+	}
+	for (auto v : seam_vertices)
+	{
+		EXPECT_TRUE(used[v]);
+	}
+}
+
+TEST(MeshOptimizerTest, VertexFetch)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeShuffledGrid(indices, positions);
+	uint32_t const num_vertices = static_cast<uint32_t>(positions.size());
+
+	// One vertex no triangle uses
+	positions.push_back(float3(-1, -1, -1));
+
+	OptimizeVertexCache(indices, num_vertices);
+	std::vector<uint32_t> const old_indices = indices;
+	std::vector<float3> new_positions = positions;
+
+	std::vector<uint32_t> const remap = OptimizeVertexFetch(indices, num_vertices + 1);
+	ASSERT_EQ(remap.size(), num_vertices + 1);
+	RemapVertices(new_positions.data(), sizeof(float3), remap);
+
+	// Vertices come in the order they are first used
+	uint32_t next_vertex = 0;
+	for (auto index : indices)
+	{
+		EXPECT_LE(index, next_vertex);
+		if (index == next_vertex)
+		{
+			++ next_vertex;
+		}
+	}
+	EXPECT_EQ(next_vertex, num_vertices);
+	EXPECT_EQ(remap[num_vertices], num_vertices);
+
+	for (size_t i = 0; i < indices.size(); ++ i)
+	{
+		EXPECT_EQ(indices[i], remap[old_indices[i]]);
+		EXPECT_TRUE(new_positions[indices[i]] == positions[old_indices[i]]);
+	}
+	EXPECT_TRUE(new_positions[num_vertices] == positions[num_vertices]);
+}
@@ -0,0 +1,233 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Math.hpp>
+#include <KFL/Timer.hpp>
+#include <KlayGE/MeshOptimizer.hpp>
+#include <KlayGE/Meshlet.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	// A closed UV sphere with outward facing triangles, in cache optimized order like MeshMLJIT makes
+	void MakeSphere(std::vector<uint32_t>& indices, std::vector<float3>& positions, uint32_t rings, uint32_t segments)
+	{
+		positions.clear();
+		for (uint32_t r = 0; r <= rings; ++ r)
+		{
+			float const theta = r * PI / rings;
+			for (uint32_t s = 0; s < segments; ++ s)
+			{
+				float const phi = s * 2 * PI / segments;
+				positions.push_back(float3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+			}
+		}
+
+		indices.clear();
+		for (uint32_t r = 0; r < rings; ++ r)
+		{
+			for (uint32_t s = 0; s < segments; ++ s)
+			{
+				uint32_t const v0 = r * segments + s;
+				uint32_t const v1 = r * segments + (s + 1) % segments;
+				uint32_t const v2 = v0 + segments;
+				uint32_t const v3 = v1 + segments;
+				if (r != 0)
+				{
+					indices.insert(indices.end(), { v0, v1, v2 });
+				}
+				if (r != rings - 1)
+				{
+					indices.insert(indices.end(), { v2, v1, v3 });
+				}
+			}
+		}
+
+		OptimizeVertexCache(indices, static_cast<uint32_t>(positions.size()));
+	}
+
+	Frustum MakeFrustum(float3 const & eye_pos, float3 const & look_at)
+	{
+		float4x4 const view_proj = MathLib::look_at_lh(eye_pos, look_at)
+			* MathLib::perspective_fov_lh(PI / 4, 1.0f, 0.1f, 100.0f);
+		Frustum frustum;
+		frustum.ClipMatrix(view_proj, MathLib::inverse(view_proj));
+		return frustum;
+	}
+
+	bool FrontFacing(std::vector<uint32_t> const & indices, std::vector<float3> const & positions, uint32_t tri,
+		float3 const & eye_pos)
+	{
+		float3 const & p0 = positions[indices[tri * 3 + 0]];
+		float3 const & p1 = positions[indices[tri * 3 + 1]];
+		float3 const & p2 = positions[indices[tri * 3 + 2]];
+		return MathLib::dot(MathLib::cross(p1 - p0, p2 - p0), p0 - eye_pos) < 0;
+	}
+}
+
+TEST(MeshletTest, Build)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeSphere(indices, positions, 64, 128);
+
+	std::vector<Meshlet> const meshlets = BuildMeshlets(indices, positions, 64, 124);
+	ASSERT_FALSE(meshlets.empty());
+
+	uint32_t next_index = 0;
+	for (auto const & meshlet : meshlets)
+	{
+		// Contiguous, and cover every triangle once
+		EXPECT_EQ(meshlet.start_index, next_index);
+		EXPECT_EQ(meshlet.num_indices % 3, 0U);
+		EXPECT_LE(meshlet.num_indices / 3, 124U);
+		next_index += meshlet.num_indices;
+
+		std::vector<uint32_t> vertices(indices.begin() + meshlet.start_index,
+			indices.begin() + meshlet.start_index + meshlet.num_indices);
+		std::sort(vertices.begin(), vertices.end());
+		vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+		EXPECT_LE(vertices.size(), 64U);
+
+		for (uint32_t i = 0; i < meshlet.num_indices; i += 3)
+		{
+			float3 const & p0 = positions[indices[meshlet.start_index + i + 0]];
+			float3 const & p1 = positions[indices[meshlet.start_index + i + 1]];
+			float3 const & p2 = positions[indices[meshlet.start_index + i + 2]];
+			for (auto const & p : { p0, p1, p2 })
+			{
+				EXPECT_LE(MathLib::length(p - meshlet.center), meshlet.radius * 1.0001f);
+			}
+
+			float3 const n = MathLib::cross(p1 - p0, p2 - p0);
+			if (meshlet.cone_cos > 0)
+			{
+				EXPECT_GE(MathLib::dot(MathLib::normalize(n), meshlet.cone_axis), meshlet.cone_cos - 1e-4f);
+			}
+		}
+	}
+	EXPECT_EQ(next_index, indices.size());
+
+	// Cache optimized order keeps meshlets full
+	EXPECT_LT(meshlets.size(), indices.size() / 3 / 124 * 2);
+}
+
+TEST(MeshletTest, Cull)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeSphere(indices, positions, 64, 128);
+	std::vector<Meshlet> const meshlets = BuildMeshlets(indices, positions);
+
+	std::vector<uint32_t> visible_meshlets;
+	std::vector<bool> visible(meshlets.size());
+
+	// Whole sphere in view, the back half is culled by cones
+	float3 const eye_pos(0, 0, -5);
+	uint32_t const num_indices = CullMeshlets(meshlets, MakeFrustum(eye_pos, float3(0, 0, 0)), eye_pos, visible_meshlets);
+	EXPECT_LT(num_indices, indices.size() * 3 / 4);
+	EXPECT_GT(num_indices, indices.size() * 2 / 5);
+
+	// Every triangle that could be seen is kept
+	std::fill(visible.begin(), visible.end(), false);
+	for (auto id : visible_meshlets)
+	{
+		visible[id] = true;
+	}
+	for (uint32_t i = 0; i < meshlets.size(); ++ i)
+	{
+		if (!visible[i])
+		{
+			for (uint32_t tri = meshlets[i].start_index / 3; tri < (meshlets[i].start_index + meshlets[i].num_indices) / 3; ++ tri)
+			{
+				EXPECT_FALSE(FrontFacing(indices, positions, tri, eye_pos));
+			}
+		}
+	}
+
+	// Looking past the edge, the frustum culls most of the rest
+	Frustum const frustum = MakeFrustum(eye_pos, float3(3, 0, 0));
+	uint32_t const side_num_indices = CullMeshlets(meshlets, frustum, eye_pos, visible_meshlets);
+	EXPECT_LT(side_num_indices, num_indices / 2);
+
+	std::fill(visible.begin(), visible.end(), false);
+	for (auto id : visible_meshlets)
+	{
+		visible[id] = true;
+	}
+	for (uint32_t i = 0; i < meshlets.size(); ++ i)
+	{
+		if (!visible[i])
+		{
+			for (uint32_t tri = meshlets[i].start_index / 3; tri < (meshlets[i].start_index + meshlets[i].num_indices) / 3; ++ tri)
+			{
+				if (FrontFacing(indices, positions, tri, eye_pos))
+				{
+					for (uint32_t j = 0; j < 3; ++ j)
+					{
+						EXPECT_EQ(frustum.Intersect(Sphere(positions[indices[tri * 3 + j]], 0)), BO_No);
+					}
+				}
+			}
+		}
+	}
+
+	// The compacted list is the visible meshlets' indices in order
+	std::vector<uint16_t> indices_16(indices.begin(), indices.end());
+	std::vector<uint8_t> compacted;
+	CompactMeshletIndices(meshlets, visible_meshlets, indices_16.data(), sizeof(uint16_t), compacted);
+	ASSERT_EQ(compacted.size(), side_num_indices * sizeof(uint16_t));
+	uint16_t const * compacted_16 = reinterpret_cast<uint16_t const *>(compacted.data());
+	for (auto id : visible_meshlets)
+	{
+		for (uint32_t i = 0; i < meshlets[id].num_indices; ++ i)
+		{
+			EXPECT_EQ(*compacted_16, indices[meshlets[id].start_index + i]);
+			++ compacted_16;
+		}
+	}
+
+	// From inside, every triangle faces away
+	EXPECT_EQ(CullMeshlets(meshlets, MakeFrustum(float3(0, 0, 0), float3(0, 0, 1)), float3(0, 0, 0), visible_meshlets), 0U);
+}
+
+TEST(MeshletTest, CullBenchmark)
+{
+	std::vector<uint32_t> indices;
+	std::vector<float3> positions;
+	MakeSphere(indices, positions, 256, 512);
+	std::vector<Meshlet> const meshlets = BuildMeshlets(indices, positions);
+
+	// A camera orbiting close to the surface, looking along it, as a building would be seen from the street
+	uint32_t const num_frames = 100;
+	uint64_t total_indices = 0;
+	uint64_t submitted_indices = 0;
+	std::vector<uint32_t> visible_meshlets;
+	std::vector<uint8_t> compacted;
+	Timer timer;
+	for (uint32_t frame = 0; frame < num_frames; ++ frame)
+	{
+		float const angle = frame * 2 * PI / num_frames;
+		float3 const eye_pos(std::sin(angle) * 1.5f, 0.2f, std::cos(angle) * 1.5f);
+		float3 const look_dir(std::cos(angle) - std::sin(angle) * 0.8f, 0, -std::sin(angle) - std::cos(angle) * 0.8f);
+		uint32_t const num_indices = CullMeshlets(meshlets, MakeFrustum(eye_pos, eye_pos + look_dir), eye_pos,
+			visible_meshlets);
+		CompactMeshletIndices(meshlets, visible_meshlets, indices.data(), sizeof(uint32_t), compacted);
+
+		total_indices += indices.size();
+		submitted_indices += num_indices;
+	}
+	double const elapsed = timer.elapsed();
+	EXPECT_LT(submitted_indices, total_indices / 2);
+
+	cout << meshlets.size() << " meshlets, " << indices.size() / 3 << " triangles" << endl;
+	cout << "Triangles submitted: " << submitted_indices / 3 / num_frames
+		<< ", culled: " << (total_indices - submitted_indices) / 3 / num_frames << " per frame" << endl;
+	cout << "Cull and compact: " << elapsed * 1000 / num_frames << " ms per frame" << endl;
+}
@@ -0,0 +1,72 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Util.hpp>
+#include <KFL/ResIdentifier.hpp>
+#include <KlayGE/MappedPackage.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	std::vector<uint8_t> MakeTestData(uint32_t size, bool compressible)
+	{
+		std::vector<uint8_t> data(size);
+		std::minstd_rand rng(size);
+		for (uint32_t i = 0; i < size; ++ i)
+		{
+			data[i] = compressible ? static_cast<uint8_t>(i / 64) : static_cast<uint8_t>(rng());
+		}
+		return data;
+	}
+
+	std::vector<uint8_t> ReadAll(ResIdentifierPtr const & res)
+	{
+		std::stringstream ss;
+		ss << res->input_stream().rdbuf();
+		std::string const str = ss.str();
+		return std::vector<uint8_t>(str.begin(), str.end());
+	}
+}
+
+TEST(PackageTest, MappedPackageRoundTrip)
+{
+	std::string const pkt_name = "PackageTest.kpk";
+
+	std::vector<uint8_t> const compressed = MakeTestData(100 * 1024, true);
+	std::vector<uint8_t> const random = MakeTestData(40 * 1024, false);
+	std::vector<uint8_t> const stored = MakeTestData(5000, false);
+	{
+		MappedPackageWriter writer(16 * 1024, 4096);
+		writer.AddFile("models/compressed.model_bin", compressed.data(), compressed.size(), true);
+		writer.AddFile("textures\\random.dds", random.data(), random.size(), true);
+		writer.AddFile("textures/stored.dds", stored.data(), stored.size(), false);
+		writer.AddFile("empty.txt", nullptr, 0, true);
+
+		std::ofstream ofs(pkt_name.c_str(), std::ios_base::binary);
+		writer.Save(ofs);
+	}
+
+	{
+		MappedPackage package(pkt_name, 0);
+		EXPECT_EQ(4U, package.FilePaths().size());
+		EXPECT_EQ(0xFFFFFFFFU, package.Find("textures/missing.dds"));
+		EXPECT_NE(0xFFFFFFFFU, package.Find("Textures/Random.DDS"));
+
+		EXPECT_TRUE(compressed == ReadAll(package.Extract("models/compressed.model_bin", "compressed")));
+		EXPECT_TRUE(random == ReadAll(package.Extract("textures/random.dds", "random")));
+		EXPECT_TRUE(stored == ReadAll(package.Extract("textures/stored.dds", "stored")));
+		EXPECT_TRUE(ReadAll(package.Extract("empty.txt", "empty")).empty());
+		EXPECT_FALSE(package.Extract("textures/missing.dds", "missing"));
+	}
+
+	std::remove(pkt_name.c_str());
+}
@@ -0,0 +1,154 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KlayGE/App3D.hpp>
+#include <KlayGE/Context.hpp>
+#include <KlayGE/GraphicsBuffer.hpp>
+#include <KlayGE/RenderableHelper.hpp>
+#include <KlayGE/RenderFactory.hpp>
+#include <KlayGE/RenderLayout.hpp>
+#include <KlayGE/RenderMaterial.hpp>
+#include <KlayGE/SceneManager.hpp>
+#include <KlayGE/SceneObjectHelper.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "KlayGETests.hpp"
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	typedef std::vector<std::pair<uint64_t, Renderable*>> RenderQueueItems;
+
+	// Only the addresses are compared, the renderables are never touched
+	RenderQueueItems MakeItems(std::vector<uint64_t> const & keys)
+	{
+		RenderQueueItems items(keys.size());
+		for (size_t i = 0; i < keys.size(); ++ i)
+		{
+			items[i] = std::make_pair(keys[i], reinterpret_cast<Renderable*>(static_cast<uintptr_t>(i + 1)));
+		}
+		return items;
+	}
+
+	void TestSortMatchesStableSort(std::vector<uint64_t> const & keys)
+	{
+		RenderQueueItems items = MakeItems(keys);
+		RenderQueueItems expected = items;
+		std::stable_sort(expected.begin(), expected.end(),
+			[](std::pair<uint64_t, Renderable*> const & lhs, std::pair<uint64_t, Renderable*> const & rhs)
+			{
+				return lhs.first < rhs.first;
+			});
+
+		RenderQueueItems scratch;
+		SceneManager::SortRenderQueue(items, scratch);
+		EXPECT_TRUE(items == expected);
+	}
+
+	// Points sharing a material and a layout with other instances
+	class QueueRenderable : public RenderablePoint
+	{
+	public:
+		QueueRenderable(RenderMaterialPtr const & mtl, RenderLayoutPtr const & rl)
+		{
+			mtl_ = mtl;
+			rl_ = rl;
+		}
+	};
+}
+
+TEST(RenderQueueTest, SortMatchesStableSort)
+{
+	std::ranlux24_base gen;
+
+	// Few distinct keys with a shared high part, most passes are skipped
+	std::uniform_int_distribution<uint32_t> few_dis(0, 15);
+	std::vector<uint64_t> keys(1000);
+	for (auto& key : keys)
+	{
+		key = SceneManager::RenderQueueKey(3, few_dis(gen), few_dis(gen), 0);
+	}
+	TestSortMatchesStableSort(keys);
+
+	// Keys using all the bytes
+	std::uniform_int_distribution<uint32_t> u32_dis;
+	for (auto& key : keys)
+	{
+		key = (static_cast<uint64_t>(u32_dis(gen)) << 32) | (u32_dis(gen) & 0xFFFF0007U);
+	}
+	TestSortMatchesStableSort(keys);
+
+	TestSortMatchesStableSort(std::vector<uint64_t>());
+	TestSortMatchesStableSort(std::vector<uint64_t>(1, 42));
+	TestSortMatchesStableSort(std::vector<uint64_t>(100, 42));
+}
+
+TEST(RenderQueueTest, KeyFieldOrder)
+{
+	uint32_t const max_value = std::numeric_limits<uint32_t>::max();
+
+	EXPECT_LT(SceneManager::RenderQueueKey(0, max_value, max_value, max_value), SceneManager::RenderQueueKey(1, 0, 0, 0));
+	EXPECT_LT(SceneManager::RenderQueueKey(1, 0, max_value, max_value), SceneManager::RenderQueueKey(1, 1, 0, 0));
+	EXPECT_LT(SceneManager::RenderQueueKey(1, 1, 0, max_value), SceneManager::RenderQueueKey(1, 1, 1, 0));
+	EXPECT_LT(SceneManager::RenderQueueKey(1, 1, 1, 0), SceneManager::RenderQueueKey(1, 1, 1, 1));
+}
+
+TEST(RenderQueueTest, KeyClampsOverflowingIds)
+{
+	uint32_t const huge = 1U << 20;
+
+	EXPECT_EQ(SceneManager::RenderQueueKey(0, huge, 0, 0), SceneManager::RenderQueueKey(0, huge + 1, 0, 0));
+	EXPECT_LT(SceneManager::RenderQueueKey(0, huge, 0, 0), SceneManager::RenderQueueKey(1, 0, 0, 0));
+
+	EXPECT_EQ(SceneManager::RenderQueueKey(0, 0, huge, 0), SceneManager::RenderQueueKey(0, 0, huge + 1, 0));
+	EXPECT_LT(SceneManager::RenderQueueKey(0, 0, huge, 0), SceneManager::RenderQueueKey(0, 1, 0, 0));
+
+	EXPECT_EQ(SceneManager::RenderQueueKey(0, 0, 0, huge << 8), SceneManager::RenderQueueKey(0, 0, 0, (huge << 8) + 1));
+	EXPECT_LT(SceneManager::RenderQueueKey(0, 0, 0, huge << 8), SceneManager::RenderQueueKey(0, 0, 1, 0));
+
+	EXPECT_EQ(SceneManager::RenderQueueKey(huge, 0, 0, 0), SceneManager::RenderQueueKey(huge + 1, 0, 0, 0));
+}
+
+TEST_F(KlayGETest, RenderQueueGroupsStates)
+{
+	RenderFactory& rf = Context::Instance().RenderFactoryInstance();
+
+	std::vector<RenderMaterialPtr> mtls(2);
+	for (auto& mtl : mtls)
+	{
+		mtl = MakeSharedPtr<RenderMaterial>();
+	}
+
+	float v = 0;
+	GraphicsBufferPtr vb = rf.MakeVertexBuffer(BU_Static, EAH_GPU_Read | EAH_Immutable, sizeof(v), &v);
+	std::vector<RenderLayoutPtr> rls(2);
+	for (auto& rl : rls)
+	{
+		rl = rf.MakeRenderLayout();
+		rl->TopologyType(RenderLayout::TT_PointList);
+		rl->BindVertexStream(vb, VertexElement(VEU_Position, 0, EF_R32F));
+	}
+
+	// Interleaved, so drawing in submission order would switch states on every renderable
+	uint32_t const num_renderables = 16;
+	SceneManager& sm = Context::Instance().SceneManagerInstance();
+	for (uint32_t i = 0; i < num_renderables; ++ i)
+	{
+		auto renderable = MakeSharedPtr<QueueRenderable>(mtls[i & 1], rls[(i >> 1) & 1]);
+		sm.AddSceneObject(MakeSharedPtr<SceneObjectHelper>(renderable, SceneObject::SOA_Overlay));
+	}
+
+	sm.Update();
+
+	EXPECT_EQ(sm.NumDrawCalls(), num_renderables);
+	// The technique, material and layout are set for the first draw, then the 4 material and layout groups take
+	//  1 layout switch, 1 material and layout switch, and 1 layout switch
+	EXPECT_EQ(sm.NumStateChanges(), 3U + 1 + 2 + 1);
+
+	sm.ClearObject();
+}
@@ -0,0 +1,661 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Util.hpp>
+#include <KFL/Hash.hpp>
+#include <KFL/Timer.hpp>
+#include <KlayGE/ResLoader.hpp>
+#include <KlayGE/Extract7z.hpp>
+#include <KFL/ResIdentifier.hpp>
+#include <KFL/CXX17/filesystem.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <random>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	struct SyntheticResource
+	{
+		SyntheticResource()
+			: checksum(0), load_order(0), ready(false), children_ready(false)
+		{
+		}
+
+		uint32_t checksum;
+		uint32_t load_order;
+		std::atomic<bool> ready;
+
+		std::vector<std::shared_ptr<SyntheticResource>> children;
+		bool children_ready;
+	};
+
+	std::atomic<uint32_t> synthetic_load_counter(0);
+
+	// Simulates the decode work of a real resource in SubThreadStage, without touching the disk or the GPU
+	class SyntheticLoadingDesc : public ResLoadingDesc
+	{
+	public:
+		SyntheticLoadingDesc(uint64_t type, std::string const & name, uint32_t work_size)
+			: type_(type), name_(name), work_size_(work_size)
+		{
+			resource_ = MakeSharedPtr<std::shared_ptr<SyntheticResource>>();
+		}
+
+		// SubThreadStage blocks until the gate opens
+		SyntheticLoadingDesc(uint64_t type, std::string const & name, std::shared_future<void> const & gate)
+			: type_(type), name_(name), work_size_(0), gate_(gate)
+		{
+			resource_ = MakeSharedPtr<std::shared_ptr<SyntheticResource>>();
+		}
+
+		// Resources found during SubThreadStage, like the textures of a model
+		void Children(std::vector<std::string> const & names, uint32_t work_size)
+		{
+			child_names_ = names;
+			child_work_size_ = work_size;
+		}
+
+		uint64_t Type() const override
+		{
+			return type_;
+		}
+
+		std::string_view Name() const override
+		{
+			return name_;
+		}
+
+		bool StateLess() const override
+		{
+			return true;
+		}
+
+		std::shared_ptr<void> CreateResource() override
+		{
+			*resource_ = MakeSharedPtr<SyntheticResource>();
+			return *resource_;
+		}
+
+		void SubThreadStage() override
+		{
+			if (gate_.valid())
+			{
+				gate_.wait();
+			}
+			(*resource_)->load_order = ++ synthetic_load_counter;
+
+			std::vector<uint32_t> data(work_size_);
+			std::minstd_rand rng(static_cast<uint32_t>(RT_HASH(name_.c_str())));
+			for (auto& d : data)
+			{
+				d = rng();
+			}
+			std::sort(data.begin(), data.end());
+
+			uint32_t checksum = 0;
+			for (auto d : data)
+			{
+				checksum = checksum * 31 + d;
+			}
+			(*resource_)->checksum = checksum;
+
+			for (auto const & child_name : child_names_)
+			{
+				(*resource_)->children.push_back(ResLoader::Instance().ASyncQueryDependencyT<SyntheticResource>(*this,
+					MakeSharedPtr<SyntheticLoadingDesc>(CT_HASH("SyntheticTextureLoadingDesc"), child_name, child_work_size_)));
+			}
+		}
+
+		void MainThreadStage() override
+		{
+			bool children_ready = true;
+			for (auto const & child : (*resource_)->children)
+			{
+				children_ready &= child->ready;
+			}
+			(*resource_)->children_ready = children_ready;
+
+			(*resource_)->ready = true;
+		}
+
+		bool HasSubThreadStage() const override
+		{
+			return true;
+		}
+
+		size_t Hash() const override
+		{
+			size_t seed = static_cast<size_t>(type_);
+			HashRange(seed, name_.begin(), name_.end());
+			return seed;
+		}
+
+		bool Match(ResLoadingDesc const & rhs) const override
+		{
+			if (this->Type() == rhs.Type())
+			{
+				SyntheticLoadingDesc const & sld = static_cast<SyntheticLoadingDesc const &>(rhs);
+				return name_ == sld.name_;
+			}
+			return false;
+		}
+
+		void CopyDataFrom(ResLoadingDesc const & rhs) override
+		{
+			BOOST_ASSERT(this->Type() == rhs.Type());
+
+			SyntheticLoadingDesc const & sld = static_cast<SyntheticLoadingDesc const &>(rhs);
+			name_ = sld.name_;
+			work_size_ = sld.work_size_;
+			child_names_ = sld.child_names_;
+			child_work_size_ = sld.child_work_size_;
+			gate_ = sld.gate_;
+			resource_ = sld.resource_;
+		}
+
+		std::shared_ptr<void> CloneResourceFrom(std::shared_ptr<void> const & resource) override
+		{
+			return resource;
+		}
+
+		std::shared_ptr<void> Resource() const override
+		{
+			return *resource_;
+		}
+
+		uint64_t CpuMemorySize() const override
+		{
+			return work_size_ * sizeof(uint32_t);
+		}
+
+		bool ReleaseResource() override
+		{
+			resource_ = MakeSharedPtr<std::shared_ptr<SyntheticResource>>();
+			return true;
+		}
+
+	private:
+		uint64_t type_;
+		std::string name_;
+		uint32_t work_size_;
+		std::vector<std::string> child_names_;
+		uint32_t child_work_size_ = 0;
+		std::shared_future<void> gate_;
+		std::shared_ptr<std::shared_ptr<SyntheticResource>> resource_;
+	};
+
+	void WaitForResources(std::vector<std::shared_ptr<SyntheticResource>> const & resources)
+	{
+		ResLoader& rl = ResLoader::Instance();
+		for (;;)
+		{
+			rl.Update();
+
+			bool all_ready = true;
+			for (auto const & res : resources)
+			{
+				if (!res->ready)
+				{
+					all_ready = false;
+					break;
+				}
+			}
+			if (all_ready)
+			{
+				break;
+			}
+
+			std::this_thread::yield();
+		}
+	}
+
+	double LoadSyntheticBatch(uint32_t num_threads, uint32_t num_textures, uint32_t num_models)
+	{
+		ResLoader& rl = ResLoader::Instance();
+		rl.NumLoadingThreads(num_threads);
+
+		std::vector<std::shared_ptr<SyntheticResource>> resources;
+
+		Timer timer;
+		for (uint32_t i = 0; i < num_textures; ++ i)
+		{
+			std::string const name = "tex_" + std::to_string(num_threads) + "_" + std::to_string(i);
+			resources.push_back(rl.ASyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(
+				CT_HASH("SyntheticTextureLoadingDesc"), name, 32 * 1024)));
+		}
+		for (uint32_t i = 0; i < num_models; ++ i)
+		{
+			std::string const name = "model_" + std::to_string(num_threads) + "_" + std::to_string(i);
+			resources.push_back(rl.ASyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(
+				CT_HASH("SyntheticModelLoadingDesc"), name, 256 * 1024)));
+		}
+
+		WaitForResources(resources);
+
+		return timer.elapsed();
+	}
+}
+
+TEST(ResLoaderTest, MatchLoadedResource)
+{
+	ResLoader& rl = ResLoader::Instance();
+
+	uint64_t const type = CT_HASH("SyntheticTextureLoadingDesc");
+	std::shared_ptr<SyntheticResource> res0 = rl.SyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "match_0", 16));
+	std::shared_ptr<SyntheticResource> res1 = rl.SyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "match_1", 16));
+	EXPECT_NE(res0, res1);
+	EXPECT_EQ(res0, rl.SyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "match_0", 16)));
+	EXPECT_EQ(res1, rl.ASyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "match_1", 16)));
+
+	std::shared_ptr<SyntheticResource> res2 = rl.SyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(CT_HASH("SyntheticModelLoadingDesc"), "match_0", 16));
+	EXPECT_NE(res0, res2);
+}
+
+TEST(ResLoaderTest, AddPathOnce)
+{
+	ResLoader& rl = ResLoader::Instance();
+
+	std::filesystem::path const folder = std::filesystem::temp_directory_path() / "klayge_add_path_once";
+	std::filesystem::create_directories(folder);
+	{
+		std::ofstream ofs((folder / "add_path_once.txt").string().c_str());
+		ofs << "KlayGE";
+	}
+
+	// Models add their folder on every load. Adding it again is a no-op, so one DelPath removes it.
+	rl.AddPath(folder.string());
+	rl.AddPath(folder.string());
+	EXPECT_FALSE(rl.Locate("add_path_once.txt").empty());
+	rl.DelPath(folder.string());
+	EXPECT_TRUE(rl.Locate("add_path_once.txt").empty());
+
+	std::filesystem::remove_all(folder);
+}
+
+TEST(ResLoaderTest, PriorityAndCancel)
+{
+	ResLoader& rl = ResLoader::Instance();
+	uint32_t const default_num_threads = rl.NumLoadingThreads();
+	rl.NumLoadingThreads(1);
+
+	uint64_t const type = CT_HASH("SyntheticTextureLoadingDesc");
+
+	// Keep the only loading thread busy, so the rest stay in the queue
+	std::promise<void> gate;
+	std::shared_ptr<SyntheticResource> blocker = rl.ASyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "priority_blocker", gate.get_future().share()));
+	while (rl.QueueDepth(RLP_Normal) != 0)
+	{
+		std::this_thread::yield();
+	}
+
+	ResLoadingDescPtr low_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "priority_low", 16);
+	ResLoadingDescPtr normal_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "priority_normal", 16);
+	ResLoadingDescPtr cancelled_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "priority_cancelled", 16);
+	ResLoadingDescPtr immediate_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "priority_immediate", 16);
+	std::shared_ptr<SyntheticResource> low = rl.ASyncQueryT<SyntheticResource>(low_desc, RLP_Low);
+	std::shared_ptr<SyntheticResource> normal = rl.ASyncQueryT<SyntheticResource>(normal_desc, RLP_Low);
+	std::shared_ptr<SyntheticResource> cancelled = rl.ASyncQueryT<SyntheticResource>(cancelled_desc, RLP_Normal);
+	std::shared_ptr<SyntheticResource> immediate = rl.ASyncQueryT<SyntheticResource>(immediate_desc, RLP_Immediate);
+
+	rl.Reprioritize(normal_desc, RLP_Normal);
+	EXPECT_EQ(1U, rl.QueueDepth(RLP_Immediate));
+	EXPECT_EQ(0U, rl.QueueDepth(RLP_High));
+	EXPECT_EQ(2U, rl.QueueDepth(RLP_Normal));
+	EXPECT_EQ(1U, rl.QueueDepth(RLP_Low));
+
+	rl.Cancel(cancelled_desc);
+	EXPECT_EQ(1U, rl.QueueDepth(RLP_Normal));
+
+	gate.set_value();
+	WaitForResources({ blocker, low, normal, immediate });
+
+	EXPECT_LT(immediate->load_order, normal->load_order);
+	EXPECT_LT(normal->load_order, low->load_order);
+	EXPECT_EQ(0U, cancelled->load_order);
+	EXPECT_FALSE(cancelled->ready);
+
+	rl.NumLoadingThreads(default_num_threads);
+}
+
+TEST(ResLoaderTest, CancelSharedLoad)
+{
+	ResLoader& rl = ResLoader::Instance();
+
+	uint64_t const type = CT_HASH("SyntheticTextureLoadingDesc");
+
+	// A stateless request joins the load in flight, then the one that started it is cancelled
+	std::promise<void> gate;
+	ResLoadingDescPtr original_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "shared_cancel", gate.get_future().share());
+	std::shared_ptr<SyntheticResource> original = rl.ASyncQueryT<SyntheticResource>(original_desc);
+	std::shared_ptr<SyntheticResource> shared = rl.ASyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "shared_cancel", 16));
+	EXPECT_EQ(original, shared);
+
+	rl.Cancel(original_desc);
+	gate.set_value();
+
+	Timer timer;
+	while (!shared->ready && (timer.elapsed() < 10))
+	{
+		rl.Update();
+		std::this_thread::yield();
+	}
+	EXPECT_TRUE(shared->ready);
+
+	EXPECT_EQ(shared, rl.SyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "shared_cancel", 16)));
+}
+
+TEST(ResLoaderTest, SyncQueryWhileLoading)
+{
+	ResLoader& rl = ResLoader::Instance();
+	uint32_t const default_num_threads = rl.NumLoadingThreads();
+	rl.NumLoadingThreads(1);
+
+	uint64_t const type = CT_HASH("SyntheticTextureLoadingDesc");
+
+	// The loading thread is inside SubThreadStage when SyncQuery asks for the same resource
+	std::promise<void> gate;
+	std::shared_ptr<SyntheticResource> async_res = rl.ASyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "sync_while_loading", gate.get_future().share()));
+	while (rl.QueueDepth(RLP_Normal) != 0)
+	{
+		std::this_thread::yield();
+	}
+
+	uint32_t const loads_before = synthetic_load_counter;
+	std::thread opener([&gate]
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			gate.set_value();
+		});
+	std::shared_ptr<SyntheticResource> sync_res = rl.SyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "sync_while_loading", 16));
+	opener.join();
+
+	EXPECT_EQ(async_res, sync_res);
+	EXPECT_TRUE(sync_res->ready);
+	EXPECT_EQ(loads_before + 1, synthetic_load_counter);
+
+	rl.NumLoadingThreads(default_num_threads);
+}
+
+TEST(ResLoaderTest, ResidencyEviction)
+{
+	ResLoader& rl = ResLoader::Instance();
+	uint64_t const default_budget = rl.ResidencyBudget();
+
+	// Flush whatever earlier tests left resident
+	rl.ResidencyBudget(0);
+	rl.ResetResidencyStats();
+	rl.ResidencyBudget(1536 * sizeof(uint32_t));
+
+	uint64_t const type = CT_HASH("SyntheticTextureLoadingDesc");
+	std::shared_ptr<SyntheticResource> a = rl.SyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "residency_a", 1024));
+	std::weak_ptr<SyntheticResource> weak_a = a;
+	a.reset();
+	EXPECT_FALSE(weak_a.expired());
+
+	std::shared_ptr<SyntheticResource> b = rl.SyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "residency_b", 1024));
+	std::weak_ptr<SyntheticResource> weak_b = b;
+	b.reset();
+
+	rl.Update();
+	EXPECT_TRUE(weak_a.expired());
+	EXPECT_FALSE(weak_b.expired());
+
+	EXPECT_EQ(weak_b.lock(), rl.SyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "residency_b", 1024)));
+	rl.SyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "residency_a", 1024));
+
+	ResidencyStats const stats = rl.GetResidencyStats();
+	EXPECT_EQ(1U, stats.hits);
+	EXPECT_EQ(3U, stats.misses);
+	EXPECT_EQ(1U, stats.evictions);
+
+	// Without a budget nothing is held by ResLoader
+	rl.ResidencyBudget(default_budget);
+	EXPECT_TRUE(weak_b.expired());
+	EXPECT_EQ(0U, rl.GetResidencyStats().num_resident);
+
+	std::shared_ptr<SyntheticResource> c = rl.SyncQueryT<SyntheticResource>(
+		MakeSharedPtr<SyntheticLoadingDesc>(type, "residency_c", 1024));
+	std::weak_ptr<SyntheticResource> weak_c = c;
+	c.reset();
+	rl.Update();
+	EXPECT_TRUE(weak_c.expired());
+}
+
+TEST(ResLoaderTest, UpdateBudget)
+{
+	ResLoader& rl = ResLoader::Instance();
+
+	std::promise<void> gate_promise;
+	std::shared_future<void> gate = gate_promise.get_future().share();
+
+	uint64_t const type = CT_HASH("SyntheticTextureLoadingDesc");
+	std::vector<std::shared_ptr<SyntheticResource>> resources;
+	for (uint32_t i = 0; i < 3; ++ i)
+	{
+		resources.push_back(rl.ASyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(
+			type, "budget_low_" + std::to_string(i), gate), RLP_Low));
+	}
+	std::shared_ptr<SyntheticResource> urgent = rl.ASyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(
+		type, "budget_high", gate), RLP_High);
+	resources.push_back(urgent);
+
+	// Let every load reach the main thread stage before the first Update
+	gate_promise.set_value();
+	for (auto const & res : resources)
+	{
+		while (0 == res->load_order)
+		{
+			std::this_thread::yield();
+		}
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	// An empty budget still lets each Update finish one load
+	rl.UpdateTimeBudget(0);
+	rl.Update();
+	EXPECT_TRUE(urgent->ready);
+	EXPECT_EQ(3U, rl.NumDeferredLoads());
+
+	uint32_t num_updates = 1;
+	for (;;)
+	{
+		uint32_t num_ready = 0;
+		for (auto const & res : resources)
+		{
+			num_ready += res->ready ? 1 : 0;
+		}
+		EXPECT_EQ(num_updates, num_ready);
+		if (num_ready == resources.size())
+		{
+			break;
+		}
+
+		rl.Update();
+		++ num_updates;
+	}
+	EXPECT_EQ(0U, rl.NumDeferredLoads());
+
+	rl.UpdateTimeBudget(std::numeric_limits<double>::max());
+}
+
+TEST(ResLoaderTest, Dependencies)
+{
+	ResLoader& rl = ResLoader::Instance();
+	rl.NumLoadingThreads(4);
+
+	uint64_t const type = CT_HASH("SyntheticModelLoadingDesc");
+	std::vector<std::string> const child_names = { "dep_tex_0", "dep_tex_1", "dep_tex_2", "dep_tex_3" };
+
+	auto async_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "dep_model_async", 1024);
+	async_desc->Children(child_names, 64 * 1024);
+	std::shared_ptr<SyntheticResource> async_model = rl.ASyncQueryT<SyntheticResource>(async_desc);
+	WaitForResources({ async_model });
+	ASSERT_EQ(child_names.size(), async_model->children.size());
+	EXPECT_TRUE(async_model->children_ready);
+
+	// The children are loaded now, so the second model reuses them
+	auto shared_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "dep_model_shared", 1024);
+	shared_desc->Children(child_names, 64 * 1024);
+	std::shared_ptr<SyntheticResource> shared_model = rl.ASyncQueryT<SyntheticResource>(shared_desc);
+	WaitForResources({ shared_model });
+	EXPECT_TRUE(shared_model->children_ready);
+	for (size_t i = 0; i < child_names.size(); ++ i)
+	{
+		EXPECT_EQ(async_model->children[i], shared_model->children[i]);
+	}
+
+	auto sync_desc = MakeSharedPtr<SyntheticLoadingDesc>(type, "dep_model_sync", 1024);
+	sync_desc->Children({ "dep_tex_sync_0", "dep_tex_sync_1" }, 64 * 1024);
+	std::shared_ptr<SyntheticResource> sync_model = rl.SyncQueryT<SyntheticResource>(sync_desc);
+	EXPECT_TRUE(sync_model->ready);
+	EXPECT_TRUE(sync_model->children_ready);
+	for (auto const & child : sync_model->children)
+	{
+		EXPECT_TRUE(child->ready);
+	}
+}
+
+TEST(ResLoaderTest, LoadingTelemetry)
+{
+	ResLoader& rl = ResLoader::Instance();
+	rl.LoadingTelemetry(true);
+	rl.ClearLoadingRecords();
+
+	uint64_t const type = CT_HASH("SyntheticModelLoadingDesc");
+	std::vector<std::shared_ptr<SyntheticResource>> resources;
+	resources.push_back(rl.ASyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "telemetry_big", 512 * 1024)));
+	resources.push_back(rl.ASyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "telemetry_small", 1024)));
+	WaitForResources(resources);
+	rl.SyncQueryT<SyntheticResource>(MakeSharedPtr<SyntheticLoadingDesc>(type, "telemetry_big", 512 * 1024));
+
+	std::vector<ResLoadingRecord> const records = rl.LoadingRecords();
+	ASSERT_EQ(3U, records.size());
+	for (auto const & record : records)
+	{
+		EXPECT_EQ(type, record.type);
+		EXPECT_GE(record.queue_wait, 0);
+	}
+
+	std::vector<ResLoadingSummary> const summary = rl.LoadingSummary();
+	ASSERT_EQ(2U, summary.size());
+	EXPECT_EQ("telemetry_big", summary[0].name);
+	EXPECT_EQ(1U, summary[0].num_loads);
+	EXPECT_EQ(1U, summary[0].num_cache_hits);
+	EXPECT_GT(summary[0].sub_thread_time, summary[1].sub_thread_time);
+	EXPECT_EQ("telemetry_small", summary[1].name);
+
+	rl.ExportLoadingTelemetryToCSV("ResLoaderTelemetry.csv");
+	rl.ExportLoadingTelemetryToChromeTrace("ResLoaderTelemetry.json");
+	{
+		std::ifstream csv("ResLoaderTelemetry.csv");
+		std::string line;
+		uint32_t num_lines = 0;
+		while (std::getline(csv, line))
+		{
+			++ num_lines;
+		}
+		EXPECT_EQ(4U, num_lines);
+
+		std::ifstream json("ResLoaderTelemetry.json");
+		std::stringstream ss;
+		ss << json.rdbuf();
+		EXPECT_NE(std::string::npos, ss.str().find("\"telemetry_big\""));
+		EXPECT_NE(std::string::npos, ss.str().find("\"SubThreadStage\""));
+	}
+	std::remove("ResLoaderTelemetry.csv");
+	std::remove("ResLoaderTelemetry.json");
+
+	rl.LoadingTelemetry(false);
+	rl.ClearLoadingRecords();
+}
+
+TEST(ResLoaderTest, LoadingThreadsBenchmark)
+{
+	ResLoader& rl = ResLoader::Instance();
+	uint32_t const default_num_threads = rl.NumLoadingThreads();
+
+	uint32_t const num_threads[] = { 1, 2, 4, 8 };
+	for (auto num : num_threads)
+	{
+		double const elapsed = LoadSyntheticBatch(num, 128, 16);
+		EXPECT_EQ(num, rl.NumLoadingThreads());
+
+		cout << num << " loading thread(s): " << elapsed * 1000 << " ms" << endl;
+	}
+
+	rl.NumLoadingThreads(default_num_threads);
+}
+
+// Needs a real package, pointed to by KLAYGE_BENCHMARK_PACKAGE
+TEST(ResLoaderTest, PackageOpenBenchmark)
+{
+	char const * pkt_name = std::getenv("KLAYGE_BENCHMARK_PACKAGE");
+	if (pkt_name == nullptr)
+	{
+		cout << "KLAYGE_BENCHMARK_PACKAGE is not set, skipped" << endl;
+		return;
+	}
+
+	ResIdentifierPtr pkt_file = MakeSharedPtr<ResIdentifier>(pkt_name, 0,
+		MakeSharedPtr<std::ifstream>(pkt_name, std::ios_base::binary));
+	ASSERT_TRUE(*pkt_file);
+
+	SevenZipPackage package(MakeSharedPtr<ResIdentifier>(pkt_name, 0, MakeSharedPtr<std::ifstream>(pkt_name, std::ios_base::binary)), "");
+	std::vector<std::string> file_paths = package.FilePaths();
+	if (file_paths.size() > 500)
+	{
+		file_paths.resize(500);
+	}
+
+	// Every file re-parses the archive header and re-decodes its solid block
+	std::vector<std::string> uncached_contents;
+	Timer timer;
+	for (auto const & path : file_paths)
+	{
+		std::shared_ptr<std::stringstream> ss = MakeSharedPtr<std::stringstream>();
+		Extract7z(pkt_file, "", path, ss);
+		uncached_contents.push_back(ss->str());
+	}
+	double const uncached_time = timer.elapsed();
+
+	std::vector<std::string> cached_contents;
+	timer.restart();
+	for (auto const & path : file_paths)
+	{
+		ResIdentifierPtr file = package.Extract(path, path);
+		ASSERT_TRUE(file);
+		std::stringstream ss;
+		ss << file->input_stream().rdbuf();
+		cached_contents.push_back(ss.str());
+	}
+	double const cached_time = timer.elapsed();
+
+	EXPECT_TRUE(uncached_contents == cached_contents);
+
+	cout << "Open " << file_paths.size() << " files: " << uncached_time * 1000 << " ms uncached, "
+		<< cached_time * 1000 << " ms cached (" << package.NumBlockDecodes() << " block decodes)" << endl;
+}
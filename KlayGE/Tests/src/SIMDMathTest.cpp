@@ -7,6 +7,7 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <random>
 
 using namespace std;
 using namespace KlayGE;
@@ -31,3 +32,49 @@ TEST(SIMDMathTest, NormalizeVector4)
 	v = SIMDMathLib::NormalizeVector4(v);
 	EXPECT_LT(MathLib::abs(SIMDMathLib::GetX(SIMDMathLib::LengthVector4(v)) - 1.0f), 1e-3f);
 }
+
+TEST(SIMDMathTest, IntersectAABBsFrustum)
+{
+	float4x4 const view = MathLib::look_at_lh(float3(0, 0, -60), float3(0, 0, 0));
+	float4x4 const proj = MathLib::perspective_fov_lh(PI / 4, 1.0f, 1.0f, 100.0f);
+	float4x4 const clip = view * proj;
+	Frustum frustum;
+	frustum.ClipMatrix(clip, MathLib::inverse(clip));
+
+	// Not a whole number of 8 boxes. Some boxes are big enough to straddle the planes.
+	uint32_t const num = 1003;
+	std::mt19937 gen(num);
+	std::uniform_real_distribution<float> pos_dis(-80, 80);
+	std::uniform_real_distribution<float> size_dis(0.1f, 20);
+	std::vector<float> bounds[6];
+	for (auto& b : bounds)
+	{
+		b.resize(num);
+	}
+	std::vector<AABBox> boxes(num);
+	for (uint32_t i = 0; i < num; ++ i)
+	{
+		float3 const min_pt(pos_dis(gen), pos_dis(gen), pos_dis(gen));
+		float3 const max_pt = min_pt + float3(size_dis(gen), size_dis(gen), size_dis(gen));
+		boxes[i] = AABBox(min_pt, max_pt);
+		for (int j = 0; j < 3; ++ j)
+		{
+			bounds[j][i] = min_pt[j];
+			bounds[j + 3][i] = max_pt[j];
+		}
+	}
+
+	std::vector<BoundOverlap> results(num);
+	SIMDMathLib::IntersectAABBsFrustum(bounds[0].data(), bounds[1].data(), bounds[2].data(),
+		bounds[3].data(), bounds[4].data(), bounds[5].data(), num, frustum, results.data());
+
+	uint32_t counts[3] = { 0, 0, 0 };
+	for (uint32_t i = 0; i < num; ++ i)
+	{
+		EXPECT_EQ(results[i], frustum.Intersect(boxes[i]));
+		++ counts[results[i]];
+	}
+	EXPECT_GT(counts[BO_Yes], 0U);
+	EXPECT_GT(counts[BO_No], 0U);
+	EXPECT_GT(counts[BO_Partial], 0U);
+}
@@ -0,0 +1,345 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Timer.hpp>
+#include <KlayGE/App3D.hpp>
+#include <KlayGE/Camera.hpp>
+#include <KlayGE/Context.hpp>
+#include <KlayGE/SceneManager.hpp>
+#include <KlayGE/SceneObject.hpp>
+#include <KlayGE/OCTree/OCTree.hpp>
+
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "KlayGETests.hpp"
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	// The base ClipScene, without the tree of a scene manager plugin
+	class CullingSceneManager : public SceneManager
+	{
+	public:
+		void Cull(Frustum const & frustum)
+		{
+			frustum_ = &frustum;
+			this->ClipScene();
+		}
+
+	protected:
+		void OnAddSceneObject(SceneObjectPtr const & obj) override
+		{
+			KFL_UNUSED(obj);
+		}
+		void OnDelSceneObject(std::vector<SceneObjectPtr>::iterator iter) override
+		{
+			KFL_UNUSED(iter);
+		}
+		void DoSuspend() override
+		{
+		}
+		void DoResume() override
+		{
+		}
+	};
+
+	class BoxObject : public SceneObject
+	{
+	public:
+		BoxObject(AABBox const & box, uint32_t attrib)
+			: SceneObject(attrib), box_(box)
+		{
+		}
+
+		void Move(float3 const & offset)
+		{
+			box_ += offset;
+			this->PosBoundWSDirty(true);
+		}
+
+		AABBox const & PosBoundWS() const override
+		{
+			return box_;
+		}
+
+	private:
+		AABBox box_;
+	};
+
+	// Unit boxes scattered around the camera. Every 4th one is a child of the one before it.
+	//  With moveable_roots, every other root box is moveable.
+	void MakeScene(SceneManager& sm, uint32_t num_objs, std::vector<SceneObjectPtr>& objs, bool moveable_roots = false)
+	{
+		std::mt19937 gen(num_objs);
+		std::uniform_real_distribution<float> dis(-100, 100);
+
+		objs.resize(num_objs);
+		for (uint32_t i = 0; i < num_objs; ++ i)
+		{
+			float3 const center(dis(gen), dis(gen), dis(gen));
+			uint32_t attrib = SceneObject::SOA_Cullable;
+			if (moveable_roots && (0 == (i & 1)))
+			{
+				attrib |= SceneObject::SOA_Moveable;
+			}
+			objs[i] = MakeSharedPtr<BoxObject>(AABBox(center - float3(0.5f, 0.5f, 0.5f), center + float3(0.5f, 0.5f, 0.5f)),
+				attrib);
+			if (3 == (i & 3))
+			{
+				objs[i]->Parent(objs[i - 1].get());
+			}
+			sm.AddSceneObject(objs[i]);
+		}
+	}
+
+	// 20 small boxes packed in a 2x1.6 cell
+	std::vector<SceneObjectPtr> MakeCell(SceneManager& sm, float3 const & corner)
+	{
+		std::vector<SceneObjectPtr> cell(20);
+		for (uint32_t i = 0; i < cell.size(); ++ i)
+		{
+			float3 const min = corner + float3((i % 5) * 0.4f, (i / 5) * 0.4f, 0);
+			cell[i] = MakeSharedPtr<BoxObject>(AABBox(min, min + float3(0.2f, 0.2f, 0.2f)), SceneObject::SOA_Cullable);
+			sm.AddSceneObject(cell[i]);
+		}
+		return cell;
+	}
+
+	Frustum const & SetupCamera()
+	{
+		Camera& camera = Context::Instance().AppInstance().ActiveCamera();
+		camera.ViewParams(float3(0, 0, -120), float3(0, 0, 0));
+		camera.ProjParams(PI / 4, 1, 1, 250);
+		return camera.ViewFrustum();
+	}
+
+	// Runs a frame, so the per frame stats of the scene manager roll over, then culls
+	void CullFrame(SceneManager& sm, Frustum const & frustum)
+	{
+		sm.Update();
+		sm.ClipSceneByFrustum(frustum);
+	}
+
+	void ExpectExactMarks(std::vector<SceneObjectPtr> const & objs, Frustum const & frustum)
+	{
+		for (auto const & obj : objs)
+		{
+			BoundOverlap const parent_bo = obj->Parent() ? obj->Parent()->VisibleMark() : BO_Partial;
+			EXPECT_EQ(obj->VisibleMark(), (BO_Partial == parent_bo) ? frustum.Intersect(obj->PosBoundWS()) : parent_bo);
+		}
+	}
+}
+
+TEST_F(KlayGETest, ParallelClipSceneMatchesFrustum)
+{
+	CullingSceneManager sm;
+	std::vector<SceneObjectPtr> objs;
+	// Not a whole number of chunks
+	MakeScene(sm, 20077, objs);
+	Frustum const & frustum = SetupCamera();
+
+	sm.CullingThreads(1);
+	sm.Cull(frustum);
+	std::vector<BoundOverlap> single_marks(objs.size());
+	for (size_t i = 0; i < objs.size(); ++ i)
+	{
+		single_marks[i] = objs[i]->VisibleMark();
+	}
+
+	sm.CullingThreads(4);
+	sm.Cull(frustum);
+
+	uint32_t num_visible = 0;
+	for (size_t i = 0; i < objs.size(); ++ i)
+	{
+		SceneObject const & so = *objs[i];
+		EXPECT_EQ(so.VisibleMark(), single_marks[i]);
+
+		BoundOverlap expected;
+		BoundOverlap const parent_bo = so.Parent() ? so.Parent()->VisibleMark() : BO_Partial;
+		if (BO_Partial == parent_bo)
+		{
+			expected = frustum.Intersect(so.PosBoundWS());
+		}
+		else
+		{
+			expected = parent_bo;
+		}
+		EXPECT_EQ(so.VisibleMark(), expected);
+
+		if (so.VisibleMark() != BO_No)
+		{
+			++ num_visible;
+		}
+	}
+	EXPECT_GT(num_visible, 0U);
+	EXPECT_LT(num_visible, objs.size());
+}
+
+TEST_F(KlayGETest, ClipSceneSeesStaticObjectMovedAfterUpdate)
+{
+	CullingSceneManager sm;
+	std::vector<SceneObjectPtr> objs;
+	MakeScene(sm, 100, objs);
+	Frustum const & frustum = SetupCamera();
+
+	// Behind the camera
+	SceneObjectPtr box = MakeSharedPtr<BoxObject>(AABBox(float3(-0.5f, -0.5f, -200.5f), float3(0.5f, 0.5f, -199.5f)),
+		SceneObject::SOA_Cullable);
+	sm.AddSceneObject(box);
+	sm.Cull(frustum);
+	EXPECT_EQ(box->VisibleMark(), BO_No);
+
+	// Moved in front of it with no Update of the scene manager in between, as DoUpdate of an app would
+	checked_cast<BoxObject*>(box.get())->Move(float3(0, 0, 200));
+	sm.Cull(frustum);
+	EXPECT_EQ(box->VisibleMark(), BO_Yes);
+}
+
+TEST_F(KlayGETest, ClipSceneBenchmark)
+{
+	uint32_t const hw_threads = std::max(std::thread::hardware_concurrency(), 1U);
+	uint32_t const num_passes = 20;
+	for (uint32_t num_objs = 10000; num_objs <= 50000; num_objs += 40000)
+	{
+		CullingSceneManager sm;
+		std::vector<SceneObjectPtr> objs;
+		MakeScene(sm, num_objs, objs);
+		Frustum const & frustum = SetupCamera();
+
+		for (uint32_t threads = 1; threads <= hw_threads; threads *= 2)
+		{
+			sm.CullingThreads(threads);
+
+			Timer timer;
+			for (uint32_t pass = 0; pass < num_passes; ++ pass)
+			{
+				sm.Cull(frustum);
+			}
+			double const elapsed = timer.elapsed();
+
+			cout << "ClipScene, " << num_objs << " objects, " << threads << " threads: "
+				<< elapsed / num_passes * 1000 << " ms per pass" << endl;
+		}
+	}
+}
+
+TEST_F(KlayGETest, SceneManagerPluginsBenchmark)
+{
+	std::string const cfg_sm_name = Context::Instance().Config().scene_manager_name;
+	uint32_t const num_objs = 50000;
+	uint32_t const num_passes = 20;
+	for (auto const & sm_name : { "OCTree", "BVH" })
+	{
+		Context::Instance().LoadSceneManager(sm_name);
+		SceneManager& sm = Context::Instance().SceneManagerInstance();
+
+		std::vector<SceneObjectPtr> objs;
+		MakeScene(sm, num_objs, objs, true);
+		Frustum const & frustum = SetupCamera();
+
+		double elapsed = 0;
+		for (uint32_t pass = 0; pass < num_passes; ++ pass)
+		{
+			// The moveable boxes drift a little every frame, like walking actors
+			for (auto const & obj : objs)
+			{
+				if (obj->Attrib() & SceneObject::SOA_Moveable)
+				{
+					checked_cast<BoxObject*>(obj.get())->Move(float3(0.2f, 0, 0.1f));
+				}
+			}
+
+			Timer timer;
+			sm.ClipSceneByFrustum(frustum);
+			elapsed += timer.elapsed();
+		}
+
+		if (std::string("BVH") == sm_name)
+		{
+			ExpectExactMarks(objs, frustum);
+		}
+
+		cout << sm_name << ", " << num_objs << " objects, half of the roots moving: "
+			<< elapsed / num_passes * 1000 << " ms per pass" << endl;
+
+		sm.ClearObject();
+	}
+
+	Context::Instance().LoadSceneManager(cfg_sm_name);
+}
+
+TEST_F(KlayGETest, OCTreeIncrementalUpdate)
+{
+	std::string const cfg_sm_name = Context::Instance().Config().scene_manager_name;
+	Context::Instance().LoadSceneManager("OCTree");
+	// The plugin isn't linked, so no dynamic_cast
+	OCTree& octree = static_cast<OCTree&>(Context::Instance().SceneManagerInstance());
+
+	std::vector<SceneObjectPtr> objs;
+	MakeScene(octree, 20000, objs);
+	Frustum const & frustum = SetupCamera();
+	CullFrame(octree, frustum);
+	CullFrame(octree, frustum);
+	ExpectExactMarks(objs, frustum);
+
+	// A cell inside the scene only touches the nodes around it, instead of rebuilding the tree
+	std::vector<SceneObjectPtr> cell = MakeCell(octree, float3(30, 10, 5));
+	CullFrame(octree, frustum);
+	CullFrame(octree, frustum);
+	EXPECT_GE(octree.NumNodeOperations(), cell.size());
+	EXPECT_LT(octree.NumNodeOperations(), 64U);
+	ExpectExactMarks(objs, frustum);
+	ExpectExactMarks(cell, frustum);
+
+	for (auto const & obj : cell)
+	{
+		octree.DelSceneObject(obj);
+	}
+	CullFrame(octree, frustum);
+	EXPECT_GE(octree.NumNodeOperations(), cell.size());
+	EXPECT_LT(octree.NumNodeOperations(), 64U);
+	ExpectExactMarks(objs, frustum);
+
+	// A cell in front of the camera is out of the root. The root grows toward it, and the octant it lands in is split.
+	std::vector<SceneObjectPtr> near_cell = MakeCell(octree, float3(-0.8f, -0.6f, -110));
+	CullFrame(octree, frustum);
+	CullFrame(octree, frustum);
+	EXPECT_GT(octree.NumNodeOperations(), near_cell.size());
+	EXPECT_LT(octree.NumNodeOperations(), 64U);
+	ExpectExactMarks(objs, frustum);
+	ExpectExactMarks(near_cell, frustum);
+	EXPECT_NE(near_cell[0]->VisibleMark(), BO_No);
+
+	// Removing it merges the split nodes back
+	for (auto const & obj : near_cell)
+	{
+		octree.DelSceneObject(obj);
+	}
+	CullFrame(octree, frustum);
+	EXPECT_GT(octree.NumNodeOperations(), near_cell.size());
+	EXPECT_LT(octree.NumNodeOperations(), 64U);
+
+	// Bounds the root can't hold. Looking away from the scene culls the root, but not this object.
+	float const inf = std::numeric_limits<float>::infinity();
+	SceneObjectPtr sky = MakeSharedPtr<BoxObject>(AABBox(float3(-inf, -inf, -inf), float3(inf, inf, inf)),
+		SceneObject::SOA_Cullable);
+	octree.AddSceneObject(sky);
+	Camera& camera = Context::Instance().AppInstance().ActiveCamera();
+	camera.ViewParams(float3(0, 0, -1000), float3(0, 0, -2000));
+	Frustum const & away_frustum = camera.ViewFrustum();
+	CullFrame(octree, away_frustum);
+	EXPECT_NE(sky->VisibleMark(), BO_No);
+	for (auto const & obj : objs)
+	{
+		EXPECT_EQ(obj->VisibleMark(), BO_No);
+	}
+
+	octree.ClearObject();
+	Context::Instance().LoadSceneManager(cfg_sm_name);
+}
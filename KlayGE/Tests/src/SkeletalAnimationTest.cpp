@@ -0,0 +1,453 @@
+#include <KlayGE/KlayGE.hpp>
+#include <KFL/Math.hpp>
+#include <KFL/Timer.hpp>
+#include <KlayGE/Mesh.hpp>
+#include <KlayGE/SkeletalAnimation.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace KlayGE;
+
+namespace
+{
+	uint32_t const NUM_JOINTS = 80;
+	uint32_t const NUM_KEYS = 30;
+	uint32_t const KEY_INTERVAL = 2;
+
+	// A humanoid-sized tree: a spine of 8 joints, with a limb of 9 joints hanging from each. Joints swing
+	//  back and forth, neighbouring keys are a few degrees apart, as sampled clips are.
+	void MakeSkeleton(std::vector<Joint>& joints, std::vector<KeyFrames>& kfs, uint32_t seed)
+	{
+		std::minstd_rand rng(seed);
+		std::uniform_real_distribution<float> angle(-0.3f, 0.3f);
+		std::uniform_real_distribution<float> offset(-0.1f, 0.1f);
+
+		joints.resize(NUM_JOINTS);
+		kfs.resize(NUM_JOINTS);
+		for (uint32_t i = 0; i < NUM_JOINTS; ++ i)
+		{
+			Joint& joint = joints[i];
+			joint.name = "joint" + std::to_string(i);
+			joint.parent = (0 == i) ? -1 : static_cast<int16_t>((i < 8) ? i - 1 : i - 8);
+			joint.inverse_origin_real = MathLib::rotation_quat_yaw_pitch_roll(angle(rng), angle(rng), angle(rng));
+			joint.inverse_origin_dual = MathLib::quat_trans_to_udq(joint.inverse_origin_real, float3(0, -0.1f * i, 0));
+			joint.inverse_origin_scale = 1;
+
+			KeyFrames& kf = kfs[i];
+			float3 const bone(offset(rng), 0.2f, offset(rng));
+			float3 const amplitude(angle(rng) * 3, angle(rng) * 3, angle(rng) * 3);
+			float const phase = angle(rng) * 10;
+			for (uint32_t k = 0; k < NUM_KEYS; ++ k)
+			{
+				float const swing = std::sin(k * 0.3f + phase);
+				Quaternion const real = MathLib::rotation_quat_yaw_pitch_roll(amplitude.x() * swing,
+					amplitude.y() * swing, amplitude.z() * swing);
+				kf.frame_id.push_back(k * KEY_INTERVAL);
+				kf.bind_real.push_back(real);
+				kf.bind_dual.push_back(MathLib::quat_trans_to_udq(real, bone * (1 + 0.1f * swing)));
+				kf.bind_scale.push_back(1.0f + 0.1f * swing);
+			}
+		}
+	}
+
+	// As a model keeps them after loading
+	std::shared_ptr<KeyFramesType> CompressTracks(std::vector<KeyFrames> const & kfs)
+	{
+		auto ckfs = MakeSharedPtr<KeyFramesType>(kfs.size());
+		for (size_t i = 0; i < kfs.size(); ++ i)
+		{
+			(*ckfs)[i] = CompressKeyFrames(kfs[i]);
+		}
+		return ckfs;
+	}
+
+	// SkinnedModel::BuildBones as it was, one joint at a time with sclerp
+	void ReferencePose(std::vector<Joint>& joints, std::vector<KeyFrames> const & kfs, float frame,
+		std::vector<float4>& bind_reals, std::vector<float4>& bind_duals)
+	{
+		for (size_t i = 0; i < joints.size(); ++ i)
+		{
+			Joint& joint = joints[i];
+			std::pair<std::pair<Quaternion, Quaternion>, float> const key_dq = kfs[i].Frame(frame);
+			if (joint.parent != -1)
+			{
+				ConcatenateJoint(joint, joints[joint.parent], key_dq.first.first, key_dq.first.second, key_dq.second);
+			}
+			else
+			{
+				joint.bind_real = key_dq.first.first;
+				joint.bind_dual = key_dq.first.second;
+				joint.bind_scale = key_dq.second;
+			}
+		}
+
+		bind_reals.resize(joints.size());
+		bind_duals.resize(joints.size());
+		for (size_t i = 0; i < joints.size(); ++ i)
+		{
+			SkinningDualQuat(bind_reals[i], bind_duals[i], joints[i]);
+		}
+	}
+
+	// Where the skinning dual quaternion puts a point, what the vertex shader computes
+	float3 SkinPoint(float4 const & bind_real, float4 const & bind_dual, float3 const & pos)
+	{
+		float const scale = MathLib::length(bind_real);
+		Quaternion const real(bind_real.x() / scale, bind_real.y() / scale, bind_real.z() / scale, bind_real.w() / scale);
+		Quaternion const dual(bind_dual.x(), bind_dual.y(), bind_dual.z(), bind_dual.w());
+		return MathLib::transform_quat(pos * scale, real) + MathLib::udq_to_trans(real, dual);
+	}
+
+	void ExpectSamePose(std::vector<float4> const & ref_reals, std::vector<float4> const & ref_duals,
+		std::vector<float4> const & bind_reals, std::vector<float4> const & bind_duals, float tolerance)
+	{
+		ASSERT_EQ(ref_reals.size(), bind_reals.size());
+		float3 const probe(0.3f, 0.5f, -0.2f);
+		for (size_t i = 0; i < ref_reals.size(); ++ i)
+		{
+			float3 const ref_pos = SkinPoint(ref_reals[i], ref_duals[i], probe);
+			float3 const pos = SkinPoint(bind_reals[i], bind_duals[i], probe);
+			EXPECT_LT(MathLib::length(ref_pos - pos), tolerance * std::max(MathLib::length(ref_pos), 1.0f)) << "joint " << i;
+			EXPECT_NEAR(MathLib::length(ref_reals[i]), MathLib::length(bind_reals[i]), tolerance) << "joint " << i;
+		}
+	}
+}
+
+TEST(SkeletalAnimationTest, MatchesScalarPose)
+{
+	std::vector<Joint> joints;
+	std::vector<KeyFrames> kfs;
+	MakeSkeleton(joints, kfs, 1);
+	std::vector<Joint> ref_joints = joints;
+
+	SkeletalPoseEvaluator evaluator;
+	std::vector<float4> bind_reals, bind_duals;
+	std::vector<float4> ref_reals, ref_duals;
+
+	// Blending linearly is off sclerp by a little at each joint, and that adds up to the end of a limb
+	float const tolerance = 3e-3f;
+
+	// Forward, on and between keys, across the loop, then jumping back
+	float const frames[] = { 0.0f, 0.5f, 1.25f, 2.0f, 7.9f, 30.0f, 57.5f, 58.2f, 59.7f, 60.4f, 3.3f, 0.1f };
+	for (auto frame : frames)
+	{
+		evaluator.Evaluate(joints, kfs, frame, bind_reals, bind_duals);
+		ReferencePose(ref_joints, kfs, frame, ref_reals, ref_duals);
+		ExpectSamePose(ref_reals, ref_duals, bind_reals, bind_duals, tolerance);
+	}
+
+	// Mirrored joints take the matrix path on both sides
+	for (uint32_t i = 20; i < NUM_JOINTS; i += 20)
+	{
+		for (auto& scale : kfs[i].bind_scale)
+		{
+			scale = -scale;
+		}
+	}
+	evaluator.Evaluate(joints, kfs, 11.5f, bind_reals, bind_duals);
+	ReferencePose(ref_joints, kfs, 11.5f, ref_reals, ref_duals);
+	ExpectSamePose(ref_reals, ref_duals, bind_reals, bind_duals, tolerance);
+}
+
+TEST(SkeletalAnimationTest, CompressedKeyFrames)
+{
+	std::vector<Joint> joints;
+	std::vector<KeyFrames> kfs;
+	MakeSkeleton(joints, kfs, 1);
+
+	// Like baked clips, a quarter of the joints never move, another quarter turn at a steady rate
+	for (uint32_t i = 0; i < NUM_JOINTS; ++ i)
+	{
+		KeyFrames& kf = kfs[i];
+		for (uint32_t k = 1; k < NUM_KEYS; ++ k)
+		{
+			if (i % 4 == 1)
+			{
+				kf.bind_real[k] = kf.bind_real[0];
+				kf.bind_dual[k] = kf.bind_dual[0];
+				kf.bind_scale[k] = kf.bind_scale[0];
+			}
+			else if (i % 4 == 2)
+			{
+				float3 const trans = MathLib::udq_to_trans(kf.bind_real[0], kf.bind_dual[0]);
+				kf.bind_real[k] = MathLib::rotation_quat_yaw_pitch_roll(0.02f * k, 0.0f, 0.0f);
+				kf.bind_dual[k] = MathLib::quat_trans_to_udq(kf.bind_real[k], trans);
+				kf.bind_scale[k] = kf.bind_scale[0];
+			}
+		}
+		if (i % 4 == 2)
+		{
+			kf.bind_real[0] = Quaternion::Identity();
+			kf.bind_dual[0] = MathLib::quat_trans_to_udq(kf.bind_real[0], MathLib::udq_to_trans(kf.bind_real[1], kf.bind_dual[1]));
+		}
+	}
+
+	KeyFramesType compressed_kfs(NUM_JOINTS);
+	std::vector<KeyFrames> decompressed_kfs(NUM_JOINTS);
+	size_t raw_size = 0;
+	size_t compressed_size = 0;
+	size_t raw_memory = 0;
+	size_t compressed_memory = 0;
+	for (uint32_t i = 0; i < NUM_JOINTS; ++ i)
+	{
+		KeyFrames kf = kfs[i];
+		ReduceKeyFrames(kf, 1e-4f, 1e-4f, 1e-4f);
+		if (i % 4 == 1)
+		{
+			EXPECT_EQ(kf.frame_id.size(), 1U) << "joint " << i;
+		}
+		else if (i % 4 == 2)
+		{
+			EXPECT_LT(kf.frame_id.size(), NUM_KEYS / 3) << "joint " << i;
+		}
+		EXPECT_EQ(kf.frame_id.front(), kfs[i].frame_id.front());
+		if (kf.frame_id.size() > 1)
+		{
+			EXPECT_EQ(kf.frame_id.back(), kfs[i].frame_id.back());
+		}
+
+		CompressedKeyFrames& ckf = compressed_kfs[i];
+		ckf = CompressKeyFrames(kf);
+		decompressed_kfs[i] = DecompressKeyFrames(ckf);
+		ASSERT_EQ(decompressed_kfs[i].frame_id, kf.frame_id);
+
+		// As model_bin stores them, before and after
+		raw_size += sizeof(uint32_t) + kfs[i].frame_id.size() * (sizeof(uint32_t) + sizeof(Quaternion) * 2);
+		compressed_size += sizeof(uint32_t) + sizeof(float3) * 2 + sizeof(float) * 2 + ckf.keys.size() * sizeof(ckf.keys[0]);
+
+		// And in memory, where the loader used to expand them back
+		raw_memory += sizeof(KeyFrames) + kfs[i].frame_id.capacity() * sizeof(kfs[i].frame_id[0])
+			+ kfs[i].bind_real.capacity() * sizeof(kfs[i].bind_real[0]) + kfs[i].bind_dual.capacity() * sizeof(kfs[i].bind_dual[0])
+			+ kfs[i].bind_scale.capacity() * sizeof(kfs[i].bind_scale[0]);
+		compressed_memory += sizeof(CompressedKeyFrames) + ckf.keys.capacity() * sizeof(ckf.keys[0]);
+	}
+	EXPECT_EQ(sizeof(CompressedKey), 16U);
+	cout << "Key frames: " << raw_size << " -> " << compressed_size << " bytes" << endl;
+	cout << "In memory: " << raw_memory << " -> " << compressed_memory << " bytes" << endl;
+	EXPECT_LT(compressed_size * 3, raw_size);
+	EXPECT_LT(compressed_memory * 4, raw_memory);
+
+	// Posed by the same evaluator, the compressed tracks land where the full ones do
+	std::vector<Joint> compressed_joints = joints;
+	std::vector<Joint> decompressed_joints = joints;
+	SkeletalPoseEvaluator evaluator;
+	SkeletalPoseEvaluator compressed_evaluator;
+	SkeletalPoseEvaluator decompressed_evaluator;
+	std::vector<float4> bind_reals, bind_duals;
+	std::vector<float4> compressed_reals, compressed_duals;
+	std::vector<float4> decompressed_reals, decompressed_duals;
+	float const frames[] = { 0.0f, 0.5f, 7.9f, 30.0f, 57.5f, 59.7f, 3.3f };
+	for (auto frame : frames)
+	{
+		evaluator.Evaluate(joints, kfs, frame, bind_reals, bind_duals);
+		compressed_evaluator.Evaluate(compressed_joints, compressed_kfs, frame, compressed_reals, compressed_duals);
+		ExpectSamePose(bind_reals, bind_duals, compressed_reals, compressed_duals, 2e-3f);
+
+		// Sampling the compressed keys is what expanding them first gave
+		decompressed_evaluator.Evaluate(decompressed_joints, decompressed_kfs, frame, decompressed_reals, decompressed_duals);
+		ExpectSamePose(decompressed_reals, decompressed_duals, compressed_reals, compressed_duals, 1e-6f);
+	}
+}
+
+TEST(SkeletalAnimationTest, AnimationLod)
+{
+	std::vector<Joint> joints;
+	std::vector<KeyFrames> raw_kfs;
+	MakeSkeleton(joints, raw_kfs, 1);
+	auto kfs = CompressTracks(raw_kfs);
+
+	auto model = MakeSharedPtr<SkinnedModel>(L"Model");
+	model->AssignJoints(joints.begin(), joints.end());
+	model->AttachKeyFrames(kfs);
+	EXPECT_FALSE(model->WantsScreenArea());
+
+	// Full detail down to 10% of the screen, then every 4th frame, with the spine and the top of the limbs
+	uint32_t const max_depth = 2;
+	std::vector<AnimationLod> lods(2);
+	lods[0].min_screen_area = 0.1f;
+	lods[0].update_interval = 1;
+	lods[0].max_joint_depth = 0xFFFFFFFF;
+	lods[1].min_screen_area = 0;
+	lods[1].update_interval = 4;
+	lods[1].max_joint_depth = max_depth;
+	model->AnimationLods(lods);
+	EXPECT_TRUE(model->WantsScreenArea());
+
+	uint32_t num_evaluated, num_blended, num_skipped;
+	SkinnedModel::TakeAnimationStats(num_evaluated, num_blended, num_skipped);
+
+	// Off screen, time runs but nothing is posed
+	model->SetFrame(1.0f);
+	model->SetFrame(2.0f);
+	EXPECT_FLOAT_EQ(model->GetFrame(), 2.0f);
+	SkinnedModel::TakeAnimationStats(num_evaluated, num_blended, num_skipped);
+	EXPECT_EQ(num_evaluated, 0U);
+	EXPECT_EQ(num_skipped, 2U);
+
+	std::vector<Joint> ref_joints = joints;
+	SkeletalPoseEvaluator evaluator;
+	std::vector<float4> ref_reals, ref_duals;
+
+	// Close up, every frame
+	model->ScreenArea(0.5f);
+	model->SetFrame(3.0f);
+	evaluator.Evaluate(ref_joints, *kfs, 3.0f, ref_reals, ref_duals);
+	ExpectSamePose(ref_reals, ref_duals, model->GetBindRealParts(), model->GetBindDualParts(), 1e-5f);
+
+	// The intervals below blend between the poses at these frames
+	std::vector<float> min_scales(NUM_JOINTS, 1e10f);
+	std::vector<float> max_scales(NUM_JOINTS, 0.0f);
+	{
+		std::vector<Joint> interval_joints = ref_joints;
+		std::vector<float4> interval_reals, interval_duals;
+		float const interval_frames[] = { 4.0f, 6.0f, 8.0f };
+		for (auto frame : interval_frames)
+		{
+			evaluator.Evaluate(interval_joints, *kfs, frame, interval_reals, interval_duals, max_depth);
+			for (uint32_t j = 0; j < NUM_JOINTS; ++ j)
+			{
+				min_scales[j] = std::min(min_scales[j], MathLib::length(interval_reals[j]));
+				max_scales[j] = std::max(max_scales[j], MathLib::length(interval_reals[j]));
+			}
+		}
+	}
+
+	// Far away. Switching is exact, then each interval is evaluated once and ends on that pose. In between, the
+	//  joints keep a scale between the ones they blend, the mesh doesn't shrink.
+	for (uint32_t i = 0; i <= 8; ++ i)
+	{
+		model->ScreenArea(0.01f);
+		model->SetFrame(4.0f + i * 0.5f);
+
+		for (uint32_t j = 0; j < NUM_JOINTS; ++ j)
+		{
+			float const scale = MathLib::length(model->GetBindRealParts()[j]);
+			EXPECT_GE(scale, min_scales[j] - 1e-5f) << "joint " << j;
+			EXPECT_LE(scale, max_scales[j] + 1e-5f) << "joint " << j;
+		}
+	}
+	SkinnedModel::TakeAnimationStats(num_evaluated, num_blended, num_skipped);
+	// The close up one too
+	EXPECT_EQ(num_evaluated, 1U + 3U);
+	EXPECT_EQ(num_blended, 6U);
+	EXPECT_EQ(num_skipped, 0U);
+
+	evaluator.Evaluate(ref_joints, *kfs, 8.0f, ref_reals, ref_duals, max_depth);
+	ExpectSamePose(ref_reals, ref_duals, model->GetBindRealParts(), model->GetBindDualParts(), 1e-4f);
+
+	// Deeper joints kept their first key, so the full pose is somewhere else
+	evaluator.Evaluate(ref_joints, *kfs, 8.0f, ref_reals, ref_duals);
+	float max_distance = 0;
+	float3 const probe(0.3f, 0.5f, -0.2f);
+	for (uint32_t i = 0; i < NUM_JOINTS; ++ i)
+	{
+		max_distance = std::max(max_distance, MathLib::length(SkinPoint(ref_reals[i], ref_duals[i], probe)
+			- SkinPoint(model->GetBindRealParts()[i], model->GetBindDualParts()[i], probe)));
+	}
+	EXPECT_GT(max_distance, 0.01f);
+}
+
+TEST(SkeletalAnimationTest, PoseBenchmark)
+{
+	uint32_t const num_models = 300;
+	std::vector<std::vector<Joint>> joints(num_models);
+	std::vector<std::vector<KeyFrames>> kfs(num_models);
+	std::vector<std::shared_ptr<KeyFramesType>> compressed_kfs(num_models);
+	for (uint32_t i = 0; i < num_models; ++ i)
+	{
+		MakeSkeleton(joints[i], kfs[i], i + 1);
+		compressed_kfs[i] = CompressTracks(kfs[i]);
+	}
+
+	uint32_t const num_frames = 30;
+	double const num_joints = static_cast<double>(num_frames) * num_models * NUM_JOINTS;
+	std::vector<float4> bind_reals, bind_duals;
+
+	double scalar_time;
+	{
+		Timer timer;
+		for (uint32_t f = 0; f < num_frames; ++ f)
+		{
+			for (uint32_t i = 0; i < num_models; ++ i)
+			{
+				ReferencePose(joints[i], kfs[i], f * 0.4f, bind_reals, bind_duals);
+			}
+		}
+		scalar_time = timer.elapsed();
+	}
+
+	double batched_time;
+	{
+		std::vector<SkeletalPoseEvaluator> evaluators(num_models);
+		Timer timer;
+		for (uint32_t f = 0; f < num_frames; ++ f)
+		{
+			for (uint32_t i = 0; i < num_models; ++ i)
+			{
+				evaluators[i].Evaluate(joints[i], kfs[i], f * 0.4f, bind_reals, bind_duals);
+			}
+		}
+		batched_time = timer.elapsed();
+	}
+
+	double compressed_time;
+	{
+		std::vector<SkeletalPoseEvaluator> evaluators(num_models);
+		Timer timer;
+		for (uint32_t f = 0; f < num_frames; ++ f)
+		{
+			for (uint32_t i = 0; i < num_models; ++ i)
+			{
+				evaluators[i].Evaluate(joints[i], *compressed_kfs[i], f * 0.4f, bind_reals, bind_duals);
+			}
+		}
+		compressed_time = timer.elapsed();
+	}
+
+	cout << "Scalar: " << num_joints / scalar_time / 1e6 << " M joints/s" << endl;
+	cout << "Batched: " << num_joints / batched_time / 1e6 << " M joints/s" << endl;
+	cout << "Batched, compressed keys: " << num_joints / compressed_time / 1e6 << " M joints/s" << endl;
+	EXPECT_LT(batched_time, scalar_time);
+}
+
+TEST(SkeletalAnimationTest, SetFramesBenchmark)
+{
+	uint32_t const num_models = 300;
+	std::vector<std::shared_ptr<SkinnedModel>> models(num_models);
+	std::vector<SkinnedModel*> model_ptrs(num_models);
+	for (uint32_t i = 0; i < num_models; ++ i)
+	{
+		std::vector<Joint> joints;
+		std::vector<KeyFrames> kfs;
+		MakeSkeleton(joints, kfs, i + 1);
+
+		models[i] = MakeSharedPtr<SkinnedModel>(L"Model");
+		models[i]->AssignJoints(joints.begin(), joints.end());
+		models[i]->AttachKeyFrames(CompressTracks(kfs));
+		model_ptrs[i] = models[i].get();
+	}
+
+	uint32_t const num_frames = 30;
+	double const num_joints = static_cast<double>(num_frames) * num_models * NUM_JOINTS;
+	std::vector<float> frames(num_models);
+
+	Timer timer;
+	for (uint32_t f = 0; f < num_frames; ++ f)
+	{
+		std::fill(frames.begin(), frames.end(), f * 0.4f);
+		SkinnedModel::SetFrames(model_ptrs, frames);
+	}
+	double const elapsed = timer.elapsed();
+
+	cout << "SetFrames, " << std::thread::hardware_concurrency() << " hardware threads: "
+		<< num_joints / elapsed / 1e6 << " M joints/s" << endl;
+	EXPECT_FLOAT_EQ(models[0]->GetFrame(), (num_frames - 1) * 0.4f);
+}
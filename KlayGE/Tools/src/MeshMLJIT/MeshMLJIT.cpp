@@ -1,6 +1,7 @@
 #include <KlayGE/KlayGE.hpp>
 #include <KFL/Math.hpp>
 #include <KFL/Util.hpp>
+#include <KFL/ErrorHandling.hpp>
 #include <KFL/XMLDom.hpp>
 #include <KlayGE/ResLoader.hpp>
 #include <KlayGE/RenderLayout.hpp>
@@ -8,6 +9,9 @@
 #include <KlayGE/RenderMaterial.hpp>
 #include <KlayGE/Renderable.hpp>
 #include <KlayGE/Mesh.hpp>
+#include <KlayGE/MeshOptimizer.hpp>
+#include <KlayGE/Meshlet.hpp>
+#include <KlayGE/SkeletalAnimation.hpp>
 #include <KFL/Hash.hpp>
 #include <KFL/CXX17/filesystem.hpp>
 
@@ -76,15 +80,14 @@ namespace
 	}
 
 	std::string const JIT_EXT_NAME = ".model_bin";
-	uint32_t const MODEL_BIN_VERSION = 14;
+	uint32_t const MODEL_BIN_VERSION = 19;
+	uint32_t const MODEL_BIN_BLOB_ALIGNMENT = 16;
 
-	struct KeyFrames
-	{
-		std::vector<uint32_t> frame_id;
-		std::vector<Quaternion> bind_real;
-		std::vector<Quaternion> bind_dual;
-		std::vector<float> bind_scale;
-	};
+	// How far a dropped key may be from what blending its neighbours gives. Translation and scale are
+	//  relative to the track's largest.
+	float const KEY_ROTATION_TOLERANCE = 1e-4f;
+	float const KEY_TRANSLATION_TOLERANCE = 1e-4f;
+	float const KEY_SCALE_TOLERANCE = 1e-4f;
 
 	struct AABBKeyFrames
 	{
@@ -480,13 +483,54 @@ namespace
 		}
 	}
 
+	// Sizes and worst errors of the quantized vertices, for the report
+	struct VertexQuantizationStats
+	{
+		uint64_t float_bytes;
+		uint64_t packed_bytes;
+		float max_pos_error;
+		float max_tc_error;
+		float max_tangent_error;
+		float max_color_error;
+	};
+
+	// [0, 1] to the whole int16 range, to the nearest step
+	int16_t QuantizeSNorm16(float v)
+	{
+		return static_cast<int16_t>(MathLib::clamp<int32_t>(static_cast<int32_t>(std::floor(v * 65535 + 0.5f)) - 32768,
+			-32768, 32767));
+	}
+
+	// What the GPU fetches from a SNORM16 element, before the shader scales it by the bound
+	float DequantizeSNorm16(int16_t v)
+	{
+		return std::max(v / 32767.0f, -1.0f);
+	}
+
+	uint32_t QuantizeUNorm8(float v)
+	{
+		return static_cast<uint32_t>(MathLib::clamp<int32_t>(static_cast<int32_t>(std::floor(v * 255 + 0.5f)), 0, 255));
+	}
+
+	float DequantizeUNorm8(uint32_t v)
+	{
+		return (v & 0xFF) / 255.0f;
+	}
+
+	// Vertex colors are biased from [-1, 1] like normals
+	uint32_t QuantizeColorChannel(float v)
+	{
+		return QuantizeUNorm8(v * 0.5f + 0.5f);
+	}
+
 	void CompileMeshesVerticesChunk(XMLNodePtr const & vertices_chunk,
 		AABBox& pos_bb, AABBox& tc_bb, std::vector<VertexElement>& vertex_elements,
 		std::vector<int16_t>& positions, std::vector<uint32_t>& normals,
 		std::vector<uint32_t>& tangent_quats, 
 		std::vector<uint32_t>& diffuses, std::vector<uint32_t>& speculars,
 		std::vector<int16_t>& tex_coords, 
-		std::vector<uint32_t>& bone_indices, std::vector<uint32_t>& bone_weights)
+		std::vector<uint32_t>& bone_indices, std::vector<uint32_t>& bone_weights,
+		VertexQuantizationStats& stats)
 	{
 		std::vector<float3> mesh_positions;
 		std::vector<float3> mesh_normals;
@@ -836,6 +880,33 @@ namespace
 			}
 		}
 
+		// As floats, the vertex would have taken this much
+		uint32_t float_vertex_size = sizeof(float3);
+		if (has_diffuse)
+		{
+			float_vertex_size += sizeof(float4);
+		}
+		if (has_specular)
+		{
+			float_vertex_size += sizeof(float3);
+		}
+		if (has_weight)
+		{
+			float_vertex_size += sizeof(float4) + sizeof(uint32_t) * 4;
+		}
+		if (has_tex_coord)
+		{
+			float_vertex_size += sizeof(float2);
+		}
+		if (has_tangent_quat || (has_normal && (has_tangent || has_binormal)) || (has_tangent && has_binormal))
+		{
+			float_vertex_size += sizeof(Quaternion);
+		}
+		else if (has_normal)
+		{
+			float_vertex_size += sizeof(float3);
+		}
+
 		bool recompute_tangent_quat = false;
 
 		{
@@ -1012,9 +1083,9 @@ namespace
 			pos = (pos - pos_center) / pos_extent * 0.5f + 0.5f;
 			int16_t s_pos[4] = 
 			{
-				static_cast<int16_t>(MathLib::clamp<int32_t>(static_cast<int32_t>(pos.x() * 65535 - 32768), -32768, 32767)),
-				static_cast<int16_t>(MathLib::clamp<int32_t>(static_cast<int32_t>(pos.y() * 65535 - 32768), -32768, 32767)),
-				static_cast<int16_t>(MathLib::clamp<int32_t>(static_cast<int32_t>(pos.z() * 65535 - 32768), -32768, 32767)),
+				QuantizeSNorm16(pos.x()),
+				QuantizeSNorm16(pos.y()),
+				QuantizeSNorm16(pos.z()),
 				32767
 			};
 
@@ -1022,24 +1093,36 @@ namespace
 			positions.push_back(s_pos[1]);
 			positions.push_back(s_pos[2]);
 			positions.push_back(s_pos[3]);
+
+			float3 const decoded(DequantizeSNorm16(s_pos[0]), DequantizeSNorm16(s_pos[1]), DequantizeSNorm16(s_pos[2]));
+			stats.max_pos_error = std::max(stats.max_pos_error,
+				MathLib::length(decoded * pos_extent + pos_center - mesh_positions[index]));
 		}
 		for (uint32_t index = 0; index < mesh_diffuses.size(); ++ index)
 		{
 			float4 const & diffuse = mesh_diffuses[index];
-			uint32_t compact = (MathLib::clamp<uint32_t>(static_cast<uint32_t>((diffuse.x() * 0.5f + 0.5f) * 255), 0, 255) << 0)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((diffuse.y() * 0.5f + 0.5f) * 255), 0, 255) << 8)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((diffuse.z() * 0.5f + 0.5f) * 255), 0, 255) << 16)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((diffuse.w() * 0.5f + 0.5f) * 255), 0, 255) << 24);
+			uint32_t compact = (QuantizeColorChannel(diffuse.x()) << 0)
+				| (QuantizeColorChannel(diffuse.y()) << 8)
+				| (QuantizeColorChannel(diffuse.z()) << 16)
+				| (QuantizeColorChannel(diffuse.w()) << 24);
 			diffuses.push_back(compact);
+
+			float4 const decoded(DequantizeUNorm8(compact >> 0) * 2 - 1, DequantizeUNorm8(compact >> 8) * 2 - 1,
+				DequantizeUNorm8(compact >> 16) * 2 - 1, DequantizeUNorm8(compact >> 24) * 2 - 1);
+			stats.max_color_error = std::max(stats.max_color_error, MathLib::length(decoded - diffuse));
 		}
 		for (uint32_t index = 0; index < mesh_speculars.size(); ++ index)
 		{
 			float3 const & specular = mesh_speculars[index];
-			uint32_t compact = (MathLib::clamp<uint32_t>(static_cast<uint32_t>((specular.x() * 0.5f + 0.5f) * 255), 0, 255) << 0)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((specular.y() * 0.5f + 0.5f) * 255), 0, 255) << 8)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((specular.z() * 0.5f + 0.5f) * 255), 0, 255) << 16)
+			uint32_t compact = (QuantizeColorChannel(specular.x()) << 0)
+				| (QuantizeColorChannel(specular.y()) << 8)
+				| (QuantizeColorChannel(specular.z()) << 16)
 				| 0xFF000000;
 			speculars.push_back(compact);
+
+			float3 const decoded(DequantizeUNorm8(compact >> 0) * 2 - 1, DequantizeUNorm8(compact >> 8) * 2 - 1,
+				DequantizeUNorm8(compact >> 16) * 2 - 1);
+			stats.max_color_error = std::max(stats.max_color_error, MathLib::length(decoded - specular));
 		}
 		for (uint32_t index = 0; index < mesh_tex_coords.size(); ++ index)
 		{
@@ -1047,32 +1130,58 @@ namespace
 			tex_coord = (tex_coord - tc_center) / tc_extent * 0.5f + 0.5f;
 			int16_t s_tc[2] = 
 			{
-				static_cast<int16_t>(MathLib::clamp<int32_t>(static_cast<int32_t>(tex_coord.x() * 65535 - 32768), -32768, 32767)),
-				static_cast<int16_t>(MathLib::clamp<int32_t>(static_cast<int32_t>(tex_coord.y() * 65535 - 32768), -32768, 32767)),
+				QuantizeSNorm16(tex_coord.x()),
+				QuantizeSNorm16(tex_coord.y())
 			};
 
 			tex_coords.push_back(s_tc[0]);
 			tex_coords.push_back(s_tc[1]);
+
+			float2 const decoded(DequantizeSNorm16(s_tc[0]) * tc_extent.x() + tc_center.x(),
+				DequantizeSNorm16(s_tc[1]) * tc_extent.y() + tc_center.y());
+			stats.max_tc_error = std::max(stats.max_tc_error, MathLib::length(decoded - mesh_tex_coords[index]));
 		}
 		for (uint32_t index = 0; index < mesh_tangent_quats.size(); ++ index)
 		{
 			Quaternion const & tangent_quat = mesh_tangent_quats[index];
-			uint32_t compact = (MathLib::clamp<uint32_t>(static_cast<uint32_t>((tangent_quat.x() * 0.5f + 0.5f) * 255), 0, 255) << 0)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((tangent_quat.y() * 0.5f + 0.5f) * 255), 0, 255) << 8)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((tangent_quat.z() * 0.5f + 0.5f) * 255), 0, 255) << 16)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>((tangent_quat.w() * 0.5f + 0.5f) * 255), 0, 255) << 24);
+			uint32_t compact = (QuantizeUNorm8(tangent_quat.x() * 0.5f + 0.5f) << 0)
+				| (QuantizeUNorm8(tangent_quat.y() * 0.5f + 0.5f) << 8)
+				| (QuantizeUNorm8(tangent_quat.z() * 0.5f + 0.5f) << 16)
+				| (QuantizeUNorm8(tangent_quat.w() * 0.5f + 0.5f) << 24);
 			tangent_quats.push_back(compact);
+
+			Quaternion const decoded = MathLib::normalize(Quaternion(DequantizeUNorm8(compact >> 0) * 2 - 1,
+				DequantizeUNorm8(compact >> 8) * 2 - 1, DequantizeUNorm8(compact >> 16) * 2 - 1,
+				DequantizeUNorm8(compact >> 24) * 2 - 1));
+			float const cos_half = std::min(std::abs(MathLib::dot(decoded, MathLib::normalize(tangent_quat))), 1.0f);
+			stats.max_tangent_error = std::max(stats.max_tangent_error, MathLib::rad2deg(2 * std::acos(cos_half)));
 		}
 		for (uint32_t index = 0; index < mesh_normals.size(); ++ index)
 		{
-			float3 const normal = MathLib::normalize(mesh_normals[index]) * 0.5f + 0.5f;
-			uint32_t compact = MathLib::clamp<uint32_t>(static_cast<uint32_t>(normal.x() * 255), 0, 255)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>(normal.y() * 255), 0, 255) << 8)
-				| (MathLib::clamp<uint32_t>(static_cast<uint32_t>(normal.z() * 255), 0, 255) << 16);
-			normals.push_back(compact);					
+			float3 const normal = MathLib::normalize(mesh_normals[index]);
+			uint32_t compact = QuantizeUNorm8(normal.x() * 0.5f + 0.5f)
+				| (QuantizeUNorm8(normal.y() * 0.5f + 0.5f) << 8)
+				| (QuantizeUNorm8(normal.z() * 0.5f + 0.5f) << 16);
+			normals.push_back(compact);
+
+			if (mesh_tangent_quats.empty())
+			{
+				float3 const decoded = MathLib::normalize(float3(DequantizeUNorm8(compact >> 0) * 2 - 1,
+					DequantizeUNorm8(compact >> 8) * 2 - 1, DequantizeUNorm8(compact >> 16) * 2 - 1));
+				float const cos_angle = MathLib::clamp(MathLib::dot(decoded, normal), -1.0f, 1.0f);
+				stats.max_tangent_error = std::max(stats.max_tangent_error, MathLib::rad2deg(std::acos(cos_angle)));
+			}
 		}
 		bone_indices = mesh_bone_indices;
 		bone_weights = mesh_bone_weights;
+
+		uint32_t packed_vertex_size = 0;
+		for (auto const & ve : vertex_elements)
+		{
+			packed_vertex_size += ve.element_size();
+		}
+		stats.float_bytes += static_cast<uint64_t>(float_vertex_size) * mesh_positions.size();
+		stats.packed_bytes += static_cast<uint64_t>(packed_vertex_size) * mesh_positions.size();
 	}
 
 	void CompileMeshesTrianglesChunk(XMLNodePtr const & triangles_chunk,
@@ -1301,9 +1410,9 @@ namespace
 		std::vector<uint32_t>& mesh_num_indices,
 		std::vector<uint32_t>& mesh_start_indices,
 		std::vector<uint8_t>& merged_indices,
-		char& is_index_16_bit)
+		std::vector<char>& mesh_is_index_16_bit)
 	{
-		is_index_16_bit &= is_index_16s;
+		mesh_is_index_16_bit.push_back(is_index_16s);
 
 		uint32_t num_indices = static_cast<uint32_t>(triangle_indices.size() / (is_index_16s ? 2 : 4));
 		uint32_t start_indicees = mesh_start_indices.back();
@@ -1328,13 +1437,124 @@ namespace
 		}
 	}
 
+	std::vector<uint32_t> TriangleIndicesToUInt32(std::vector<uint8_t> const & triangle_indices, char is_index_16s)
+	{
+		uint32_t const num_indices = static_cast<uint32_t>(triangle_indices.size() / (is_index_16s ? 2 : 4));
+		std::vector<uint32_t> indices(num_indices);
+		for (uint32_t i = 0; i < num_indices; ++ i)
+		{
+			if (is_index_16s)
+			{
+				indices[i] = *reinterpret_cast<uint16_t const *>(&triangle_indices[i * sizeof(uint16_t)]);
+			}
+			else
+			{
+				indices[i] = *reinterpret_cast<uint32_t const *>(&triangle_indices[i * sizeof(uint32_t)]);
+			}
+		}
+		return indices;
+	}
+
+	std::vector<float3> DecodePositions(std::vector<int16_t> const & positions, AABBox const & pos_bb)
+	{
+		float3 const pos_center = pos_bb.Center();
+		float3 const pos_extent = pos_bb.HalfSize();
+		std::vector<float3> mesh_positions(positions.size() / 4);
+		for (size_t i = 0; i < mesh_positions.size(); ++ i)
+		{
+			float3 const s_pos(positions[i * 4 + 0], positions[i * 4 + 1], positions[i * 4 + 2]);
+			mesh_positions[i] = ((s_pos + 32768.0f) / 65535.0f - 0.5f) * 2.0f * pos_extent + pos_center;
+		}
+		return mesh_positions;
+	}
+
+	// Reorders triangles and vertices of the mesh just appended for the post-transform cache, overdraw and vertex fetch.
+	//  positions are reordered too, for the steps after. Adds the cache stats before and after, weighted by triangles
+	//  and vertices, for the report.
+	void OptimizeMesh(std::vector<int16_t>& positions, AABBox const & pos_bb,
+		std::vector<uint8_t>& triangle_indices, char is_index_16s,
+		uint32_t base_vertex, uint32_t num_vertices,
+		std::vector<VertexElement> const & merged_ves, std::vector<std::vector<uint8_t>>& merged_vertices,
+		VertexCacheStats& before, VertexCacheStats& after)
+	{
+		std::vector<uint32_t> indices = TriangleIndicesToUInt32(triangle_indices, is_index_16s);
+		uint32_t const num_indices = static_cast<uint32_t>(indices.size());
+		std::vector<float3> const mesh_positions = DecodePositions(positions, pos_bb);
+
+		uint32_t const num_triangles = num_indices / 3;
+		VertexCacheStats const stats_before = AnalyzeVertexCache(indices, num_vertices);
+
+		OptimizeVertexCache(indices, num_vertices);
+		OptimizeOverdraw(indices, mesh_positions);
+		std::vector<uint32_t> const remap = OptimizeVertexFetch(indices, num_vertices);
+		for (size_t i = 0; i < merged_vertices.size(); ++ i)
+		{
+			uint32_t const stride = merged_ves[i].element_size();
+			RemapVertices(&merged_vertices[i][base_vertex * stride], stride, remap);
+		}
+		RemapVertices(positions.data(), 4 * sizeof(positions[0]), remap);
+
+		VertexCacheStats const stats_after = AnalyzeVertexCache(indices, num_vertices);
+		before.acmr += stats_before.acmr * num_triangles;
+		before.atvr += stats_before.atvr * num_vertices;
+		after.acmr += stats_after.acmr * num_triangles;
+		after.atvr += stats_after.atvr * num_vertices;
+
+		for (uint32_t i = 0; i < num_indices; ++ i)
+		{
+			if (is_index_16s)
+			{
+				*reinterpret_cast<uint16_t*>(&triangle_indices[i * sizeof(uint16_t)]) = static_cast<uint16_t>(indices[i]);
+			}
+			else
+			{
+				*reinterpret_cast<uint32_t*>(&triangle_indices[i * sizeof(uint32_t)]) = indices[i];
+			}
+		}
+	}
+
+	// Simplifies the mesh to each ratio of its triangles, each LOD from the one before. The chain stops when
+	//  simplification stalls on the error limit, it's not worth a LOD that barely shrinks.
+	void GenerateMeshLods(std::vector<int16_t> const & positions, AABBox const & pos_bb,
+		std::vector<uint8_t> const & triangle_indices, char is_index_16s, std::vector<float> const & lod_ratios,
+		std::vector<std::vector<uint32_t>>& lods, std::vector<float>& lod_errors)
+	{
+		lods.clear();
+		lod_errors.clear();
+
+		std::vector<uint32_t> const indices = TriangleIndicesToUInt32(triangle_indices, is_index_16s);
+		std::vector<float3> const mesh_positions = DecodePositions(positions, pos_bb);
+		uint32_t const num_vertices = static_cast<uint32_t>(mesh_positions.size());
+		float const max_error = MathLib::length(pos_bb.HalfSize()) * 0.1f;
+
+		ArrayRef<uint32_t> last_lod = indices;
+		for (auto ratio : lod_ratios)
+		{
+			uint32_t const target_num_indices = static_cast<uint32_t>(indices.size() * ratio) / 3 * 3;
+			float error;
+			std::vector<uint32_t> lod = SimplifyMesh(last_lod, mesh_positions, target_num_indices, max_error, &error);
+			if (lod.empty() || (lod.size() > last_lod.size() * 9 / 10))
+			{
+				break;
+			}
+
+			OptimizeVertexCache(lod, num_vertices);
+			lods.push_back(std::move(lod));
+			lod_errors.push_back(error);
+			last_lod = lods.back();
+		}
+	}
+
 	void CompileMeshesChunk(XMLNodePtr const & meshes_chunk,
 		std::vector<std::string>& mesh_names, std::vector<int32_t>& mtl_ids,
 		std::vector<AABBox>& pos_bbs, std::vector<AABBox>& tc_bbs, 
 		std::vector<uint32_t>& mesh_num_vertices, std::vector<uint32_t>& mesh_base_vertices,
 		std::vector<uint32_t>& mesh_num_indices, std::vector<uint32_t>& mesh_start_indices,
+		std::vector<std::vector<std::pair<uint32_t, uint32_t>>>& mesh_lod_indices,
+		std::vector<std::vector<Meshlet>>& mesh_meshlets,
 		std::vector<VertexElement>& merged_ves, std::vector<std::vector<uint8_t>>& merged_vertices,
-		std::vector<uint8_t>& merged_indices, char& is_index_16_bit)
+		std::vector<uint8_t>& merged_indices, std::vector<char>& mesh_is_index_16_bit, std::vector<float> const & lod_ratios,
+		bool quiet)
 	{
 		mesh_names.clear();
 		mtl_ids.clear();
@@ -1346,7 +1566,9 @@ namespace
 		merged_ves.clear();
 		merged_vertices.clear();
 		merged_indices.clear();
-		is_index_16_bit = true;
+		mesh_lod_indices.clear();
+		mesh_meshlets.clear();
+		mesh_is_index_16_bit.clear();
 
 		std::vector<VertexElement> ves;
 		std::vector<int16_t> positions;
@@ -1359,6 +1581,16 @@ namespace
 		std::vector<uint32_t> bone_weights;
 		std::vector<uint8_t> triangle_indices;
 
+		VertexCacheStats stats_before = { 0, 0 };
+		VertexCacheStats stats_after = { 0, 0 };
+		VertexQuantizationStats quantization_stats = { 0, 0, 0, 0, 0, 0 };
+
+		std::vector<std::vector<std::vector<uint32_t>>> mesh_lods;
+		std::vector<float> lod_errors;
+		std::vector<uint32_t> lod_num_triangles;
+		std::vector<float> lod_max_errors;
+		uint32_t num_meshlets = 0;
+
 		uint32_t mesh_index = 0;
 		for (XMLNodePtr mesh_node = meshes_chunk->FirstNode("mesh"); mesh_node; mesh_node = mesh_node->NextSibling("mesh"), ++ mesh_index)
 		{
@@ -1385,7 +1617,7 @@ namespace
 					pos_bbs[mesh_index], tc_bbs[mesh_index], ves,
 					positions, normals,	tangent_quats,
 					diffuses, speculars, tex_coords,
-					bone_indices, bone_weights);
+					bone_indices, bone_weights, quantization_stats);
 				AppendMeshVertices(ves,
 					positions, normals, tangent_quats, 
 					diffuses, speculars, tex_coords, 
@@ -1402,22 +1634,129 @@ namespace
 				char is_index_16s = true;
 				CompileMeshesTrianglesChunk(triangles_chunk,
 					triangle_indices, is_index_16s);
+				if (vertices_chunk)
+				{
+					OptimizeMesh(positions, pos_bbs[mesh_index], triangle_indices, is_index_16s,
+						mesh_base_vertices[mesh_index], mesh_num_vertices[mesh_index],
+						merged_ves, merged_vertices, stats_before, stats_after);
+
+					mesh_lods.resize(mesh_index + 1);
+					GenerateMeshLods(positions, pos_bbs[mesh_index], triangle_indices, is_index_16s, lod_ratios,
+						mesh_lods[mesh_index], lod_errors);
+					for (size_t lod = 0; lod < mesh_lods[mesh_index].size(); ++ lod)
+					{
+						if (lod >= lod_num_triangles.size())
+						{
+							lod_num_triangles.push_back(0);
+							lod_max_errors.push_back(0);
+						}
+						lod_num_triangles[lod] += static_cast<uint32_t>(mesh_lods[mesh_index][lod].size() / 3);
+						lod_max_errors[lod] = std::max(lod_max_errors[lod], lod_errors[lod]);
+					}
+
+					// Skinned meshes move away from their bind pose bounds, only static ones are cluster culled
+					if (bone_indices.empty())
+					{
+						mesh_meshlets.resize(mesh_index + 1);
+						mesh_meshlets[mesh_index] = BuildMeshlets(TriangleIndicesToUInt32(triangle_indices, is_index_16s),
+							DecodePositions(positions, pos_bbs[mesh_index]));
+						num_meshlets += static_cast<uint32_t>(mesh_meshlets[mesh_index].size());
+					}
+				}
 				AppendMeshIndices(triangle_indices, is_index_16s,
 					mesh_num_indices, mesh_start_indices, merged_indices,
-					is_index_16_bit);
+					mesh_is_index_16_bit);
 			}
 		}
 
-		if (is_index_16_bit)
+		// LODs go after all the full detail meshes, in the same index stream
+		mesh_lods.resize(mesh_names.size());
+		mesh_lod_indices.resize(mesh_names.size());
+		mesh_meshlets.resize(mesh_names.size());
+		uint32_t num_all_indices = mesh_start_indices.back();
+		for (size_t i = 0; i < mesh_lods.size(); ++ i)
 		{
-			std::vector<uint8_t> merged_indices_16(merged_indices.size() / 2);
-			for (uint32_t ind_index = 0; ind_index < mesh_start_indices.back(); ++ ind_index)
+			for (auto const & lod : mesh_lods[i])
+			{
+				uint32_t const num_indices = static_cast<uint32_t>(lod.size());
+				mesh_lod_indices[i].emplace_back(num_indices, num_all_indices);
+
+				merged_indices.resize(merged_indices.size() + num_indices * sizeof(uint32_t));
+				std::memcpy(&merged_indices[num_all_indices * sizeof(uint32_t)], lod.data(), num_indices * sizeof(uint32_t));
+				num_all_indices += num_indices;
+			}
+		}
+
+		// Indices are local to each mesh, so only a mesh with more than 64K vertices needs 32-bit ones. 16-bit meshes
+		//  go first, then the 32-bit ones from a 4-byte boundary. Start indices count in the mesh's own index size.
+		mesh_is_index_16_bit.resize(mesh_names.size(), true);
+		bool const all_is_index_16_bit
+			= (std::find(mesh_is_index_16_bit.begin(), mesh_is_index_16_bit.end(), 0) == mesh_is_index_16_bit.end());
+
+		std::vector<uint8_t> packed_indices;
+		for (uint32_t index_size = 2; index_size <= 4; index_size += 2)
+		{
+			packed_indices.resize((packed_indices.size() + index_size - 1) & ~static_cast<size_t>(index_size - 1));
+
+			auto relocate = [&merged_indices, &packed_indices, index_size](uint32_t& start_index, uint32_t num_indices)
+			{
+				uint32_t const* src = reinterpret_cast<uint32_t const *>(&merged_indices[start_index * sizeof(uint32_t)]);
+				start_index = static_cast<uint32_t>(packed_indices.size() / index_size);
+				packed_indices.resize(packed_indices.size() + num_indices * index_size);
+				uint8_t* dst = &packed_indices[start_index * index_size];
+				for (uint32_t i = 0; i < num_indices; ++ i)
+				{
+					if (2 == index_size)
+					{
+						uint16_t const ind16 = Native2LE(static_cast<uint16_t>(src[i]));
+						std::memcpy(dst + i * sizeof(ind16), &ind16, sizeof(ind16));
+					}
+					else
+					{
+						uint32_t const ind32 = Native2LE(src[i]);
+						std::memcpy(dst + i * sizeof(ind32), &ind32, sizeof(ind32));
+					}
+				}
+			};
+
+			for (size_t i = 0; i < mesh_num_indices.size(); ++ i)
 			{
-				uint16_t ind16 = Native2LE(static_cast<uint16_t>(*reinterpret_cast<uint32_t*>(&merged_indices[ind_index * sizeof(uint32_t)])));
-				std::memcpy(&merged_indices_16[ind_index * sizeof(uint16_t)], &ind16, sizeof(ind16));
+				if ((2 == index_size) == (mesh_is_index_16_bit[i] != 0))
+				{
+					relocate(mesh_start_indices[i], mesh_num_indices[i]);
+					for (auto& lod : mesh_lod_indices[i])
+					{
+						relocate(lod.second, lod.first);
+					}
+				}
 			}
+		}
+		merged_indices.swap(packed_indices);
+
+		if (!quiet && (mesh_start_indices.back() > 0))
+		{
+			cout << "Indices: " << num_all_indices * (all_is_index_16_bit ? sizeof(uint16_t) : sizeof(uint32_t))
+				<< " bytes with one index size -> " << merged_indices.size() << endl;
 
-			merged_indices.swap(merged_indices_16);
+			float const num_triangles = mesh_start_indices.back() / 3.0f;
+			float const num_vertices = static_cast<float>(mesh_base_vertices.back());
+			cout << "Vertices: " << quantization_stats.float_bytes << " bytes as floats -> " << quantization_stats.packed_bytes
+				<< ", max error: position " << quantization_stats.max_pos_error
+				<< ", texcoord " << quantization_stats.max_tc_error
+				<< ", tangent frame " << quantization_stats.max_tangent_error << " degrees"
+				<< ", color " << quantization_stats.max_color_error << endl;
+			cout << "Vertex cache: ACMR " << stats_before.acmr / num_triangles << " -> " << stats_after.acmr / num_triangles
+				<< ", ATVR " << stats_before.atvr / num_vertices << " -> " << stats_after.atvr / num_vertices << endl;
+
+			for (size_t lod = 0; lod < lod_num_triangles.size(); ++ lod)
+			{
+				cout << "LOD " << lod + 1 << ": " << lod_num_triangles[lod] << " triangles, max error "
+					<< lod_max_errors[lod] << endl;
+			}
+			if (num_meshlets > 0)
+			{
+				cout << "Meshlets: " << num_meshlets << endl;
+			}
 		}
 	}
 
@@ -1801,9 +2140,10 @@ namespace
 		std::vector<AABBox> const & pos_bbs, std::vector<AABBox> const & tc_bbs,
 		std::vector<uint32_t> const & mesh_num_vertices, std::vector<uint32_t> const & mesh_base_vertices,
 		std::vector<uint32_t> const & mesh_num_indices, std::vector<uint32_t> const & mesh_start_indices,
-		std::vector<VertexElement> const & merged_ves,
-		std::vector<std::vector<uint8_t>> const & merged_vertices, std::vector<uint8_t> const & merged_indices,
-		char is_index_16_bit, std::ostream& os)
+		std::vector<std::vector<std::pair<uint32_t, uint32_t>>> const & mesh_lod_indices,
+		std::vector<std::vector<Meshlet>> const & mesh_meshlets,
+		std::vector<VertexElement> const & merged_ves, std::vector<char> const & mesh_is_index_16_bit,
+		uint32_t index_bytes, std::ostream& os)
 	{
 		uint32_t num_merged_ves = Native2LE(static_cast<uint32_t>(merged_ves.size()));
 		os.write(reinterpret_cast<char*>(&num_merged_ves), sizeof(num_merged_ves));
@@ -1817,15 +2157,8 @@ namespace
 
 		uint32_t num_vertices = Native2LE(mesh_base_vertices.back());
 		os.write(reinterpret_cast<char*>(&num_vertices), sizeof(num_vertices));
-		uint32_t num_indices = Native2LE(mesh_start_indices.back());
-		os.write(reinterpret_cast<char*>(&num_indices), sizeof(num_indices));
-		os.write(&is_index_16_bit, sizeof(is_index_16_bit));
-
-		for (size_t i = 0; i < merged_vertices.size(); ++ i)
-		{
-			os.write(reinterpret_cast<char const *>(&merged_vertices[i][0]), merged_vertices[i].size() * sizeof(merged_vertices[i][0]));
-		}
-		os.write(reinterpret_cast<char const *>(&merged_indices[0]), merged_indices.size() * sizeof(merged_indices[0]));
+		index_bytes = Native2LE(index_bytes);
+		os.write(reinterpret_cast<char*>(&index_bytes), sizeof(index_bytes));
 
 		for (uint32_t mesh_index = 0; mesh_index < mesh_num_vertices.size(); ++ mesh_index)
 		{
@@ -1858,10 +2191,44 @@ namespace
 			os.write(reinterpret_cast<char*>(&nv), sizeof(nv));
 			uint32_t bv = Native2LE(mesh_base_vertices[mesh_index]);
 			os.write(reinterpret_cast<char*>(&bv), sizeof(bv));
+			os.write(&mesh_is_index_16_bit[mesh_index], sizeof(mesh_is_index_16_bit[mesh_index]));
 			uint32_t ni = Native2LE(mesh_num_indices[mesh_index]);
 			os.write(reinterpret_cast<char*>(&ni), sizeof(ni));
 			uint32_t si = Native2LE(mesh_start_indices[mesh_index]);
 			os.write(reinterpret_cast<char*>(&si), sizeof(si));
+
+			uint32_t num_lods = Native2LE(static_cast<uint32_t>(mesh_lod_indices[mesh_index].size() + 1));
+			os.write(reinterpret_cast<char*>(&num_lods), sizeof(num_lods));
+			for (auto const & lod : mesh_lod_indices[mesh_index])
+			{
+				uint32_t lod_ni = Native2LE(lod.first);
+				os.write(reinterpret_cast<char*>(&lod_ni), sizeof(lod_ni));
+				uint32_t lod_si = Native2LE(lod.second);
+				os.write(reinterpret_cast<char*>(&lod_si), sizeof(lod_si));
+			}
+
+			uint32_t num_meshlets = Native2LE(static_cast<uint32_t>(mesh_meshlets[mesh_index].size()));
+			os.write(reinterpret_cast<char*>(&num_meshlets), sizeof(num_meshlets));
+			for (auto const & meshlet : mesh_meshlets[mesh_index])
+			{
+				uint32_t meshlet_si = Native2LE(meshlet.start_index);
+				os.write(reinterpret_cast<char*>(&meshlet_si), sizeof(meshlet_si));
+				uint32_t meshlet_ni = Native2LE(meshlet.num_indices);
+				os.write(reinterpret_cast<char*>(&meshlet_ni), sizeof(meshlet_ni));
+
+				float4 sphere;
+				sphere.x() = Native2LE(meshlet.center.x());
+				sphere.y() = Native2LE(meshlet.center.y());
+				sphere.z() = Native2LE(meshlet.center.z());
+				sphere.w() = Native2LE(meshlet.radius);
+				os.write(reinterpret_cast<char*>(&sphere), sizeof(sphere));
+				float4 cone;
+				cone.x() = Native2LE(meshlet.cone_axis.x());
+				cone.y() = Native2LE(meshlet.cone_axis.y());
+				cone.z() = Native2LE(meshlet.cone_axis.z());
+				cone.w() = Native2LE(meshlet.cone_cos);
+				os.write(reinterpret_cast<char*>(&cone), sizeof(cone));
+			}
 		}
 	}
 
@@ -1897,32 +2264,65 @@ namespace
 		frame_rate = Native2LE(frame_rate);
 		os.write(reinterpret_cast<char*>(&frame_rate), sizeof(frame_rate));
 
+		uint32_t num_keys = 0;
+		uint32_t num_reduced_keys = 0;
 		for (size_t i = 0; i < kfs.size(); ++ i)
 		{
-			uint32_t num_kf = Native2LE(static_cast<uint32_t>(kfs[i].frame_id.size()));
+			// The real part with w positive, and the sign in the scale, the way the loader has always read keys
+			KeyFrames kf;
+			for (size_t j = 0; j < kfs[i].frame_id.size(); ++ j)
+			{
+				// Compressed keys store the frame in 16 bits
+				if (kfs[i].frame_id[j] > 0xFFFF)
+				{
+					TMSG("Key frame " + std::to_string(kfs[i].frame_id[j]) + " of joint " + std::to_string(i)
+						+ " is beyond the 65535 frames a compressed animation can hold");
+				}
+
+				Quaternion const scaled_real = kfs[i].bind_real[j] * kfs[i].bind_scale[j];
+				float const bind_scale = MathLib::length(scaled_real) * MathLib::SignBit(scaled_real.w());
+
+				kf.frame_id.push_back(kfs[i].frame_id[j]);
+				kf.bind_real.push_back(scaled_real / bind_scale);
+				kf.bind_dual.push_back(kfs[i].bind_dual[j]);
+				kf.bind_scale.push_back(bind_scale);
+			}
+			num_keys += static_cast<uint32_t>(kf.frame_id.size());
+
+			ReduceKeyFrames(kf, KEY_ROTATION_TOLERANCE, KEY_TRANSLATION_TOLERANCE, KEY_SCALE_TOLERANCE);
+			num_reduced_keys += static_cast<uint32_t>(kf.frame_id.size());
+
+			CompressedKeyFrames ckf = CompressKeyFrames(kf);
+
+			uint32_t num_kf = Native2LE(static_cast<uint32_t>(ckf.keys.size()));
 			os.write(reinterpret_cast<char*>(&num_kf), sizeof(num_kf));
 
-			for (size_t j = 0; j < kfs[i].frame_id.size(); ++ j)
+			for (uint32_t j = 0; j < 3; ++ j)
 			{
-				Quaternion bind_real = kfs[i].bind_real[j];
-				Quaternion bind_dual = kfs[i].bind_dual[j];
-				float bind_scale = kfs[i].bind_scale[j];
+				ckf.translation_min[j] = Native2LE(ckf.translation_min[j]);
+				ckf.translation_extent[j] = Native2LE(ckf.translation_extent[j]);
+			}
+			os.write(reinterpret_cast<char*>(&ckf.translation_min), sizeof(ckf.translation_min));
+			os.write(reinterpret_cast<char*>(&ckf.translation_extent), sizeof(ckf.translation_extent));
+			ckf.scale_min = Native2LE(ckf.scale_min);
+			os.write(reinterpret_cast<char*>(&ckf.scale_min), sizeof(ckf.scale_min));
+			ckf.scale_extent = Native2LE(ckf.scale_extent);
+			os.write(reinterpret_cast<char*>(&ckf.scale_extent), sizeof(ckf.scale_extent));
 
-				uint32_t frame_id = Native2LE(kfs[i].frame_id[j]);
-				os.write(reinterpret_cast<char*>(&frame_id), sizeof(frame_id));
-				bind_real *= bind_scale;
-				bind_real.x() = Native2LE(bind_real.x());
-				bind_real.y() = Native2LE(bind_real.y());
-				bind_real.z() = Native2LE(bind_real.z());
-				bind_real.w() = Native2LE(bind_real.w());
-				os.write(reinterpret_cast<char*>(&bind_real), sizeof(bind_real));
-				bind_dual.x() = Native2LE(bind_dual.x());
-				bind_dual.y() = Native2LE(bind_dual.y());
-				bind_dual.z() = Native2LE(bind_dual.z());
-				bind_dual.w() = Native2LE(bind_dual.w());
-				os.write(reinterpret_cast<char*>(&bind_dual), sizeof(bind_dual));
+			for (auto& key : ckf.keys)
+			{
+				key.frame_id = Native2LE(key.frame_id);
+				for (uint32_t j = 0; j < 3; ++ j)
+				{
+					key.rotation[j] = Native2LE(key.rotation[j]);
+					key.translation[j] = Native2LE(key.translation[j]);
+				}
+				key.scale = Native2LE(key.scale);
 			}
+			os.write(reinterpret_cast<char*>(ckf.keys.data()), ckf.keys.size() * sizeof(ckf.keys[0]));
 		}
+
+		cout << "Key frames: " << num_keys << " -> " << num_reduced_keys << endl;
 	}
 
 	void WriteBBKeyFramesChunk(std::vector<AABBKeyFrames> const & bb_kfs, std::ostream& os)
@@ -2105,7 +2505,8 @@ namespace
 		return ret;
 	}
 
-	void MeshMLJIT(std::string const & meshml_name, std::string const & output_name, std::string const & platform)
+	void MeshMLJIT(std::string const & meshml_name, std::string const & output_name, std::string const & platform,
+		std::vector<float> const & lod_ratios, bool quiet)
 	{
 		std::ostringstream ss;
 
@@ -2174,17 +2575,19 @@ namespace
 		std::vector<uint32_t> mesh_base_vertices;
 		std::vector<uint32_t> mesh_num_indices;
 		std::vector<uint32_t> mesh_start_indices;
+		std::vector<std::vector<std::pair<uint32_t, uint32_t>>> mesh_lod_indices;
+		std::vector<std::vector<Meshlet>> mesh_meshlets;
 		std::vector<VertexElement> merged_ves;
 		std::vector<std::vector<uint8_t>> merged_vertices;
 		std::vector<uint8_t> merged_indices;
-		char is_index_16_bit = true;
+		std::vector<char> mesh_is_index_16_bit;
 		if (meshes_chunk)
 		{
 			CompileMeshesChunk(meshes_chunk, mesh_names, mtl_ids, pos_bbs, tc_bbs,
 				mesh_num_vertices, mesh_base_vertices,
-				mesh_num_indices, mesh_start_indices,
+				mesh_num_indices, mesh_start_indices, mesh_lod_indices, mesh_meshlets,
 				merged_ves, merged_vertices, merged_indices,
-				is_index_16_bit);
+				mesh_is_index_16_bit, lod_ratios, quiet);
 		}
 		{
 			uint32_t num_meshes = Native2LE(static_cast<uint32_t>(pos_bbs.size()));
@@ -2266,8 +2669,8 @@ namespace
 		if (meshes_chunk)
 		{
 			WriteMeshesChunk(mesh_names, mtl_ids, pos_bbs, tc_bbs,
-				mesh_num_vertices, mesh_base_vertices, mesh_num_indices, mesh_start_indices,
-				merged_ves, merged_vertices, merged_indices, is_index_16_bit, ss);
+				mesh_num_vertices, mesh_base_vertices, mesh_num_indices, mesh_start_indices, mesh_lod_indices,
+				mesh_meshlets, merged_ves, mesh_is_index_16_bit, static_cast<uint32_t>(merged_indices.size()), ss);
 		}
 
 		if (bones_chunk)
@@ -2297,12 +2700,50 @@ namespace
 		uint64_t len = 0;
 		ofs.write(reinterpret_cast<char*>(&len), sizeof(len));
 
+		// Vertex streams and indices are stored raw after the compressed part, at aligned offsets.
+		//  A mapped model_bin can be handed to buffer creation without any copy.
+		std::vector<std::pair<uint8_t const *, uint64_t>> blobs;
+		if (meshes_chunk)
+		{
+			for (auto const & vertices : merged_vertices)
+			{
+				blobs.emplace_back(vertices.data(), vertices.size());
+			}
+			blobs.emplace_back(merged_indices.data(), merged_indices.size());
+		}
+
+		uint32_t num_blobs = Native2LE(static_cast<uint32_t>(blobs.size()));
+		ofs.write(reinterpret_cast<char*>(&num_blobs), sizeof(num_blobs));
+		uint32_t reserved = 0;
+		ofs.write(reinterpret_cast<char*>(&reserved), sizeof(reserved));
+
+		std::ofstream::pos_type blob_table_pos = ofs.tellp();
+		std::vector<uint64_t> blob_table(blobs.size() * 2, 0);
+		ofs.write(reinterpret_cast<char*>(blob_table.data()), blob_table.size() * sizeof(blob_table[0]));
+
 		LZMACodec lzma;
-		len = lzma.Encode(ofs, ss.str().c_str(), ss.str().size());
+		len = lzma.EncodeChunked(ofs, ss.str().c_str(), ss.str().size());
+
+		for (size_t i = 0; i < blobs.size(); ++ i)
+		{
+			uint64_t offset = static_cast<std::streamoff>(ofs.tellp());
+			uint64_t const aligned_offset = (offset + MODEL_BIN_BLOB_ALIGNMENT - 1) & ~static_cast<uint64_t>(MODEL_BIN_BLOB_ALIGNMENT - 1);
+			for (; offset < aligned_offset; ++ offset)
+			{
+				ofs.put(0);
+			}
+			ofs.write(reinterpret_cast<char const *>(blobs[i].first), static_cast<std::streamsize>(blobs[i].second));
+
+			blob_table[i * 2 + 0] = Native2LE(aligned_offset);
+			blob_table[i * 2 + 1] = Native2LE(blobs[i].second);
+		}
 
 		ofs.seekp(p, std::ios_base::beg);
 		len = Native2LE(len);
 		ofs.write(reinterpret_cast<char*>(&len), sizeof(len));
+
+		ofs.seekp(blob_table_pos, std::ios_base::beg);
+		ofs.write(reinterpret_cast<char*>(blob_table.data()), blob_table.size() * sizeof(blob_table[0]));
 	}
 }
 
@@ -2311,6 +2752,7 @@ int main(int argc, char* argv[])
 	std::string input_name;
 	filesystem::path target_folder;
 	std::string platform;
+	std::vector<float> lod_ratios = { 0.5f, 0.25f, 0.125f };
 	bool quiet = false;
 
 	boost::program_options::options_description desc("Allowed options");
@@ -2319,6 +2761,8 @@ int main(int argc, char* argv[])
 		("input-name,I", boost::program_options::value<std::string>(), "Input meshml name.")
 		("target-folder,T", boost::program_options::value<std::string>(), "Target folder.")
 		("platform,P", boost::program_options::value<std::string>()->implicit_value(""), "Platform name.")
+		("lod-ratios,L", boost::program_options::value<std::string>(),
+			"Triangle ratios of the LODs, comma separated. Default is 0.5,0.25,0.125. 0 for no LOD.")
 		("quiet,q", boost::program_options::value<bool>()->implicit_value(true), "Quiet mode.")
 		("version,v", "Version.");
 
@@ -2353,6 +2797,22 @@ int main(int argc, char* argv[])
 	{
 		platform = vm["platform"].as<std::string>();
 	}
+	if (vm.count("lod-ratios") > 0)
+	{
+		std::vector<std::string> strs;
+		boost::algorithm::split(strs, vm["lod-ratios"].as<std::string>(), boost::is_any_of(","));
+
+		lod_ratios.clear();
+		for (auto& str : strs)
+		{
+			boost::algorithm::trim(str);
+			float const ratio = static_cast<float>(atof(str.c_str()));
+			if ((ratio > 0) && (ratio < 1))
+			{
+				lod_ratios.push_back(ratio);
+			}
+		}
+	}
 	if (vm.count("quiet") > 0)
 	{
 		quiet = vm["quiet"].as<bool>();
@@ -2397,7 +2857,7 @@ int main(int argc, char* argv[])
 
 	std::string output_name = (target_folder / filesystem::path(file_name)).string() + JIT_EXT_NAME;
 
-	MeshMLJIT(meshml_name, output_name, platform);
+	MeshMLJIT(meshml_name, output_name, platform, lod_ratios, quiet);
 
 	if (!quiet)
 	{
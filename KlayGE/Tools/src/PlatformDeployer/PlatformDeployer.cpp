@@ -2,11 +2,14 @@
 #include <KFL/Util.hpp>
 #include <KlayGE/JudaTexture.hpp>
 #include <KlayGE/ResLoader.hpp>
+#include <KlayGE/MappedPackage.hpp>
+#include <KFL/ResIdentifier.hpp>
 #include <KFL/XMLDom.hpp>
 #include <KFL/CXX17/filesystem.hpp>
 
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <vector>
 #include <regex>
 
@@ -379,6 +382,48 @@ void Deploy(std::vector<std::string> const & res_names, std::string const & res_
 	}
 }
 
+// Packs every file under pack_folder, named by its path relative to the folder. Deploy only writes and runs the
+//  conversion script, so this is a separate step that runs once the converted resources are in the folder.
+void Pack(std::string const & pack_folder, std::string const & package_name)
+{
+	filesystem::path const folder(pack_folder);
+	std::string const folder_name = folder.generic_string();
+
+	MappedPackageWriter writer;
+	filesystem::recursive_directory_iterator end_itr;
+	for (filesystem::recursive_directory_iterator i(folder); i != end_itr; ++ i)
+	{
+		if (!filesystem::is_regular_file(i->status()))
+		{
+			continue;
+		}
+
+		std::string res_name = i->path().generic_string().substr(folder_name.size());
+		while (!res_name.empty() && (res_name[0] == '/'))
+		{
+			res_name.erase(res_name.begin());
+		}
+
+		std::ifstream ifs(i->path().string().c_str(), std::ios_base::binary);
+		if (ifs)
+		{
+			std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+			// Textures are stored, so that they can be read straight from the mapping
+			std::string ext_name = i->path().extension().string();
+			boost::algorithm::to_lower(ext_name);
+			writer.AddFile(res_name, data.data(), data.size(), ext_name != ".dds");
+		}
+		else
+		{
+			cout << "Could not open " << res_name << ", not packed." << endl;
+		}
+	}
+
+	std::ofstream ofs(package_name.c_str(), std::ios_base::binary);
+	writer.Save(ofs);
+}
+
 int main(int argc, char* argv[])
 {
 	ResLoader::Instance().AddPath("../../Tools/media/PlatformDeployer");
@@ -386,6 +431,8 @@ int main(int argc, char* argv[])
 	std::vector<std::string> res_names;
 	std::string res_type;
 	std::string platform;
+	std::string package_name;
+	std::string pack_folder;
 
 	boost::program_options::options_description desc("Allowed options");
 	desc.add_options()
@@ -393,6 +440,9 @@ int main(int argc, char* argv[])
 		("input-name,I", boost::program_options::value<std::string>(), "Input resource name.")
 		("type,T", boost::program_options::value<std::string>(), "Resource type.")
 		("platform,P", boost::program_options::value<std::string>(), "Platform name.")
+		("package,K", boost::program_options::value<std::string>(),
+			"Pack the deployed resources in the pack folder into a .kpk package, instead of deploying.")
+		("pack-folder,F", boost::program_options::value<std::string>(), "Folder of deployed resources to pack.")
 		("version,v", "Version.");
 
 	boost::program_options::variables_map vm;
@@ -411,6 +461,25 @@ int main(int argc, char* argv[])
 		Context::Destroy();
 		return 1;
 	}
+	if (vm.count("package") > 0)
+	{
+		package_name = vm["package"].as<std::string>();
+		if (vm.count("pack-folder") > 0)
+		{
+			pack_folder = vm["pack-folder"].as<std::string>();
+		}
+		else
+		{
+			cout << "Need the folder of deployed resources to pack." << endl;
+			Context::Destroy();
+			return 1;
+		}
+
+		Pack(pack_folder, package_name);
+
+		Context::Destroy();
+		return 0;
+	}
 	if (vm.count("input-name") > 0)
 	{
 		std::string input_name_str = vm["input-name"].as<std::string>();
@@ -480,7 +549,6 @@ int main(int argc, char* argv[])
 	{
 		platform = "d3d_11_0";
 	}
-
 	boost::algorithm::to_lower(res_type);
 	boost::algorithm::to_lower(platform);
 